@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errmsg.h>
+#include <fmt.h>
+#include <str.h>
+#include <open.h>
+#include "atomicfile.h"
+
+/*
+ * replaces file with the len bytes at buf by writing a temporary file next
+ * to it and renaming that, so readers see either the old or the new content
+ */
+int write_file_atomic( const char *file, const char *buf, size_t len )
+{
+    return write_file_atomic_mode(file, buf, len, 0644);
+}
+
+/* the same with the permissions set before anything is written */
+int write_file_atomic_mode( const char *file, const char *buf, size_t len, mode_t mode )
+{
+    char tmp[str_len(file)+sizeof(".tmp.")+FMT_ULONG];
+    size_t i, o=0;
+    int fd;
+
+    i=fmt_str(tmp, file);
+    i+=fmt_str(tmp+i, ".tmp.");
+    i+=fmt_ulong(tmp+i, getpid());
+    tmp[i]='\0';
+
+    if ( -1 == (fd=open_trunc(tmp)) ) {
+        carpsys(tmp);
+        return -1;
+    }
+    if ( fchmod(fd, mode) ) {
+        carpsys(tmp);
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    while ( o < len ) {
+        ssize_t w = write(fd, buf+o, len-o);
+        if ( 0 >= w ) {
+            carpsys("write");
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        o+=w;
+    }
+    if ( close(fd) || rename(tmp, file) ) {
+        carpsys(file);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mmap.h>
+
+int main( int argc, char *argv[] )
+{
+    char dir[] = "/tmp/atomicfile-XXXXXX", file[sizeof(dir)+sizeof("/f")];
+    const char *m;
+    size_t i, len;
+    struct stat st;
+
+    assert(mkdtemp(dir));
+    i = fmt_str(file, dir);
+    i += fmt_str(file+i, "/f");
+    file[i] = '\0';
+    assert(0==write_file_atomic(file, "first", 5));
+    assert(0==write_file_atomic(file, "second", 6));
+    assert((m=mmap_read(file, &len)) && len==6 && !memcmp(m, "second", 6));
+    mmap_unmap(m, len);
+    assert(0==write_file_atomic_mode(file, "secret", 6, 0600));
+    assert(0==stat(file, &st) && (st.st_mode & 0777)==0600);
+    unlink(file);
+    assert(0==rmdir(dir));
+    assert(-1==write_file_atomic(file, "gone", 4));
+    exit(EXIT_SUCCESS);
+}
+#endif
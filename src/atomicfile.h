@@ -0,0 +1,8 @@
+#ifndef ATOMICFILE_H
+#define ATOMICFILE_H
+#include <stddef.h>
+#include <sys/types.h>
+
+int write_file_atomic( const char *, const char *, size_t );
+int write_file_atomic_mode( const char *, const char *, size_t, mode_t );
+#endif
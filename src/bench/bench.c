@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ *
+ * bench - times the stages of the ICS pipeline on calendar files and writes
+ *         one JSON object per file and stage to stdout
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <scan.h>
+#include <str.h>
+#include <open.h>
+#include "../ics.h"
+#include "../shardparse.h"
+
+#define CHUNKSIZE 500
+
+enum bench_stage {
+    STAGE_SPLIT,
+    STAGE_PARSE,
+    STAGE_INSERT,
+    STAGE_STATISTICS,
+    STAGE_FORMAT,
+    STAGE_COUNT
+};
+
+static const char *stage_name[STAGE_COUNT]={ "split", "parse", "insert", "statistics", "format" };
+
+static unsigned short warmup=1, reps=5, threads=1;
+static size_t chunksize=CHUNKSIZE;
+static short year=2020, month=0;
+static const char *commit="unknown";
+
+static char devnull_space[BUFFER_OUTSIZE];
+static buffer devnull;
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void null_format( struct report_context *rep ) { }
+
+static char *load_file( const char *name, size_t *len )
+{
+    struct stat st;
+    char *data;
+    size_t o=0;
+    ssize_t r;
+    int fd=open_read(name);
+
+    if ( -1 == fd || fstat(fd, &st) ) {
+        carpsys(name);
+        return NULL;
+    }
+    if ( !(data=malloc(st.st_size+1)) ) {
+        carpsys("malloc");
+        close(fd);
+        return NULL;
+    }
+    while ( o < (size_t)st.st_size && 0 < (r=read(fd, data+o, st.st_size-o)) )
+        o+=r;
+    close(fd);
+    data[o]='\0';
+    *len=o;
+    return data;
+}
+
+/* hand the data to the parser in chunks, the way the http client does */
+static int feed( struct ics_context *ctx, const char *data, size_t len )
+{
+    char buf[chunksize+1];
+    size_t o, n;
+
+    for (o=0; o<len; o+=n) {
+        n=(len-o<chunksize)?len-o:chunksize;
+        memcpy(buf, data+o, n);
+        buf[n]='\0';
+        if ( ics_parser(ctx, buf) )
+            return -1;
+    }
+    return ics_finish(ctx);
+}
+
+static unsigned long long run_stage( enum bench_stage stage, const char *data, size_t len, struct config_context *cfgctx )
+{
+    struct holiday_table ht;
+    struct ics_context ctx, src;
+    struct report_context rep;
+    unsigned long long t0, t1;
+
+    init_holiday_list(&ht, year);
+    init_ics_context(&ctx, &ht, "bench");
+    /* parsed on its own and merged into the report, as the report does it */
+    init_ics_context(&src, &ht, "bench");
+    src.unsorted = true;
+    init_report_context(&rep, "text", &devnull);
+    if ( stage == STAGE_SPLIT )
+        src.stop_after = ICS_STAGE_SPLIT;
+    else if ( stage == STAGE_PARSE )
+        src.stop_after = ICS_STAGE_PARSE;
+    if ( stage == STAGE_STATISTICS )
+        rep.format.header = rep.format.timeline = rep.format.footer = null_format;
+
+    t0=now_ns();
+    if ( threads > 1 )
+        parse_ics_body(&src, data, len, threads);
+    else
+        feed(&src, data, len);
+    ics_merge(&ctx, &src, 1);
+    t1=now_ns();
+    if ( stage >= STAGE_STATISTICS ) {
+        t0=now_ns();
+        cal_statistics(&ctx, &rep, cfgctx);
+        buffer_flush(&devnull);
+        t1=now_ns();
+    }
+
+    free_ics_context(&src);
+    free_ics_context(&ctx);
+    free_report_context(&rep);
+    return t1-t0;
+}
+
+static int cmp_ull( const void *a, const void *b )
+{
+    unsigned long long x=*(const unsigned long long *)a, y=*(const unsigned long long *)b;
+    return (x>y)-(x<y);
+}
+
+static unsigned long count_events( const char *data, size_t len )
+{
+    unsigned long n=0;
+    const char *p=data, *e=data+len;
+
+    while ( (p=memmem(p, e-p, "BEGIN:VEVENT", sizeof("BEGIN:VEVENT")-1)) ) {
+        n++;
+        p+=sizeof("BEGIN:VEVENT")-1;
+    }
+    return n;
+}
+
+static void put_field( const char *name, unsigned long long v )
+{
+    buffer_puts(buffer_1, ",\"");
+    buffer_puts(buffer_1, name);
+    buffer_puts(buffer_1, "\":");
+    buffer_putulong(buffer_1, v);
+}
+
+/* a JSON string: backslash and double quote escaped, control characters as \u00XX */
+static void put_string( const char *name, const char *value )
+{
+    static const char hex[]="0123456789abcdef";
+    char u[]="\\u00XX";
+
+    buffer_puts(buffer_1, "\"");
+    buffer_puts(buffer_1, name);
+    buffer_puts(buffer_1, "\":\"");
+    for (; *value; ++value) {
+        if ( *value == '\\' || *value == '"' ) {
+            buffer_put(buffer_1, "\\", 1);
+            buffer_put(buffer_1, value, 1);
+        } else if ( (unsigned char)*value < 0x20 ) {
+            u[4] = hex[(unsigned char)*value>>4];
+            u[5] = hex[*value&0xf];
+            buffer_put(buffer_1, u, 6);
+        } else
+            buffer_put(buffer_1, value, 1);
+    }
+    buffer_puts(buffer_1, "\"");
+}
+
+static int bench_file( const char *name, struct config_context *cfgctx )
+{
+    unsigned long long t[reps], median[STAGE_COUNT];
+    unsigned long events;
+    size_t len, i;
+    char *data;
+    int s;
+
+    if ( !(data=load_file(name, &len)) )
+        return -1;
+    events=count_events(data, len);
+
+    for (s=0; s<STAGE_COUNT; ++s) {
+        for (i=0; i<warmup; ++i)
+            run_stage(s, data, len, cfgctx);
+        for (i=0; i<reps; ++i)
+            t[i]=run_stage(s, data, len, cfgctx);
+        qsort(t, reps, sizeof(t[0]), cmp_ull);
+        median[s]=t[reps/2];
+
+        buffer_puts(buffer_1, "{");
+        put_string("commit", commit);
+        buffer_puts(buffer_1, ",");
+        put_string("file", name);
+        buffer_puts(buffer_1, ",");
+        put_string("stage", stage_name[s]);
+        put_field("events", events);
+        put_field("bytes", len);
+        put_field("warmup", warmup);
+        put_field("reps", reps);
+        put_field("threads", threads);
+        put_field("min_ns", t[0]);
+        put_field("median_ns", median[s]);
+        put_field("max_ns", t[reps-1]);
+        /* the parser stages run cumulatively, report their own share as well */
+        if ( s == STAGE_PARSE || s == STAGE_INSERT || s == STAGE_FORMAT )
+            put_field("stage_ns", (median[s]>median[s-1])?median[s]-median[s-1]:0);
+        else
+            put_field("stage_ns", median[s]);
+        if ( s <= STAGE_INSERT && median[s] )
+            put_field("kb_per_s", (unsigned long long)len*1000000ULL/median[s]);
+        buffer_puts(buffer_1, "}");
+        buffer_putnlflush(buffer_1);
+    }
+
+    free(data);
+    return 0;
+}
+
+static void show_help( const char *progname )
+{
+    buffer_puts(buffer_2, progname);
+    buffer_puts(buffer_2, " [options] file.ics...\n");
+    buffer_puts(buffer_2, "\t-w [num]\twarm-up runs per stage (1)\n");
+    buffer_puts(buffer_2, "\t-r [num]\trepetitions per stage (5)\n");
+    buffer_puts(buffer_2, "\t-b [bytes]\tchunk size handed to the parser (500)\n");
+    buffer_puts(buffer_2, "\t-t [num]\tparse the whole file on num threads (1)\n");
+    buffer_puts(buffer_2, "\t-y [year]\tyear to report (2020)\n");
+    buffer_puts(buffer_2, "\t-m [0-12]\tmonth to report, 0 for the whole year (0)\n");
+    buffer_puts(buffer_2, "\t-c [id]\tcommit id written to the results");
+    buffer_putnlflush(buffer_2);
+}
+
+int main( int argc, char *argv[] )
+{
+    struct config_context cfgctx;
+    struct user_context user;
+    unsigned long l;
+    int o, ret=0;
+
+    while ( ( o = getopt(argc, argv, "w:r:b:t:y:m:c:h")) !=-1 ) {
+        switch(o) {
+        case 'w': scan_ushort(optarg, &warmup); break;
+        case 'r': scan_ushort(optarg, &reps); if (!reps) reps=1; break;
+        case 'b': scan_ulong(optarg, &l); if (l) chunksize=l; break;
+        case 't': scan_ushort(optarg, &threads); break;
+        case 'y': scan_short(optarg, &year); break;
+        case 'm': scan_short(optarg, &month); break;
+        case 'c': commit=optarg; break;
+        default:
+            show_help(argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc ) {
+        show_help(argv[0]);
+        return 1;
+    }
+
+    buffer_init(&devnull, (ssize_t (*)())write, open_write("/dev/null"), devnull_space, sizeof(devnull_space));
+
+    memset(&user, 0, sizeof(user));
+    user.name="bench";
+    user.vacation=30;
+    user.monthhours=168;
+    memset(&cfgctx, 0, sizeof(cfgctx));
+    cfgctx.first_user=cfgctx.last_user=&user;
+    cfgctx.prog_arg.year=year;
+    cfgctx.prog_arg.month=month;
+    cfgctx.prog_arg.user="bench";
+
+    for (; optind<argc; ++optind)
+        if ( bench_file(argv[optind], &cfgctx) )
+            ret=1;
+
+    return ret;
+}
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ *
+ * gencal - writes a deterministic synthetic iCalendar of arbitrary size
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <scan.h>
+#include <str.h>
+
+#define FOLD_AT 75
+
+static uint32_t seed=0x5eed;
+static unsigned long events=1000;
+static unsigned short year=2020, per_day=8;
+static unsigned short allday_pct=5, alarm_pct=50, fold_pct=20, overlap_pct=30, tzid_pct=0;
+
+static const char *projects[]={ "projectX", "housekeeping", "projectY", "support", "travel" };
+
+/* the first one comes with a VTIMEZONE, the other one from the zoneinfo of the system */
+static const char *zones[]={ "Europe/Berlin", "America/New_York" };
+#define VTIMEZONE "BEGIN:VTIMEZONE\r\nTZID:Europe/Berlin\r\nBEGIN:DAYLIGHT\r\nTZOFFSETFROM:+0100\r\n"\
+    "TZOFFSETTO:+0200\r\nTZNAME:CEST\r\nDTSTART:19700329T020000\r\nRRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU\r\n"\
+    "END:DAYLIGHT\r\nBEGIN:STANDARD\r\nTZOFFSETFROM:+0200\r\nTZOFFSETTO:+0100\r\nTZNAME:CET\r\n"\
+    "DTSTART:19701025T030000\r\nRRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU\r\nEND:STANDARD\r\nEND:VTIMEZONE\r\n"
+
+/* xorshift32, so every run with the same seed produces the same bytes */
+static uint32_t rnd()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* days since 1970-01-01 -> y/m/d, see http://howardhinnant.github.io/date_algorithms.html */
+static void civil_from_days( long z, long *y, unsigned *m, unsigned *d )
+{
+    z += 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);
+    unsigned mp = (5*doy + 2)/153;
+    *d = doy - (153*mp+2)/5 + 1;
+    *m = mp < 10 ? mp+3 : mp-9;
+    *y = (long)yoe + era * 400 + (*m <= 2);
+}
+
+static long days_from_civil( long y, unsigned m, unsigned d )
+{
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y-399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153*(m > 2 ? m-3 : m+9) + 2)/5 + d-1;
+    unsigned doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + (long)doe - 719468;
+}
+
+static void put_num( unsigned long v, unsigned digits )
+{
+    char t[20];
+    size_t i=digits;
+    while (i--) { t[i]='0'+v%10; v/=10; }
+    buffer_put(buffer_1, t, digits);
+}
+
+static void put_date( long day )
+{
+    long y; unsigned m, d;
+    civil_from_days(day, &y, &m, &d);
+    put_num(y,4); put_num(m,2); put_num(d,2);
+}
+
+/* floating or in the zone of a TZID */
+static void put_localtime( long day, unsigned minute )
+{
+    put_date(day);
+    buffer_puts(buffer_1, "T");
+    put_num(minute/60,2); put_num(minute%60,2);
+    buffer_puts(buffer_1, "00");
+}
+
+static void put_datetime( long day, unsigned minute )
+{
+    put_localtime(day, minute);
+    buffer_puts(buffer_1, "Z");
+}
+
+/* NAME;TZID=zone:yyyymmddThhmm00 or NAME:yyyymmddThhmm00Z without zone */
+static void put_zoned( const char *name, const char *zone, long day, unsigned minute )
+{
+    buffer_puts(buffer_1, name);
+    if ( zone ) {
+        buffer_puts(buffer_1, ";TZID=");
+        buffer_puts(buffer_1, zone);
+        buffer_puts(buffer_1, ":");
+        put_localtime(day, minute);
+    } else {
+        buffer_puts(buffer_1, ":");
+        put_datetime(day, minute);
+    }
+    buffer_puts(buffer_1, "\r\n");
+}
+
+/* content lines longer than 75 octets are folded with CRLF + space (RFC 5545 3.1) */
+static void put_line( const char *name, const char *value, int fold )
+{
+    size_t nl=str_len(name), vl=str_len(value), col;
+
+    buffer_put(buffer_1, name, nl);
+    col=nl;
+    while (vl) {
+        size_t n=vl;
+        if ( fold && col+n > FOLD_AT ) {
+            n = FOLD_AT-col;
+            buffer_put(buffer_1, value, n);
+            buffer_puts(buffer_1, "\r\n ");
+            col=1;
+        } else {
+            buffer_put(buffer_1, value, n);
+        }
+        value+=n; vl-=n;
+    }
+    buffer_puts(buffer_1, "\r\n");
+}
+
+static void put_event( unsigned long i, long sday, unsigned smin, long eday, unsigned emin, int allday,
+        const char *zone, const char *summary )
+{
+    char description[]="Lorem ipsum dolor sit amet, consetetur sadipscing elitr, sed diam nonumy "
+        "eirmod tempor invidunt ut labore et dolore magna aliquyam erat, sed diam voluptua.";
+    int fold = (rnd()%100 < fold_pct);
+
+    buffer_puts(buffer_1, "BEGIN:VEVENT\r\n");
+    if ( allday ) {
+        buffer_puts(buffer_1, "DTSTART;VALUE=DATE:"); put_date(sday); buffer_puts(buffer_1, "\r\n");
+        buffer_puts(buffer_1, "DTEND;VALUE=DATE:"); put_date(eday); buffer_puts(buffer_1, "\r\n");
+        buffer_puts(buffer_1, "X-FUNAMBOL-ALLDAY:1\r\n");
+    } else {
+        put_zoned("DTSTART", zone, sday, smin);
+        put_zoned("DTEND", zone, eday, emin);
+    }
+    buffer_puts(buffer_1, "DTSTAMP:"); put_datetime(sday, 0); buffer_puts(buffer_1, "\r\n");
+    buffer_puts(buffer_1, "UID:"); put_num(i,10); buffer_puts(buffer_1, "@gencal\r\n");
+    put_line("SUMMARY:", summary, 0);
+    if ( fold )
+        put_line("DESCRIPTION:", description, 1);
+    if ( !allday && rnd()%4 == 0 )
+        buffer_puts(buffer_1, "LOCATION:customer site\r\n");
+    buffer_puts(buffer_1, "CLASS:PUBLIC\r\nSTATUS:CONFIRMED\r\nTRANSP:OPAQUE\r\n");
+    if ( rnd()%100 < alarm_pct ) {
+        buffer_puts(buffer_1, "BEGIN:VALARM\r\nACTION:DISPLAY\r\n");
+        put_line("DESCRIPTION:", summary, 0);
+        buffer_puts(buffer_1, "TRIGGER;VALUE=DURATION:-PT30M\r\nEND:VALARM\r\n");
+    }
+    buffer_puts(buffer_1, "END:VEVENT\r\n");
+}
+
+static void show_help( const char *progname )
+{
+    buffer_puts(buffer_2, progname);
+    buffer_puts(buffer_2, "\n");
+    buffer_puts(buffer_2, "\t-n [num]\tnumber of events (1000)\n");
+    buffer_puts(buffer_2, "\t-s [num]\tseed\n");
+    buffer_puts(buffer_2, "\t-y [year]\tfirst year (2020)\n");
+    buffer_puts(buffer_2, "\t-d [num]\tevents per day (8)\n");
+    buffer_puts(buffer_2, "\t-a [0-100]\tall day events in percent (5)\n");
+    buffer_puts(buffer_2, "\t-l [0-100]\tevents with alarm in percent (50)\n");
+    buffer_puts(buffer_2, "\t-f [0-100]\tevents with folded lines in percent (20)\n");
+    buffer_puts(buffer_2, "\t-o [0-100]\tvacations overlapping the previous one in percent (30)\n");
+    buffer_puts(buffer_2, "\t-z [0-100]\ttimed events with a TZID in percent (0)");
+    buffer_putnlflush(buffer_2);
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned long i, s;
+    long first, day, vac_start=-1;
+    int o;
+
+    while ( ( o = getopt(argc, argv, "n:s:y:d:a:l:f:o:z:h")) !=-1 ) {
+        switch(o) {
+        case 'n': scan_ulong(optarg, &events); break;
+        case 's': scan_ulong(optarg, &s); seed=s?s:0x5eed; break;
+        case 'y': scan_ushort(optarg, &year); break;
+        case 'd': scan_ushort(optarg, &per_day); if (!per_day) per_day=1; break;
+        case 'a': scan_ushort(optarg, &allday_pct); break;
+        case 'l': scan_ushort(optarg, &alarm_pct); break;
+        case 'f': scan_ushort(optarg, &fold_pct); break;
+        case 'o': scan_ushort(optarg, &overlap_pct); break;
+        case 'z': scan_ushort(optarg, &tzid_pct); break;
+        default:
+            show_help(argv[0]);
+            return 1;
+        }
+    }
+
+    buffer_puts(buffer_1, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//caltimist//gencal//EN\r\n"
+            "X-WR-CALNAME:caltimist-bench\r\n");
+    if ( tzid_pct )
+        buffer_puts(buffer_1, VTIMEZONE);
+
+    first=days_from_civil(year, 1, 1);
+    for (i=0; i<events; ++i) {
+        day = first + i/per_day;
+
+        if ( rnd()%100 < allday_pct ) {
+            long start = day;
+            if ( vac_start >= 0 && rnd()%100 < overlap_pct )
+                start = vac_start + 1;
+            vac_start = start;
+            put_event(i, start, 0, start + 1 + rnd()%5, 0, 1, NULL, "vacation (caltimist-bench)");
+        } else {
+            unsigned smin = (7 + rnd()%10)*60 + (rnd()%4)*15;
+            unsigned dur = 30 + (rnd()%8)*30;
+            const char *zone = (tzid_pct && rnd()%100 < tzid_pct)?zones[i%2]:NULL;
+            put_event(i, day, smin, day + (smin+dur)/(24*60), (smin+dur)%(24*60), 0, zone,
+                    projects[rnd()%(sizeof(projects)/sizeof(projects[0]))]);
+        }
+    }
+
+    buffer_puts(buffer_1, "END:VCALENDAR\r\n");
+    buffer_flush(buffer_1);
+    return 0;
+}
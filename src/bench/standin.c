@@ -0,0 +1,573 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ *
+ * standin - stand-in calendar server on localhost: serves the files of a
+ *           directory over HTTP and HTTPS with configurable latency,
+ *           bandwidth, chunking, keep-alive, gzip and ETag/304, so the
+ *           fetch path can be measured offline and reproducibly. A CalDAV
+ *           REPORT gets a canned multistatus with the files themselves.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <scan.h>
+#include <str.h>
+#include <fmt.h>
+#include <mmap.h>
+#include <stralloc.h>
+#ifndef NOSSL
+#include <openssl/ssl.h>
+#endif
+#ifndef NOZLIB
+#include <zlib.h>
+#endif
+#include "../hash.h"
+
+#define REQUESTSIZE 8192
+#define WRITESIZE 16384
+/* a kept-alive connection without a new request is closed after that many seconds */
+#define IDLE_TIMEOUT 10
+
+/* one accepted connection, plain or TLS */
+struct connection {
+    int sock;
+#ifndef NOSSL
+    SSL *ssl;
+#endif
+};
+
+static const char *root=".";
+static unsigned long latency_ms=0, bandwidth=0, chunksize=0;
+static unsigned short http_port=0, https_port=0;
+static int tls=0, keepalive=0, gzip=0, etag=0, verbose=0;
+#ifndef NOSSL
+static const char *cert_file=NULL, *key_file=NULL;
+static SSL_CTX *ssl_ctx=NULL;
+#endif
+
+static unsigned long long now_ms( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void sleep_ms( unsigned long long ms )
+{
+    struct timespec ts = { ms/1000, (ms%1000)*1000000 };
+    while ( nanosleep(&ts, &ts) )
+        ;
+}
+
+static ssize_t conn_read( struct connection *c, char *buf, size_t len )
+{
+#ifndef NOSSL
+    if ( c->ssl )
+        return SSL_read(c->ssl, buf, len);
+#endif
+    return read(c->sock, buf, len);
+}
+
+static int conn_write( struct connection *c, const char *buf, size_t len )
+{
+    ssize_t r;
+
+    for (; len; buf+=r, len-=r) {
+#ifndef NOSSL
+        if ( c->ssl )
+            r = SSL_write(c->ssl, buf, len);
+        else
+#endif
+        r = write(c->sock, buf, len);
+        if ( r <= 0 )
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * the body in pieces of at most WRITESIZE (or the chunk size), each one
+ * sent no earlier than the bandwidth allows
+ */
+static int send_body( struct connection *c, const char *body, size_t len )
+{
+    unsigned long long t0=now_ms(), due;
+    size_t sent=0, n, piece=chunksize?chunksize:WRITESIZE;
+    char head[2*sizeof(unsigned long)+2];
+
+    if ( bandwidth && piece > bandwidth/10+1 )
+        piece = bandwidth/10+1;
+    while ( sent < len ) {
+        n = (len-sent<piece)?len-sent:piece;
+        if ( chunksize ) {
+            size_t hl = fmt_xlong(head, n);
+            head[hl++]='\r'; head[hl++]='\n';
+            if ( conn_write(c, head, hl) || conn_write(c, body+sent, n) || conn_write(c, "\r\n", 2) )
+                return -1;
+        } else if ( conn_write(c, body+sent, n) )
+            return -1;
+        sent += n;
+        if ( bandwidth && (due = t0 + sent*1000ULL/bandwidth) > now_ms() )
+            sleep_ms(due-now_ms());
+    }
+    return chunksize?conn_write(c, "0\r\n\r\n", 5):0;
+}
+
+#ifndef NOZLIB
+static int compress_gzip( stralloc *out, const char *in, size_t len )
+{
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof(z));
+    if ( Z_OK != deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) )
+        return -1;
+    if ( !stralloc_ready(out, deflateBound(&z, len)) ) {
+        deflateEnd(&z);
+        return -1;
+    }
+    z.next_in = (unsigned char *)in;
+    z.avail_in = len;
+    z.next_out = (unsigned char *)out->s;
+    z.avail_out = out->a;
+    ret = deflate(&z, Z_FINISH);
+    out->len = z.total_out;
+    deflateEnd(&z);
+    return (ret==Z_STREAM_END)?0:-1;
+}
+#endif
+
+/* value of header name in the request head, NULL if it is not there */
+static const char *header( const char *req, const char *name )
+{
+    const char *h = req;
+    size_t n = str_len(name);
+
+    while ( (h = strstr(h, "\r\n")) ) {
+        h += 2;
+        if ( !strncasecmp(h, name, n) && h[n] == ':' ) {
+            for (h+=n+1; *h==' '; ++h)
+                ;
+            return h;
+        }
+    }
+    return NULL;
+}
+
+static int header_has( const char *req, const char *name, const char *token )
+{
+    const char *v = header(req, name);
+    const char *e = v?strstr(v, "\r\n"):NULL;
+    const char *t = v?strcasestr(v, token):NULL;
+
+    return t && t < e;
+}
+
+static int send_status( struct connection *c, const char *status, int last )
+{
+    stralloc sa;
+    int ret;
+
+    stralloc_init(&sa);
+    ret = (stralloc_copys(&sa, "HTTP/1.1 ") && stralloc_cats(&sa, status) &&
+            stralloc_cats(&sa, "\r\nContent-Length: 0\r\n") &&
+            stralloc_cats(&sa, last?"Connection: close\r\n\r\n":"\r\n"))?conn_write(c, sa.s, sa.len):-1;
+    stralloc_free(&sa);
+    return ret;
+}
+
+/* text for XML, with CR as a character reference the way CalDAV servers send it */
+static int cat_xml( stralloc *sa, const char *s, size_t len )
+{
+    const char *e;
+    size_t i;
+
+    for (i=0; i<len; ++i) {
+        switch ( s[i] ) {
+        case '&': e = "&amp;"; break;
+        case '<': e = "&lt;"; break;
+        case '>': e = "&gt;"; break;
+        case '\r': e = "&#13;"; break;
+        default:
+            if ( !stralloc_append(sa, s+i) )
+                return -1;
+            continue;
+        }
+        if ( !stralloc_cats(sa, e) )
+            return -1;
+    }
+    return 0;
+}
+
+/* the <response> for the resource in file at href; 1 if it cannot be read */
+static int cat_resource( stralloc *ms, unsigned long long *token, const char *file, const char *href, size_t hl )
+{
+    char tag[FMT_HASH];
+    const char *data;
+    size_t len;
+    unsigned long long h;
+    int ret=-1;
+
+    if ( !(data = mmap_read(file, &len)) )
+        return 1;
+    h = hash_buf(hash_str(""), data, len);
+    *token = hash_buf(*token, (const char *)&h, sizeof(h));
+    if ( stralloc_cats(ms, "<D:response><D:href>") && !cat_xml(ms, href, hl) &&
+            stralloc_cats(ms, "</D:href><D:propstat><D:prop><D:getetag>\"") &&
+            stralloc_catb(ms, tag, fmt_hash(tag, h)) &&
+            stralloc_cats(ms, "\"</D:getetag><C:calendar-data>") && !cat_xml(ms, data, len) &&
+            stralloc_cats(ms, "</C:calendar-data></D:prop><D:status>HTTP/1.1 200 OK</D:status>"
+                "</D:propstat></D:response>\r\n") )
+        ret = 0;
+    mmap_unmap(data, len);
+    return ret;
+}
+
+/*
+ * the canned answer to a REPORT on path: the file there, or every regular
+ * file of the directory if path ends in /, each with its calendar-data,
+ * and a sync-token from their contents. Whatever was asked for (a
+ * calendar-query, a sync-collection from any token or a multiget), the
+ * whole collection comes back, so a sync never sees a deletion.
+ * 1 if there is nothing to answer with.
+ */
+static int multistatus( stralloc *ms, const char *file, const char *path )
+{
+    char tag[FMT_HASH];
+    unsigned long long token=hash_str("");
+    struct dirent *d;
+    struct stat st;
+    stralloc name, href;
+    size_t n=str_len(path);
+    DIR *dir;
+    int ret=0;
+
+    if ( !stralloc_copys(ms, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+                "<D:multistatus xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\r\n") )
+        return -1;
+    if ( path[n-1] != '/' )
+        ret = cat_resource(ms, &token, file, path, n);
+    else if ( !(dir = opendir(file)) )
+        ret = 1;
+    else {
+        stralloc_init(&name);
+        stralloc_init(&href);
+        while ( (d = readdir(dir)) ) {
+            if ( d->d_name[0] == '.' )
+                continue;
+            if ( !stralloc_copys(&name, file) || !stralloc_cats(&name, d->d_name) || !stralloc_0(&name) ||
+                    !stralloc_copys(&href, path) || !stralloc_cats(&href, d->d_name) ) {
+                ret = -1;
+                break;
+            }
+            /* one that went away in between is left out */
+            if ( !stat(name.s, &st) && S_ISREG(st.st_mode) &&
+                    0 > cat_resource(ms, &token, name.s, href.s, href.len) ) {
+                ret = -1;
+                break;
+            }
+        }
+        closedir(dir);
+        stralloc_free(&name);
+        stralloc_free(&href);
+    }
+    if ( !ret && (!stralloc_cats(ms, "<D:sync-token>urn:standin:") ||
+                !stralloc_catb(ms, tag, fmt_hash(tag, token)) ||
+                !stralloc_cats(ms, "</D:sync-token>\r\n</D:multistatus>\r\n")) )
+        ret = -1;
+    return ret;
+}
+
+/* answers one request; 1 if the connection stays open for the next one */
+static int respond( struct connection *c, char *req )
+{
+    char tag[FMT_HASH+8], *path, *e, *file;
+    const char *inm, *body=NULL, *status="200 OK";
+    stralloc head, gz, ms;
+    size_t len=0, n, tl=0;
+    int last, report, found, zipped=0, ret=-1;
+
+    last = !keepalive || header_has(req, "Connection", "close") || !strstr(req, " HTTP/1.1\r\n");
+    report = str_start(req, "REPORT ");
+    if ( !report && !str_start(req, "GET ") )
+        return send_status(c, "405 Method Not Allowed", 1)?-1:0;
+    path = req+(report?7:4);
+    if ( !(e = strchr(path, ' ')) || *path != '/' || strstr(path, "/..") )
+        return send_status(c, "400 Bad Request", 1)?-1:0;
+    *e = '\0';
+    if ( !(file = malloc(str_len(root)+str_len(path)+1)) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    n = fmt_str(file, root);
+    file[n+fmt_str(file+n, path)]='\0';
+    stralloc_init(&ms);
+    if ( !report )
+        body = mmap_read(file, &len);
+    else if ( 0 > (found = multistatus(&ms, file, path)) ) {
+        carpsys("stralloc");
+        free(file);
+        stralloc_free(&ms);
+        return -1;
+    } else if ( !found ) {
+        body = ms.s;
+        len = ms.len;
+        status = "207 Multi-Status";
+    }
+    free(file);
+    *e = ' ';
+    if ( verbose ) {
+        buffer_puts(buffer_2, "standin: ");
+        buffer_put(buffer_2, req, str_chr(req, '\r'));
+        buffer_putnlflush(buffer_2);
+    }
+    if ( latency_ms )
+        sleep_ms(latency_ms);
+    if ( !body ) {
+        stralloc_free(&ms);
+        return send_status(c, "404 Not Found", last)?-1:!last;
+    }
+
+    stralloc_init(&head);
+    stralloc_init(&gz);
+    if ( etag && !report ) {
+        tag[tl++]='"';
+        tl += fmt_hash(tag+tl, hash_buf(hash_str(""), body, len));
+        if ( gzip && header_has(req, "Accept-Encoding", "gzip") )
+            tl += fmt_str(tag+tl, "-gz");
+        tag[tl++]='"';
+        inm = header(req, "If-None-Match");
+        if ( inm && (!strncmp(inm, tag, tl) || *inm == '*') )
+            status = "304 Not Modified";
+    }
+#ifndef NOZLIB
+    if ( gzip && *status == '2' && header_has(req, "Accept-Encoding", "gzip") ) {
+        if ( compress_gzip(&gz, body, len) ) {
+            carp("deflate");
+            goto out;
+        }
+        zipped = 1;
+    }
+#endif
+    if ( !stralloc_copys(&head, "HTTP/1.1 ") || !stralloc_cats(&head, status) ||
+         !stralloc_cats(&head, report?"\r\nContent-Type: application/xml; charset=utf-8\r\n":
+                                       "\r\nContent-Type: text/calendar; charset=utf-8\r\n") ||
+         (tl && (!stralloc_cats(&head, "ETag: ") || !stralloc_catb(&head, tag, tl) || !stralloc_cats(&head, "\r\n"))) ||
+         (zipped && !stralloc_cats(&head, "Content-Encoding: gzip\r\n")) ||
+         (*status == '2' && chunksize && !stralloc_cats(&head, "Transfer-Encoding: chunked\r\n")) ||
+         (*status == '2' && !chunksize && (!stralloc_cats(&head, "Content-Length: ") ||
+                                           !stralloc_catulong0(&head, zipped?gz.len:len, 0) ||
+                                           !stralloc_cats(&head, "\r\n"))) ||
+         (last && !stralloc_cats(&head, "Connection: close\r\n")) ||
+         !stralloc_cats(&head, "\r\n") ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    if ( conn_write(c, head.s, head.len) ||
+         (*status == '2' && send_body(c, zipped?gz.s:body, zipped?gz.len:len)) )
+        goto out;
+    ret = !last;
+out:
+    if ( !report )
+        mmap_unmap(body, len);
+    stralloc_free(&ms);
+    stralloc_free(&head);
+    stralloc_free(&gz);
+    return ret;
+}
+
+/*
+ * reads requests until the connection is closed, by either side. The body
+ * of a request (the query of a REPORT) is read past but not looked at.
+ */
+static void serve( struct connection *c )
+{
+    char req[REQUESTSIZE];
+    const char *cl;
+    unsigned long body;
+    size_t len=0, n;
+    ssize_t r;
+    char *end;
+
+    while ( 1 ) {
+        while ( !(end = (len?strstr(req, "\r\n\r\n"):NULL)) ) {
+            if ( len >= sizeof(req)-1 || 0 >= (r=conn_read(c, req+len, sizeof(req)-1-len)) )
+                return;
+            len += r;
+            req[len] = '\0';
+        }
+        end[2] = '\0';
+        body = 0;
+        if ( (cl = header(req, "Content-Length")) )
+            scan_ulong(cl, &body);
+        n = end+4-req;
+        if ( body > sizeof(req)-1-n ) {
+            send_status(c, "413 Content Too Large", 1);
+            return;
+        }
+        while ( len < n+body ) {
+            if ( 0 >= (r=conn_read(c, req+len, sizeof(req)-1-len)) )
+                return;
+            len += r;
+        }
+        req[len] = '\0';
+        if ( 1 != respond(c, req) )
+            return;
+        /* a pipelined request may follow right behind */
+        n += body;
+        memmove(req, req+n, len-n+1);
+        len -= n;
+    }
+}
+
+static void handle( int sock, int tls )
+{
+    struct connection c = { sock };
+    struct timeval tv = { IDLE_TIMEOUT, 0 };
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#ifndef NOSSL
+    c.ssl = NULL;
+    if ( tls && (!(c.ssl = SSL_new(ssl_ctx)) || !SSL_set_fd(c.ssl, sock) || 1 != SSL_accept(c.ssl)) ) {
+        carp("SSL_accept");
+        _exit(1);
+    }
+#endif
+    serve(&c);
+#ifndef NOSSL
+    if ( c.ssl ) {
+        SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+    }
+#endif
+    close(sock);
+    _exit(0);
+}
+
+/* a listener on 127.0.0.1, port 0 picks a free one; the URL goes to stdout */
+static int listen_on( unsigned short port, const char *scheme )
+{
+    struct sockaddr_in sin = { .sin_family=AF_INET, .sin_port=htons(port), .sin_addr.s_addr=htonl(INADDR_LOOPBACK) };
+    socklen_t slen=sizeof(sin);
+    int one=1, l=socket(AF_INET, SOCK_STREAM, 0);
+
+    if ( l < 0 || setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+         bind(l, (struct sockaddr *)&sin, sizeof(sin)) || listen(l, 64) ||
+         getsockname(l, (struct sockaddr *)&sin, &slen) ) {
+        carpsys("listen");
+        return -1;
+    }
+    buffer_puts(buffer_1, scheme);
+    buffer_puts(buffer_1, "://localhost:");
+    buffer_putulong(buffer_1, ntohs(sin.sin_port));
+    buffer_putsflush(buffer_1, "/\n");
+    return l;
+}
+
+static void show_help( const char *progname )
+{
+    buffer_puts(buffer_2, progname);
+    buffer_puts(buffer_2, "\n");
+    buffer_puts(buffer_2, "\t-d [dir]\tdirectory with the calendars to serve (.)\n");
+    buffer_puts(buffer_2, "\t-p [port]\tHTTP port, 0: any free one (0)\n");
+#ifndef NOSSL
+    buffer_puts(buffer_2, "\t-s [port]\tHTTPS port too, 0: any free one (needs -c and -k)\n");
+    buffer_puts(buffer_2, "\t-c [file]\tcertificate chain (PEM)\n");
+    buffer_puts(buffer_2, "\t-k [file]\tprivate key (PEM)\n");
+#endif
+    buffer_puts(buffer_2, "\t-l [ms]\t\tlatency before each response (0)\n");
+    buffer_puts(buffer_2, "\t-b [bytes]\tbandwidth per connection in bytes/s, 0: unlimited (0)\n");
+    buffer_puts(buffer_2, "\t-C [bytes]\tchunked transfer encoding with chunks of that size\n");
+    buffer_puts(buffer_2, "\t-K\t\tkeep connections alive for further requests\n");
+#ifndef NOZLIB
+    buffer_puts(buffer_2, "\t-z\t\tgzip the body if the client accepts it (caltimist does not ask)\n");
+#endif
+    buffer_puts(buffer_2, "\t-e\t\tETag from the content, 304 on a matching If-None-Match\n");
+    buffer_puts(buffer_2, "\t-v\t\tlog requests to stderr");
+    buffer_putnlflush(buffer_2);
+}
+
+int main( int argc, char *argv[] )
+{
+    struct pollfd pfd[2];
+    nfds_t n=0, i;
+    int o, s;
+
+    while ( ( o = getopt(argc, argv, "d:p:s:c:k:l:b:C:Kzevh")) !=-1 ) {
+        switch(o) {
+        case 'd': root=optarg; break;
+        case 'p': scan_ushort(optarg, &http_port); break;
+#ifndef NOSSL
+        case 's': scan_ushort(optarg, &https_port); tls=1; break;
+        case 'c': cert_file=optarg; break;
+        case 'k': key_file=optarg; break;
+#endif
+        case 'l': scan_ulong(optarg, &latency_ms); break;
+        case 'b': scan_ulong(optarg, &bandwidth); break;
+        case 'C': scan_ulong(optarg, &chunksize); break;
+        case 'K': keepalive=1; break;
+#ifndef NOZLIB
+        case 'z': gzip=1; break;
+#endif
+        case 'e': etag=1; break;
+        case 'v': verbose=1; break;
+        default:
+            show_help(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    if ( -1 == (pfd[n].fd = listen_on(http_port, "http")) )
+        return 1;
+    pfd[n++].events = POLLIN;
+#ifndef NOSSL
+    if ( tls ) {
+        if ( !(ssl_ctx = SSL_CTX_new(TLS_server_method())) ||
+             1 != SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file?cert_file:"cert.pem") ||
+             1 != SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file?key_file:"key.pem", SSL_FILETYPE_PEM) ) {
+            carp("certificate or key not usable");
+            return 1;
+        }
+        if ( -1 == (pfd[n].fd = listen_on(https_port, "https")) )
+            return 1;
+        pfd[n++].events = POLLIN;
+    }
+#endif
+
+    /* one process per connection, so slow clients do not hold up the others */
+    while ( 0 <= poll(pfd, n, -1) || errno == EINTR ) {
+        for (i=0; i<n; ++i) {
+            if ( !(pfd[i].revents & POLLIN) || 0 > (s = accept(pfd[i].fd, NULL, NULL)) )
+                continue;
+            switch ( fork() ) {
+            case 0:
+                close(pfd[0].fd);
+                if ( n > 1 ) close(pfd[1].fd);
+                handle(s, i==1);
+            case -1:
+                carpsys("fork");
+            default:
+                close(s);
+            }
+        }
+    }
+    carpsys("poll");
+    return 1;
+}
@@ -0,0 +1,527 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errmsg.h>
+#include <str.h>
+#include <scan.h>
+#include <fmt.h>
+#include "hash.h"
+#include "caldav.h"
+
+void init_caldav_context( struct caldav_context *cd, int(*parser)(void *,char *), void *parser_ctx )
+{
+    memset(cd, 0, sizeof(struct caldav_context));
+    cd->parser = parser;
+    cd->parser_ctx = parser_ctx;
+}
+
+void init_caldav_sync_context( struct caldav_context *cd, caldav_response_fn response, void *response_ctx )
+{
+    memset(cd, 0, sizeof(struct caldav_context));
+    stralloc_init(&cd->href);
+    stralloc_init(&cd->status);
+    stralloc_init(&cd->data);
+    stralloc_init(&cd->sync_token);
+    cd->response = response;
+    cd->response_ctx = response_ctx;
+}
+
+void free_caldav_context( struct caldav_context *cd )
+{
+    stralloc_free(&cd->href);
+    stralloc_free(&cd->status);
+    stralloc_free(&cd->data);
+    stralloc_free(&cd->sync_token);
+    stralloc_free(&cd->etag);
+}
+
+static int catutc( stralloc *sa, time_t t )
+{
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    return stralloc_catulong0(sa, tm.tm_year+1900, 4) && stralloc_catulong0(sa, tm.tm_mon+1, 2) &&
+        stralloc_catulong0(sa, tm.tm_mday, 2) && stralloc_append(sa, "T") &&
+        stralloc_catulong0(sa, tm.tm_hour, 2) && stralloc_catulong0(sa, tm.tm_min, 2) &&
+        stralloc_catulong0(sa, tm.tm_sec, 2) && stralloc_append(sa, "Z");
+}
+
+/*
+ * RFC 4791 7.8 calendar-query for all events overlapping [begin,end), with
+ * their calendar-data if data is set, else only their getetags
+ */
+int caldav_calendar_query( stralloc *sa, time_t begin, time_t end, bool data )
+{
+    if ( !stralloc_copys(sa,
+                "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\r\n"
+                "<C:calendar-query xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\r\n") ||
+            !stralloc_cats(sa, data?" <D:prop><D:getetag/><C:calendar-data/></D:prop>\r\n":
+                " <D:prop><D:getetag/></D:prop>\r\n") ||
+            !stralloc_cats(sa,
+                " <C:filter>\r\n"
+                "  <C:comp-filter name=\"VCALENDAR\">\r\n"
+                "   <C:comp-filter name=\"VEVENT\">\r\n"
+                "    <C:time-range start=\"") ||
+            !catutc(sa, begin) ||
+            !stralloc_cats(sa, "\" end=\"") ||
+            !catutc(sa, end) ||
+            !stralloc_cats(sa, "\"/>\r\n"
+                "   </C:comp-filter>\r\n"
+                "  </C:comp-filter>\r\n"
+                " </C:filter>\r\n"
+                "</C:calendar-query>\r\n") ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    return 0;
+}
+
+static int cat_escaped( stralloc *sa, const char *s, size_t len )
+{
+    for (; len--; ++s) {
+        const char *e = (*s == '<')?"&lt;":(*s == '>')?"&gt;":(*s == '&')?"&amp;":(*s == '"')?"&quot;":NULL;
+        if ( !(e?stralloc_cats(sa, e):stralloc_catb(sa, s, 1)) )
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * RFC 6578 3.2 sync-collection, an empty token asks for the initial sync;
+ * without data only what changed is listed, not its calendar-data
+ */
+int caldav_sync_collection( stralloc *sa, const char *token, bool data )
+{
+    if ( !stralloc_copys(sa,
+                "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\r\n"
+                "<D:sync-collection xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\r\n"
+                " <D:sync-token>") ||
+            !cat_escaped(sa, token, str_len(token)) ||
+            !stralloc_cats(sa, "</D:sync-token>\r\n"
+                " <D:sync-level>1</D:sync-level>\r\n") ||
+            !stralloc_cats(sa, data?" <D:prop><D:getetag/><C:calendar-data/></D:prop>\r\n":
+                " <D:prop><D:getetag/></D:prop>\r\n") ||
+            !stralloc_cats(sa, "</D:sync-collection>\r\n") ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    return 0;
+}
+
+/* RFC 4791 7.9 calendar-multiget for the '\0' separated hrefs */
+int caldav_calendar_multiget( stralloc *sa, const char *hrefs, size_t len )
+{
+    size_t i, l;
+
+    if ( !stralloc_copys(sa,
+                "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\r\n"
+                "<C:calendar-multiget xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\r\n"
+                " <D:prop><D:getetag/><C:calendar-data/></D:prop>\r\n") )
+        goto fail;
+    for (i=0; i<len; i+=l+1) {
+        l = str_len(hrefs+i);
+        if ( !stralloc_cats(sa, " <D:href>") || !cat_escaped(sa, hrefs+i, l) ||
+                !stralloc_cats(sa, "</D:href>\r\n") )
+            goto fail;
+    }
+    if ( stralloc_cats(sa, "</C:calendar-multiget>\r\n") )
+        return 0;
+fail:
+    carpsys("stralloc");
+    return -1;
+}
+
+static int flush( struct caldav_context *cd )
+{
+    if ( !cd->outlen )
+        return 0;
+    cd->out[cd->outlen] = '\0';
+    cd->outlen = 0;
+    return cd->parser(cd->parser_ctx, cd->out);
+}
+
+static int emit( struct caldav_context *cd, const char *s, size_t len )
+{
+    stralloc *sa;
+
+    if ( cd->field == CALDAV_CALDATA && cd->parser ) {
+        while ( len-- ) {
+            if ( cd->outlen == CALDAV_CHUNK && flush(cd) )
+                return -1;
+            cd->out[cd->outlen++] = *s++;
+        }
+        return 0;
+    }
+    switch ( cd->field ) {
+    case CALDAV_CALDATA: sa = &cd->data; break;
+    case CALDAV_HREF: sa = &cd->href; break;
+    case CALDAV_STATUS: sa = &cd->status; break;
+    case CALDAV_SYNCTOKEN: sa = &cd->sync_token; break;
+    case CALDAV_GETETAG: sa = &cd->etag; break;
+    default: return 0;
+    }
+    if ( !stralloc_catb(sa, s, len) ) {
+        carpsys("stralloc_catb");
+        return -1;
+    }
+    return 0;
+}
+
+static int emit_codepoint( struct caldav_context *cd, unsigned long c )
+{
+    char u[4];
+    size_t n;
+
+    if ( c < 0x80 ) { u[0]=c; n=1; }
+    else if ( c < 0x800 ) { u[0]=0xc0|(c>>6); u[1]=0x80|(c&0x3f); n=2; }
+    else if ( c < 0x10000 ) { u[0]=0xe0|(c>>12); u[1]=0x80|((c>>6)&0x3f); u[2]=0x80|(c&0x3f); n=3; }
+    else { u[0]=0xf0|(c>>18); u[1]=0x80|((c>>12)&0x3f); u[2]=0x80|((c>>6)&0x3f); u[3]=0x80|(c&0x3f); n=4; }
+    return emit(cd, u, n);
+}
+
+static int emit_entity( struct caldav_context *cd )
+{
+    static const struct { const char *name; char c; } named[] = {
+        { "lt", '<' }, { "gt", '>' }, { "amp", '&' }, { "quot", '"' }, { "apos", '\'' },
+    };
+    const char *e = cd->entity;
+    unsigned long c;
+    size_t i;
+
+    cd->entity[cd->entitylen] = '\0';
+    if ( e[0] == '#' ) {
+        if ( (e[1] == 'x' || e[1] == 'X') ? scan_xlong(e+2, &c) : scan_ulong(e+1, &c) )
+            if ( c <= 0x10ffff )
+                return emit_codepoint(cd, c);
+    } else
+        for (i=0; i<sizeof(named)/sizeof(named[0]); ++i)
+            if ( str_equal(e, named[i].name) )
+                return emit(cd, &named[i].c, 1);
+    /* unknown entity, pass it on as it was */
+    return emit(cd, "&", 1) || emit(cd, e, cd->entitylen) || emit(cd, ";", 1);
+}
+
+/* compares the local name of the element in tag, i.e. without namespace prefix and attributes */
+static bool is_element( const char *tag, size_t len, const char *name )
+{
+    size_t i, l=0;
+
+    if ( len && tag[0] == '/' ) {
+        tag++;
+        len--;
+    }
+    for (i=0; i<len && tag[i] != ' ' && tag[i] != '\t' && tag[i] != '\r' && tag[i] != '\n' && tag[i] != '/'; ++i)
+        if ( tag[i] == ':' ) l=i+1;
+    return (i-l == str_len(name)) && !memcmp(tag+l, name, i-l);
+}
+
+static void trim( stralloc *sa )
+{
+    size_t i=0;
+
+    while ( sa->len && (sa->s[sa->len-1] == ' ' || sa->s[sa->len-1] == '\t' ||
+                sa->s[sa->len-1] == '\r' || sa->s[sa->len-1] == '\n') )
+        sa->len--;
+    while ( i < sa->len && (sa->s[i] == ' ' || sa->s[i] == '\t' || sa->s[i] == '\r' || sa->s[i] == '\n') )
+        i++;
+    if ( i ) {
+        memmove(sa->s, sa->s+i, sa->len-i);
+        sa->len -= i;
+    }
+}
+
+/* hands a complete <response> to the callback */
+static int finish_response( struct caldav_context *cd )
+{
+    unsigned short status=0;
+    size_t i;
+
+    cd->in_response = cd->in_propstat = false;
+    trim(&cd->href);
+    if ( !cd->href.len )
+        return 0;
+    if ( !stralloc_0(&cd->href) || !stralloc_0(&cd->status) ) {
+        carpsys("stralloc_0");
+        return -1;
+    }
+    /* HTTP/1.1 404 Not Found */
+    trim(&cd->status);
+    i = str_chr(cd->status.s, ' ');
+    if ( cd->status.s[i] )
+        scan_ushort(cd->status.s+i+1, &status);
+    return cd->response(cd->response_ctx, cd->href.s, status, cd->has_data?&cd->data:NULL);
+}
+
+/* a start or end tag outside of the collected elements */
+static int process_tag( struct caldav_context *cd )
+{
+    const char *tag = cd->tag;
+    size_t len = cd->taglen;
+    bool empty;
+
+    if ( !len || tag[0] == '?' || tag[0] == '!' )
+        return 0;
+    if ( tag[0] == '/' ) {
+        if ( !cd->response )
+            return 0;
+        if ( is_element(tag, len, "response") && cd->in_response )
+            return finish_response(cd);
+        if ( is_element(tag, len, "propstat") )
+            cd->in_propstat = false;
+        return 0;
+    }
+    empty = (tag[len-1] == '/');
+    if ( is_element(tag, len, "calendar-data") ) {
+        if ( !empty ) {
+            cd->state = CALDAV_DATA;
+            cd->field = CALDAV_CALDATA;
+            cd->has_data = true;
+            cd->resources++;
+        }
+        return 0;
+    }
+    if ( !empty && is_element(tag, len, "getetag") ) {
+        cd->etag.len = 0;
+        cd->field = CALDAV_GETETAG;
+        cd->state = CALDAV_DATA;
+        return 0;
+    }
+    if ( !cd->response )
+        return 0;
+    if ( is_element(tag, len, "response") ) {
+        cd->in_response = !empty;
+        cd->in_propstat = cd->has_data = false;
+        cd->href.len = cd->status.len = cd->data.len = 0;
+    } else if ( is_element(tag, len, "propstat") )
+        cd->in_propstat = !empty;
+    else if ( empty )
+        return 0;
+    else if ( cd->in_response && !cd->in_propstat && !cd->href.len && is_element(tag, len, "href") )
+        cd->field = CALDAV_HREF;
+    else if ( cd->in_response && !cd->in_propstat && is_element(tag, len, "status") ) {
+        cd->status.len = 0;
+        cd->field = CALDAV_STATUS;
+    } else if ( !cd->in_response && is_element(tag, len, "sync-token") ) {
+        cd->sync_token.len = 0;
+        cd->field = CALDAV_SYNCTOKEN;
+    }
+    if ( cd->field != CALDAV_NONE )
+        cd->state = CALDAV_DATA;
+    return 0;
+}
+
+int caldav_parser( void *ctx, char *buf )
+{
+    struct caldav_context *cd = (struct caldav_context *)ctx;
+    const char *cdata = "![CDATA[";
+    char c;
+
+    for (; (c=*buf); ++buf) {
+        switch ( cd->state ) {
+        case CALDAV_TEXT:
+            if ( c == '<' ) {
+                cd->state = CALDAV_TAG;
+                cd->taglen = 0;
+            }
+            break;
+
+        case CALDAV_TAG:
+            if ( c != '>' ) {
+                if ( cd->taglen < sizeof(cd->tag) )
+                    cd->tag[cd->taglen++] = c;
+                break;
+            }
+            cd->state = CALDAV_TEXT;
+            if ( process_tag(cd) )
+                return -1;
+            break;
+
+        case CALDAV_DATA:
+            if ( c == '&' ) {
+                cd->state = CALDAV_ENTITY;
+                cd->entitylen = 0;
+            } else if ( c == '<' ) {
+                cd->state = CALDAV_DATA_TAG;
+                cd->taglen = 0;
+            } else if ( emit(cd, &c, 1) )
+                return -1;
+            break;
+
+        case CALDAV_ENTITY:
+            if ( c == ';' ) {
+                cd->state = CALDAV_DATA;
+                if ( emit_entity(cd) )
+                    return -1;
+            } else if ( cd->entitylen < sizeof(cd->entity)-1 )
+                cd->entity[cd->entitylen++] = c;
+            break;
+
+        case CALDAV_DATA_TAG:
+            if ( c == '>' && (!cd->taglen || cd->tag[0] != '!') ) {
+                /* end of the element, make sure the last line of calendar-data is terminated */
+                if ( cd->taglen && cd->tag[0] == '/' ) {
+                    cd->state = CALDAV_TEXT;
+                    if ( cd->field == CALDAV_CALDATA && emit(cd, "\r\n", 2) )
+                        return -1;
+                    if ( cd->field == CALDAV_SYNCTOKEN )
+                        trim(&cd->sync_token);
+                    if ( cd->field == CALDAV_GETETAG ) {
+                        trim(&cd->etag);
+                        cd->etags += hash_buf(hash_str(""), cd->etag.s, cd->etag.len);
+                    }
+                    cd->field = CALDAV_NONE;
+                } else
+                    cd->state = CALDAV_DATA;
+                break;
+            }
+            if ( cd->taglen < sizeof(cd->tag) )
+                cd->tag[cd->taglen++] = c;
+            if ( cd->taglen == str_len(cdata) && !memcmp(cd->tag, cdata, cd->taglen) ) {
+                cd->state = CALDAV_CDATA;
+                cd->brackets = 0;
+            }
+            break;
+
+        case CALDAV_CDATA:
+            if ( c == ']' ) {
+                cd->brackets++;
+                break;
+            }
+            if ( c == '>' && cd->brackets >= 2 ) {
+                cd->brackets -= 2;
+                cd->state = CALDAV_DATA;
+            }
+            for (; cd->brackets; cd->brackets--)
+                if ( emit(cd, "]", 1) )
+                    return -1;
+            if ( cd->state == CALDAV_CDATA && emit(cd, &c, 1) )
+                return -1;
+            break;
+        }
+    }
+    return flush(cd);
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+static int collect( void *ctx, char *buf )
+{
+    return stralloc_cats((stralloc *)ctx, buf)?0:-1;
+}
+
+static int collect_response( void *ctx, const char *href, unsigned short status, const stralloc *data )
+{
+    stralloc *sa = (stralloc *)ctx;
+
+    assert(stralloc_cats(sa, href) && stralloc_cats(sa, " ") && stralloc_catulong0(sa, status, 0) &&
+            stralloc_cats(sa, " "));
+    assert(data?stralloc_catb(sa, data->s, data->len):stralloc_cats(sa, "-"));
+    assert(stralloc_cats(sa, "|"));
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *multistatus =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<d:multistatus xmlns:d=\"DAV:\" xmlns:cal=\"urn:ietf:params:xml:ns:caldav\">\n"
+        "<d:response><d:href>/cal/1.ics</d:href><d:propstat><d:prop>\n"
+        "<cal:calendar-data>BEGIN:VCALENDAR&#13;\nBEGIN:VEVENT&#13;\nSUMMARY:a &amp; b &lt;c&gt; &#x20AC;&#13;\n"
+        "END:VEVENT&#13;\nEND:VCALENDAR&#13;\n</cal:calendar-data>\n"
+        "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>\n"
+        "<d:response><d:href>/cal/2.ics</d:href><d:propstat><d:prop>\n"
+        "<calendar-data xmlns=\"urn:ietf:params:xml:ns:caldav\"><![CDATA[BEGIN:VEVENT\r\nSUMMARY:]x]]<y>\r\nEND:VEVENT]]></calendar-data>\n"
+        "<cal:calendar-data/>\n"
+        "</d:prop></d:propstat></d:response></d:multistatus>\n";
+    const char *expected =
+        "BEGIN:VCALENDAR\r\nBEGIN:VEVENT\r\nSUMMARY:a & b <c> \xe2\x82\xac\r\nEND:VEVENT\r\nEND:VCALENDAR\r\n\r\n"
+        "BEGIN:VEVENT\r\nSUMMARY:]x]]<y>\r\nEND:VEVENT\r\n";
+    struct caldav_context cd;
+    stralloc sa, q;
+    char piece[256];
+    size_t step, i, len=str_len(multistatus);
+
+    /* every split of the response gives the same result */
+    for (step=1; step<sizeof(piece); ++step) {
+        stralloc_init(&sa);
+        init_caldav_context(&cd, collect, &sa);
+        for (i=0; i<len; i+=step) {
+            size_t n = (len-i<step)?len-i:step;
+            memcpy(piece, multistatus+i, n);
+            piece[n] = '\0';
+            assert(0==caldav_parser(&cd, piece));
+        }
+        assert(cd.resources==2 && !cd.etags);
+        assert(sa.len==str_len(expected) && !memcmp(sa.s, expected, sa.len));
+        stralloc_free(&sa);
+    }
+
+    /* sync-collection: changed, deleted and a resource without calendar-data */
+    multistatus =
+        "<d:multistatus xmlns:d=\"DAV:\" xmlns:c=\"urn:ietf:params:xml:ns:caldav\">\n"
+        "<d:response><d:href>/cal/a.ics</d:href><d:propstat><d:prop><d:getetag>\"1\"</d:getetag>"
+        "<c:calendar-data>BEGIN:VEVENT&#13;\nEND:VEVENT&#13;\n</c:calendar-data></d:prop>"
+        "<d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>\n"
+        "<d:response>\n <d:href>/cal/b&amp;c.ics</d:href>\n <d:status>HTTP/1.1 404 Not Found</d:status>\n</d:response>\n"
+        "<d:response><d:href>/cal/d.ics</d:href><d:propstat><d:prop><d:getetag>\"2\"</d:getetag></d:prop>"
+        "<d:status>HTTP/1.1 200 OK</d:status></d:propstat><d:propstat><d:prop><c:calendar-data/></d:prop>"
+        "<d:status>HTTP/1.1 404 Not Found</d:status></d:propstat></d:response>\n"
+        "<d:sync-token>\n http://example.com/sync/7 </d:sync-token>\n"
+        "</d:multistatus>\n";
+    expected = "/cal/a.ics 0 BEGIN:VEVENT\r\nEND:VEVENT\r\n\r\n|/cal/b&c.ics 404 -|/cal/d.ics 0 -|";
+    len = str_len(multistatus);
+    for (step=1; step<sizeof(piece); ++step) {
+        stralloc_init(&sa);
+        init_caldav_sync_context(&cd, collect_response, &sa);
+        for (i=0; i<len; i+=step) {
+            size_t n = (len-i<step)?len-i:step;
+            memcpy(piece, multistatus+i, n);
+            piece[n] = '\0';
+            assert(0==caldav_parser(&cd, piece));
+        }
+        assert(sa.len==str_len(expected) && !memcmp(sa.s, expected, sa.len));
+        assert(cd.sync_token.len==25 && !memcmp(cd.sync_token.s, "http://example.com/sync/7", 25));
+        assert(cd.etags==hash_str("\"1\"")+hash_str("\"2\""));
+        free_caldav_context(&cd);
+        stralloc_free(&sa);
+    }
+
+    stralloc_init(&q);
+    assert(0==caldav_sync_collection(&q, "http://example.com/sync/7?a&b", true));
+    assert(stralloc_0(&q));
+    assert(strstr(q.s, "<D:sync-token>http://example.com/sync/7?a&amp;b</D:sync-token>"));
+    assert(strstr(q.s, "<C:calendar-data/>"));
+    assert(0==caldav_sync_collection(&q, "t", false));
+    assert(stralloc_0(&q) && !strstr(q.s, "calendar-data"));
+    assert(0==caldav_calendar_multiget(&q, "/cal/1.ics\0/cal/<2>.ics", sizeof("/cal/1.ics\0/cal/<2>.ics")));
+    assert(stralloc_0(&q));
+    assert(strstr(q.s, "<D:href>/cal/1.ics</D:href>\r\n <D:href>/cal/&lt;2&gt;.ics</D:href>\r\n</C:calendar-multiget>"));
+    assert(0==caldav_calendar_query(&q, 1682899200, 1685577600, true));
+    assert(stralloc_0(&q));
+    assert(strstr(q.s, "<C:time-range start=\"20230501T000000Z\" end=\"20230601T000000Z\"/>"));
+    assert(strstr(q.s, "<D:prop><D:getetag/><C:calendar-data/></D:prop>"));
+    assert(0==caldav_calendar_query(&q, 1682899200, 1685577600, false));
+    assert(stralloc_0(&q) && strstr(q.s, "<D:prop><D:getetag/></D:prop>"));
+
+    /* only the getetags of a calendar-query */
+    char etags[] =
+        "<d:multistatus xmlns:d=\"DAV:\"><d:response><d:href>/cal/a.ics</d:href><d:propstat><d:prop>"
+        "<d:getetag> \"1\" </d:getetag></d:prop></d:propstat></d:response>\n"
+        "<d:response><d:href>/cal/b.ics</d:href><d:propstat><d:prop><d:getetag>\"2\"</d:getetag>"
+        "</d:prop></d:propstat></d:response></d:multistatus>\n";
+    init_caldav_context(&cd, collect, &sa);
+    assert(0==caldav_parser(&cd, etags) && !cd.resources);
+    assert(cd.etags==hash_str("\"1\"")+hash_str("\"2\""));
+    free_caldav_context(&cd);
+    stralloc_free(&q);
+
+    exit(EXIT_SUCCESS);
+}
+#endif
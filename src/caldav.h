@@ -0,0 +1,71 @@
+#ifndef CALDAV_H
+#define CALDAV_H
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <stralloc.h>
+
+#define CALDAV_CHUNK 4096
+
+enum caldav_state {
+    CALDAV_TEXT=0,
+    CALDAV_TAG,
+    CALDAV_DATA,
+    CALDAV_ENTITY,
+    CALDAV_DATA_TAG,
+    CALDAV_CDATA
+};
+
+/* element whose text is currently collected */
+enum caldav_field {
+    CALDAV_NONE=0,
+    CALDAV_CALDATA,
+    CALDAV_HREF,
+    CALDAV_STATUS,
+    CALDAV_SYNCTOKEN,
+    CALDAV_GETETAG
+};
+
+/*
+ * called per <response> of a sync-collection or calendar-multiget: href,
+ * the status of the response itself (0 if it only has propstats) and its
+ * calendar-data (NULL if there was none)
+ */
+typedef int (*caldav_response_fn)( void *, const char *, unsigned short, const stralloc * );
+
+/*
+ * pulls the calendar-data out of a CalDAV multistatus response and streams
+ * it, unescaped, into the wrapped parser (usually ics_parser). With a
+ * response callback instead, every <response> is collected and handed over
+ * as a whole, the sync-token of the multistatus is kept in sync_token.
+ * Either way the getetags of the responses are summed up in etags, which
+ * changes with any resource that was changed, added or removed.
+ */
+struct caldav_context {
+    int (*parser)( void *, char * );
+    void *parser_ctx;
+    caldav_response_fn response;
+    void *response_ctx;
+    enum caldav_state state;
+    enum caldav_field field;
+    bool in_response, in_propstat, has_data;
+    stralloc href, status, data, sync_token, etag;
+    unsigned long long etags; // sum of the hashes of the getetags, 0 if there were none
+    char tag[64];
+    size_t taglen;
+    char entity[12];
+    size_t entitylen;
+    unsigned short brackets;
+    unsigned long resources;
+    char out[CALDAV_CHUNK+1];
+    size_t outlen;
+};
+
+void init_caldav_context( struct caldav_context *, int(*)(void *,char *), void * );
+void init_caldav_sync_context( struct caldav_context *, caldav_response_fn, void * );
+void free_caldav_context( struct caldav_context * );
+int caldav_calendar_query( stralloc *, time_t, time_t, bool );
+int caldav_sync_collection( stralloc *, const char *, bool );
+int caldav_calendar_multiget( stralloc *, const char *, size_t );
+int caldav_parser( void *, char * );
+#endif
@@ -6,18 +6,40 @@
 
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <buffer.h>
 #include <scan.h>
 #include <str.h>
 #include <errmsg.h>
 #include "httpsclient.h"
+#include "http.h"
+#include "syncstore.h"
+#include "holidays.h"
+#include "holidayrules.h"
+#include "reportcache.h"
+#include "gzipout.h"
+#include "shardparse.h"
+#include "tzone.h"
+#include "template.h"
 #include "ics.h"
+#include "report.h"
 
 #define V(__l,__fn) do{if(verbosity>=__l){ __fn; }}while(0);
 short verbosity=0;
 
 char *PROGNAME;
 
+enum long_only_options {
+    OPT_TRACE=256,
+    OPT_METRICS
+};
+
+static const struct option long_options[] = {
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "metrics", required_argument, NULL, OPT_METRICS },
+    { NULL, 0, NULL, 0 }
+};
+
 static void show_help()
 {
     buffer_puts(buffer_1,PROGNAME);
@@ -26,8 +48,12 @@ static void show_help()
     buffer_puts(buffer_1,"\t-m [1-12]\tmonth\n");
     buffer_puts(buffer_1,"\t-u [user]\tuser\n");
     buffer_puts(buffer_1,"\t-p [project]\tproject\n");
-    buffer_puts(buffer_1,"\t-o [text|]\toutput format\n");
+    buffer_puts(buffer_1,"\t-o [text|html|file]\toutput format or template file\n");
+    buffer_puts(buffer_1,"\t-s\tsummary: sums per project instead of every timeslot, in constant memory\n");
+    buffer_puts(buffer_1,"\t-g\tgrouped: a year with subtotals per month\n");
     buffer_puts(buffer_1,"\t-v\tverbosity\n");
+    buffer_puts(buffer_1,"\t--trace [file]\twrite a trace of all phases (chrome://tracing)\n");
+    buffer_puts(buffer_1,"\t--metrics [file]\twrite Prometheus metrics of the run (node_exporter textfile)\n");
     buffer_puts(buffer_1,"\t-[UP]\tshow user or project list and exit\n");
     buffer_puts(buffer_1,"\t-h\thelp");
     buffer_putnlflush(buffer_1);
@@ -43,7 +69,7 @@ static int cgi_auth_user(char **user)
     return 0;
 }
 
-static int handle_request(char **request)
+static int handle_request(char **request, bool gzip)
 {
     char *method=getenv("REQUEST_METHOD");
     char *contentlength,*t;
@@ -77,6 +103,9 @@ static int handle_request(char **request)
     } else return -1;
 
     buffer_puts(buffer_1,"Content-Type:text/html;charset=iso-8859-1\n");
+    if (gzip)
+        buffer_puts(buffer_1,"Content-Encoding:gzip\n");
+    buffer_puts(buffer_1,"Vary:Accept-Encoding\n");
     buffer_putnlflush(buffer_1);
     return str_len(*request);
 }
@@ -85,9 +114,13 @@ static int validate_args( struct program_args *pa )
 {
     if ( (-1 > pa->month) || (12 < pa->month) ||
             ((-1 != pa->year) && (1970 > pa->year)) ||
-            (pa->show_project && pa->show_user) )
+            (pa->show_project && pa->show_user) ||
+            (pa->summary && pa->grouped) )
         return -1;
     if ( (pa->year>0) && (pa->month==-1) ) pa->month=0;
+    /* grouping is by month within a year, a single month has nothing to group */
+    if ( pa->grouped && pa->month )
+        return -1;
     return 0;
 }
 
@@ -102,34 +135,13 @@ static int parse_query_string(struct program_args *pa, char *request, const shor
             scan_short( request+cur+2, &(pa->year));
         else if ( (request[cur] == 'm') && (request[cur+1] == '=') )
             scan_short( request+cur+2, &(pa->month));
+        else if ( (request[cur] == 'g') && (request[cur+1] == '=') )
+            pa->grouped = (request[cur+2] == '1');
         cur+=sep+1;
     }
     return 0;
 }
 
-static void free_cfgctx( struct config_context *c )
-{
-    struct user_context *u, *tu;
-    struct project_context *p, *tp;
-
-    if (c->general.user) free(c->general.user);
-    if (c->general.password) free(c->general.password);
-    if (c->general.public_holidays) free(c->general.public_holidays);
-    for (u=c->first_user; u;) {
-        if (u->name) free(u->name);
-        if (u->cal) free(u->cal);
-        tu=u->next_user;
-        free(u);
-        u=tu;
-    }
-    for (p=c->first_project; p;) {
-        if (p->name) free(p->name);
-        tp=p->next_project;
-        free(p);
-        p=tp;
-    }
-}
-
 int main( int argc, char *argv[], char *envp[] )
 {
     int ret=EXIT_SUCCESS, o;
@@ -138,6 +150,10 @@ int main( int argc, char *argv[], char *envp[] )
     struct user_context *ucntx;
     struct project_context *pcntx;
     struct config_context cfgctx;
+    struct gzip_output gz;
+    char gzspace[BUFFER_OUTSIZE];
+    buffer gzbuf, *out=buffer_1;
+    bool gzip=false;
     memset( &cfgctx,0, sizeof(struct config_context));
 
     cfgctx.prog_arg.year=-1;
@@ -145,8 +161,12 @@ int main( int argc, char *argv[], char *envp[] )
     cfgctx.prog_arg.user = NULL;
     cfgctx.prog_arg.project = NULL;
     cfgctx.prog_arg.format = NULL;
+    cfgctx.prog_arg.trace = NULL;
+    cfgctx.prog_arg.metrics = NULL;
     cfgctx.prog_arg.show_user=false;
     cfgctx.prog_arg.show_project=false;
+    cfgctx.prog_arg.summary=false;
+    cfgctx.prog_arg.grouped=false;
 
     PROGNAME = argv[0];
 #if 0
@@ -163,14 +183,21 @@ int main( int argc, char *argv[], char *envp[] )
         (PROGNAME[pnlen-1] == 'i')) {
         char *request;
         short total;
+        gzip = accepts_gzip(getenv("HTTP_ACCEPT_ENCODING"));
         if ( cgi_auth_user(&(cfgctx.prog_arg.user)) ||
-            (0>(total=handle_request(&request))) )
+            (0>(total=handle_request(&request, gzip))) )
             exit(EXIT_FAILURE);
+        /* the table is compressed row by row as the formatter writes it */
+        if ( gzip ) {
+            if ( init_gzip_output(&gz, &gzbuf, 1, gzspace, sizeof(gzspace)) )
+                exit(EXIT_FAILURE);
+            out = &gzbuf;
+        }
         cfgctx.prog_arg.format="html";
         parse_query_string(&cfgctx.prog_arg, request,total);
     }
 
-    while ( ( o = getopt(argc, argv, "y:m:u:p:o:vUPh")) !=-1 ) {
+    while ( ( o = getopt_long(argc, argv, "y:m:u:p:o:sgvUPh", long_options, NULL)) !=-1 ) {
         switch(o) {
         case 'y':
             scan_short(optarg,&(cfgctx.prog_arg.year));
@@ -187,6 +214,12 @@ int main( int argc, char *argv[], char *envp[] )
         case 'o':
             cfgctx.prog_arg.format = optarg;
             break;
+        case 's':
+            cfgctx.prog_arg.summary=true;
+            break;
+        case 'g':
+            cfgctx.prog_arg.grouped=true;
+            break;
         case 'v':
             verbosity++;
             break;
@@ -196,6 +229,12 @@ int main( int argc, char *argv[], char *envp[] )
         case 'P':
             cfgctx.prog_arg.show_project=true;
             break;
+        case OPT_TRACE:
+            cfgctx.prog_arg.trace = optarg;
+            break;
+        case OPT_METRICS:
+            cfgctx.prog_arg.metrics = optarg;
+            break;
         default:
             ret=EXIT_FAILURE;
         case 'h':
@@ -207,6 +246,16 @@ int main( int argc, char *argv[], char *envp[] )
     set_config_verbosity(verbosity);
     set_ics_verbosity(verbosity);
     set_httpsclient_verbosity(verbosity);
+    set_http_verbosity(verbosity);
+    set_syncstore_verbosity(verbosity);
+    set_holidays_verbosity(verbosity);
+    set_holidayrules_verbosity(verbosity);
+    set_reportcache_verbosity(verbosity);
+    set_report_verbosity(verbosity);
+    set_gzipout_verbosity(verbosity);
+    set_shardparse_verbosity(verbosity);
+    set_tzone_verbosity(verbosity);
+    set_template_verbosity(verbosity);
 
     if ( validate_args(&(cfgctx.prog_arg)) ||
         parse_config(&cfgctx) )
@@ -228,31 +277,15 @@ int main( int argc, char *argv[], char *envp[] )
         exit(EXIT_SUCCESS);
     }
 
-    init_holiday_list(cfgctx.prog_arg.year);
-    if ( cfgctx.general.public_holidays )
-        if ( fetch_calendar( NULL, cfgctx.general.public_holidays, &(cfgctx.general), ics_parser ) ) {
-            free_cfgctx(&cfgctx);
-            die(EXIT_FAILURE,"failed to fetch public holiday calendar");
-        }
-
-    for_each_user(&cfgctx, ucntx) {
-        if (cfgctx.prog_arg.user && !str_equal(ucntx->name,cfgctx.prog_arg.user))
-            continue;
-
-        if ( fetch_calendar( ucntx->name, ucntx->cal, &(cfgctx.general), ics_parser ) ) {
-            free_cfgctx(&cfgctx);
-            die(EXIT_FAILURE,"failed to fetch user calendar(s)");
-        }
-    }
-
-    if ( cfgctx.prog_arg.project )
-        filter_project_calentries( cfgctx.prog_arg.project );
-
-    if ( cal_statistics(&cfgctx) ) {
-        free_cfgctx(&cfgctx);
-        die(EXIT_FAILURE,"issue while printing calendar statistics");
+    ret = generate_report(&cfgctx, out);
+    /* ends the gzip stream in any case, the browser shows what is there */
+    if ( gzip && finish_gzip_output(&gz, out) )
+        ret = -1;
+    if ( ret ) {
+        free_config(&cfgctx);
+        die(EXIT_FAILURE,"failed to generate report");
     }
 
-    free_cfgctx(&cfgctx);
+    free_config(&cfgctx);
     exit(EXIT_SUCCESS);
 }
@@ -16,8 +16,20 @@
 #include <unistd.h>
 #include <limits.h>
 #include <scan.h>
+#include <byte.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <mmap.h>
+#include "atomicfile.h"
+#include "hash.h"
 
 #define PATH_SEPARATOR '/'
+#define CONFIG_INDEX_MAGIC "caltimist-config 1\n"
+#define CONFIG_INDEX_SUFFIX ".idx"
+/* a hex number and a separator */
+#define INDEX_FIELD (FMT_HASH+1)
+#define INDEX_USERS "[User]\n"
+#define INDEX_PROJECTS "[Projects]\n"
 
 #define V(__l,__fn) do{if(config_verbosity>=__l){ __fn; }}while(0);
 short config_verbosity=0;
@@ -99,6 +111,22 @@ static int prepare_new_project(struct config_context *cfgctx, char *name)
     return 0;
 }
 
+static int prepare_new_group(struct config_context *cfgctx, char *name)
+{
+    struct group_context *group = calloc( 1, sizeof(struct group_context) );
+    if (!group) {
+        carpsys("calloc");
+        return -1;
+    }
+    group->name = name;
+    if (!cfgctx->first_group) {
+        cfgctx->first_group = group; cfgctx->last_group = group;
+    } else {
+        cfgctx->last_group->next_group = group; cfgctx->last_group = group;
+    }
+    return 0;
+}
+
 static int get_float_as_centiushort( unsigned short *v, const char *floatstring ) {
     double f=0.0;
 
@@ -115,6 +143,29 @@ static int get_float_as_centiushort( unsigned short *v, const char *floatstring
     return 0;
 }
 
+/* cal=a,b adds the calendars a and b to the ones the user has already */
+static int add_cal_values( struct user_context *u, const char *strval )
+{
+    size_t len;
+    char **cal;
+
+    for (; *strval; strval += len + (strval[len]?1:0)) {
+        if ( !(len = str_chr(strval, ',')) )
+            continue;
+        if ( !(cal = realloc(u->cal, (u->cals+1)*sizeof(char *))) ) {
+            carpsys("realloc");
+            return -1;
+        }
+        u->cal = cal;
+        if ( !(u->cal[u->cals] = strndup(strval, len)) ) {
+            carpsys("strndup");
+            return -1;
+        }
+        u->cals++;
+    }
+    return 0;
+}
+
 static int get_string_value( char **var, const char *strval )
 {
     size_t len=str_len(strval);
@@ -129,7 +180,80 @@ static int get_string_value( char **var, const char *strval )
     return 0;
 }
 
-static int parse_line(struct config_context *cfgctx, stralloc *sa)
+/* one kind of named entries ({name} and its settings) in the config index */
+struct config_section {
+    stralloc text;
+    struct config_entry {
+        unsigned long long hash;
+        size_t offset;
+    } *entry;
+    size_t entries;
+    size_t alloc;
+};
+
+/* the normalised lines of the rc file, collected while it is parsed */
+struct config_compiler {
+    stralloc common;
+    struct config_section users;
+    struct config_section projects;
+};
+
+static int add_entry( struct config_section *sec, const char *name, size_t len )
+{
+    if ( sec->entries == sec->alloc ) {
+        size_t n = sec->alloc?sec->alloc*2:64;
+        struct config_entry *e = realloc(sec->entry, n*sizeof(struct config_entry));
+        if ( !e ) {
+            carpsys("realloc");
+            return -1;
+        }
+        sec->entry = e;
+        sec->alloc = n;
+    }
+    sec->entry[sec->entries].hash = hash_buf(hash_str(""), name, len);
+    sec->entry[sec->entries].offset = sec->text.len;
+    sec->entries++;
+    return 0;
+}
+
+/*
+ * users and projects go to their own sections so they can be looked up by
+ * name, everything else ([General], [Groups]) is always loaded
+ */
+static int compile_line( struct config_compiler *cc, unsigned short active, const char *line, size_t len )
+{
+    struct config_section *sec = NULL;
+    stralloc *sa = &cc->common;
+
+    if ( line[0] == '[' ) {
+        if ( str_equal(line, "[User]") || str_equal(line, "[Projects]") )
+            return 0;
+    } else if ( active & (1 << USERCTX) )
+        sec = &cc->users;
+    else if ( active & (1 << PROJECTCTX) )
+        sec = &cc->projects;
+    if ( sec ) {
+        sa = &sec->text;
+        if ( len > 2 && line[0] == '{' && line[len-1] == '}' && add_entry(sec, line+1, len-2) )
+            return -1;
+    }
+    if ( !stralloc_catb(sa, line, len) || !stralloc_append(sa, "\n") ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    return 0;
+}
+
+static void free_compiler( struct config_compiler *cc )
+{
+    stralloc_free(&cc->common);
+    stralloc_free(&cc->users.text);
+    stralloc_free(&cc->projects.text);
+    free(cc->users.entry);
+    free(cc->projects.entry);
+}
+
+static int parse_line(struct config_context *cfgctx, stralloc *sa, struct config_compiler *cc)
 {
     size_t numspace=0;
     int ret=0;
@@ -143,6 +267,8 @@ static int parse_line(struct config_context *cfgctx, stralloc *sa)
     line[numspace]=0;
 
     if (!numspace) return 0;
+    if ( cc && compile_line(cc, cfgctx->active_context, line, numspace) )
+        return -1;
 
     if (str_equal(line, "[General]")) {
         cfgctx->active_context = (1 << GENERALCTX);
@@ -153,6 +279,9 @@ static int parse_line(struct config_context *cfgctx, stralloc *sa)
     else if (str_equal(line, "[Projects]")) {
         cfgctx->active_context = (1 << PROJECTCTX);
     }
+    else if (str_equal(line, "[Groups]")) {
+        cfgctx->active_context = (1 << GROUPCTX);
+    }
     else if ( (cfgctx->active_context ) &&  numspace>2 \
             && line[0]=='{' && line[numspace-1]=='}') {
         //chop the brackets
@@ -172,14 +301,40 @@ static int parse_line(struct config_context *cfgctx, stralloc *sa)
         if ( cfgctx->active_context & (1 << PROJECTCTX) )
             if ( 0>prepare_new_project(cfgctx, name) )
                 return -1;
+
+        if ( cfgctx->active_context & (1 << GROUPCTX) )
+            if ( 0>prepare_new_group(cfgctx, name) )
+                return -1;
     }
 #define  if_ctx_value(__scope,__param) if ( (cfgctx->active_context & (1 << __scope)) &&  str_start(line, __param"=" ) )
     else if_ctx_value(GENERALCTX, "user") { ret=get_string_value( &(cfgctx->general.user), line+sizeof("user")); }
     else if_ctx_value(GENERALCTX, "password") { ret=get_string_value( &(cfgctx->general.password), line+sizeof("password")); }
     else if_ctx_value(GENERALCTX, "public_holidays") { ret=get_string_value( &(cfgctx->general.public_holidays), line+sizeof("public_holidays")); }
-    else if_ctx_value(USERCTX, "cal") { ret=get_string_value( &(cfgctx->last_user->cal), line+sizeof("cal")); }
+    else if_ctx_value(GENERALCTX, "holiday_rules") { ret=get_string_value( &(cfgctx->general.holiday_rules), line+sizeof("holiday_rules")); }
+    else if_ctx_value(GENERALCTX, "trace") { ret=get_string_value( &(cfgctx->general.trace), line+sizeof("trace")); }
+    else if_ctx_value(GENERALCTX, "metrics") { ret=get_string_value( &(cfgctx->general.metrics), line+sizeof("metrics")); }
+    else if_ctx_value(GENERALCTX, "format") { ret=get_string_value( &(cfgctx->general.format), line+sizeof("format")); }
+    else if_ctx_value(GENERALCTX, "sync_dir") { ret=get_string_value( &(cfgctx->general.sync_dir), line+sizeof("sync_dir")); }
+    else if_ctx_value(GENERALCTX, "cache_dir") { ret=get_string_value( &(cfgctx->general.cache_dir), line+sizeof("cache_dir")); }
+    else if_ctx_value(GENERALCTX, "ca_file") { ret=get_string_value( &(cfgctx->general.ca_file), line+sizeof("ca_file")); }
+    else if_ctx_value(GENERALCTX, "holiday_cache_days") { ret=(scan_ushort( line+sizeof("holiday_cache_days"), &cfgctx->general.holiday_cache_days )?0:-1); }
+    else if_ctx_value(GENERALCTX, "dns_ttl") { ret=(scan_ushort( line+sizeof("dns_ttl"), &cfgctx->general.dns_ttl )?0:-1); }
+    else if_ctx_value(GENERALCTX, "connect_timeout") { ret=(scan_ushort( line+sizeof("connect_timeout"), &cfgctx->general.connect_timeout )?0:-1); }
+    else if_ctx_value(GENERALCTX, "tls_timeout") { ret=(scan_ushort( line+sizeof("tls_timeout"), &cfgctx->general.tls_timeout )?0:-1); }
+    else if_ctx_value(GENERALCTX, "first_byte_timeout") { ret=(scan_ushort( line+sizeof("first_byte_timeout"), &cfgctx->general.first_byte_timeout )?0:-1); }
+    else if_ctx_value(GENERALCTX, "total_timeout") { ret=(scan_ushort( line+sizeof("total_timeout"), &cfgctx->general.total_timeout )?0:-1); }
+    else if_ctx_value(GENERALCTX, "pipeline") { ret=(scan_ushort( line+sizeof("pipeline"), &cfgctx->general.pipeline )?0:-1); }
+    else if_ctx_value(GENERALCTX, "parse_threads") { ret=(scan_ushort( line+sizeof("parse_threads"), &cfgctx->general.parse_threads )?0:-1); }
+    else if_ctx_value(USERCTX, "cal") { ret=add_cal_values( cfgctx->last_user, line+sizeof("cal")); }
     else if_ctx_value(USERCTX, "vacation") { ret=(scan_ushort( line+sizeof("vacation"), &cfgctx->last_user->vacation )?0:-1); }
     else if_ctx_value(USERCTX, "monthhours") { ret=(scan_ushort( line+sizeof("monthhours"), &cfgctx->last_user->monthhours )?0:-1); }
+    else if_ctx_value(USERCTX, "caldav") { ret=(scan_ushort( line+sizeof("caldav"), &cfgctx->last_user->caldav )?0:-1); }
+    else if_ctx_value(USERCTX, "sync") { ret=(scan_ushort( line+sizeof("sync"), &cfgctx->last_user->sync )?0:-1); }
+    else if_ctx_value(USERCTX, "group") { ret=get_string_value( &(cfgctx->last_user->group), line+sizeof("group")); }
+    else if_ctx_value(USERCTX, "public_holidays") { ret=get_string_value( &(cfgctx->last_user->public_holidays), line+sizeof("public_holidays")); }
+    else if_ctx_value(GROUPCTX, "public_holidays") { ret=get_string_value( &(cfgctx->last_group->public_holidays), line+sizeof("public_holidays")); }
+    else if_ctx_value(USERCTX, "holiday_rules") { ret=get_string_value( &(cfgctx->last_user->holiday_rules), line+sizeof("holiday_rules")); }
+    else if_ctx_value(GROUPCTX, "holiday_rules") { ret=get_string_value( &(cfgctx->last_group->holiday_rules), line+sizeof("holiday_rules")); }
     else if_ctx_value(PROJECTCTX, "onsite" ) { ret=get_float_as_centiushort( &cfgctx->last_project->onsite, line+sizeof("onsite") ); }
     else if_ctx_value(PROJECTCTX, "remote" ) { ret=get_float_as_centiushort( &cfgctx->last_project->remote, line+sizeof("remote") ); }
     else {
@@ -189,18 +344,270 @@ static int parse_line(struct config_context *cfgctx, stralloc *sa)
     return ret;
 }
 
+/* identifies the rc file the index was compiled from */
+static int cat_stamp( stralloc *sa, const struct stat *st )
+{
+    return stralloc_catulong0(sa, st->st_dev, 0) && stralloc_append(sa, " ") &&
+        stralloc_catulong0(sa, st->st_ino, 0) && stralloc_append(sa, " ") &&
+        stralloc_catulong0(sa, st->st_size, 0) && stralloc_append(sa, " ") &&
+        stralloc_catulong0(sa, st->st_mtim.tv_sec, 0) && stralloc_append(sa, ".") &&
+        stralloc_catulong0(sa, st->st_mtim.tv_nsec, 9) && stralloc_append(sa, "\n");
+}
+
+static int cat_field( stralloc *sa, unsigned long long v, const char *sep )
+{
+    char f[FMT_HASH];
+
+    return stralloc_catb(sa, f, fmt_hash(f, v)) && stralloc_cats(sa, sep);
+}
+
+/* a power of two with at least every other slot free */
+static size_t index_slots( size_t entries )
+{
+    size_t n;
+
+    for (n=2; n < 2*entries; n<<=1)
+        ;
+    return n;
+}
+
+/* open addressing, the entries in file order so the first of two equal names wins */
+static void fill_slots( unsigned long long *slot, size_t slots, const struct config_section *sec, size_t base )
+{
+    size_t i, j;
+
+    for (i=0; i<sec->entries; ++i) {
+        for (j=sec->entry[i].hash&(slots-1); slot[j]; j=(j+1)&(slots-1))
+            ;
+        slot[j] = base+sec->entry[i].offset;
+    }
+}
+
+/*
+ * the compiled rc file: stamp of the rc file, sizes and offsets, the hash
+ * slots of users and projects (offset of the {name} line or 0), then the
+ * normalised lines. The index gets the permissions of the rc file, it
+ * holds the same passwords.
+ */
+static int save_config_index( const struct config_compiler *cc, const char *file, const struct stat *st )
+{
+    size_t uslots=index_slots(cc->users.entries), pslots=index_slots(cc->projects.entries);
+    size_t users, projects, end, i;
+    unsigned long long *slot;
+    stralloc sa;
+    int ret=-1;
+
+    stralloc_init(&sa);
+    if ( !(slot = calloc(uslots+pslots, sizeof(unsigned long long))) ) {
+        carpsys("calloc");
+        return -1;
+    }
+    if ( !stralloc_copys(&sa, CONFIG_INDEX_MAGIC) || !cat_stamp(&sa, st) ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    users = sa.len + 5*INDEX_FIELD + (uslots+pslots)*INDEX_FIELD + cc->common.len;
+    projects = users + (sizeof(INDEX_USERS)-1) + cc->users.text.len;
+    end = projects + (sizeof(INDEX_PROJECTS)-1) + cc->projects.text.len;
+    fill_slots(slot, uslots, &cc->users, users+(sizeof(INDEX_USERS)-1));
+    fill_slots(slot+uslots, pslots, &cc->projects, projects+(sizeof(INDEX_PROJECTS)-1));
+    if ( !cat_field(&sa, uslots, " ") || !cat_field(&sa, pslots, " ") || !cat_field(&sa, users, " ") ||
+            !cat_field(&sa, projects, " ") || !cat_field(&sa, end, "\n") ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    for (i=0; i<uslots+pslots; ++i)
+        if ( !cat_field(&sa, slot[i], "\n") ) {
+            carpsys("stralloc");
+            goto out;
+        }
+    if ( !stralloc_cat(&sa, &cc->common) ||
+            !stralloc_cats(&sa, INDEX_USERS) || !stralloc_cat(&sa, &cc->users.text) ||
+            !stralloc_cats(&sa, INDEX_PROJECTS) || !stralloc_cat(&sa, &cc->projects.text) ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    ret = write_file_atomic_mode(file, sa.s, sa.len, st->st_mode & 0777);
+out:
+    free(slot);
+    stralloc_free(&sa);
+    return ret;
+}
+
+/* hands the lines between p and end to parse_line */
+static int feed_lines( struct config_context *cfgctx, const char *p, const char *end )
+{
+    stralloc line;
+    size_t n;
+    int ret=0;
+
+    stralloc_init(&line);
+    for (; p < end; p += n+1) {
+        n = byte_chr(p, end-p, '\n');
+        if ( !stralloc_copyb(&line, p, n) || !stralloc_0(&line) ) {
+            carpsys("stralloc");
+            ret = -1;
+            break;
+        }
+        line.len--;
+        if ( 0>parse_line(cfgctx, &line, NULL) ) {
+            ret = -1;
+            break;
+        }
+    }
+    stralloc_free(&line);
+    return ret;
+}
+
+struct config_index {
+    const char *map;
+    size_t size;
+    const char *slot;
+    size_t uslots, pslots;
+    const char *common, *users, *projects, *end;
+};
+
+static int scan_field( const char *p, unsigned long long *v, char sep )
+{
+    return FMT_HASH == scan_xlonglong(p, v) && p[FMT_HASH] == sep;
+}
+
+/*
+ * the entry name in the slots of a section: its {name} line up to the next
+ * entry, NULL if it is not there (or the slot points somewhere odd)
+ */
+static const char *find_entry( const struct config_index *ci, const char *slot, size_t slots,
+        const char *begin, const char *end, const char *name, const char **entry_end )
+{
+    size_t n = str_len(name), i, probes;
+    unsigned long long h = hash_buf(hash_str(""), name, n), off;
+    const char *p;
+
+    for (i=h&(slots-1), probes=0; probes < slots; i=(i+1)&(slots-1), ++probes) {
+        if ( !scan_field(slot+i*INDEX_FIELD, &off, '\n') || !off )
+            return NULL;
+        p = ci->map+off;
+        if ( p < begin || p >= end )
+            return NULL;
+        if ( (size_t)(end-p) > n+2 && p[0] == '{' && !memcmp(p+1, name, n) && p[n+1] == '}' && p[n+2] == '\n' ) {
+            const char *q = p+n+3;
+            while ( q < end && *q != '{' )
+                q += byte_chr(q, end-q, '\n')+1;
+            *entry_end = q;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* all entries of a section, or only the one asked for */
+static int load_section( struct config_context *cfgctx, const struct config_index *ci, const char *header,
+        const char *slot, size_t slots, const char *begin, const char *end, const char *name )
+{
+    const char *p, *q;
+
+    if ( feed_lines(cfgctx, header, begin) )
+        return -1;
+    if ( !name )
+        return feed_lines(cfgctx, begin, end);
+    if ( !(p = find_entry(ci, slot, slots, begin, end, name, &q)) )
+        return 0;
+    return feed_lines(cfgctx, p, q);
+}
+
+/*
+ * takes the config from the index when it was compiled from this very rc
+ * file, then only the selected user and project are loaded (all of them
+ * without a selection or for -U/-P): 0 if it was used, 1 if not, -1 on
+ * errors in the config itself
+ */
+static int load_config_index( struct config_context *cfgctx, const char *file, const struct stat *st )
+{
+    struct program_args *pa = &cfgctx->prog_arg;
+    struct config_index ci;
+    unsigned long long v[5];
+    const char *p;
+    stralloc stamp;
+    size_t n, i;
+    int ret=1;
+
+    memset(&ci, 0, sizeof(ci));
+    stralloc_init(&stamp);
+    if ( !(ci.map = mmap_read(file, &ci.size)) ) {
+        if ( errno != ENOENT )
+            carpsys(file);
+        return 1;
+    }
+    p = ci.map;
+    ci.end = ci.map+ci.size;
+    n = str_len(CONFIG_INDEX_MAGIC);
+    if ( ci.size < n || memcmp(p, CONFIG_INDEX_MAGIC, n) )
+        goto corrupt;
+    p += n;
+    if ( !stralloc_copys(&stamp, "") || !cat_stamp(&stamp, st) ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    if ( (size_t)(ci.end-p) < stamp.len || memcmp(p, stamp.s, stamp.len) ) {
+        V(1,carp("config index is out of date: ", file));
+        goto out;
+    }
+    p += stamp.len;
+    if ( ci.end-p < 5*INDEX_FIELD )
+        goto corrupt;
+    for (i=0; i<5; ++i)
+        if ( !scan_field(p+i*INDEX_FIELD, v+i, i<4?' ':'\n') )
+            goto corrupt;
+    p += 5*INDEX_FIELD;
+    ci.uslots = v[0];
+    ci.pslots = v[1];
+    if ( !ci.uslots || (ci.uslots & (ci.uslots-1)) || ci.uslots > ci.size ||
+            !ci.pslots || (ci.pslots & (ci.pslots-1)) || ci.pslots > ci.size ||
+            v[4] != ci.size || v[2] > v[3] || v[3] > v[4] ||
+            (size_t)(ci.end-p)/INDEX_FIELD < ci.uslots+ci.pslots )
+        goto corrupt;
+    ci.slot = p;
+    ci.common = p+(ci.uslots+ci.pslots)*INDEX_FIELD;
+    ci.users = ci.map+v[2];
+    ci.projects = ci.map+v[3];
+    if ( ci.users < ci.common ||
+            (size_t)(ci.projects-ci.users) < (sizeof(INDEX_USERS)-1) || memcmp(ci.users, INDEX_USERS, sizeof(INDEX_USERS)-1) ||
+            (size_t)(ci.end-ci.projects) < (sizeof(INDEX_PROJECTS)-1) || memcmp(ci.projects, INDEX_PROJECTS, sizeof(INDEX_PROJECTS)-1) )
+        goto corrupt;
+
+    ret = -1;
+    if ( feed_lines(cfgctx, ci.common, ci.users) ||
+            load_section(cfgctx, &ci, ci.users, ci.slot, ci.uslots, ci.users+sizeof(INDEX_USERS)-1, ci.projects,
+                pa->show_user?NULL:pa->user) ||
+            load_section(cfgctx, &ci, ci.projects, ci.slot+ci.uslots*INDEX_FIELD, ci.pslots, ci.projects+sizeof(INDEX_PROJECTS)-1, ci.end,
+                pa->show_project?NULL:pa->project) )
+        goto out;
+    V(1,carp("config from index: ", file));
+    ret = 0;
+    goto out;
+corrupt:
+    carp("ignoring damaged config index: ", file);
+out:
+    stralloc_free(&stamp);
+    mmap_unmap(ci.map, ci.size);
+    return ret;
+}
+
 int parse_config( struct config_context *cfgctx )
 {
-    char *rcfile = NULL;
+    char *rcfile = NULL, *index = NULL;
     int f=0, ret=0;
     buffer b;
     char buf[1024];
-    size_t l;
+    size_t l, i;
     struct user_context *user;
     struct project_context *project;
+    struct config_compiler cc;
+    struct stat st;
     stralloc line;
 
     stralloc_init(&line);
+    memset(&cc, 0, sizeof(cc));
 
     rcfile = get_rc_file();
     if (!rcfile) { ret=-1; goto cleanup; }
@@ -212,18 +619,59 @@ int parse_config( struct config_context *cfgctx )
         ret=-1;
         goto cleanup;
     }
+    if ( fstat(f, &st) ) {
+        carpsys(rcfile);
+        ret=-1;
+        goto cleanup;
+    }
 
-    buffer_init(&b,read,f,buf,1024);
-    for (;;) {
-        stralloc_zero(&line);
-        l=buffer_getline_sa(&b,&line);
-        if (0>l)
-            carpsys("buffer_getline_sa");
-        if (0>=l)
-            break;
-        stralloc_chomp(&line);
+    if ( !cat_stamp(&line, &st) || !stralloc_0(&line) ) {
+        carpsys("stralloc");
+        ret=-1;
+        goto cleanup;
+    }
+    cfgctx->fingerprint = hash_str(line.s);
 
-        if (0>parse_line(cfgctx, &line)) { ret=-1; goto cleanup; }
+    /* <rcfile>.idx, compiled on the first run after each change of the rc file */
+    if ( !(index = calloc(str_len(rcfile)+sizeof(CONFIG_INDEX_SUFFIX), sizeof(char))) ) {
+        carpsys("calloc");
+        ret=-1;
+        goto cleanup;
+    }
+    fmt_str(index+fmt_str(index, rcfile), CONFIG_INDEX_SUFFIX);
+    if ( 0>(ret = load_config_index(cfgctx, index, &st)) )
+        goto cleanup;
+
+    if ( ret ) {
+        ret = 0;
+        buffer_init(&b,read,f,buf,1024);
+        for (;;) {
+            stralloc_zero(&line);
+            l=buffer_getline_sa(&b,&line);
+            if (0>l)
+                carpsys("buffer_getline_sa");
+            if (0>=l)
+                break;
+            stralloc_chomp(&line);
+
+            if (0>parse_line(cfgctx, &line, &cc)) { ret=-1; goto cleanup; }
+        }
+        if ( save_config_index(&cc, index, &st) )
+            carp("failed to save config index: ", index);
+    }
+
+    for_each_user(cfgctx, user) {
+        struct group_context *group;
+        if (!user->group)
+            continue;
+        for_each_group(cfgctx, group)
+            if (str_equal(group->name, user->group))
+                break;
+        if (!group) {
+            carp("unknown group ", user->group, " of user ", user->name);
+            ret=-1;
+            goto cleanup;
+        }
     }
 
     V(1,
@@ -234,8 +682,15 @@ int parse_config( struct config_context *cfgctx )
             buffer_putlong(buffer_2,user->vacation);
             buffer_puts(buffer_2,"\thours: ");
             buffer_putlong(buffer_2,user->monthhours);
-            buffer_puts(buffer_2,"\tcal: ");
-            buffer_puts(buffer_2,user->cal);
+            buffer_puts(buffer_2,"\tcal:");
+            for_each_cal(user, i) {
+                buffer_puts(buffer_2," ");
+                buffer_puts(buffer_2,user->cal[i]);
+            }
+            buffer_puts(buffer_2,"\tpublic_holidays: ");
+            buffer_puts(buffer_2,get_public_holidays(cfgctx, user)?get_public_holidays(cfgctx, user):"-");
+            buffer_puts(buffer_2,"\tholiday_rules: ");
+            buffer_puts(buffer_2,get_holiday_rules(cfgctx, user)?get_holiday_rules(cfgctx, user):"-");
             buffer_putnlflush(buffer_2);
         }
 
@@ -255,13 +710,114 @@ int parse_config( struct config_context *cfgctx )
 
 cleanup:
     stralloc_free(&line);
+    free_compiler(&cc);
     if (rcfile) free(rcfile);
+    if (index) free(index);
     if (0 < f) close(f);
     return ret;
 }
 
+/* the holiday calendar of a user: own one, the one of the group, the global one */
+const char *get_public_holidays( const struct config_context *c, const struct user_context *u )
+{
+    const struct group_context *g;
+
+    if ( u && u->public_holidays )
+        return u->public_holidays;
+    if ( u && u->group )
+        for_each_group(c, g)
+            if ( str_equal(g->name, u->group) && g->public_holidays )
+                return g->public_holidays;
+    return c->general.public_holidays;
+}
+
+/* the built-in holiday rules of a user, looked up the same way */
+const char *get_holiday_rules( const struct config_context *c, const struct user_context *u )
+{
+    const struct group_context *g;
+
+    if ( u && u->holiday_rules )
+        return u->holiday_rules;
+    if ( u && u->group )
+        for_each_group(c, g)
+            if ( str_equal(g->name, u->group) && g->holiday_rules )
+                return g->holiday_rules;
+    return c->general.holiday_rules;
+}
+
+void free_config( struct config_context *c )
+{
+    struct user_context *u, *tu;
+    struct project_context *p, *tp;
+    struct group_context *g, *tg;
+    size_t i;
+
+    if (c->general.user) free(c->general.user);
+    if (c->general.password) free(c->general.password);
+    if (c->general.public_holidays) free(c->general.public_holidays);
+    if (c->general.holiday_rules) free(c->general.holiday_rules);
+    if (c->general.trace) free(c->general.trace);
+    if (c->general.metrics) free(c->general.metrics);
+    if (c->general.format) free(c->general.format);
+    if (c->general.sync_dir) free(c->general.sync_dir);
+    if (c->general.cache_dir) free(c->general.cache_dir);
+    if (c->general.ca_file) free(c->general.ca_file);
+    for (u=c->first_user; u;) {
+        if (u->name) free(u->name);
+        for_each_cal(u, i)
+            free(u->cal[i]);
+        if (u->cal) free(u->cal);
+        if (u->group) free(u->group);
+        if (u->public_holidays) free(u->public_holidays);
+        if (u->holiday_rules) free(u->holiday_rules);
+        tu=u->next_user;
+        free(u);
+        u=tu;
+    }
+    for (p=c->first_project; p;) {
+        if (p->name) free(p->name);
+        tp=p->next_project;
+        free(p);
+        p=tp;
+    }
+    for (g=c->first_group; g;) {
+        if (g->name) free(g->name);
+        if (g->public_holidays) free(g->public_holidays);
+        if (g->holiday_rules) free(g->holiday_rules);
+        tg=g->next_group;
+        free(g);
+        g=tg;
+    }
+}
+
 #ifdef UNITTEST
 #include <assert.h>
+#include <string.h>
+#include <utime.h>
+
+#define RC "[General]\n user = x\n password = secret\n ca_file = /tmp/ca.pem\n metrics = /tmp/m.prom\n[Groups]\n{south}\npublic_holidays=south.ics\nholiday_rules=de-by\n"\
+    "[User]\n{alice}\ncal = http://a/work, http://a/travel\nvacation = 30\ncal=,http://a/oncall,\n{bob}\ncal=http://b\ngroup=south\nmonthhours=160\n"\
+    "[Projects]\n{p1}\nonsite=100.5\n{p2}\nremote=80\n[User]\n"
+
+static size_t count_users( const struct config_context *c )
+{
+    const struct user_context *u;
+    size_t n=0;
+
+    for_each_user(c, u)
+        n++;
+    return n;
+}
+
+static void load( struct config_context *c, char *user, char *project, bool all )
+{
+    free_config(c);
+    memset(c, 0, sizeof(*c));
+    c->prog_arg.user = user;
+    c->prog_arg.project = project;
+    c->prog_arg.show_user = all;
+    assert(0==parse_config(c));
+}
 
 char *PROGNAME;
 int main(int argc, char *argv[])
@@ -278,6 +834,94 @@ int main(int argc, char *argv[])
     assert(100==v);
     assert(0==get_float_as_centiushort(&v, "12.234"));
     assert(1223==v);
+
+    /* the index, compiled on the first run and after changes of the rc file */
+    char dir[] = "/tmp/config-XXXXXX", *index;
+    struct config_context cfg;
+    struct utimbuf old = { 1000000000, 1000000000 };
+    struct stat st;
+    stralloc sa;
+    int fd;
+
+    assert(mkdtemp(dir));
+    setenv("HOME", dir, 1);
+    free(rcfile);
+    rcfile = get_rc_file();
+    stralloc_init(&sa);
+    stralloc_copys(&sa, RC);
+    for (p=0; p<100; ++p) {
+        stralloc_cats(&sa, "{u");
+        stralloc_catulong0(&sa, p, 0);
+        stralloc_cats(&sa, "}\ncal=http://u\n");
+    }
+    assert(-1!=(fd=open_trunc(rcfile)) && sa.len==(size_t)write(fd, sa.s, sa.len) && 0==close(fd));
+    assert(0==chmod(rcfile, 0600) && 0==utime(rcfile, &old));
+    assert((index = calloc(str_len(rcfile)+sizeof(CONFIG_INDEX_SUFFIX), 1)));
+    fmt_str(index+fmt_str(index, rcfile), CONFIG_INDEX_SUFFIX);
+
+    memset(&cfg, 0, sizeof(cfg));
+    load(&cfg, NULL, NULL, false);
+    assert(count_users(&cfg)==102);
+    assert(0==stat(index, &st) && (st.st_mode & 0777)==0600);
+
+    load(&cfg, "bob", NULL, false);
+    assert(count_users(&cfg)==1 && str_equal(cfg.first_user->name, "bob"));
+    assert(cfg.first_user->cals==1 && str_equal(cfg.first_user->cal[0], "http://b") && cfg.first_user->monthhours==160);
+    assert(str_equal(get_public_holidays(&cfg, cfg.first_user), "south.ics"));
+    assert(str_equal(get_holiday_rules(&cfg, cfg.first_user), "de-by"));
+    assert(str_equal(cfg.general.password, "secret") && str_equal(cfg.general.ca_file, "/tmp/ca.pem") &&
+            str_equal(cfg.general.metrics, "/tmp/m.prom"));
+    assert(cfg.first_project && cfg.first_project->onsite==10050 && cfg.last_project->remote==8000);
+
+    load(&cfg, "u57", "p2", false);
+    assert(count_users(&cfg)==1 && str_equal(cfg.first_user->name, "u57"));
+    assert(cfg.first_project==cfg.last_project && str_equal(cfg.first_project->name, "p2"));
+    load(&cfg, "nobody", "none", false);
+    assert(!cfg.first_user && !cfg.first_project);
+    load(&cfg, "bob", NULL, true);
+    assert(count_users(&cfg)==102 && str_equal(cfg.first_user->name, "alice"));
+
+    /* a changed rc file is parsed again, a damaged index ignored */
+    assert(-1!=(fd=open_append(rcfile)) && 12==write(fd, "{carol}\ncal=\n", 12) && 0==close(fd));
+    load(&cfg, "carol", NULL, false);
+    assert(count_users(&cfg)==103);
+    load(&cfg, "carol", NULL, false);
+    assert(count_users(&cfg)==1);
+    assert(0==truncate(index, 300));
+    load(&cfg, "alice", NULL, false);
+    assert(count_users(&cfg)==103);
+    load(&cfg, "alice", NULL, false);
+    assert(count_users(&cfg)==1 && cfg.first_user->vacation==30);
+    /* calendars from both cal= lines, in order */
+    assert(cfg.first_user->cals==3 && str_equal(cfg.first_user->cal[1], "http://a/travel") &&
+            str_equal(cfg.first_user->cal[2], "http://a/oncall"));
+    load(&cfg, "carol", NULL, false);
+    assert(count_users(&cfg)==1 && !cfg.first_user->cals);
+    free_config(&cfg);
+
+    unlink(index);
+    unlink(rcfile);
+    rmdir(dir);
+    free(index);
+    free(rcfile);
+    stralloc_free(&sa);
+
+    struct config_context c;
+    struct group_context g = { "south", "south.ics", "de-by", NULL };
+    struct user_context u = { .name="u" };
+    memset(&c, 0, sizeof(c));
+    assert(!get_public_holidays(&c, &u));
+    c.general.public_holidays = "global.ics";
+    c.first_group = &g;
+    assert(str_equal(get_public_holidays(&c, NULL), "global.ics"));
+    assert(str_equal(get_public_holidays(&c, &u), "global.ics"));
+    u.group = "south";
+    assert(str_equal(get_public_holidays(&c, &u), "south.ics"));
+    u.public_holidays = "own.ics";
+    assert(str_equal(get_public_holidays(&c, &u), "own.ics"));
+    assert(str_equal(get_holiday_rules(&c, &u), "de-by"));
+    u.group = NULL;
+    assert(!get_holiday_rules(&c, &u));
     return 0;
 }
 #endif
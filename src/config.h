@@ -8,7 +8,8 @@ void set_config_verbosity( short );
 enum config_flags {
     GENERALCTX,
     USERCTX,
-    PROJECTCTX
+    PROJECTCTX,
+    GROUPCTX
 };
 
 struct program_args {
@@ -17,21 +18,46 @@ struct program_args {
     char *user;
     char *project;
     char *format;
+    char *trace;
+    char *metrics; // node_exporter textfile written at the end of the run
     bool show_user;
     bool show_project;
+    bool summary; // only the sums, added up while the calendars are parsed
+    bool grouped; // a year with the subtotals of each month after its rows
 };
 
 struct general_context {
     char *user;
     char *password;
     char *public_holidays;
+    char *holiday_rules; // region of the built-in holiday rules
+    char *trace;
+    char *metrics;
+    char *format; // template file used when no -o is given
+    char *sync_dir;
+    char *cache_dir;
+    char *ca_file; // PEM file of the CAs trusted for https, instead of those of the system
+    unsigned short holiday_cache_days;
+    unsigned short dns_ttl;
+    unsigned short connect_timeout;
+    unsigned short tls_timeout;
+    unsigned short first_byte_timeout;
+    unsigned short total_timeout;
+    unsigned short parse_threads;
+    unsigned short pipeline;
 };
 
 struct user_context {
     char *name;
-    char *cal;
+    char **cal; // the calendars of the user, from one or more cal= lines separated by commas
+    size_t cals;
     unsigned short vacation;
     unsigned short monthhours;
+    unsigned short caldav;
+    unsigned short sync;
+    char *group;
+    char *public_holidays;
+    char *holiday_rules; // region of the built-in holiday rules
     struct user_context *next_user;
 };
 
@@ -42,17 +68,32 @@ struct project_context {
     struct project_context *next_project;
 };
 
+/* settings shared by the users of a group, e.g. the region they work in */
+struct group_context {
+    char *name;
+    char *public_holidays;
+    char *holiday_rules; // region of the built-in holiday rules
+    struct group_context *next_group;
+};
+
 struct config_context {
     struct program_args prog_arg;
     struct general_context general;
     struct user_context *first_user, *last_user;
     struct project_context *first_project, *last_project;
+    struct group_context *first_group, *last_group;
     unsigned short active_context;
+    unsigned long long fingerprint; // of the rc file, changes with each edit
 };
 
 #define for_each_user(__cfgctx,__user) for (__user=(__cfgctx)->first_user; (__user); (__user)=(__user)->next_user)
 #define for_each_project(__cfgctx,__project) for (__project=(__cfgctx)->first_project; (__project); (__project)=(__project)->next_project)
+#define for_each_cal(__user,__i) for (__i=0; (__i)<(__user)->cals; ++(__i))
+#define for_each_group(__cfgctx,__group) for (__group=(__cfgctx)->first_group; (__group); (__group)=(__group)->next_group)
 
 extern char *PROGNAME;
 int parse_config( struct config_context * );
+void free_config( struct config_context * );
+const char *get_public_holidays( const struct config_context *, const struct user_context * );
+const char *get_holiday_rules( const struct config_context *, const struct user_context * );
 #endif
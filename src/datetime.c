@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <str.h>
+#include <scan.h>
+#include "datetime.h"
+
+/*
+ * calendar arithmetic on day numbers (days since 1970-01-01) in the proleptic
+ * gregorian calendar, see http://howardhinnant.github.io/date_algorithms.html
+ */
+
+long days_from_civil( long y, unsigned m, unsigned d )
+{
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y-399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153*(m > 2 ? m-3 : m+9) + 2)/5 + d-1;
+    unsigned doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + (long)doe - 719468;
+}
+
+void civil_from_days( long z, long *y, unsigned *m, unsigned *d )
+{
+    z += 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);
+    unsigned mp = (5*doy + 2)/153;
+    *d = doy - (153*mp+2)/5 + 1;
+    *m = mp < 10 ? mp+3 : mp-9;
+    *y = (long)yoe + era * 400 + (*m <= 2);
+}
+
+/* 0 = sunday, like tm_wday */
+int weekday_from_days( long z )
+{
+    return (int)(((z % 7) + 11) % 7);
+}
+
+unsigned days_in_month( long y, unsigned m )
+{
+    static const unsigned char dim[]={ 31,28,31,30,31,30,31,31,30,31,30,31 };
+    if ( m == 2 && (y%4 == 0) && ((y%100 != 0) || (y%400 == 0)) )
+        return 29;
+    return dim[m-1];
+}
+
+/* day number and seconds of that day to a timestamp, either in UTC or local time */
+time_t civil_to_time( long day, long tod, bool utc )
+{
+    struct tm t;
+    long y;
+    unsigned m, d;
+
+    if ( utc )
+        return (time_t)day*SECONDS_PER_DAY + tod;
+
+    civil_from_days(day, &y, &m, &d);
+    memset(&t, 0, sizeof(struct tm));
+    t.tm_year = (int)(y-1900);
+    t.tm_mon = (int)m-1;
+    t.tm_mday = (int)d;
+    t.tm_hour = (int)(tod/3600);
+    t.tm_min = (int)(tod/60%60);
+    t.tm_sec = (int)(tod%60);
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+void time_to_civil( time_t ts, bool utc, long *day, long *tod )
+{
+    struct tm t;
+
+    if ( utc ) {
+        *day = (long)(ts/SECONDS_PER_DAY);
+        *tod = (long)(ts%SECONDS_PER_DAY);
+        if ( *tod < 0 ) { *tod += SECONDS_PER_DAY; (*day)--; }
+        return;
+    }
+    localtime_r(&ts, &t);
+    *day = days_from_civil(t.tm_year+1900, t.tm_mon+1, t.tm_mday);
+    *tod = t.tm_hour*3600 + t.tm_min*60 + t.tm_sec;
+}
+
+/*
+ * yyyymmdd[Thhmmss[Z]] to the day number and the seconds of that day as
+ * written, -1 if it is no date. utc (if given) tells if there was a Z.
+ */
+int datetime_scan( const char *ts, bool dayevent, long *day, long *tod, bool *utc )
+{
+    unsigned long y, m, d, hh=0, mm=0, ss=0;
+    size_t len=str_len(ts);
+    bool z=false;
+
+    if ( len < (sizeof("yyyymmdd")-1) )
+        return -1;
+    scan_ulongn(ts, 4, &y);
+    scan_ulongn(ts+4, 2, &m);
+    scan_ulongn(ts+6, 2, &d);
+    if ( m < 1 || m > 12 || d < 1 || d > 31 )
+        return -1;
+
+    if ( ! dayevent && len >= (sizeof("yyyymmddThhmmss")-1) && ts[8] == 'T' ) {
+        scan_ulongn(ts+9, 2, &hh);
+        scan_ulongn(ts+11, 2, &mm);
+        scan_ulongn(ts+13, 2, &ss);
+        z = (ts[15] == 'Z');
+    }
+    if ( utc )
+        *utc = z;
+    *day = days_from_civil(y, m, d);
+    *tod = hh*3600+mm*60+ss;
+    return 0;
+}
+
+/*
+ * yyyymmdd[Thhmmss[Z]] to a timestamp. Dates and floating times are taken
+ * as local time, a trailing Z means UTC. utc (if given) tells which one it was.
+ */
+time_t datetime_parse( const char *ts, bool dayevent, bool *utc )
+{
+    long day, tod;
+    bool z;
+
+    if ( datetime_scan(ts, dayevent, &day, &tod, &z) )
+        return -1;
+    if ( utc )
+        *utc = z;
+    return civil_to_time(day, tod, z);
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+int main( int argc, char *argv[] )
+{
+    long y, day, tod;
+    unsigned m, d;
+    bool utc;
+
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    assert(0==days_from_civil(1970, 1, 1));
+    assert(18262==days_from_civil(2020, 1, 1));
+    civil_from_days(18262+59, &y, &m, &d);
+    assert(y==2020 && m==2 && d==29);
+    assert(4==weekday_from_days(0));
+    assert(3==weekday_from_days(18262));
+    assert(3==weekday_from_days(-1));
+    assert(29==days_in_month(2000, 2));
+    assert(28==days_in_month(1900, 2));
+
+    assert((10*60*60)==datetime_parse("19700101T100000Z", false, &utc));
+    assert(utc);
+    assert((10*60*60)==datetime_parse("19700101T100000", false, &utc));
+    assert(!utc);
+    assert(0==datetime_parse("19700101T100000Z", true, NULL));
+    assert(-1==datetime_parse("1970", false, NULL));
+    assert(0==datetime_scan("20200301T013000", false, &day, &tod, &utc) && day==18262+60 && tod==5400 && !utc);
+
+    time_to_civil(-1, true, &day, &tod);
+    assert(day==-1 && tod==SECONDS_PER_DAY-1);
+    assert(civil_to_time(18262, 3600, false)==civil_to_time(18262, 3600, true));
+
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,16 @@
+#ifndef DATETIME_H
+#define DATETIME_H
+#include <stdbool.h>
+#include <time.h>
+
+#define SECONDS_PER_DAY (24*60*60)
+
+long days_from_civil( long, unsigned, unsigned );
+void civil_from_days( long, long *, unsigned *, unsigned * );
+int weekday_from_days( long );
+unsigned days_in_month( long, unsigned );
+time_t civil_to_time( long, long, bool );
+void time_to_civil( time_t, bool, long *, long * );
+int datetime_scan( const char *, bool, long *, long *, bool * );
+time_t datetime_parse( const char *, bool, bool * );
+#endif
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errmsg.h>
+#include "dedup.h"
+
+void init_dedup_set( struct dedup_set *d )
+{
+    memset(d, 0, sizeof(struct dedup_set));
+}
+
+void free_dedup_set( struct dedup_set *d )
+{
+    free(d->slot);
+    memset(d, 0, sizeof(struct dedup_set));
+}
+
+/* the keys are hashes already, their low bits pick the slot */
+static uint64_t *probe( const struct dedup_set *d, uint64_t key )
+{
+    size_t mask = d->slots-1, h = key & mask;
+
+    while ( d->slot[h] && d->slot[h] != key )
+        h = (h+1) & mask;
+    return &d->slot[h];
+}
+
+static int grow( struct dedup_set *d )
+{
+    struct dedup_set old = *d;
+    size_t i;
+
+    d->slots = old.slots?old.slots*2:256;
+    if ( !(d->slot = calloc(d->slots, sizeof(uint64_t))) ) {
+        carpsys("calloc");
+        *d = old;
+        return -1;
+    }
+    for (i=0; i<old.slots; ++i)
+        if ( old.slot[i] )
+            *probe(d, old.slot[i]) = old.slot[i];
+    free(old.slot);
+    return 0;
+}
+
+/* 1 if key was added before, else it is added and 0; -1 if out of memory */
+int dedup_seen( struct dedup_set *d, uint64_t key )
+{
+    uint64_t *slot;
+
+    if ( !key )
+        key = 1;
+    if ( (d->len+1)*2 > d->slots && grow(d) )
+        return -1;
+    slot = probe(d, key);
+    if ( *slot )
+        return 1;
+    *slot = key;
+    d->len++;
+    return 0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+int main( int argc, char *argv[] )
+{
+    struct dedup_set d;
+    uint64_t k;
+
+    init_dedup_set(&d);
+    assert(0==dedup_seen(&d, 42) && 1==dedup_seen(&d, 42));
+    /* 0 is taken as 1 */
+    assert(0==dedup_seen(&d, 0) && 1==dedup_seen(&d, 1) && d.len==2);
+
+    /* colliding slots and growing */
+    for (k=1; k<=2000; ++k)
+        assert(0==dedup_seen(&d, k<<32));
+    assert(d.len==2002 && d.slots>=2*d.len);
+    for (k=1; k<=2000; ++k)
+        assert(1==dedup_seen(&d, k<<32));
+    assert(1==dedup_seen(&d, 42));
+
+    free_dedup_set(&d);
+    assert(!d.slot && !d.len);
+    exit(EXIT_SUCCESS);
+}
+#endif
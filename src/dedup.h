@@ -0,0 +1,16 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* 64 bit keys of the events seen so far, open addressing, 0 marks a free slot */
+struct dedup_set {
+    uint64_t *slot;
+    size_t slots;
+    size_t len;
+};
+
+void init_dedup_set( struct dedup_set * );
+void free_dedup_set( struct dedup_set * );
+int dedup_seen( struct dedup_set *, uint64_t );
+#endif
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
+#include <buffer.h>
+#include <errmsg.h>
+#include <str.h>
+#include "dns.h"
+
+void init_dns_cache( struct dns_cache *dc, unsigned short ttl )
+{
+    memset(dc, 0, sizeof(struct dns_cache));
+    dc->ttl = ttl?ttl:DNS_DEFAULT_TTL;
+#ifndef NOTHREADS
+    pthread_mutex_init(&dc->lock, NULL);
+#endif
+}
+
+static void free_dns_entry( struct dns_entry *e )
+{
+    if (e->hostname) free(e->hostname);
+    if (e->service) free(e->service);
+    if (e->addr_list) freeaddrinfo(e->addr_list);
+    free(e);
+}
+
+void free_dns_cache( struct dns_cache *dc )
+{
+    struct dns_entry *e, *next;
+
+    for (e=dc->first_entry; e; e=next) {
+        next=e->next_entry;
+        free_dns_entry(e);
+    }
+    for (e=dc->retired; e; e=next) {
+        next=e->next_entry;
+        free_dns_entry(e);
+    }
+    dc->first_entry=dc->retired=NULL;
+#ifndef NOTHREADS
+    pthread_mutex_destroy(&dc->lock);
+#endif
+}
+
+#ifndef NOTHREADS
+static unsigned long long now_ms( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+#endif
+
+static int resolve_now( const char *hostname, const char *service, struct addrinfo **res, int *err )
+{
+    struct addrinfo hints;
+    int r;
+
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    r = getaddrinfo( hostname, service, &hints, res );
+    *err = errno;
+    return r;
+}
+
+#ifndef NOTHREADS
+/*
+ * one getaddrinfo on a thread of its own, as it has no timeout. If the
+ * waiter gives up, the thread is left behind and frees the query when the
+ * resolver returns; whoever of the two is last frees it.
+ */
+struct dns_query {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    char *hostname, *service;
+    struct addrinfo *result;
+    int gai_result, err;
+    bool done, abandoned;
+};
+
+static void free_dns_query( struct dns_query *q )
+{
+    if ( q->result ) freeaddrinfo(q->result);
+    pthread_cond_destroy(&q->done_cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q->hostname);
+    free(q->service);
+    free(q);
+}
+
+static void *resolve_thread( void *arg )
+{
+    struct dns_query *q = arg;
+    struct addrinfo *res=NULL;
+    int r, err;
+    bool abandoned;
+
+    r = resolve_now( q->hostname, q->service, &res, &err );
+    pthread_mutex_lock(&q->lock);
+    q->result = r?NULL:res;
+    q->gai_result = r;
+    q->err = err;
+    q->done = true;
+    abandoned = q->abandoned;
+    pthread_cond_signal(&q->done_cond);
+    pthread_mutex_unlock(&q->lock);
+    if ( abandoned )
+        free_dns_query(q);
+    return NULL;
+}
+#endif
+
+/*
+ * getaddrinfo, given up at deadline (ms of CLOCK_MONOTONIC, 0: none): 1 on
+ * timeout, else 0 with its result in gai_result
+ */
+static int resolve( const char *hostname, const char *service, unsigned long long deadline,
+        struct addrinfo **res, int *gai_result, int *err )
+{
+#ifndef NOTHREADS
+    struct dns_query *q;
+    pthread_condattr_t attr;
+    pthread_t thread;
+    struct timespec ts;
+    bool done;
+
+    if ( !deadline ) {
+        *gai_result = resolve_now( hostname, service, res, err );
+        return 0;
+    }
+    if ( now_ms() >= deadline )
+        return 1;
+    if ( !(q=calloc(1, sizeof(struct dns_query))) ||
+            !(q->hostname=strdup(hostname)) || !(q->service=strdup(service)) ) {
+        if ( q ) {
+            free(q->hostname);
+            free(q);
+        }
+        *gai_result = EAI_MEMORY;
+        return 0;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if ( pthread_create(&thread, NULL, resolve_thread, q) ) {
+        free_dns_query(q);
+        *gai_result = resolve_now( hostname, service, res, err );
+        return 0;
+    }
+    pthread_detach(thread);
+
+    ts.tv_sec = deadline/1000;
+    ts.tv_nsec = (deadline%1000)*1000000;
+    pthread_mutex_lock(&q->lock);
+    while ( !q->done && pthread_cond_timedwait(&q->done_cond, &q->lock, &ts) != ETIMEDOUT )
+        ;
+    done = q->done;
+    q->abandoned = !done;
+    pthread_mutex_unlock(&q->lock);
+    if ( !done )
+        return 1;
+    *res = q->result;
+    *gai_result = q->gai_result;
+    *err = q->err;
+    q->result = NULL;
+    free_dns_query(q);
+    return 0;
+#else
+    /* without threads there is nothing to bound the resolver with */
+    (void)deadline;
+    *gai_result = resolve_now( hostname, service, res, err );
+    return 0;
+#endif
+}
+
+static int lookup( struct dns_cache *dc, const char *hostname, const char *service, unsigned long long deadline,
+        const struct addrinfo **addr_list )
+{
+    struct dns_entry *e, **prev;
+    time_t now = time(NULL);
+    int gai_result, err;
+
+    for (prev=&dc->first_entry; (e=*prev); prev=&e->next_entry) {
+        if ( !str_equal(e->hostname, hostname) || !str_equal(e->service, service) )
+            continue;
+        if ( e->expires > now ) {
+            dc->hits++;
+            *addr_list = e->addr_list;
+            return 0;
+        }
+        *prev = e->next_entry;
+        e->next_entry = dc->retired;
+        dc->retired = e;
+        break;
+    }
+    dc->misses++;
+
+    if ( !(e=calloc(1, sizeof(struct dns_entry))) ||
+            !(e->hostname=strdup(hostname)) || !(e->service=strdup(service)) ) {
+        carpsys("calloc");
+        if ( e ) free_dns_entry(e);
+        return -1;
+    }
+
+    if ( resolve( hostname, service, deadline, &e->addr_list, &gai_result, &err ) ) {
+        carp("timeout while resolving ", hostname);
+        e->addr_list = NULL;
+        free_dns_entry(e);
+        return -1;
+    }
+    if ( gai_result ) {
+        buffer_puts(buffer_2, "getaddrinfo: ");
+        buffer_puts(buffer_2, hostname);
+        buffer_puts(buffer_2, ": ");
+        buffer_puts(buffer_2, (gai_result == EAI_SYSTEM)?strerror(err):gai_strerror(gai_result));
+        buffer_putnlflush(buffer_2);
+        e->addr_list = NULL;
+        free_dns_entry(e);
+        return -1;
+    }
+    e->expires = now + dc->ttl;
+    e->next_entry = dc->first_entry;
+    dc->first_entry = e;
+    *addr_list = e->addr_list;
+    return 0;
+}
+
+/*
+ * addresses of hostname/service, resolved at most once per ttl and given up
+ * at deadline (ms of CLOCK_MONOTONIC, 0: none). The list belongs to the
+ * cache and stays valid until the cache is freed. Threads looking up at the
+ * same time wait for each other, so a host is resolved once for all of them.
+ */
+int dns_lookup( struct dns_cache *dc, const char *hostname, const char *service, unsigned long long deadline,
+        const struct addrinfo **addr_list )
+{
+    int ret;
+
+#ifndef NOTHREADS
+    pthread_mutex_lock(&dc->lock);
+#endif
+    ret = lookup(dc, hostname, service, deadline, addr_list);
+#ifndef NOTHREADS
+    pthread_mutex_unlock(&dc->lock);
+#endif
+    return ret;
+}
+
+/*
+ * order for connection attempts as of RFC 8305 section 4: address families
+ * interleaved, starting with the family the resolver preferred
+ */
+size_t dns_sort_addresses( const struct addrinfo *addr_list, const struct addrinfo **out, size_t max )
+{
+    const struct addrinfo *ai, *first[DNS_MAX_ADDRESSES], *second[DNS_MAX_ADDRESSES];
+    size_t nfirst=0, nsecond=0, i=0, j=0, n=0;
+
+    if ( !addr_list )
+        return 0;
+    for (ai=addr_list; ai; ai=ai->ai_next) {
+        if ( ai->ai_family == addr_list->ai_family ) {
+            if ( nfirst < DNS_MAX_ADDRESSES ) first[nfirst++] = ai;
+        } else if ( nsecond < DNS_MAX_ADDRESSES )
+            second[nsecond++] = ai;
+    }
+    while ( n < max && (i < nfirst || j < nsecond) ) {
+        if ( i < nfirst ) out[n++] = first[i++];
+        if ( n < max && j < nsecond ) out[n++] = second[j++];
+    }
+    return n;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+int main( int argc, char *argv[] )
+{
+    struct dns_cache dc;
+    const struct addrinfo *a, *b, *sorted[4];
+    struct addrinfo ai[4];
+    size_t n;
+
+    init_dns_cache(&dc, 0);
+    assert(dc.ttl==DNS_DEFAULT_TTL);
+    assert(0==dns_lookup(&dc, "127.0.0.1", "http", 0, &a));
+    assert(0==dns_lookup(&dc, "127.0.0.1", "http", 0, &b));
+    assert(a==b && dc.hits==1 && dc.misses==1);
+    assert(0==dns_lookup(&dc, "127.0.0.1", "https", now_ms()+5000, &b));
+    assert(a!=b && dc.misses==2);
+    dc.first_entry->expires=0;
+    a=b;
+    assert(0==dns_lookup(&dc, "127.0.0.1", "https", 0, &b));
+    assert(dc.misses==3);
+    /* whoever still connects to the expired addresses can go on */
+    assert(dc.retired && dc.retired->addr_list==a && !dc.retired->next_entry);
+    /* past the deadline nothing is resolved any more, a cached entry still counts */
+    assert(-1==dns_lookup(&dc, "::1", "http", 1, &b));
+    assert(0==dns_lookup(&dc, "127.0.0.1", "https", 1, &b) && dc.hits==2);
+    free_dns_cache(&dc);
+
+    memset(ai, 0, sizeof(ai));
+    ai[0].ai_family=AF_INET6; ai[0].ai_next=&ai[1];
+    ai[1].ai_family=AF_INET6; ai[1].ai_next=&ai[2];
+    ai[2].ai_family=AF_INET6; ai[2].ai_next=&ai[3];
+    ai[3].ai_family=AF_INET;
+    n = dns_sort_addresses(ai, sorted, 4);
+    assert(n==4 && sorted[0]==&ai[0] && sorted[1]==&ai[3] && sorted[2]==&ai[1] && sorted[3]==&ai[2]);
+    assert(2==dns_sort_addresses(ai, sorted, 2));
+
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,41 @@
+#ifndef DNS_H
+#define DNS_H
+#include <time.h>
+#include <netdb.h>
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
+
+/* seconds a resolved host is reused when no dns_ttl is configured */
+#define DNS_DEFAULT_TTL 60
+/* addresses tried per host at most */
+#define DNS_MAX_ADDRESSES 16
+
+struct dns_entry {
+    char *hostname;
+    char *service;
+    struct addrinfo *addr_list;
+    time_t expires;
+    struct dns_entry *next_entry;
+};
+
+/*
+ * resolved addresses per host and service, shared by all fetches of a run,
+ * also from several threads. Expired entries are retired, not freed, as
+ * another fetch may still be connecting to their addresses.
+ */
+struct dns_cache {
+    unsigned short ttl;
+    unsigned long hits, misses;
+    struct dns_entry *first_entry;
+    struct dns_entry *retired;
+#ifndef NOTHREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+void init_dns_cache( struct dns_cache *, unsigned short );
+void free_dns_cache( struct dns_cache * );
+int dns_lookup( struct dns_cache *, const char *, const char *, unsigned long long, const struct addrinfo ** );
+size_t dns_sort_addresses( const struct addrinfo *, const struct addrinfo **, size_t );
+#endif
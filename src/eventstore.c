@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errmsg.h>
+#include <str.h>
+#include "hash.h"
+#include "eventstore.h"
+
+void init_event_store( struct event_store *es )
+{
+    memset(es, 0, sizeof(struct event_store));
+    es->subjects.copy = true;
+}
+
+static void free_string_table( struct string_table *t )
+{
+    size_t i;
+
+    if ( t->copy )
+        for (i=1; i<t->len; ++i)
+            free((char *)t->str[i]);
+    free(t->str);
+    free(t->data);
+    free(t->slot);
+}
+
+void free_event_store( struct event_store *es )
+{
+    free(es->start);
+    free(es->end);
+    free(es->flags);
+    free(es->user);
+    free(es->subject);
+    free_string_table(&es->users);
+    free_string_table(&es->subjects);
+    memset(es, 0, sizeof(struct event_store));
+}
+
+/* minutes since the epoch, seconds are cut off, out of range is clamped */
+uint32_t event_minutes( time_t t )
+{
+    if ( t <= 0 )
+        return 0;
+    if ( t/60 > UINT32_MAX )
+        return UINT32_MAX;
+    return t/60;
+}
+
+static uint32_t *probe( struct string_table *t, const char *s )
+{
+    size_t mask = t->slots-1, h = hash_str(s) & mask;
+
+    while ( t->slot[h] && !str_equal(t->str[t->slot[h]], s) )
+        h = (h+1) & mask;
+    return &t->slot[h];
+}
+
+static int grow_slots( struct string_table *t )
+{
+    uint32_t *old = t->slot;
+    size_t i, n = t->slots;
+
+    t->slots = n?n*2:64;
+    if ( !(t->slot = calloc(t->slots, sizeof(uint32_t))) ) {
+        carpsys("calloc");
+        t->slot = old;
+        t->slots = n;
+        return -1;
+    }
+    for (i=1; i<t->len; ++i)
+        *probe(t, t->str[i]) = i;
+    free(old);
+    return 0;
+}
+
+/* id of s, added with data if it is new */
+static int intern( struct string_table *t, const char *s, const void *data, uint32_t *id )
+{
+    uint32_t *slot;
+
+    if ( !s ) {
+        *id = 0;
+        return 0;
+    }
+    /* the entries of one user come in a row and share the pointer */
+    if ( t->last && t->str[t->last] == s ) {
+        *id = t->last;
+        return 0;
+    }
+    if ( (t->len+1)*2 > t->slots && grow_slots(t) )
+        return -1;
+    slot = probe(t, s);
+    if ( *slot ) {
+        *id = t->last = *slot;
+        return 0;
+    }
+    if ( t->len+1 >= t->alloc ) {
+        size_t n = t->alloc?t->alloc*2:64;
+        const char **str = realloc(t->str, n*sizeof(char *));
+        const void **d = str?realloc(t->data, n*sizeof(void *)):NULL;
+        if ( str )
+            t->str = str;
+        if ( !d ) {
+            carpsys("realloc");
+            return -1;
+        }
+        t->data = d;
+        t->alloc = n;
+    }
+    if ( !t->len ) {
+        t->str[0] = NULL;
+        t->data[0] = NULL;
+        t->len = 1;
+    }
+    if ( t->copy && !(s = strdup(s)) ) {
+        carpsys("strdup");
+        return -1;
+    }
+    t->str[t->len] = s;
+    t->data[t->len] = data;
+    *id = *slot = t->last = t->len++;
+    return 0;
+}
+
+static int grow_columns( struct event_store *es )
+{
+    size_t n = es->alloc?es->alloc*2:256;
+    void *p;
+
+#define GROW(__col) \
+    if ( !(p = realloc(es->__col, n*sizeof(*es->__col))) ) { \
+        carpsys("realloc"); \
+        return -1; \
+    } \
+    es->__col = p;
+    GROW(start)
+    GROW(end)
+    GROW(flags)
+    GROW(user)
+    GROW(subject)
+#undef GROW
+    es->alloc = n;
+    return 0;
+}
+
+/* the events go, the ids stay valid */
+void clear_event_store( struct event_store *es )
+{
+    es->len = 0;
+}
+
+/* id of a subject, for event_store_add */
+int event_store_subject( struct event_store *es, const char *subject, uint32_t *id )
+{
+    return intern(&es->subjects, subject, NULL, id);
+}
+
+int event_store_add( struct event_store *es, const char *user, const struct holiday_table *holidays,
+        uint32_t subject, time_t start, time_t end, uint8_t flags )
+{
+    uint32_t u;
+
+    if ( es->len == es->alloc && grow_columns(es) )
+        return -1;
+    if ( intern(&es->users, user, holidays, &u) )
+        return -1;
+    es->start[es->len] = event_minutes(start);
+    es->end[es->len] = event_minutes(end);
+    es->flags[es->len] = flags;
+    es->user[es->len] = u;
+    es->subject[es->len] = subject;
+    es->len++;
+    return 0;
+}
+
+/*
+ * centihours of the timed events clipped to [begin,end), per event cut off
+ * the same way as the timeline. Branch free and only masks of the flags, so
+ * the loop is vectorized even at -O2.
+ */
+__attribute__((optimize("tree-vectorize")))
+void event_store_worksums( const struct event_store *es, time_t begin, time_t end, long *onsite_ch, long *remote_ch )
+{
+    const uint32_t *restrict s = es->start, *restrict e = es->end;
+    const uint8_t *restrict f = es->flags;
+    uint32_t b = event_minutes(begin), n = event_minutes(end);
+    uint64_t onsite=0, remote=0;
+    size_t i, len = es->len;
+
+    for (i=0; i<len; ++i) {
+        uint32_t from = (s[i]>b)?s[i]:b, to = (e[i]<n)?e[i]:n;
+        uint32_t ch = ((to>from)?to-from:0)*5/3;
+        uint32_t on = -(uint32_t)(!!(f[i]&EVENT_ONSITE)), day = -(uint32_t)(!!(f[i]&EVENT_DAYEVENT));
+        ch &= ~day;
+        onsite += ch & on;
+        remote += ch & ~on;
+    }
+    *onsite_ch += onsite;
+    *remote_ch += remote;
+}
+
+/*
+ * the same sums per period in one pass, the periods are the n ranges between
+ * the n+1 ascending times of bound; an event is cut at their boundaries
+ */
+void event_store_periodsums( const struct event_store *es, const time_t *bound, size_t n,
+        long *onsite_ch, long *remote_ch )
+{
+    uint32_t from, to, ch;
+    size_t i, k;
+
+    for (i=0; i<es->len; ++i) {
+        if ( (es->flags[i] & EVENT_DAYEVENT) || es->end[i] <= event_minutes(bound[0]) ||
+                es->start[i] >= event_minutes(bound[n]) )
+            continue;
+        for (k=0; k<n && event_minutes(bound[k+1]) <= es->start[i]; ++k)
+            ;
+        for (; k<n && event_minutes(bound[k]) < es->end[i]; ++k) {
+            from = event_minutes(bound[k]);
+            to = event_minutes(bound[k+1]);
+            if ( es->start[i] > from )
+                from = es->start[i];
+            if ( es->end[i] < to )
+                to = es->end[i];
+            ch = (to-from)*5/3;
+            if ( es->flags[i] & EVENT_ONSITE )
+                onsite_ch[k] += ch;
+            else
+                remote_ch[k] += ch;
+        }
+    }
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <fmt.h>
+
+int main( int argc, char *argv[] )
+{
+    struct event_store es;
+    char name[16];
+    long onsite=0, remote=0;
+    uint32_t a, b;
+    int i;
+
+    init_event_store(&es);
+    assert(event_minutes(-1)==0 && event_minutes(119)==1);
+
+    /* ids are shared, NULL is id 0 */
+    assert(0==event_store_subject(&es, "project a", &a) && 0==event_store_subject(&es, NULL, &b) && !b);
+    assert(0==event_store_add(&es, "foo", (const struct holiday_table *)&es, a, 3600, 7200, EVENT_ONSITE));
+    assert(0==event_store_add(&es, "bar", NULL, b, 0, 86400, EVENT_DAYEVENT));
+    assert(0==event_store_subject(&es, "project a", &b) && a==b);
+    assert(0==event_store_add(&es, "foo", NULL, b, 7200, 9000, 0));
+    assert(es.len==3 && es.users.len==3 && es.subjects.len==2);
+    assert(es.user[0]==es.user[2] && es.subject[0]==es.subject[2] && !es.subject[1]);
+    assert(str_equal(event_user(&es, 2), "foo") && event_holidays(&es, 2)==(void *)&es);
+    assert(!event_subject(&es, 1) && event_end(&es, 1)==86400);
+
+    /* clipped to the window, the day event does not count */
+    event_store_worksums(&es, 0, 8100, &onsite, &remote);
+    assert(onsite==100 && remote==25);
+
+    /* lots of subjects, the table grows */
+    for (i=0; i<1000; ++i) {
+        name[fmt_ulong(name, i)] = '\0';
+        assert(0==event_store_subject(&es, name, &a));
+        assert(0==event_store_add(&es, "foo", NULL, a, 0, 60, 0));
+    }
+    assert(es.len==1003 && es.subjects.len==1002 && str_equal(event_subject(&es, 1002), "999"));
+    onsite=remote=0;
+    event_store_worksums(&es, 0, 86400, &onsite, &remote);
+    assert(onsite==100 && remote==50+1000);
+
+    /* cut at the period boundaries */
+    {
+        time_t bound[] = { 0, 5400, 86400 };
+        long on[2]={0,0}, re[2]={0,0};
+
+        assert(0==event_store_add(&es, "foo", NULL, 0, 86400-3600, 86400+3600, EVENT_ONSITE));
+        event_store_periodsums(&es, bound, 2, on, re);
+        assert(on[0]==50 && on[1]==50+100 && re[0]==1000 && re[1]==50);
+    }
+
+    /* the ids outlive the events */
+    clear_event_store(&es);
+    assert(!es.len && 0==event_store_subject(&es, "999", &b) && a==b);
+
+    free_event_store(&es);
+    exit(EXIT_SUCCESS);
+}
+#endif
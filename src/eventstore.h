@@ -0,0 +1,58 @@
+#ifndef EVENTSTORE_H
+#define EVENTSTORE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* bits in event_store.flags */
+#define EVENT_DAYEVENT 0x01
+#define EVENT_ONSITE   0x02
+
+struct holiday_table;
+
+/* strings by id, id 0 is NULL; data is an optional pointer kept per id */
+struct string_table {
+    const char **str;
+    const void **data;
+    size_t len;
+    size_t alloc;
+    uint32_t *slot; // open addressing, 0: free, else the id
+    size_t slots;
+    uint32_t last; // id of the last lookup
+    bool copy; // strdup the strings, else they have to outlive the table
+};
+
+/*
+ * the events of a report in columns, so the aggregation only touches the
+ * arrays it needs: start/end in minutes since the epoch, the EVENT_* bits
+ * and the ids of user and subject
+ */
+struct event_store {
+    size_t len;
+    size_t alloc;
+    uint32_t *start;
+    uint32_t *end;
+    uint8_t *flags;
+    uint32_t *user;
+    uint32_t *subject;
+    struct string_table users; // data: the holiday table of the user
+    struct string_table subjects;
+};
+
+#define event_start(__es,__i) ((time_t)(__es)->start[__i]*60)
+#define event_end(__es,__i) ((time_t)(__es)->end[__i]*60)
+#define string_by_id(__t,__id) ((__id)?(__t)->str[__id]:NULL)
+#define event_user(__es,__i) string_by_id(&(__es)->users, (__es)->user[__i])
+#define event_subject(__es,__i) string_by_id(&(__es)->subjects, (__es)->subject[__i])
+#define event_holidays(__es,__i) ((const struct holiday_table *)(__es)->users.data[(__es)->user[__i]])
+
+void init_event_store( struct event_store * );
+void free_event_store( struct event_store * );
+uint32_t event_minutes( time_t );
+void clear_event_store( struct event_store * );
+int event_store_subject( struct event_store *, const char *, uint32_t * );
+int event_store_add( struct event_store *, const char *, const struct holiday_table *, uint32_t, time_t, time_t, uint8_t );
+void event_store_worksums( const struct event_store *, time_t, time_t, long *, long * );
+void event_store_periodsums( const struct event_store *, const time_t *, size_t, long *, long * );
+#endif
@@ -4,8 +4,7 @@
 #include <buffer.h>
 #include <fmt.h>
 #include <stralloc.h>
-#include "formats/text.h"
-#include "formats/html.h"
+#include "trace.h"
 
 #define DECSEP ","
 #define CURSYM "€"
@@ -14,14 +13,16 @@
 #define FMT_IND_HOURS(__o,__d) do { stralloc_catlong0(&__o,__d/100,2); stralloc_append(&__o,DECSEP); stralloc_catulong0(&__o,((__d<0)?-1:1)*__d%100,2); stralloc_append(&__o,"h"); } while(0);
 #define FMT_PRICE(__o,__p) do { stralloc_catlong(&__o,__p/100); stralloc_append(&__o,DECSEP); stralloc_catulong0(&__o,__p%100,2); stralloc_append(&__o,CURSYM); } while(0);
 
-extern struct stralloc output_line_sa;
-extern struct timeslotinfo tsi;
+struct report_context;
+struct template;
 
 struct formats {
     char *name;
-    void (*header)();
-    void (*timeline)();
-    void (*footer)();
+    void (*header)( struct report_context * );
+    void (*timeline)( struct report_context * );
+    void (*footer)( struct report_context * );
+    void (*project)( struct report_context * ); // one subject with its sums, in summary mode
+    void (*month)( struct report_context * ); // the subtotals of one month, in grouped mode
 };
 
 struct timeslotinfo {
@@ -47,7 +48,38 @@ struct timeslotinfo {
     long worksum_onsite_ch;
     long worksum_remote_ch;
     long worktbd_ch;
+    long project_onsite_ch;
+    long project_remote_ch;
     short centihourlyrate_onsite;
     short centihourlyrate_remote;
 };
+
+/*
+ * the sums of a year report per month, all added up before the first row so
+ * the section of a month can end as soon as its rows are out
+ */
+struct month_sums {
+    long onsite_ch[12];
+    long remote_ch[12];
+    short vacation[12]; // days
+    short next; // the first month whose subtotals are still to come
+    short monthhours; // of the user the report is limited to
+    unsigned short vday_hours;
+    short vacation_days; // per year, of that user
+};
+
+/* everything a formatter needs to render one report */
+struct report_context {
+    struct timeslotinfo tsi;
+    struct formats format;
+    struct template *tpl; // of a format loaded from a file, NULL for the built-in ones
+    struct month_sums *months; // grouped by month, else NULL
+    stralloc output_line_sa;
+    buffer *out;
+    struct trace_context *trace;
+    struct trace_slices output_slices;
+};
+
+#include "formats/text.h"
+#include "formats/html.h"
 #endif
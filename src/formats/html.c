@@ -1,19 +1,19 @@
 #include "../format.h"
 
-void html_header()
+void html_header( struct report_context *rep )
 {
-    if ( tsi.allyear ) {
-        buffer_puts(buffer_1, "1-12/");
+    if ( rep->tsi.allyear ) {
+        buffer_puts(rep->out, "1-12/");
     } else {
-        buffer_putlong(buffer_1, tsi.mon);
-        buffer_puts(buffer_1, "/");
+        buffer_putlong(rep->out, rep->tsi.mon);
+        buffer_puts(rep->out, "/");
     }
-    buffer_putlong(buffer_1, tsi.year);
-    if ( tsi.userlimit ) {
-        buffer_puts(buffer_1, "&nbsp;");
-        buffer_puts(buffer_1, tsi.user);
+    buffer_putlong(rep->out, rep->tsi.year);
+    if ( rep->tsi.userlimit ) {
+        buffer_puts(rep->out, "&nbsp;");
+        buffer_puts(rep->out, rep->tsi.user);
     }
-    buffer_putm(buffer_1, "\n",
+    buffer_putm(rep->out, "\n",
         "<table>\n\t<tr>\t",
         "<th>Date</th>",
         "<th>Starttime</th>",
@@ -21,55 +21,96 @@ void html_header()
         "<th>Duration</th>",
         "<th>Location</th>",
         "\t</tr>");
-    buffer_putnlflush(buffer_1);
+    buffer_putnlflush(rep->out);
 }
 
-void html_timeline()
+void html_timeline( struct report_context *rep )
 {
-    stralloc_zero(&output_line_sa);
-
-    stralloc_cats(&output_line_sa, "\t<tr>\t<td>");
-    FMT_DATE(output_line_sa, tsi.mday, tsi.mon);
-    stralloc_cats(&output_line_sa, "</td><td>");
-    FMT_TIME(output_line_sa, tsi.shour, tsi.smin);
-    stralloc_cats(&output_line_sa, "</td><td>");
-    FMT_TIME(output_line_sa, tsi.ehour, tsi.emin);
-    stralloc_cats(&output_line_sa, "</td><td>");
-    FMT_IND_HOURS(output_line_sa, tsi.workhours_ch);
-    if ( tsi.onsite ) {
-        stralloc_cats(&output_line_sa, "</td><td>onsite");
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_cats(&rep->output_line_sa, "\t<tr>\t<td>");
+    FMT_DATE(rep->output_line_sa, rep->tsi.mday, rep->tsi.mon);
+    stralloc_cats(&rep->output_line_sa, "</td><td>");
+    FMT_TIME(rep->output_line_sa, rep->tsi.shour, rep->tsi.smin);
+    stralloc_cats(&rep->output_line_sa, "</td><td>");
+    FMT_TIME(rep->output_line_sa, rep->tsi.ehour, rep->tsi.emin);
+    stralloc_cats(&rep->output_line_sa, "</td><td>");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.workhours_ch);
+    if ( rep->tsi.onsite ) {
+        stralloc_cats(&rep->output_line_sa, "</td><td>onsite");
     } else {
-        stralloc_cats(&output_line_sa, "</td><td>remote");
+        stralloc_cats(&rep->output_line_sa, "</td><td>remote");
+    }
+    stralloc_cats(&rep->output_line_sa, "</td>\t</tr>");
+
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
+}
+
+void html_project( struct report_context *rep )
+{
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_cats(&rep->output_line_sa, "\t<tr>\t<td colspan=\"3\">");
+    stralloc_cats(&rep->output_line_sa, rep->tsi.project?rep->tsi.project:"-");
+    stralloc_cats(&rep->output_line_sa, "</td><td>");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.project_onsite_ch);
+    stralloc_cats(&rep->output_line_sa, " onsite</td><td>");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.project_remote_ch);
+    stralloc_cats(&rep->output_line_sa, " remote</td>\t</tr>");
+
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
+}
+
+void html_month( struct report_context *rep )
+{
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_cats(&rep->output_line_sa, "\t<tr>\t<th colspan=\"5\">");
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.mon);
+    stralloc_append(&rep->output_line_sa, "/");
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.year);
+    stralloc_cats(&rep->output_line_sa, "&nbsp;Onsite: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_onsite_ch);
+    stralloc_cats(&rep->output_line_sa, "&nbsp;Remote: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_remote_ch);
+    if ( rep->tsi.userlimit ) {
+        stralloc_cats(&rep->output_line_sa, "&nbsp;worktime balance: ");
+        FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worktbd_ch);
+        stralloc_cats(&rep->output_line_sa, "&nbsp;vacation: ");
+        stralloc_catlong(&rep->output_line_sa, rep->tsi.vmonth);
+        stralloc_cats(&rep->output_line_sa, "days");
     }
-    stralloc_cats(&output_line_sa, "</td>\t</tr>");
+    stralloc_cats(&rep->output_line_sa, "</th>\t</tr>");
 
-    buffer_putsaflush(buffer_1, &output_line_sa);
-    buffer_putnlflush(buffer_1);
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
 }
 
-void html_footer()
+void html_footer( struct report_context *rep )
 {
-    stralloc_zero(&output_line_sa);
-
-    stralloc_catm(&output_line_sa, "\t<tr>\t<td colspan=\"5\">", "Onsite: ");
-    FMT_IND_HOURS(output_line_sa, tsi.worksum_onsite_ch);
-    stralloc_cats(&output_line_sa, "&nbsp;Remote: ");
-    FMT_IND_HOURS(output_line_sa, tsi.worksum_remote_ch);
-    stralloc_cats(&output_line_sa, "&nbsp;worktime balance: ");
-    FMT_IND_HOURS(output_line_sa, tsi.worktbd_ch);
-    stralloc_cats(&output_line_sa, "</td>\t</tr>");
-    buffer_putsaflush(buffer_1, &output_line_sa);
-    buffer_putnlflush(buffer_1);
-
-    stralloc_zero(&output_line_sa);
-
-    stralloc_catm(&output_line_sa, "\t<tr>\t<td colspan=\"5\">", "vacation: ");
-    stralloc_catlong(&output_line_sa, tsi.vmonth);
-    stralloc_cats(&output_line_sa, "days (left: ");
-    stralloc_catlong(&output_line_sa, tsi.vleft);
-    stralloc_catm(&output_line_sa, "days)", "</td>\t</tr>\n</table>");
-
-    buffer_putsaflush(buffer_1, &output_line_sa);
-    buffer_putnlflush(buffer_1);
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_catm(&rep->output_line_sa, "\t<tr>\t<td colspan=\"5\">", "Onsite: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_onsite_ch);
+    stralloc_cats(&rep->output_line_sa, "&nbsp;Remote: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_remote_ch);
+    stralloc_cats(&rep->output_line_sa, "&nbsp;worktime balance: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worktbd_ch);
+    stralloc_cats(&rep->output_line_sa, "</td>\t</tr>");
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
+
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_catm(&rep->output_line_sa, "\t<tr>\t<td colspan=\"5\">", "vacation: ");
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.vmonth);
+    stralloc_cats(&rep->output_line_sa, "days (left: ");
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.vleft);
+    stralloc_catm(&rep->output_line_sa, "days)", "</td>\t</tr>\n</table>");
+
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
 }
 
@@ -1,7 +1,9 @@
 #ifndef FORMAT_HTML_H
 #define FORMAT_HTML_H
 
-void html_header();
-void html_timeline();
-void html_footer();
+void html_header( struct report_context * );
+void html_timeline( struct report_context * );
+void html_footer( struct report_context * );
+void html_project( struct report_context * );
+void html_month( struct report_context * );
 #endif
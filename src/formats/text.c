@@ -1,78 +1,112 @@
 #include "../format.h"
 
-void text_header()
+void text_header( struct report_context *rep )
 {
-    if ( tsi.allyear ) {
-        buffer_puts(buffer_1, "1-12/");
+    if ( rep->tsi.allyear ) {
+        buffer_puts(rep->out, "1-12/");
     } else {
-        buffer_putlong(buffer_1, tsi.mon);
-        buffer_puts(buffer_1, "/");
+        buffer_putlong(rep->out, rep->tsi.mon);
+        buffer_puts(rep->out, "/");
     }
-    buffer_putlong(buffer_1, tsi.year);
-    if ( tsi.userlimit ) {
-        buffer_puts(buffer_1, "\t");
-        buffer_puts(buffer_1, tsi.user);
+    buffer_putlong(rep->out, rep->tsi.year);
+    if ( rep->tsi.userlimit ) {
+        buffer_puts(rep->out, "\t");
+        buffer_puts(rep->out, rep->tsi.user);
     }
-    if ( tsi.projectlimit ) {
-        buffer_puts(buffer_1, "\tProjekt ");
-        buffer_puts(buffer_1, tsi.project);
+    if ( rep->tsi.projectlimit ) {
+        buffer_puts(rep->out, "\tProjekt ");
+        buffer_puts(rep->out, rep->tsi.project);
     }
-    buffer_putnlflush(buffer_1);
+    buffer_putnlflush(rep->out);
 }
 
-void text_timeline()
+void text_timeline( struct report_context *rep )
 {
-    stralloc_zero(&output_line_sa);
+    stralloc_zero(&rep->output_line_sa);
 
-    FMT_DATE(output_line_sa, tsi.mday, tsi.mon);
-    stralloc_append(&output_line_sa, " ");
-    FMT_TIME(output_line_sa, tsi.shour, tsi.smin);
-    stralloc_cats(&output_line_sa, " -> ");
-    FMT_TIME(output_line_sa, tsi.ehour, tsi.emin);
-    stralloc_cats(&output_line_sa, " = ");
-    FMT_IND_HOURS(output_line_sa, tsi.workhours_ch);
-    if ( tsi.onsite )
-        stralloc_cats(&output_line_sa, " | onsite");
+    FMT_DATE(rep->output_line_sa, rep->tsi.mday, rep->tsi.mon);
+    stralloc_append(&rep->output_line_sa, " ");
+    FMT_TIME(rep->output_line_sa, rep->tsi.shour, rep->tsi.smin);
+    stralloc_cats(&rep->output_line_sa, " -> ");
+    FMT_TIME(rep->output_line_sa, rep->tsi.ehour, rep->tsi.emin);
+    stralloc_cats(&rep->output_line_sa, " = ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.workhours_ch);
+    if ( rep->tsi.onsite )
+        stralloc_cats(&rep->output_line_sa, " | onsite");
     else
-        stralloc_cats(&output_line_sa, " | remote");
-    if ( !tsi.userlimit )
-        stralloc_catm(&output_line_sa, " | ", tsi.user);
-    if ( !tsi.projectlimit )
-        stralloc_catm(&output_line_sa, " | ", tsi.project);
+        stralloc_cats(&rep->output_line_sa, " | remote");
+    if ( !rep->tsi.userlimit )
+        stralloc_catm(&rep->output_line_sa, " | ", rep->tsi.user);
+    if ( !rep->tsi.projectlimit )
+        stralloc_catm(&rep->output_line_sa, " | ", rep->tsi.project);
 
-    buffer_putsaflush(buffer_1, &output_line_sa);
-    buffer_putnlflush(buffer_1);
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
 }
 
-void text_footer()
+void text_project( struct report_context *rep )
 {
-    long r, o;
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_cats(&rep->output_line_sa, rep->tsi.project?rep->tsi.project:"-");
+    stralloc_cats(&rep->output_line_sa, ": onsite ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.project_onsite_ch);
+    stralloc_cats(&rep->output_line_sa, " | remote ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.project_remote_ch);
 
-    stralloc_zero(&output_line_sa);
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
+}
 
-    stralloc_cats(&output_line_sa, "Onsite: ");
-    FMT_IND_HOURS(output_line_sa, tsi.worksum_onsite_ch);
-    stralloc_cats(&output_line_sa, "\tRemote: ");
-    FMT_IND_HOURS(output_line_sa, tsi.worksum_remote_ch);
-    if ( tsi.projectlimit ) {
-        stralloc_cats(&output_line_sa, "\namount onsite => ");
-        o=(tsi.worksum_onsite_ch * tsi.centihourlyrate_onsite)/100;
-        FMT_PRICE(output_line_sa, o);
-        stralloc_cats(&output_line_sa, "\namount remote => ");
-        r=(tsi.worksum_remote_ch * tsi.centihourlyrate_remote)/100;
-        FMT_PRICE(output_line_sa, r);
-        stralloc_cats(&output_line_sa, "\namount sum => ");
+/* the sums in tsi, of the whole report or of one month */
+static void cat_sums( struct report_context *rep )
+{
+    long r, o;
+
+    stralloc_cats(&rep->output_line_sa, "Onsite: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_onsite_ch);
+    stralloc_cats(&rep->output_line_sa, "\tRemote: ");
+    FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worksum_remote_ch);
+    if ( rep->tsi.projectlimit ) {
+        stralloc_cats(&rep->output_line_sa, "\namount onsite => ");
+        o=(rep->tsi.worksum_onsite_ch * rep->tsi.centihourlyrate_onsite)/100;
+        FMT_PRICE(rep->output_line_sa, o);
+        stralloc_cats(&rep->output_line_sa, "\namount remote => ");
+        r=(rep->tsi.worksum_remote_ch * rep->tsi.centihourlyrate_remote)/100;
+        FMT_PRICE(rep->output_line_sa, r);
+        stralloc_cats(&rep->output_line_sa, "\namount sum => ");
         o+=r;
-        FMT_PRICE(output_line_sa, o);
-    } else if ( tsi.userlimit ) {
-        stralloc_cats(&output_line_sa, "\nworktime balance: ");
-        FMT_IND_HOURS(output_line_sa, tsi.worktbd_ch);
-        stralloc_cats(&output_line_sa, "\tvacation: ");
-        stralloc_catlong(&output_line_sa, tsi.vmonth);
-        stralloc_cats(&output_line_sa, "days (left: ");
-        stralloc_catlong(&output_line_sa, tsi.vleft);
-        stralloc_cats(&output_line_sa, "days)");
+        FMT_PRICE(rep->output_line_sa, o);
+    } else if ( rep->tsi.userlimit ) {
+        stralloc_cats(&rep->output_line_sa, "\nworktime balance: ");
+        FMT_IND_HOURS(rep->output_line_sa, rep->tsi.worktbd_ch);
+        stralloc_cats(&rep->output_line_sa, "\tvacation: ");
+        stralloc_catlong(&rep->output_line_sa, rep->tsi.vmonth);
+        stralloc_cats(&rep->output_line_sa, "days (left: ");
+        stralloc_catlong(&rep->output_line_sa, rep->tsi.vleft);
+        stralloc_cats(&rep->output_line_sa, "days)");
     }
-    buffer_putsaflush(buffer_1, &output_line_sa);
-    buffer_putnlflush(buffer_1);
+}
+
+void text_month( struct report_context *rep )
+{
+    stralloc_zero(&rep->output_line_sa);
+
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.mon);
+    stralloc_append(&rep->output_line_sa, "/");
+    stralloc_catlong(&rep->output_line_sa, rep->tsi.year);
+    stralloc_cats(&rep->output_line_sa, " subtotal\n");
+    cat_sums(rep);
+    stralloc_append(&rep->output_line_sa, "\n");
+
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
+}
+
+void text_footer( struct report_context *rep )
+{
+    stralloc_zero(&rep->output_line_sa);
+    cat_sums(rep);
+    buffer_putsaflush(rep->out, &rep->output_line_sa);
+    buffer_putnlflush(rep->out);
 }
@@ -1,7 +1,9 @@
 #ifndef FORMAT_TEXT_H
 #define FORMAT_TEXT_H
 
-void text_header();
-void text_timeline();
-void text_footer();
+void text_header( struct report_context * );
+void text_timeline( struct report_context * );
+void text_footer( struct report_context * );
+void text_project( struct report_context * );
+void text_month( struct report_context * );
 #endif
@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <errmsg.h>
+#include <str.h>
+#include "gzipout.h"
+
+#define V(__l,__fn) do{if(gzipout_verbosity>=__l){ __fn; }}while(0);
+short gzipout_verbosity=0;
+
+void set_gzipout_verbosity( short v ) {
+    gzipout_verbosity=v;
+}
+
+/* a quality of 0, 0.0, 0.00 or 0.000 refuses a coding (RFC 9110 12.4.2) */
+static bool refused( const char *p, size_t len )
+{
+    size_t i;
+
+    for (i=0; i+2<len; ++i)
+        if ( (p[i] == 'q' || p[i] == 'Q') && p[i+1] == '=' ) {
+            for (i+=2; i<len && (p[i] == '0' || p[i] == '.'); ++i)
+                ;
+            return i == len || p[i] == ' ' || p[i] == '\t' || p[i] == ';';
+        }
+    return false;
+}
+
+/* whether an Accept-Encoding header value (NULL: none) lets us send gzip */
+bool accepts_gzip( const char *ae )
+{
+    int gzip=-1, any=-1;
+    size_t n, t;
+
+#ifdef NOZLIB
+    return false;
+#endif
+    if ( !ae )
+        return false;
+    while ( *ae ) {
+        while ( *ae == ' ' || *ae == '\t' || *ae == ',' )
+            ae++;
+        n = str_chr(ae, ',');
+        for (t=0; t<n && ae[t] != ';' && ae[t] != ' ' && ae[t] != '\t'; ++t)
+            ;
+        if ( (t == 4 && !strncasecmp(ae, "gzip", 4)) || (t == 6 && !strncasecmp(ae, "x-gzip", 6)) )
+            gzip = !refused(ae+t, n-t);
+        else if ( t == 1 && *ae == '*' )
+            any = !refused(ae+t, n-t);
+        ae += n;
+    }
+    return (gzip >= 0)?gzip:(any > 0);
+}
+
+#ifndef NOZLIB
+/* deflates until zlib wants more input (or is done with Z_FINISH), writing what it produces */
+static int deflate_to( struct gzip_output *gz, int flush )
+{
+    size_t n, o;
+    ssize_t w;
+    int r;
+
+    do {
+        gz->z.next_out = (unsigned char *)gz->out;
+        gz->z.avail_out = sizeof(gz->out);
+        r = deflate(&gz->z, flush);
+        if ( r == Z_STREAM_ERROR ) {
+            carp("deflate failed");
+            return -1;
+        }
+        n = sizeof(gz->out)-gz->z.avail_out;
+        for (o=0; o<n; o+=w)
+            if ( 0 >= (w = write(gz->fd, gz->out+o, n-o)) ) {
+                if ( w < 0 && errno == EINTR ) {
+                    w = 0;
+                    continue;
+                }
+                carpsys("write");
+                return -1;
+            }
+    } while ( gz->z.avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END) );
+    return 0;
+}
+
+/* buffer op: everything the formatter flushes goes through deflate */
+static ssize_t gzip_write( int fd, const char *buf, size_t len, buffer *b )
+{
+    struct gzip_output *gz = b->cookie;
+
+    gz->z.next_in = (unsigned char *)buf;
+    gz->z.avail_in = len;
+    if ( deflate_to(gz, Z_NO_FLUSH) )
+        return -1;
+    V(3,
+        buffer_puts(buffer_2, "gzip: ");
+        buffer_putulong(buffer_2, gz->z.total_in);
+        buffer_puts(buffer_2, " -> ");
+        buffer_putulong(buffer_2, gz->z.total_out);
+        buffer_putnlflush(buffer_2);
+    );
+    return len;
+}
+#endif
+
+/*
+ * sets up b to compress into fd (with gzip framing, windowBits 15+16) as
+ * the rows come, using space for the uncompressed side
+ */
+int init_gzip_output( struct gzip_output *gz, buffer *b, int fd, char *space, size_t len )
+{
+#ifdef NOZLIB
+    (void)gz; (void)b; (void)fd; (void)space; (void)len;
+    carp("program was compiled without zlib");
+    return -1;
+#else
+    memset(gz, 0, sizeof(struct gzip_output));
+    gz->fd = fd;
+    if ( Z_OK != deflateInit2(&gz->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) ) {
+        carp("deflateInit2 failed");
+        return -1;
+    }
+    buffer_init(b, (ssize_t (*)())gzip_write, fd, space, len);
+    b->cookie = gz;
+    return 0;
+#endif
+}
+
+/* flushes b and writes the end of the gzip stream */
+int finish_gzip_output( struct gzip_output *gz, buffer *b )
+{
+#ifdef NOZLIB
+    (void)gz; (void)b;
+    return -1;
+#else
+    int ret=0;
+
+    if ( buffer_flush(b) ) {
+        ret=-1;
+    } else {
+        gz->z.next_in = NULL;
+        gz->z.avail_in = 0;
+        ret = deflate_to(gz, Z_FINISH);
+    }
+    V(2,
+        buffer_puts(buffer_2, "gzip output: ");
+        buffer_putulong(buffer_2, gz->z.total_in);
+        buffer_puts(buffer_2, " bytes, compressed ");
+        buffer_putulong(buffer_2, gz->z.total_out);
+        buffer_putnlflush(buffer_2);
+    );
+    deflateEnd(&gz->z);
+    return ret;
+#endif
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fmt.h>
+
+#ifndef NOZLIB
+static void tick( int sig )
+{
+    (void)sig;
+}
+#endif
+
+int main( int argc, char *argv[] )
+{
+    assert(!accepts_gzip(NULL));
+    assert(!accepts_gzip(""));
+    assert(accepts_gzip("gzip"));
+    assert(accepts_gzip("deflate, gzip, br"));
+    assert(accepts_gzip("br;q=1.0, GZIP;q=0.5"));
+    assert(accepts_gzip("x-gzip"));
+    assert(!accepts_gzip("gzip;q=0"));
+    assert(!accepts_gzip("gzip; q=0.000, *"));
+    assert(accepts_gzip("gzip;q=0.01"));
+    assert(accepts_gzip("*"));
+    assert(!accepts_gzip("*;q=0"));
+    assert(!accepts_gzip("identity, br"));
+    assert(!accepts_gzip("gzipper"));
+
+#ifndef NOZLIB
+    /* rows in, one gzip stream out */
+    struct gzip_output gz;
+    buffer b;
+    char space[100], row[64], *in, *out;
+    size_t i, n, len=0, total=0;
+    FILE *f = tmpfile();
+    z_stream z;
+
+    assert(f);
+    assert(0==init_gzip_output(&gz, &b, fileno(f), space, sizeof(space)));
+    assert((in = malloc(200000)));
+    for (i=0; i<3000; ++i) {
+        n = fmt_str(row, "<tr><td>row ");
+        n += fmt_ulong(row+n, i);
+        n += fmt_str(row+n, "</td></tr>\n");
+        memcpy(in+len, row, n);
+        len += n;
+        assert(0==buffer_put(&b, row, n));
+        if ( !(i%10) )
+            assert(0==buffer_flush(&b));
+    }
+    assert(0==finish_gzip_output(&gz, &b));
+    total = lseek(fileno(f), 0, SEEK_CUR);
+    assert(total > 10 && total < len/4);
+
+    assert((out = malloc(total)));
+    assert(0==lseek(fileno(f), 0, SEEK_SET) && (ssize_t)total==read(fileno(f), out, total));
+    assert((unsigned char)out[0]==0x1f && (unsigned char)out[1]==0x8b);
+    memset(&z, 0, sizeof(z));
+    assert(Z_OK==inflateInit2(&z, 15+16));
+    char *back = malloc(len+1);
+    z.next_in = (unsigned char *)out;
+    z.avail_in = total;
+    z.next_out = (unsigned char *)back;
+    z.avail_out = len+1;
+    assert(Z_STREAM_END==inflate(&z, Z_FINISH) && z.total_out==len && !memcmp(back, in, len));
+    inflateEnd(&z);
+    free(back);
+    free(out);
+    fclose(f);
+
+    /* into a pipe that is full while a timer interrupts the writes: nothing gets lost */
+    struct sigaction sa;
+    struct itimerval it = { { 0, 5000 }, { 0, 5000 } };
+    int fds[2], status;
+    pid_t pid;
+
+    for (i=0; i<200000; ++i)
+        in[i] = rand();
+    assert(0==pipe(fds));
+    if ( !(pid = fork()) ) {
+        close(fds[1]);
+        usleep(100000);
+        assert((out = malloc(400000)));
+        for (total=0; 0 < (n = read(fds[0], out+total, 400000-total)); total+=n)
+            ;
+        memset(&z, 0, sizeof(z));
+        back = malloc(200001);
+        z.next_in = (unsigned char *)out;
+        z.avail_in = total;
+        z.next_out = (unsigned char *)back;
+        z.avail_out = 200001;
+        _exit(Z_OK==inflateInit2(&z, 15+16) && Z_STREAM_END==inflate(&z, Z_FINISH) &&
+                z.total_out==200000 && !memcmp(back, in, 200000)?0:1);
+    }
+    close(fds[0]);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tick;
+    assert(0==sigaction(SIGALRM, &sa, NULL) && 0==setitimer(ITIMER_REAL, &it, NULL));
+    assert(0==init_gzip_output(&gz, &b, fds[1], space, sizeof(space)));
+    assert(0==buffer_put(&b, in, 200000));
+    assert(0==finish_gzip_output(&gz, &b));
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_REAL, &it, NULL);
+    close(fds[1]);
+    assert(waitpid(pid, &status, 0)==pid && WIFEXITED(status) && !WEXITSTATUS(status));
+    free(in);
+#endif
+    exit(EXIT_SUCCESS);
+}
+#endif
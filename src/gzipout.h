@@ -0,0 +1,25 @@
+#ifndef GZIPOUT_H
+#define GZIPOUT_H
+#include <stdbool.h>
+#include <buffer.h>
+#ifndef NOZLIB
+#include <zlib.h>
+#endif
+
+/* compressed bytes written to the fd at once */
+#define GZIP_CHUNK 16384
+
+/* a buffer whose content is gzip compressed on the way to fd */
+struct gzip_output {
+#ifndef NOZLIB
+    z_stream z;
+#endif
+    int fd;
+    char out[GZIP_CHUNK];
+};
+
+void set_gzipout_verbosity( short );
+bool accepts_gzip( const char * );
+int init_gzip_output( struct gzip_output *, buffer *, int, char *, size_t );
+int finish_gzip_output( struct gzip_output *, buffer * );
+#endif
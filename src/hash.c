@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include "hash.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* 64 bit FNV-1a, continues from h (start with hash_buf(hash_str(""), ...)) */
+unsigned long long hash_buf( unsigned long long h, const char *s, size_t len )
+{
+    while ( len-- ) {
+        h ^= (unsigned char)*s++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+unsigned long long hash_str( const char *s )
+{
+    unsigned long long h=FNV_OFFSET;
+
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* always FMT_HASH lowercase hex digits, e.g. for file names */
+size_t fmt_hash( char *dest, unsigned long long h )
+{
+    int n;
+
+    if ( dest )
+        for (n=0; n<FMT_HASH; ++n)
+            dest[n] = "0123456789abcdef"[(h>>(60-4*n))&15];
+    return FMT_HASH;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main( int argc, char *argv[] )
+{
+    char s[FMT_HASH];
+
+    assert(hash_str("")==0xcbf29ce484222325ULL);
+    assert(hash_str("a")==0xaf63dc4c8601ec8cULL);
+    assert(hash_str("foobar")==0x85944171f73967e8ULL);
+    assert(hash_buf(hash_str("foo"), "bar", 3)==hash_str("foobar"));
+    assert(hash_buf(hash_str(""), "a\0b", 3)!=hash_str("a"));
+    assert(FMT_HASH==fmt_hash(s, 0x0123456789abcdefULL));
+    assert(!memcmp(s, "0123456789abcdef", FMT_HASH));
+    exit(EXIT_SUCCESS);
+}
+#endif
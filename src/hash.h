@@ -0,0 +1,11 @@
+#ifndef HASH_H
+#define HASH_H
+#include <stddef.h>
+
+/* hex digits written by fmt_hash */
+#define FMT_HASH 16
+
+unsigned long long hash_str( const char * );
+unsigned long long hash_buf( unsigned long long, const char *, size_t );
+size_t fmt_hash( char *, unsigned long long );
+#endif
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <str.h>
+#include "datetime.h"
+#include "holidayrules.h"
+
+#define V(__l,__fn) do{if(holidayrules_verbosity>=__l){ __fn; }}while(0);
+short holidayrules_verbosity=0;
+
+/* holidays of one region in three years, with its inherited rules */
+#define MAX_HOLIDAYS 128
+
+#define FIXED(__m,__d,__n) { HR_FIXED, __m, __d, 0, 0, HS_NONE, 0, 0, __n }
+#define FIXED_IN(__m,__d,__since,__until,__n) { HR_FIXED, __m, __d, 0, 0, HS_NONE, __since, __until, __n }
+#define FIXED_SUBST(__m,__d,__s,__since,__n) { HR_FIXED, __m, __d, 0, 0, __s, __since, 0, __n }
+#define EASTER(__o,__n) { HR_EASTER, 0, 0, 0, __o, HS_NONE, 0, 0, __n }
+#define NTH(__m,__w,__i,__since,__n) { HR_NTH_WEEKDAY, __m, 0, __w, __i, HS_NONE, __since, 0, __n }
+#define BEFORE(__m,__d,__w,__n) { HR_WEEKDAY_BEFORE, __m, __d, __w, 0, HS_NONE, 0, 0, __n }
+#define END { HR_END, 0, 0, 0, 0, HS_NONE, 0, 0, NULL }
+
+static const struct holiday_rule de[] = {
+    FIXED(1, 1, "Neujahr"),
+    EASTER(-2, "Karfreitag"),
+    EASTER(1, "Ostermontag"),
+    FIXED(5, 1, "Tag der Arbeit"),
+    EASTER(39, "Christi Himmelfahrt"),
+    EASTER(50, "Pfingstmontag"),
+    FIXED(10, 3, "Tag der Deutschen Einheit"),
+    FIXED_IN(10, 31, 2017, 2017, "Reformationstag"),
+    FIXED(12, 25, "1. Weihnachtstag"),
+    FIXED(12, 26, "2. Weihnachtstag"),
+    END
+};
+
+static const struct holiday_rule de_bw[] = {
+    FIXED(1, 6, "Heilige Drei Könige"),
+    EASTER(60, "Fronleichnam"),
+    FIXED(11, 1, "Allerheiligen"),
+    END
+};
+
+static const struct holiday_rule de_by[] = {
+    FIXED(1, 6, "Heilige Drei Könige"),
+    EASTER(60, "Fronleichnam"),
+    FIXED(8, 15, "Mariä Himmelfahrt"),
+    FIXED(11, 1, "Allerheiligen"),
+    END
+};
+
+static const struct holiday_rule de_be[] = {
+    FIXED_IN(3, 8, 2019, 0, "Internationaler Frauentag"),
+    FIXED_IN(5, 8, 2020, 2020, "Tag der Befreiung"),
+    FIXED_IN(5, 8, 2025, 2025, "Tag der Befreiung"),
+    END
+};
+
+static const struct holiday_rule de_bb[] = {
+    EASTER(0, "Ostersonntag"),
+    EASTER(49, "Pfingstsonntag"),
+    FIXED(10, 31, "Reformationstag"),
+    END
+};
+
+/* Bremen, Hamburg, Niedersachsen and Schleswig-Holstein */
+static const struct holiday_rule de_north[] = {
+    FIXED_IN(10, 31, 2018, 0, "Reformationstag"),
+    END
+};
+
+static const struct holiday_rule de_he[] = {
+    EASTER(60, "Fronleichnam"),
+    END
+};
+
+static const struct holiday_rule de_mv[] = {
+    FIXED_IN(3, 8, 2023, 0, "Internationaler Frauentag"),
+    FIXED(10, 31, "Reformationstag"),
+    END
+};
+
+/* Nordrhein-Westfalen and Rheinland-Pfalz */
+static const struct holiday_rule de_west[] = {
+    EASTER(60, "Fronleichnam"),
+    FIXED(11, 1, "Allerheiligen"),
+    END
+};
+
+static const struct holiday_rule de_sl[] = {
+    EASTER(60, "Fronleichnam"),
+    FIXED(8, 15, "Mariä Himmelfahrt"),
+    FIXED(11, 1, "Allerheiligen"),
+    END
+};
+
+static const struct holiday_rule de_sn[] = {
+    FIXED(10, 31, "Reformationstag"),
+    BEFORE(11, 23, 3, "Buß- und Bettag"),
+    END
+};
+
+static const struct holiday_rule de_st[] = {
+    FIXED(1, 6, "Heilige Drei Könige"),
+    FIXED(10, 31, "Reformationstag"),
+    END
+};
+
+static const struct holiday_rule de_th[] = {
+    FIXED_IN(9, 20, 2019, 0, "Weltkindertag"),
+    FIXED(10, 31, "Reformationstag"),
+    END
+};
+
+static const struct holiday_rule at[] = {
+    FIXED(1, 1, "Neujahr"),
+    FIXED(1, 6, "Heilige Drei Könige"),
+    EASTER(1, "Ostermontag"),
+    FIXED(5, 1, "Staatsfeiertag"),
+    EASTER(39, "Christi Himmelfahrt"),
+    EASTER(50, "Pfingstmontag"),
+    EASTER(60, "Fronleichnam"),
+    FIXED(8, 15, "Mariä Himmelfahrt"),
+    FIXED(10, 26, "Nationalfeiertag"),
+    FIXED(11, 1, "Allerheiligen"),
+    FIXED(12, 8, "Mariä Empfängnis"),
+    FIXED(12, 25, "Christtag"),
+    FIXED(12, 26, "Stefanitag"),
+    END
+};
+
+static const struct holiday_rule fr[] = {
+    FIXED(1, 1, "Jour de l'an"),
+    EASTER(1, "Lundi de Pâques"),
+    FIXED(5, 1, "Fête du Travail"),
+    FIXED(5, 8, "Victoire 1945"),
+    EASTER(39, "Ascension"),
+    EASTER(50, "Lundi de Pentecôte"),
+    FIXED(7, 14, "Fête nationale"),
+    FIXED(8, 15, "Assomption"),
+    FIXED(11, 1, "Toussaint"),
+    FIXED(11, 11, "Armistice 1918"),
+    FIXED(12, 25, "Noël"),
+    END
+};
+
+/* England and Wales; moved or extra bank holidays come from an override calendar */
+static const struct holiday_rule gb_eng[] = {
+    FIXED_SUBST(1, 1, HS_NEXT_WORKDAY, 0, "New Year's Day"),
+    EASTER(-2, "Good Friday"),
+    EASTER(1, "Easter Monday"),
+    NTH(5, 1, 1, 0, "Early May bank holiday"),
+    NTH(5, 1, -1, 0, "Spring bank holiday"),
+    NTH(8, 1, -1, 0, "Summer bank holiday"),
+    FIXED_SUBST(12, 25, HS_NEXT_WORKDAY, 0, "Christmas Day"),
+    FIXED_SUBST(12, 26, HS_NEXT_WORKDAY, 0, "Boxing Day"),
+    END
+};
+
+/* federal holidays */
+static const struct holiday_rule us[] = {
+    FIXED_SUBST(1, 1, HS_NEAREST, 0, "New Year's Day"),
+    NTH(1, 1, 3, 1986, "Martin Luther King Jr. Day"),
+    NTH(2, 1, 3, 0, "Washington's Birthday"),
+    NTH(5, 1, -1, 0, "Memorial Day"),
+    FIXED_SUBST(6, 19, HS_NEAREST, 2021, "Juneteenth"),
+    FIXED_SUBST(7, 4, HS_NEAREST, 0, "Independence Day"),
+    NTH(9, 1, 1, 0, "Labor Day"),
+    NTH(10, 1, 2, 0, "Columbus Day"),
+    FIXED_SUBST(11, 11, HS_NEAREST, 0, "Veterans Day"),
+    NTH(11, 4, 4, 0, "Thanksgiving Day"),
+    FIXED_SUBST(12, 25, HS_NEAREST, 0, "Christmas Day"),
+    END
+};
+
+/* the German states take the national holidays too */
+static const struct {
+    const char *name;
+    const struct holiday_rule *rule;
+    const struct holiday_rule *inherit;
+} regions[] = {
+    { "de", de, NULL },
+    { "de-bw", de_bw, de },
+    { "de-by", de_by, de },
+    { "de-be", de_be, de },
+    { "de-bb", de_bb, de },
+    { "de-hb", de_north, de },
+    { "de-hh", de_north, de },
+    { "de-he", de_he, de },
+    { "de-mv", de_mv, de },
+    { "de-ni", de_north, de },
+    { "de-nw", de_west, de },
+    { "de-rp", de_west, de },
+    { "de-sl", de_sl, de },
+    { "de-sn", de_sn, de },
+    { "de-st", de_st, de },
+    { "de-sh", de_north, de },
+    { "de-th", de_th, de },
+    { "at", at, NULL },
+    { "fr", fr, NULL },
+    { "gb-eng", gb_eng, NULL },
+    { "us", us, NULL }
+};
+
+struct holiday {
+    long day;
+    enum holiday_subst subst;
+    const char *name;
+};
+
+void set_holidayrules_verbosity( short v ) {
+    holidayrules_verbosity=v;
+}
+
+/* Easter Sunday of the Gregorian calendar (anonymous Gregorian algorithm), as day number */
+static long easter( long y )
+{
+    long a=y%19, b=y/100, c=y%100, d=b/4, e=b%4, f=(b+8)/25, g=(b-f+1)/3;
+    long h=(19*a+b-d-g+15)%30, i=c/4, k=c%4, l=(32+2*e+2*i-h-k)%7, m=(a+11*h+22*l)/451;
+
+    return days_from_civil(y, (h+l-7*m+114)/31, (h+l-7*m+114)%31+1);
+}
+
+/* the day of rule r in year y, -1 if it is not in force then */
+static long rule_day( const struct holiday_rule *r, long y )
+{
+    long d;
+
+    if ( (r->since && y < r->since) || (r->until && y > r->until) )
+        return -1;
+    switch ( r->kind ) {
+    case HR_FIXED:
+        return days_from_civil(y, r->month, r->day);
+    case HR_EASTER:
+        return easter(y)+r->n;
+    case HR_NTH_WEEKDAY:
+        if ( r->n < 0 ) {
+            d = days_from_civil(y, r->month, days_in_month(y, r->month));
+            return d - (weekday_from_days(d)-r->wday+7)%7;
+        }
+        d = days_from_civil(y, r->month, 1);
+        return d + (r->wday-weekday_from_days(d)+7)%7 + 7*(r->n-1);
+    case HR_WEEKDAY_BEFORE:
+        d = days_from_civil(y, r->month, r->day)-1;
+        return d - (weekday_from_days(d)-r->wday+7)%7;
+    default:
+        return -1;
+    }
+}
+
+static size_t add_rules( struct holiday *h, size_t n, const struct holiday_rule *r, long y )
+{
+    long d;
+
+    for (; r && r->kind != HR_END && n < MAX_HOLIDAYS; ++r)
+        if ( -1 != (d = rule_day(r, y)) ) {
+            h[n].day = d;
+            h[n].subst = r->subst;
+            h[n++].name = r->name;
+        }
+    return n;
+}
+
+static int by_day( const void *a, const void *b )
+{
+    const struct holiday *x=a, *y=b;
+    return (x->day > y->day) - (x->day < y->day);
+}
+
+static bool taken( const struct holiday *h, size_t n, size_t j, long day )
+{
+    size_t i;
+
+    for (i=0; i<n; ++i)
+        if ( i != j && h[i].day == day )
+            return true;
+    return false;
+}
+
+/* a holiday on a weekend moves to a weekday, one after the other */
+static void substitute( struct holiday *h, size_t n )
+{
+    size_t i;
+    int w;
+
+    for (i=0; i<n; ++i) {
+        w = weekday_from_days(h[i].day);
+        if ( h[i].subst == HS_NONE || (w != 0 && w != 6) )
+            continue;
+        if ( h[i].subst == HS_NEAREST ) {
+            h[i].day += (w == 6)?-1:1;
+            continue;
+        }
+        do
+            h[i].day++;
+        while ( weekday_from_days(h[i].day) == 0 || weekday_from_days(h[i].day) == 6 ||
+                taken(h, n, i, h[i].day) );
+    }
+}
+
+/*
+ * takes the public holidays of region out of the workdays of ht, from the
+ * built-in rules instead of a calendar. The years around are computed too,
+ * as a holiday can be moved across the turn of the year.
+ */
+int apply_holiday_rules( struct holiday_table *ht, const char *region )
+{
+    struct holiday h[MAX_HOLIDAYS];
+    struct tm t;
+    size_t i, n=0;
+    long y, first, k, yy;
+    unsigned m, d;
+
+    for (i=0; i<sizeof(regions)/sizeof(regions[0]); ++i)
+        if ( str_equal(regions[i].name, region) )
+            break;
+    if ( i == sizeof(regions)/sizeof(regions[0]) ) {
+        carp("unknown holiday_rules region: ", region);
+        return -1;
+    }
+    localtime_r(&ht->begin_year, &t);
+    first = days_from_civil(t.tm_year+1900, 1, 1);
+    for (y=t.tm_year+1900-1; y<=t.tm_year+1900+1; ++y) {
+        n = add_rules(h, n, regions[i].inherit, y);
+        n = add_rules(h, n, regions[i].rule, y);
+    }
+    qsort(h, n, sizeof(struct holiday), by_day);
+    substitute(h, n);
+
+    for (i=0; i<n; ++i) {
+        k = h[i].day-first;
+        if ( k < 0 || k >= ht->days )
+            continue;
+        ht->workdays[k/64] &= ~(1ULL << (k%64));
+        V(2,
+            civil_from_days(h[i].day, &yy, &m, &d);
+            buffer_puts(buffer_2, "holiday: ");
+            buffer_putulong(buffer_2, d);
+            buffer_puts(buffer_2, ".");
+            buffer_putulong(buffer_2, m);
+            buffer_puts(buffer_2, ". ");
+            buffer_puts(buffer_2, h[i].name);
+            buffer_putnlflush(buffer_2);
+        );
+    }
+    return 0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+static bool is_workday( const struct holiday_table *ht, long y, unsigned m, unsigned d )
+{
+    long k = days_from_civil(y, m, d)-days_from_civil(y, 1, 1);
+    return ht->workdays[k/64] >> (k%64) & 1;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct holiday_table ht;
+
+    /* computus */
+    assert(easter(2019)==days_from_civil(2019, 4, 21));
+    assert(easter(2024)==days_from_civil(2024, 3, 31));
+    assert(easter(2038)==days_from_civil(2038, 4, 25));
+    assert(easter(2285)==days_from_civil(2285, 3, 22));
+
+    /* Saxony 2023: 10 holidays on weekdays, Buß- und Bettag on 22.11. */
+    init_holiday_list(&ht, 2023);
+    assert(workdays_in_period(&ht, ht.begin_year, ht.end_year-1)==260);
+    assert(0==apply_holiday_rules(&ht, "de-sn"));
+    assert(workdays_in_period(&ht, ht.begin_year, ht.end_year-1)==250);
+    assert(!is_workday(&ht, 2023, 11, 22) && is_workday(&ht, 2023, 11, 15) && !is_workday(&ht, 2023, 4, 7));
+    assert(!is_workday(&ht, 2023, 5, 18) && !is_workday(&ht, 2023, 5, 29));
+
+    /* Berlin: Frauentag since 2019, nothing on 31.10. except in 2017 */
+    init_holiday_list(&ht, 2018);
+    assert(0==apply_holiday_rules(&ht, "de-be") && is_workday(&ht, 2018, 3, 8));
+    init_holiday_list(&ht, 2023);
+    assert(0==apply_holiday_rules(&ht, "de-be") && !is_workday(&ht, 2023, 3, 8) && is_workday(&ht, 2023, 10, 31));
+    init_holiday_list(&ht, 2017);
+    assert(0==apply_holiday_rules(&ht, "de-be") && !is_workday(&ht, 2017, 10, 31));
+
+    /* England 2021: Christmas on Saturday and Boxing Day on Sunday move to 27. and 28. */
+    init_holiday_list(&ht, 2021);
+    assert(0==apply_holiday_rules(&ht, "gb-eng"));
+    assert(!is_workday(&ht, 2021, 12, 27) && !is_workday(&ht, 2021, 12, 28) && is_workday(&ht, 2021, 12, 29));
+    assert(!is_workday(&ht, 2021, 5, 3) && !is_workday(&ht, 2021, 5, 31) && !is_workday(&ht, 2021, 8, 30));
+
+    /* US 2021: New Year's Day 2022 is a Saturday, observed on 31.12.2021 */
+    init_holiday_list(&ht, 2021);
+    assert(0==apply_holiday_rules(&ht, "us"));
+    assert(!is_workday(&ht, 2021, 12, 31) && !is_workday(&ht, 2021, 12, 24) && !is_workday(&ht, 2021, 11, 25));
+    assert(!is_workday(&ht, 2021, 1, 18) && !is_workday(&ht, 2021, 6, 18) && !is_workday(&ht, 2021, 7, 5));
+
+    assert(-1==apply_holiday_rules(&ht, "xx"));
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,32 @@
+#ifndef HOLIDAYRULES_H
+#define HOLIDAYRULES_H
+#include "ics.h"
+
+enum holiday_rule_kind {
+    HR_END=0,
+    HR_FIXED,          // month/day
+    HR_EASTER,         // n days after Easter Sunday
+    HR_NTH_WEEKDAY,    // n-th wday of month, -1: the last one
+    HR_WEEKDAY_BEFORE  // the last wday before month/day
+};
+
+/* what happens to a holiday on a weekend */
+enum holiday_subst {
+    HS_NONE=0,
+    HS_NEXT_WORKDAY,   // the next weekday that is no holiday yet
+    HS_NEAREST         // Saturday: the Friday before, Sunday: the Monday after
+};
+
+struct holiday_rule {
+    enum holiday_rule_kind kind;
+    unsigned char month, day;
+    unsigned char wday; // 0: Sunday
+    short n;
+    enum holiday_subst subst;
+    short since, until; // the years the rule is in force, 0: open
+    const char *name;
+};
+
+void set_holidayrules_verbosity( short );
+int apply_holiday_rules( struct holiday_table *, const char * );
+#endif
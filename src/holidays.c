@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <fmt.h>
+#include <str.h>
+#include <scan.h>
+#include <stralloc.h>
+#include <mmap.h>
+#include "atomicfile.h"
+#include "hash.h"
+#include "holidays.h"
+#include "holidayrules.h"
+
+#define V(__l,__fn) do{if(holidays_verbosity>=__l){ __fn; }}while(0);
+short holidays_verbosity=0;
+
+#define HOLIDAYS_MAGIC "caltimist-workdays 1\n"
+
+void set_holidays_verbosity( short v ) {
+    holidays_verbosity=v;
+}
+
+/*
+ * each distinct public holiday calendar is fetched and compiled once per
+ * run into the workday bits of the year, all users of it share the table;
+ * built-in rules need no fetch at all
+ */
+void init_holiday_regions( struct holiday_regions *hr, short year, const char *cache_dir, unsigned short cache_days )
+{
+    memset(hr, 0, sizeof(struct holiday_regions));
+    hr->year = year;
+    hr->cache_dir = cache_dir;
+    hr->cache_days = cache_days?cache_days:HOLIDAY_CACHE_DAYS;
+}
+
+void free_holiday_regions( struct holiday_regions *hr )
+{
+    struct holiday_region *r, *next;
+
+    for (r=hr->first_region; r; r=next) {
+        next = r->next_region;
+        free(r->rules);
+        free(r->url);
+        free(r);
+    }
+    hr->first_region = NULL;
+}
+
+static bool same( const char *a, const char *b )
+{
+    return a?(b && str_equal(a, b)):!b;
+}
+
+/*
+ * the region of the built-in rules and the calendar at url, a new one is set
+ * up with the weekends and the rules; it is not ready while url is not fetched
+ */
+struct holiday_region *get_holiday_region( struct holiday_regions *hr, const char *rules, const char *url )
+{
+    struct holiday_region *r, **last=&hr->first_region;
+
+    for (r=hr->first_region; r; r=r->next_region) {
+        if ( same(r->rules, rules) && same(r->url, url) )
+            return r;
+        last = &r->next_region;
+    }
+    if ( !(r = calloc(1, sizeof(struct holiday_region))) || (url && !(r->url = strdup(url))) ||
+            (rules && !(r->rules = strdup(rules))) ) {
+        carpsys("calloc");
+        if ( r )
+            free(r->url);
+        free(r);
+        return NULL;
+    }
+    init_holiday_list(&r->table, hr->year);
+    if ( rules && apply_holiday_rules(&r->table, rules) ) {
+        free(r->rules);
+        free(r->url);
+        free(r);
+        return NULL;
+    }
+    r->ready = !url;
+    *last = r;
+    return r;
+}
+
+/* <cache_dir>/workdays-<hash of url and rules>-<year> */
+static char *cache_file( const struct holiday_regions *hr, const struct holiday_region *r )
+{
+    char *f;
+    size_t i;
+
+    if ( !hr->cache_dir || !r->url )
+        return NULL;
+    if ( !(f = malloc(str_len(hr->cache_dir)+sizeof("/workdays--")+FMT_HASH+FMT_ULONG)) ) {
+        carpsys("malloc");
+        return NULL;
+    }
+    i = fmt_str(f, hr->cache_dir);
+    i += fmt_str(f+i, "/workdays-");
+    i += fmt_hash(f+i, r->rules?hash_buf(hash_str(r->url), r->rules, str_len(r->rules)):hash_str(r->url));
+    f[i++] = '-';
+    i += fmt_ulong(f+i, hr->year);
+    f[i] = '\0';
+    return f;
+}
+
+/*
+ * takes the compiled table of the region from the cache_dir, if it is there
+ * and younger than cache_days: 0 if it was loaded, 1 if not
+ */
+int load_holiday_region( const struct holiday_regions *hr, struct holiday_region *r )
+{
+    struct holiday_table t = r->table;
+    const char *map=NULL, *p, *end;
+    char *file;
+    struct stat st;
+    size_t size=0, i, n;
+    unsigned long days, wday;
+    unsigned long long word;
+    int ret=1;
+
+    if ( !(file = cache_file(hr, r)) )
+        return 1;
+    if ( stat(file, &st) ) {
+        if ( errno != ENOENT )
+            carpsys(file);
+        goto out;
+    }
+    if ( st.st_mtime + hr->cache_days*86400L < time(NULL) ) {
+        V(2,carp("holiday cache expired: ", file));
+        goto out;
+    }
+    if ( !(map = mmap_read(file, &size)) ) {
+        carpsys(file);
+        goto out;
+    }
+    /* magic, url (and rules), days and weekday of January 1st, then the words in hex */
+    p = map;
+    end = map+size;
+    n = str_len(HOLIDAYS_MAGIC);
+    if ( size < n || memcmp(p, HOLIDAYS_MAGIC, n) )
+        goto corrupt;
+    p += n;
+    n = str_len(r->url);
+    if ( (size_t)(end-p) < n+1 || memcmp(p, r->url, n) )
+        goto corrupt;
+    p += n;
+    if ( r->rules ) {
+        n = str_len(r->rules);
+        if ( (size_t)(end-p) < n+1 || *p != ' ' || memcmp(p+1, r->rules, n) )
+            goto corrupt;
+        p += n+1;
+    }
+    if ( p == end || *p++ != '\n' )
+        goto corrupt;
+    if ( !(n = scan_ulong(p, &days)) || p[n] != ' ' || days != t.days )
+        goto corrupt;
+    p += n+1;
+    if ( !(n = scan_ulong(p, &wday)) || p[n] != '\n' || wday != t.first_wday )
+        goto corrupt;
+    p += n+1;
+    for (i=0; i<HOLIDAY_WORDS; ++i) {
+        if ( end-p < FMT_HASH+1 || FMT_HASH != scan_xlonglong(p, &word) ||
+                p[FMT_HASH] != (i+1<HOLIDAY_WORDS?' ':'\n') )
+            goto corrupt;
+        t.workdays[i] = word;
+        p += FMT_HASH+1;
+    }
+    r->table = t;
+    r->ready = true;
+    ret = 0;
+    V(2,carp("holidays from cache: ", file));
+    goto out;
+corrupt:
+    carp("ignoring damaged holiday cache: ", file);
+out:
+    if ( map )
+        mmap_unmap(map, size);
+    free(file);
+    return ret;
+}
+
+/* keeps the compiled table for the next runs, if there is a cache_dir */
+int save_holiday_region( const struct holiday_regions *hr, const struct holiday_region *r )
+{
+    char word[FMT_HASH];
+    char *file;
+    stralloc sa;
+    size_t i;
+    int ret=-1;
+
+    if ( !(file = cache_file(hr, r)) )
+        return hr->cache_dir?-1:0;
+    stralloc_init(&sa);
+    if ( !stralloc_copys(&sa, HOLIDAYS_MAGIC) || !stralloc_cats(&sa, r->url) ||
+            (r->rules && (!stralloc_append(&sa, " ") || !stralloc_cats(&sa, r->rules))) || !stralloc_append(&sa, "\n") ||
+            !stralloc_catulong0(&sa, r->table.days, 0) || !stralloc_append(&sa, " ") ||
+            !stralloc_catulong0(&sa, r->table.first_wday, 0) || !stralloc_append(&sa, "\n") ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    for (i=0; i<HOLIDAY_WORDS; ++i)
+        if ( !stralloc_catb(&sa, word, fmt_hash(word, r->table.workdays[i])) ||
+                !stralloc_append(&sa, (i+1<HOLIDAY_WORDS)?" ":"\n") ) {
+            carpsys("stralloc");
+            goto out;
+        }
+    ret = write_file_atomic(file, sa.s, sa.len);
+out:
+    stralloc_free(&sa);
+    free(file);
+    return ret;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <unistd.h>
+#include <utime.h>
+
+int main( int argc, char *argv[] )
+{
+    struct holiday_regions hr;
+    struct holiday_region *a, *b, *none, *c2, *d, c;
+    char dir[] = "/tmp/holidays-XXXXXX";
+    struct utimbuf old = { 0, 0 };
+    char *file;
+
+    assert(mkdtemp(dir));
+    init_holiday_regions(&hr, 2021, dir, 0);
+    assert(hr.cache_days==HOLIDAY_CACHE_DAYS);
+
+    /* one shared table per calendar */
+    assert((a = get_holiday_region(&hr, NULL, "http://localhost/be.ics")) && !a->ready);
+    assert((b = get_holiday_region(&hr, NULL, "http://localhost/by.ics")) && a!=b);
+    assert((none = get_holiday_region(&hr, NULL, NULL)) && none->ready);
+    assert(a==get_holiday_region(&hr, NULL, "http://localhost/be.ics"));
+    assert(none==get_holiday_region(&hr, NULL, NULL));
+    assert(a->table.days==365 && workdays_in_period(&a->table, a->table.begin_year, a->table.end_year-1)==261);
+
+    /* built-in rules are ready at once, with a calendar on top they are a region of their own */
+    assert((c2 = get_holiday_region(&hr, "de-by", NULL)) && c2->ready);
+    assert(workdays_in_period(&c2->table, c2->table.begin_year, c2->table.end_year-1)==261-8);
+    assert((d = get_holiday_region(&hr, "de-by", "http://localhost/be.ics")) && d!=a && d!=c2 && !d->ready);
+    assert(!memcmp(d->table.workdays, c2->table.workdays, sizeof(d->table.workdays)));
+    assert(d==get_holiday_region(&hr, "de-by", "http://localhost/be.ics"));
+    assert(!get_holiday_region(&hr, "xx", NULL));
+
+    /* round trip through the cache */
+    assert(1==load_holiday_region(&hr, a));
+    a->table.workdays[0] &= ~1ULL;
+    a->table.workdays[5] &= ~(1ULL << (364%64));
+    assert(0==save_holiday_region(&hr, a));
+    memset(&c, 0, sizeof(c));
+    c.url = a->url;
+    init_holiday_list(&c.table, 2021);
+    assert(0==load_holiday_region(&hr, &c) && c.ready);
+    assert(!memcmp(c.table.workdays, a->table.workdays, sizeof(a->table.workdays)));
+    assert(workdays_in_period(&c.table, c.table.begin_year, c.table.end_year-1)==259);
+    /* the copy of the same calendar with rules is another one */
+    assert(1==load_holiday_region(&hr, d));
+    assert(0==save_holiday_region(&hr, d) && 0==load_holiday_region(&hr, d) && d->ready);
+    file = cache_file(&hr, d);
+    unlink(file);
+    free(file);
+
+    /* an old or damaged copy is not used */
+    file = cache_file(&hr, a);
+    assert(0==utime(file, &old));
+    assert(1==load_holiday_region(&hr, &c));
+    assert(0==truncate(file, 40));
+    assert(1==load_holiday_region(&hr, &c));
+    unlink(file);
+    free(file);
+    rmdir(dir);
+
+    free_holiday_regions(&hr);
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef HOLIDAYS_H
+#define HOLIDAYS_H
+#include <stdbool.h>
+#include "ics.h"
+
+/* days a compiled holiday table is reused from the cache_dir */
+#define HOLIDAY_CACHE_DAYS 7
+
+/*
+ * the compiled workdays of one region, shared by its users: the built-in
+ * rules of a region and/or a public holiday calendar on top of them
+ */
+struct holiday_region {
+    char *rules; // name of the built-in rules, NULL: none
+    char *url; // NULL: no public holiday calendar
+    struct holiday_table table;
+    bool ready;
+    struct holiday_region *next_region;
+};
+
+struct holiday_regions {
+    short year;
+    const char *cache_dir;
+    unsigned short cache_days;
+    struct holiday_region *first_region;
+    unsigned long compiled, cached;
+};
+
+void set_holidays_verbosity( short );
+void init_holiday_regions( struct holiday_regions *, short, const char *, unsigned short );
+void free_holiday_regions( struct holiday_regions * );
+struct holiday_region *get_holiday_region( struct holiday_regions *, const char *, const char * );
+int load_holiday_region( const struct holiday_regions *, struct holiday_region * );
+int save_holiday_region( const struct holiday_regions *, const struct holiday_region * );
+#endif
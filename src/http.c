@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <byte.h>
+#include <fmt.h>
+#include <str.h>
+#include <scan.h>
+#include "http.h"
+
+#define V(__l,__fn) do{if(http_verbosity>=__l){ __fn; }}while(0);
+short http_verbosity=0;
+
+void set_http_verbosity( short v ) {
+    http_verbosity=v;
+}
+
+void init_http_response( struct http_response *r, int(*parser)(void *,char *), void *parser_ctx )
+{
+    memset(r, 0, sizeof(struct http_response));
+    stralloc_init(&r->line);
+    stralloc_init(&r->etag);
+    r->parser = parser;
+    r->parser_ctx = parser_ctx;
+}
+
+void free_http_response( struct http_response *r )
+{
+    stralloc_free(&r->line);
+    stralloc_free(&r->etag);
+}
+
+static bool header_is( const char *line, const char *name )
+{
+    size_t l = str_len(name);
+    return !strncasecmp(line, name, l) && line[l] == ':';
+}
+
+static const char *header_value( const char *line )
+{
+    line += str_chr(line, ':');
+    if ( *line ) line++;
+    while ( *line == ' ' || *line == '\t' ) line++;
+    return line;
+}
+
+/* one complete line of the header or the chunk framing, without CRLF */
+static int process_line( struct http_response *r, const char *line )
+{
+    unsigned long ul;
+
+    switch ( r->state ) {
+    case HTTP_STATUS_LINE:
+        if ( str_len(line) < sizeof("HTTP/1.x 200")-1 || !str_start(line, "HTTP/1.") ||
+                line[8] != ' ' || 3 != scan_ulong(line+9, &ul) ) {
+            carp("invalid HTTP status line: ", line);
+            return -1;
+        }
+        r->status = (unsigned short)ul;
+        r->chunked = false;
+        r->has_length = false;
+        r->state = HTTP_HEADER;
+        V(2,carp("HTTP status: ", line));
+        return 0;
+
+    case HTTP_HEADER:
+        V(3,carp("HTTP header: ", line));
+        if ( *line ) {
+            if ( header_is(line, "Transfer-Encoding") && strcasestr(header_value(line), "chunked") )
+                r->chunked = true;
+            else if ( header_is(line, "Content-Length") && scan_ulong(header_value(line), &ul) ) {
+                r->has_length = true;
+                r->remaining = ul;
+            } else if ( header_is(line, "ETag") && !stralloc_copys(&r->etag, header_value(line)) ) {
+                carpsys("stralloc_copys");
+                return -1;
+            }
+            return 0;
+        }
+        /* interim responses like 100 Continue are followed by the real one */
+        if ( r->status >= 100 && r->status < 200 ) {
+            r->state = HTTP_STATUS_LINE;
+            return 0;
+        }
+        /* answer to If-None-Match, there is no body */
+        if ( r->status == 304 ) {
+            r->state = HTTP_DONE;
+            return 0;
+        }
+        if ( r->status < 200 || r->status >= 300 ) {
+            char s[8];
+            s[fmt_ulong(s, r->status)] = '\0';
+            carp("HTTP request failed with status ", s);
+            return -1;
+        }
+        if ( r->chunked )
+            r->state = HTTP_CHUNK_SIZE;
+        else if ( r->has_length && !r->remaining )
+            r->state = HTTP_DONE;
+        else
+            r->state = HTTP_BODY;
+        return 0;
+
+    case HTTP_CHUNK_SIZE:
+        if ( !scan_xlong(line, &ul) ) {
+            carp("invalid chunk size: ", line);
+            return -1;
+        }
+        r->remaining = ul;
+        r->state = ul?HTTP_CHUNK_DATA:HTTP_TRAILER;
+        return 0;
+
+    case HTTP_CHUNK_END:
+        r->state = HTTP_CHUNK_SIZE;
+        return 0;
+
+    case HTTP_TRAILER:
+        if ( !*line )
+            r->state = HTTP_DONE;
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+static int deliver( struct http_response *r, const char *buf, size_t len )
+{
+    size_t n;
+
+    while ( len ) {
+        n = (len > HTTP_SEGMENT)?HTTP_SEGMENT:len;
+        memcpy(r->segment, buf, n);
+        r->segment[n] = '\0';
+        if ( r->parser(r->parser_ctx, r->segment) ) {
+            carp("parser failed");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* -1 if the response is malformed, not successful or the parser failed */
+int http_feed( struct http_response *r, const char *buf, size_t len )
+{
+    size_t n;
+
+    while ( len && r->state != HTTP_DONE ) {
+        if ( r->state == HTTP_BODY || r->state == HTTP_CHUNK_DATA ) {
+            n = len;
+            if ( (r->state == HTTP_CHUNK_DATA || r->has_length) && n > r->remaining )
+                n = r->remaining;
+            if ( deliver(r, buf, n) )
+                return -1;
+            buf += n;
+            len -= n;
+            if ( r->state == HTTP_CHUNK_DATA || r->has_length ) {
+                r->remaining -= n;
+                if ( !r->remaining )
+                    r->state = (r->state == HTTP_CHUNK_DATA)?HTTP_CHUNK_END:HTTP_DONE;
+            }
+            continue;
+        }
+
+        n = byte_chr(buf, len, '\n');
+        if ( !stralloc_catb(&r->line, buf, n) ) {
+            carpsys("stralloc_catb");
+            return -1;
+        }
+        if ( n == len )
+            return 0;
+        buf += n+1;
+        len -= n+1;
+        if ( r->line.len && r->line.s[r->line.len-1] == '\r' )
+            r->line.len--;
+        if ( !stralloc_0(&r->line) ) {
+            carpsys("stralloc_0");
+            return -1;
+        }
+        if ( process_line(r, r->line.s) )
+            return -1;
+        r->line.len = 0;
+    }
+    return 0;
+}
+
+/* at the end of the connection: -1 if the body was cut short */
+int http_finish( struct http_response *r )
+{
+    if ( r->state == HTTP_DONE || (r->state == HTTP_BODY && !r->has_length) )
+        return 0;
+    carp("incomplete HTTP response");
+    return -1;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+static int collect( void *ctx, char *buf )
+{
+    return stralloc_cats((stralloc *)ctx, buf)?0:-1;
+}
+
+/* feeds the response in pieces of every size and expects body each time */
+static void check( const char *response, const char *body, int result )
+{
+    struct http_response r;
+    stralloc sa;
+    size_t step, i, len=str_len(response);
+
+    for (step=1; step<=len; ++step) {
+        int ret=0;
+        stralloc_init(&sa);
+        init_http_response(&r, collect, &sa);
+        for (i=0; !ret && i<len; i+=step)
+            ret = http_feed(&r, response+i, (len-i<step)?len-i:step);
+        if ( !ret )
+            ret = http_finish(&r);
+        assert(ret==result);
+        if ( !result )
+            assert(sa.len==str_len(body) && (!sa.len || !memcmp(sa.s, body, sa.len)));
+        free_http_response(&r);
+        stralloc_free(&sa);
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    check("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello, trailing garbage", "hello", 0);
+    check("HTTP/1.0 200 OK\nServer: x\n\nuntil the end\r\n", "until the end\r\n", 0);
+    check("HTTP/1.1 207 Multi-Status\r\ntransfer-encoding: chunked\r\n\r\n"
+            "4\r\nBEGI\r\n7;ext=1\r\nN:VEVEN\r\n1\r\nT\r\n0\r\nX-Trailer: 1\r\n\r\n", "BEGIN:VEVENT", 0);
+    check("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", "ok", 0);
+    check("HTTP/1.1 404 Not Found\r\nContent-Length: 2\r\n\r\nno", NULL, -1);
+    check("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort", NULL, -1);
+    check("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nshort", NULL, -1);
+    check("<html>", NULL, -1);
+    check("HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n", "", 0);
+
+    struct http_response r;
+    init_http_response(&r, collect, NULL);
+    assert(0==http_feed(&r, "HTTP/1.1 200 OK\r\nETag: W/\"v2\"\r\nContent-Length: 0\r\n\r\n", 52));
+    assert(r.state==HTTP_DONE && r.etag.len==6 && !memcmp(r.etag.s, "W/\"v2\"", 6));
+    free_http_response(&r);
+
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef HTTP_H
+#define HTTP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stralloc.h>
+
+/* body bytes handed to the parser at once */
+#define HTTP_SEGMENT 4096
+
+enum http_state {
+    HTTP_STATUS_LINE=0,
+    HTTP_HEADER,
+    HTTP_BODY,
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_END,
+    HTTP_TRAILER,
+    HTTP_DONE
+};
+
+/*
+ * incremental HTTP/1.1 response decoder: checks the status, removes the
+ * chunked transfer coding and feeds the body to the parser as NUL terminated
+ * strings, the way ics_parser() expects them
+ */
+struct http_response {
+    enum http_state state;
+    unsigned short status;
+    bool chunked;
+    bool has_length;
+    unsigned long long remaining;
+    stralloc line;
+    stralloc etag;
+    int (*parser)( void *, char * );
+    void *parser_ctx;
+    char segment[HTTP_SEGMENT+1];
+};
+
+void set_http_verbosity( short );
+void init_http_response( struct http_response *, int(*)(void *,char *), void * );
+void free_http_response( struct http_response * );
+int http_feed( struct http_response *, const char *, size_t );
+int http_finish( struct http_response * );
+#endif
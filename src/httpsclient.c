@@ -5,11 +5,17 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
 #include <buffer.h>
 #include <errmsg.h>
 #include <str.h>
@@ -19,9 +25,24 @@
 #include <openssl/ssl.h>
 #endif
 #include <textcode.h>
+#include <stralloc.h>
 #include "httpsclient.h"
+#include "http.h"
 
 #define BUFFERSIZE 500
+/* pipelined mode: the receive thread is at most PIPE_SLOTS reads ahead of the parser */
+#define PIPE_SLOTS 8
+#define PIPE_SLOTSIZE 65536
+/* RFC 8305 recommends 250ms between starting two connection attempts */
+#define CONNECTION_ATTEMPT_DELAY_MS 250
+
+/* one established connection, plain or TLS; the socket is non-blocking */
+struct connection {
+    int sock;
+#ifndef NOSSL
+    SSL *ssl;
+#endif
+};
 
 #define V(__l,__fn) do{if(httpsclient_verbosity>=__l){ __fn; }}while(0);
 short httpsclient_verbosity=0;
@@ -30,11 +51,142 @@ void set_httpsclient_verbosity( short v ) {
     httpsclient_verbosity=v;
 }
 
+static unsigned long long now_ms( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/* absolute deadline of a phase taking at most timeout seconds, capped by the total deadline */
+static unsigned long long deadline_in( const struct fetch_context *fc, unsigned short timeout, unsigned short dflt )
+{
+    unsigned long long d = now_ms() + (timeout?timeout:dflt)*1000ULL;
+    return (d < fc->deadline)?d:fc->deadline;
+}
+
+static int wait_socket( int sock, short events, unsigned long long deadline, const char *what )
+{
+    struct pollfd pfd = { sock, events, 0 };
+    unsigned long long now;
+    int r;
+
+    for (;;) {
+        if ( (now=now_ms()) >= deadline ) {
+            carp("timeout while waiting for ", what);
+            return -1;
+        }
+        r = poll( &pfd, 1, (int)(deadline-now) );
+        if ( r > 0 )
+            return 0;
+        if ( r < 0 && errno != EINTR ) {
+            carpsys("poll");
+            return -1;
+        }
+    }
+}
+
+#ifndef NOSSL
+/* poll until the socket can do what a non-blocking SSL call asked for, -1 on other errors */
+static int ssl_wait( struct connection *c, int ret, unsigned long long deadline, const char *what )
+{
+    switch ( SSL_get_error( c->ssl, ret ) ) {
+    case SSL_ERROR_WANT_READ:
+        return wait_socket( c->sock, POLLIN, deadline, what );
+    case SSL_ERROR_WANT_WRITE:
+        return wait_socket( c->sock, POLLOUT, deadline, what );
+    default:
+        return -1;
+    }
+}
+#endif
+
+/*
+ * bytes read, 0 at the orderly end of the response, -1 on timeout or error:
+ * a connection reset or a TLS stream cut off without close_notify may
+ * have truncated a body that is read until the close
+ */
+static ssize_t conn_read( struct connection *c, char *buf, size_t len, unsigned long long deadline, const char *what )
+{
+    ssize_t r;
+
+    for (;;) {
+#ifndef NOSSL
+        if ( c->ssl ) {
+            int ret = SSL_read( c->ssl, buf, len );
+            if ( ret > 0 )
+                return ret;
+            switch ( SSL_get_error( c->ssl, ret ) ) {
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                if ( ssl_wait( c, ret, deadline, what ) )
+                    return -1;
+                continue;
+            default:
+                /* also how the receive thread ends after a shutdown, so only with -v */
+                V(1,carp("TLS connection broken while waiting for ", what));
+                return -1;
+            }
+        }
+#endif
+        r = read( c->sock, buf, len );
+        if ( r >= 0 )
+            return r;
+        if ( errno == EINTR )
+            continue;
+        if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+            carpsys("read");
+            return -1;
+        }
+        if ( wait_socket( c->sock, POLLIN, deadline, what ) )
+            return -1;
+    }
+}
+
+static int conn_write( struct connection *c, const char *buf, size_t len, unsigned long long deadline )
+{
+    ssize_t w;
+
+    while ( len ) {
+#ifndef NOSSL
+        if ( c->ssl ) {
+            int ret = SSL_write( c->ssl, buf, len );
+            if ( ret <= 0 ) {
+                if ( ssl_wait( c, ret, deadline, "sending the request" ) )
+                    return -1;
+                continue;
+            }
+            w = ret;
+        } else
+#endif
+        {
+            w = write( c->sock, buf, len );
+            if ( w < 0 ) {
+                if ( errno == EINTR )
+                    continue;
+                if ( (errno != EAGAIN && errno != EWOULDBLOCK) ||
+                        wait_socket( c->sock, POLLOUT, deadline, "sending the request" ) ) {
+                    carpsys("write");
+                    return -1;
+                }
+                continue;
+            }
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
 struct url_parts {
     char *authstring;
     char *hostname;
     char *service;
+    char *port;
     char *path;
+    char *label;
 };
 
 static int show_connection_info( const struct addrinfo *ai )
@@ -68,8 +220,12 @@ static int show_connection_info( const struct addrinfo *ai )
 }
 
 #ifndef NOSSL
-static int ssl_context_setup( SSL_CTX **ssl_ctx, SSL **ssl, const int *sock, const char *hostname )
+static int ssl_context_setup( struct fetch_context *fc, SSL_CTX **ssl_ctx, struct connection *c, const char *hostname, const char *label )
 {
+    unsigned long long t, deadline;
+    SSL **ssl = &c->ssl;
+    int ret;
+
     *ssl_ctx = SSL_CTX_new( TLS_client_method() );
 
     if ( ! *ssl_ctx ) {
@@ -77,20 +233,28 @@ static int ssl_context_setup( SSL_CTX **ssl_ctx, SSL **ssl, const int *sock, con
         return -1;
     }
     SSL_CTX_set_verify( *ssl_ctx, SSL_VERIFY_PEER, NULL );
-    if ( ! SSL_CTX_set_default_verify_paths(*ssl_ctx) )
+    if ( fc->general && fc->general->ca_file ) {
+        if ( ! SSL_CTX_load_verify_locations(*ssl_ctx, fc->general->ca_file, NULL) ) {
+            carp("cannot load CAs from ", fc->general->ca_file);
+            return -1;
+        }
+    } else if ( ! SSL_CTX_set_default_verify_paths(*ssl_ctx) )
         return -1;
 
     *ssl = SSL_new( *ssl_ctx );
 
     if ( ! *ssl ||
-         ! SSL_set_fd( *ssl, *sock ) ||
+         ! SSL_set_fd( *ssl, c->sock ) ||
          ! SSL_set_tlsext_host_name( *ssl, hostname ) ||
          ! SSL_set1_host( *ssl, hostname ) )
         return -1;
 
-    int ret=SSL_connect( *ssl );
-    if ( 0 > ret ) {
-        //int err = SSL_get_error(*ssl, ret);
+    t = fc->trace?trace_now():0;
+    deadline = deadline_in( fc, fc->general?fc->general->tls_timeout:0, DEFAULT_TLS_TIMEOUT );
+    while ( 1 != (ret=SSL_connect( *ssl )) && !ssl_wait( c, ret, deadline, "the TLS handshake" ) )
+        ;
+    trace_complete(fc->trace, "fetch", "tls handshake", label, t);
+    if ( 1 != ret ) {
         carp("SSL_connect");
         return -1;
     }
@@ -100,39 +264,119 @@ static int ssl_context_setup( SSL_CTX **ssl_ctx, SSL **ssl, const int *sock, con
 }
 #endif
 
-static int establish_connection( int *sock, const char *hostname, const char *service )
+/*
+ * races the addresses against each other as of RFC 8305: a new attempt
+ * starts whenever the last one failed or did not finish within
+ * CONNECTION_ATTEMPT_DELAY_MS, the first connected socket wins
+ */
+static int connect_any( const struct addrinfo *addr_list, unsigned long long deadline )
 {
-    int gai_result = 0, ret=0;
-    struct addrinfo hints, *addr_list;
+    const struct addrinfo *addr[DNS_MAX_ADDRESSES];
+    struct pollfd pfd[DNS_MAX_ADDRESSES];
+    size_t n = dns_sort_addresses(addr_list, addr, DNS_MAX_ADDRESSES);
+    size_t started=0, active=0, i;
+    int sock=-1, err, timeout;
+    unsigned long long now;
+    socklen_t errlen;
+
+    while ( sock < 0 && (started < n || active) ) {
+        if ( started < n ) {
+            const struct addrinfo *ai = addr[started];
+            int s = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+
+            pfd[started].fd = -1;
+            pfd[started].events = POLLOUT;
+            pfd[started].revents = 0;
+            started++;
+            if ( s < 0 ) {
+                carpsys("socket");
+                continue;
+            }
+            V(2,show_connection_info( ai ));
+            io_nonblock(s);
+            if ( !connect( s, ai->ai_addr, ai->ai_addrlen ) ) {
+                sock = s;
+                break;
+            }
+            if ( errno != EINPROGRESS ) {
+                carpsys("connect");
+                close(s);
+                continue;
+            }
+            pfd[started-1].fd = s;
+            active++;
+        }
 
-    memset( &hints, 0, sizeof(hints) );
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
+        if ( (now=now_ms()) >= deadline ) {
+            carp("timeout while connecting");
+            break;
+        }
+        timeout = (int)(deadline-now);
+        if ( started < n && timeout > CONNECTION_ATTEMPT_DELAY_MS )
+            timeout = CONNECTION_ATTEMPT_DELAY_MS;
+        if ( 0 > poll( pfd, started, timeout ) ) {
+            if ( errno == EINTR )
+                continue;
+            carpsys("poll");
+            break;
+        }
+        for (i=0; i<started; ++i) {
+            if ( pfd[i].fd < 0 || !pfd[i].revents )
+                continue;
+            errlen = sizeof(err);
+            if ( getsockopt( pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen ) || err ) {
+                errno = err;
+                carpsys("connect");
+                close(pfd[i].fd);
+                pfd[i].fd = -1;
+                active--;
+                continue;
+            }
+            sock = pfd[i].fd;
+            pfd[i].fd = -1;
+            break;
+        }
+    }
 
-    gai_result = getaddrinfo( hostname, service, &hints, &addr_list );
-    if ( gai_result ) {
-        buffer_puts(buffer_2, "getaddrinfo");
-        buffer_putsflush(buffer_2, (gai_result == EAI_SYSTEM)?strerror(gai_result):gai_strerror(gai_result));
-        ret=-1;
-        goto cleanup;
+    for (i=0; i<started; ++i)
+        if ( pfd[i].fd >= 0 )
+            close(pfd[i].fd);
+    return sock;
+}
+
+static int establish_connection( struct fetch_context *fc, int *sock, const struct url_parts *up )
+{
+    struct dns_cache local, *dc = fc->dns;
+    const struct addrinfo *addr_list;
+    unsigned long long t;
+    int ret=0;
+
+    /* without a cache shared by the caller, the lookup is only kept for this fetch */
+    if ( !dc ) {
+        init_dns_cache(&local, fc->general?fc->general->dns_ttl:0);
+        dc = &local;
     }
 
-    for ( struct addrinfo *ai = addr_list; ai; ai = ai->ai_next ) {
-        *sock = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
-        if ( *sock < 0 ) continue;
-        V(2,show_connection_info( ai ));
+    t = fc->trace?trace_now():0;
+    /* getaddrinfo has no timeout of its own, the total deadline bounds it */
+    ret = dns_lookup( dc, up->hostname, up->port?up->port:up->service, fc->deadline, &addr_list );
+    trace_complete(fc->trace, "fetch", "dns", up->label, t);
+    if ( ret )
+        goto cleanup;
 
-        if ( connect( *sock, ai->ai_addr, ai->ai_addrlen ) ) {
-            carpsys("connect");
-            ret=-1;
-            goto cleanup;
-        }
-        break;
+    t = fc->trace?trace_now():0;
+    *sock = connect_any( addr_list, deadline_in( fc, fc->general?fc->general->connect_timeout:0, DEFAULT_CONNECT_TIMEOUT ) );
+    trace_complete(fc->trace, "fetch", "connect", up->label, t);
+    if ( *sock < 0 ) {
+        carp("no address of ", up->hostname, " could be connected");
+        ret=-1;
+        goto cleanup;
     }
     V(2,buffer_putsflush(buffer_2,"connection established\n"));
 
 cleanup:
-    freeaddrinfo(addr_list);
+    if ( dc == &local )
+        free_dns_cache(&local);
     return ret;
 }
 
@@ -155,98 +399,318 @@ static int set_global_authstring( struct url_parts *up, const struct general_con
     return 0;
 }
 
-static int get_response( int *sock, const struct url_parts *up, char *user, int(*parser)(char*,char*) )
+/* request line and headers, plus the body for methods like REPORT */
+static int build_request( const struct fetch_context *fc, const struct url_parts *up, stralloc *req )
 {
-    char buf[BUFFERSIZE];
-#ifndef NOSSL
-    SSL_CTX *ssl_ctx = NULL;
-    SSL *ssl = NULL;
-#endif
-    char *getstrings[]={ "GET "," HTTP/1.1\nHost: ","\nConnection: close\nAuthorization: Basic ","\n\n" };
-    ssize_t slen=0, rlen=1;
-    bool is_https = str_equal(up->service, "https");
-    char *b64auth=NULL, *msg=NULL;
+    char *b64auth=NULL;
+    bool v6 = up->hostname[str_chr(up->hostname, ':')];
+    int ok;
 
     if ( up->authstring ){
         size_t plen = str_len(up->authstring);
         b64auth = calloc( ((plen+2)/3)*4+1, sizeof(char));;
         if (!b64auth) {
-            carpsys("calloc"); goto err;
+            carpsys("calloc");
+            return -1;
         }
         plen=fmt_base64(b64auth,up->authstring,plen);
         b64auth[plen]='\0';
     }
 
-    for (size_t i=0;i<4;i++) slen+=str_len(getstrings[i]);
-    slen += str_len(up->path) + str_len(up->hostname) + str_len(b64auth);
+    ok = stralloc_copys(req, fc->method?fc->method:"GET") &&
+        stralloc_cats(req, " ") && stralloc_cats(req, up->path) &&
+        stralloc_cats(req, " HTTP/1.1\r\nHost: ") &&
+        stralloc_cats(req, v6?"[":"") && stralloc_cats(req, up->hostname) && stralloc_cats(req, v6?"]":"") &&
+        (!up->port || (stralloc_cats(req, ":") && stralloc_cats(req, up->port))) &&
+        stralloc_cats(req, "\r\nConnection: close\r\n") &&
+        (!b64auth || (stralloc_cats(req, "Authorization: Basic ") && stralloc_cats(req, b64auth) &&
+                      stralloc_cats(req, "\r\n"))) &&
+        (!fc->headers || stralloc_cats(req, fc->headers)) &&
+        (!fc->if_none_match || (stralloc_cats(req, "If-None-Match: ") && stralloc_cats(req, fc->if_none_match) &&
+                                stralloc_cats(req, "\r\n"))) &&
+        (!fc->body || (stralloc_cats(req, "Content-Length: ") && stralloc_catulong0(req, fc->body_len, 0) &&
+                       stralloc_cats(req, "\r\n"))) &&
+        stralloc_cats(req, "\r\n") &&
+        (!fc->body || stralloc_catb(req, fc->body, fc->body_len));
+    if (b64auth) free(b64auth);
+    if ( !ok ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    return 0;
+}
 
-    msg = calloc( slen+1, sizeof(char));;
-    if (!msg) {
-        carpsys("calloc"); goto err;
-    } else {
-        size_t i;
-        i = fmt_str( msg, getstrings[0] );
-        i+= fmt_str( msg+i, up->path );
-        i+= fmt_str( msg+i, getstrings[1] );
-        i+= fmt_str( msg+i, up->hostname );
-        if ( b64auth ) {
-            i+= fmt_str( msg+i, getstrings[2] );
-            i+= fmt_str( msg+i, b64auth );
-            free(b64auth);
-            b64auth=NULL;
+/* reads the response and feeds it to the parser in turns */
+static int receive( struct fetch_context *fc, struct connection *conn, struct http_response *response,
+        struct trace_slices *parse_slices, const char *label, unsigned long long t_request, unsigned long long *t_first )
+{
+    char buf[BUFFERSIZE];
+    unsigned long long t, deadline;
+    ssize_t rlen;
+
+    deadline = deadline_in( fc, fc->general?fc->general->first_byte_timeout:0, DEFAULT_FIRST_BYTE_TIMEOUT );
+    for (;;) {
+        rlen = conn_read( conn, buf, BUFFERSIZE-1, deadline, *t_first?"the response":"the first byte" );
+        if ( 0 > rlen )
+            return -1;
+        if ( 0 == rlen )
+            return http_finish(response);
+        deadline = fc->deadline;
+        if ( fc->trace && !*t_first ) {
+            *t_first=trace_now();
+            trace_span(fc->trace, "fetch", "time to first byte", label, t_request, *t_first);
+        }
+        fc->bytes+=rlen;
+        t = (fc->trace || fc->metrics)?trace_now():0;
+        if ( http_feed(response, buf, rlen) )
+            return -1;
+        if ( fc->metrics )
+            fc->parse_us += trace_now()-t;
+        trace_slice(fc->trace, parse_slices, t);
+        if ( response->state == HTTP_DONE )
+            return 0;
+    }
+}
+
+#ifndef NOTHREADS
+/*
+ * the reads of the receive thread on their way to the parser: slot head is
+ * the next to parse, count are filled. The receive thread waits while all
+ * are filled, the parser while none is.
+ */
+struct pipe_ring {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct connection *conn;
+    unsigned long long deadline, first_byte_deadline;
+    unsigned long long t_first; // trace time of the first read
+    char *buf;
+    size_t len[PIPE_SLOTS];
+    size_t head, count;
+    bool eof, failed, stop;
+};
+
+static void *receive_thread( void *arg )
+{
+    struct pipe_ring *p = arg;
+    size_t i;
+    ssize_t r;
+    bool first = true, stop;
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while ( p->count == PIPE_SLOTS && !p->stop )
+            pthread_cond_wait(&p->changed, &p->lock);
+        i = (p->head + p->count) % PIPE_SLOTS;
+        stop = p->stop;
+        pthread_mutex_unlock(&p->lock);
+        if ( stop )
+            break;
+
+        r = conn_read( p->conn, p->buf + i*PIPE_SLOTSIZE, PIPE_SLOTSIZE,
+                first?p->first_byte_deadline:p->deadline, first?"the first byte":"the response" );
+        if ( first && r > 0 ) {
+            p->t_first = trace_now();
+            first = false;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        if ( r > 0 ) {
+            p->len[i] = r;
+            p->count++;
+        } else {
+            p->eof = true;
+            p->failed = (r < 0);
         }
-        i+= fmt_str( msg+i, getstrings[3] );
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+        if ( r <= 0 )
+            break;
     }
-    V(3, buffer_putsflush(buffer_2, msg); );
+    return NULL;
+}
 
+/*
+ * like receive, but a thread of its own reads ahead into a ring of large
+ * buffers while this one parses, so the network wait and the parsing overlap
+ */
+static int receive_pipelined( struct fetch_context *fc, struct connection *conn, struct http_response *response,
+        struct trace_slices *parse_slices, const char *label, unsigned long long t_request, unsigned long long *t_first )
+{
+    struct pipe_ring p;
+    pthread_t thread;
+    unsigned long long t;
+    size_t n;
+    char *data;
+    int ret=0;
+
+    memset(&p, 0, sizeof(struct pipe_ring));
+    if ( !(p.buf = malloc(PIPE_SLOTS*PIPE_SLOTSIZE)) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+    p.conn = conn;
+    p.deadline = fc->deadline;
+    p.first_byte_deadline = deadline_in( fc, fc->general?fc->general->first_byte_timeout:0, DEFAULT_FIRST_BYTE_TIMEOUT );
+    if ( pthread_create(&thread, NULL, receive_thread, &p) ) {
+        carp("failed to start the receive thread, reading in turns");
+        ret = receive( fc, conn, response, parse_slices, label, t_request, t_first );
+        goto out;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&p.lock);
+        while ( !p.count && !p.eof )
+            pthread_cond_wait(&p.changed, &p.lock);
+        if ( !p.count ) {
+            pthread_mutex_unlock(&p.lock);
+            ret = p.failed?-1:http_finish(response);
+            break;
+        }
+        n = p.len[p.head];
+        data = p.buf + p.head*PIPE_SLOTSIZE;
+        pthread_mutex_unlock(&p.lock);
+
+        if ( fc->trace && !*t_first ) {
+            *t_first = p.t_first;
+            trace_span(fc->trace, "fetch", "time to first byte", label, t_request, *t_first);
+        }
+        fc->bytes += n;
+        t = (fc->trace || fc->metrics)?trace_now():0;
+        if ( http_feed(response, data, n) )
+            ret = -1;
+        if ( fc->metrics )
+            fc->parse_us += trace_now()-t;
+        trace_slice(fc->trace, parse_slices, t);
+
+        pthread_mutex_lock(&p.lock);
+        p.head = (p.head+1) % PIPE_SLOTS;
+        p.count--;
+        pthread_cond_broadcast(&p.changed);
+        pthread_mutex_unlock(&p.lock);
+        if ( ret || response->state == HTTP_DONE )
+            break;
+    }
+
+    /* done before the end of the connection: wake the receive thread */
+    pthread_mutex_lock(&p.lock);
+    p.stop = true;
+    if ( !p.eof )
+        shutdown(conn->sock, SHUT_RD);
+    pthread_cond_broadcast(&p.changed);
+    pthread_mutex_unlock(&p.lock);
+    pthread_join(thread, NULL);
+out:
+    pthread_cond_destroy(&p.changed);
+    pthread_mutex_destroy(&p.lock);
+    free(p.buf);
+    return ret;
+}
+#endif
+
+static int get_response( struct fetch_context *fc, int *sock, const struct url_parts *up, int(*parser)(void*,char*), void *parser_ctx )
+{
+    struct trace_slices parse_slices = { "fetch", "parse", up->label, 0, 0 };
+    unsigned long long t_request=0, t_first=0;
+    struct connection conn;
+    struct http_response response;
 #ifndef NOSSL
-    if ( is_https && ssl_context_setup( &ssl_ctx, &ssl, sock, up->hostname ) )
+    SSL_CTX *ssl_ctx = NULL;
+#endif
+    stralloc req;
+    int ret=0;
+    bool is_https = str_equal(up->service, "https");
+
+    stralloc_init(&req);
+    memset(&conn, 0, sizeof(struct connection));
+    init_http_response(&response, parser, parser_ctx);
+    if ( build_request( fc, up, &req ) )
         goto err;
+    V(3, buffer_putsaflush(buffer_2, &req); );
 
-    if ( is_https )
-        slen = SSL_write( ssl, msg, slen );
-    else
+    conn.sock = *sock;
+#ifndef NOSSL
+    if ( is_https && ssl_context_setup( fc, &ssl_ctx, &conn, up->hostname, up->label ) )
+        goto err;
 #else
     if ( is_https ) {
         carp("program was compiled with NO SSL support");
         goto err;
     }
 #endif
-        slen = write( *sock, msg, slen );
 
-    if ( slen != str_len(msg) ) {
+    if ( conn_write( &conn, req.s, req.len, fc->deadline ) ) {
             carp("write incomplete");
             goto err;
     }
-    if (msg) free(msg);
+    stralloc_free(&req);
+    if (fc->trace) t_request=trace_now();
 
-    while ( 0 < rlen ) {
-#ifndef NOSSL
-        if ( is_https )
-            rlen = SSL_read(ssl, buf, BUFFERSIZE );
-        else
+#ifndef NOTHREADS
+    if ( fc->general && fc->general->pipeline )
+        ret = receive_pipelined( fc, &conn, &response, &parse_slices, up->label, t_request, &t_first );
+    else
 #endif
-            rlen = read(*sock, buf, BUFFERSIZE);
-
-        buf[rlen]=0;
-        parser(buf,user);
+        ret = receive( fc, &conn, &response, &parse_slices, up->label, t_request, &t_first );
+    fc->status = response.status;
+    if ( !stralloc_copy(&fc->etag, &response.etag) ) {
+        carpsys("stralloc_copy");
+        ret=-1;
     }
+    free_http_response(&response);
+    trace_slices_flush(fc->trace, &parse_slices);
+    if ( t_first )
+        trace_complete(fc->trace, "fetch", "body transfer", up->label, t_first);
 
 #ifndef NOSSL
-    if (ssl != NULL) {
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
+    if (conn.ssl != NULL) {
+        if ( !ret )
+            SSL_shutdown(conn.ssl);
+        SSL_free(conn.ssl);
     }
     SSL_CTX_free(ssl_ctx);
 #endif
 
-    return 0;
+    return ret;
 err:
-    if (msg) free(msg);
-    if (b64auth) free(b64auth);
+#ifndef NOSSL
+    if (conn.ssl) SSL_free(conn.ssl);
+    if (ssl_ctx) SSL_CTX_free(ssl_ctx);
+#endif
+    stralloc_free(&req);
+    free_http_response(&response);
     return -1;
 }
 
+/* host[:port] or [v6address][:port] */
+static int split_port( struct url_parts *up )
+{
+    char *h = up->hostname, *p;
+    size_t i;
+
+    if ( *h == '[' ) {
+        i = str_chr(h, ']');
+        if ( !h[i] || (h[i+1] && h[i+1] != ':') )
+            return -1;
+        p = h+i+1;
+        if ( *p && !(up->port = strdup(p+1)) ) {
+            carpsys("strdup");
+            return -1;
+        }
+        memmove(h, h+1, i-1);
+        h[i-1] = '\0';
+    } else if ( h[i=str_chr(h, ':')] ) {
+        if ( !(up->port = strdup(h+i+1)) ) {
+            carpsys("strdup");
+            return -1;
+        }
+        h[i] = '\0';
+    }
+    return 0;
+}
+
 static int split_uri( const char *uri, struct url_parts *up )
 {
     size_t pos=0, pos2=0, pos3=0, max=str_len(uri)+1;
@@ -270,34 +734,151 @@ static int split_uri( const char *uri, struct url_parts *up )
     }
     uri_slice( pos2, max, path);
 
+    return split_port( up );
+}
+
+/* "label host/path", without credentials, to tell calendars apart in traces */
+static int set_label( struct url_parts *up, const char *label )
+{
+    size_t i=0;
+
+    if ( !label ) label="";
+    up->label=calloc( str_len(label)+1+str_len(up->hostname)+str_len(up->path)+1, sizeof(char) );
+    if ( !up->label ) {
+        carpsys("calloc");
+        return -1;
+    }
+    i =fmt_str( up->label, label );
+    i+=fmt_str( up->label+i, " " );
+    i+=fmt_str( up->label+i, up->hostname );
+    i+=fmt_str( up->label+i, up->path );
+    up->label[i]='\0';
     return 0;
 }
 
-int fetch_calendar( char *user, const char *cal, const struct general_context *general, int(*cal_parser)(char*,char*) )
+int fetch_calendar( struct fetch_context *fc, const char *cal, int(*cal_parser)(void*,char*), void *parser_ctx )
 {
     int ret=0;
-    int sock=0;
+    int sock=-1;
     struct url_parts up;
     memset( &up, 0, sizeof(struct url_parts));
 
+    fc->status = 0;
+    fc->etag.len = 0;
+    fc->deadline = now_ms() + (fc->general && fc->general->total_timeout?
+            fc->general->total_timeout:DEFAULT_TOTAL_TIMEOUT)*1000ULL;
     if ( cal ) {
         if ( -1 == split_uri( cal, &up ) ||
-             -1 == set_global_authstring( &up, general ) ||
-             -1 == establish_connection( &sock, up.hostname, up.service) ||
-             -1 == get_response( &sock, &up, user, cal_parser ) ) {
+             ( fc->trace && -1 == set_label( &up, fc->label ) ) ||
+             -1 == set_global_authstring( &up, fc->general ) ||
+             -1 == establish_connection( fc, &sock, &up ) ||
+             -1 == get_response( fc, &sock, &up, cal_parser, parser_ctx ) ) {
             ret=-1;
         }
         if (up.service) free(up.service);
+        if (up.port) free(up.port);
         if (up.authstring) free(up.authstring);
         if (up.hostname) free(up.hostname);
         if (up.path) free(up.path);
-        close(sock);
+        if (up.label) free(up.label);
+        if (sock >= 0) close(sock);
     }
     return ret;
 }
 
 #ifdef UNITTEST
 #include <assert.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "caldav.h"
+
+static int collect( void *ctx, char *buf )
+{
+    return stralloc_cats((stralloc *)ctx, buf)?0:-1;
+}
+
+/* stand-in CalDAV server: answers one REPORT with a chunked multistatus */
+static void serve_report( int l )
+{
+    const char *response = "HTTP/1.1 207 Multi-Status\r\nTransfer-Encoding: chunked\r\n"
+        "Content-Type: application/xml\r\n\r\n"
+        "2a\r\n<d:multistatus xmlns:d=\"DAV:\"><d:response>\r\n"
+        "2d\r\n<c:calendar-data>BEGIN:VEVENT&#13;\nEND:VEVENT\r\n"
+        "2f\r\n</c:calendar-data></d:response></d:multistatus>\r\n0\r\n\r\n";
+    char req[4096];
+    size_t len=0;
+    ssize_t r;
+    int c = accept(l, NULL, NULL);
+
+    while ( c >= 0 && len < sizeof(req)-1 && 0 < (r=read(c, req+len, sizeof(req)-1-len)) ) {
+        len += r;
+        req[len] = '\0';
+        if ( strstr(req, "</C:calendar-query>") )
+            break;
+    }
+    if ( c < 0 || !str_start(req, "REPORT /cal/ HTTP/1.1\r\nHost: 127.0.0.1:") || !strstr(req, "\r\nDepth: 1\r\n") )
+        _exit(1);
+    write(c, response, str_len(response));
+    close(c);
+    _exit(0);
+}
+
+#define BODYSIZE (PIPE_SLOTS*PIPE_SLOTSIZE*2+123)
+
+/* stand-in web server: one GET, a body of BODYSIZE bytes, the connection stays open for a while */
+static void serve_body( int l )
+{
+    char buf[4096];
+    size_t len=0, i;
+    ssize_t r;
+    int c = accept(l, NULL, NULL);
+
+    while ( c >= 0 && len < sizeof(buf)-1 && 0 < (r=read(c, buf+len, sizeof(buf)-1-len)) ) {
+        len += r;
+        buf[len] = '\0';
+        if ( strstr(buf, "\r\n\r\n") )
+            break;
+    }
+    if ( c < 0 || !str_start(buf, "GET /big.ics HTTP/1.1\r\n") )
+        _exit(1);
+    len = fmt_str(buf, "HTTP/1.1 200 OK\r\nContent-Length: ");
+    len += fmt_ulong(buf+len, BODYSIZE);
+    len += fmt_str(buf+len, "\r\n\r\n");
+    write(c, buf, len);
+    for (i=0; i<sizeof(buf); ++i)
+        buf[i] = 'a'+i%26;
+    for (len=0; len<BODYSIZE; len+=r)
+        if ( 0 >= (r=write(c, buf, (BODYSIZE-len<sizeof(buf))?BODYSIZE-len:sizeof(buf))) )
+            _exit(1);
+    sleep(5);
+    close(c);
+    _exit(0);
+}
+
+/* stand-in web server: a body read until the close, cut off by a connection reset */
+static void serve_reset( int l )
+{
+    const char *response = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nBEGIN:VCALENDAR\r\n";
+    struct linger lg = { 1, 0 };
+    char buf[4096];
+    size_t len=0;
+    ssize_t r;
+    int c = accept(l, NULL, NULL);
+
+    while ( c >= 0 && len < sizeof(buf)-1 && 0 < (r=read(c, buf+len, sizeof(buf)-1-len)) ) {
+        len += r;
+        buf[len] = '\0';
+        if ( strstr(buf, "\r\n\r\n") )
+            break;
+    }
+    if ( c < 0 )
+        _exit(1);
+    write(c, response, str_len(response));
+    usleep(100000);
+    setsockopt(c, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(c);
+    _exit(0);
+}
 
 int main( int argc, char *argv[] )
 {
@@ -310,6 +891,110 @@ int main( int argc, char *argv[] )
     assert(str_equal(up.authstring,"usr:PaSs"));
     assert(str_equal(up.hostname,"ho.st.na.me"));
     assert(str_equal(up.path,"/path/to/cal.ics"));
+    free(up.service); free(up.authstring); free(up.hostname); free(up.path);
+    memset( &up, 0, sizeof(struct url_parts));
+    assert(0==split_uri( "http://[::1]:8080/cal", &up ));
+    assert(str_equal(up.hostname,"::1") && str_equal(up.port,"8080"));
+    free(up.service); free(up.hostname); free(up.port); free(up.path);
+
+    /* nothing listens on ::1, the IPv4 listener still wins */
+    struct sockaddr_in sin = { .sin_family=AF_INET, .sin_addr.s_addr=htonl(INADDR_LOOPBACK) };
+    socklen_t slen=sizeof(sin);
+    struct addrinfo *a6, *a4;
+    char port[8];
+    int l=socket(AF_INET, SOCK_STREAM, 0), s;
+    assert(0==bind(l, (struct sockaddr *)&sin, sizeof(sin)) && 0==listen(l, 1));
+    assert(0==getsockname(l, (struct sockaddr *)&sin, &slen));
+    port[fmt_ulong(port, ntohs(sin.sin_port))]='\0';
+    struct addrinfo hints = { .ai_socktype=SOCK_STREAM, .ai_flags=AI_NUMERICHOST };
+    assert(0==getaddrinfo("::1", port, &hints, &a6));
+    assert(0==getaddrinfo("127.0.0.1", port, &hints, &a4));
+    a6->ai_next=a4;
+    assert(0<=(s=connect_any(a6, now_ms()+1000)));
+
+    /* the listener never answers, the request runs into the first byte deadline */
+    struct general_context general = { .first_byte_timeout=1 };
+    struct fetch_context fc = { .general=&general };
+    struct url_parts req = { NULL, "127.0.0.1", "http", NULL, "/", NULL };
+    unsigned long long t = now_ms();
+    fc.deadline = t+10000;
+    assert(-1==get_response(&fc, &s, &req, NULL, NULL));
+    assert(now_ms()-t >= 1000 && now_ms()-t < 5000);
+    close(s);
+    close(l);
+    a6->ai_next=NULL;
+    freeaddrinfo(a6);
+    freeaddrinfo(a4);
+
+    /* CalDAV REPORT against the stand-in server, calendar-data arrives unescaped */
+    struct caldav_context cd;
+    stralloc ics, query, url;
+    pid_t pid;
+    int status;
+    l=socket(AF_INET, SOCK_STREAM, 0);
+    sin.sin_port=0;
+    assert(0==bind(l, (struct sockaddr *)&sin, sizeof(sin)) && 0==listen(l, 1));
+    assert(0==getsockname(l, (struct sockaddr *)&sin, &slen));
+    port[fmt_ulong(port, ntohs(sin.sin_port))]='\0';
+    if ( !(pid=fork()) )
+        serve_report(l);
+    stralloc_init(&ics); stralloc_init(&query); stralloc_init(&url);
+    assert(0==caldav_calendar_query(&query, 0, 86400, true));
+    assert(stralloc_copys(&url, "http://127.0.0.1:") && stralloc_cats(&url, port) &&
+            stralloc_cats(&url, "/cal/") && stralloc_0(&url));
+    init_caldav_context(&cd, collect, &ics);
+    memset(&general, 0, sizeof(general));
+    fc.method="REPORT";
+    fc.headers="Depth: 1\r\nContent-Type: application/xml; charset=utf-8\r\n";
+    fc.body=query.s;
+    fc.body_len=query.len;
+    assert(0==fetch_calendar(&fc, url.s, caldav_parser, &cd));
+    assert(waitpid(pid, &status, 0)==pid && WIFEXITED(status) && !WEXITSTATUS(status));
+    assert(cd.resources==1);
+    assert(stralloc_0(&ics) && str_equal(ics.s, "BEGIN:VEVENT\r\nEND:VEVENT\r\n"));
+    close(l);
+
+    /* pipelined: the whole body, and done without waiting for the end of the connection */
+    l=socket(AF_INET, SOCK_STREAM, 0);
+    sin.sin_port=0;
+    assert(0==bind(l, (struct sockaddr *)&sin, sizeof(sin)) && 0==listen(l, 1));
+    assert(0==getsockname(l, (struct sockaddr *)&sin, &slen));
+    port[fmt_ulong(port, ntohs(sin.sin_port))]='\0';
+    if ( !(pid=fork()) )
+        serve_body(l);
+    assert(stralloc_copys(&url, "http://127.0.0.1:") && stralloc_cats(&url, port) &&
+            stralloc_cats(&url, "/big.ics") && stralloc_0(&url));
+    memset(&fc, 0, sizeof(fc));
+    general.pipeline=1;
+    fc.general=&general;
+    ics.len=0;
+    t = now_ms();
+    assert(0==fetch_calendar(&fc, url.s, collect, &ics));
+    assert(now_ms()-t < 4000);
+    assert(ics.len==BODYSIZE && fc.bytes>=BODYSIZE && fc.status==200);
+    for (size_t i=0; i<ics.len; ++i)
+        assert(ics.s[i]=='a'+(i%4096)%26);
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    close(l);
+
+    /* a reset is no end of the body */
+    l=socket(AF_INET, SOCK_STREAM, 0);
+    sin.sin_port=0;
+    assert(0==bind(l, (struct sockaddr *)&sin, sizeof(sin)) && 0==listen(l, 1));
+    assert(0==getsockname(l, (struct sockaddr *)&sin, &slen));
+    port[fmt_ulong(port, ntohs(sin.sin_port))]='\0';
+    if ( !(pid=fork()) )
+        serve_reset(l);
+    assert(stralloc_copys(&url, "http://127.0.0.1:") && stralloc_cats(&url, port) &&
+            stralloc_cats(&url, "/cal.ics") && stralloc_0(&url));
+    general.pipeline=0;
+    ics.len=0;
+    assert(-1==fetch_calendar(&fc, url.s, collect, &ics));
+    assert(waitpid(pid, &status, 0)==pid && WIFEXITED(status) && !WEXITSTATUS(status));
+    close(l);
+    stralloc_free(&ics); stralloc_free(&query); stralloc_free(&url);
+    stralloc_free(&fc.etag);
 
     exit(EXIT_SUCCESS);
 }
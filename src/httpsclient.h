@@ -1,7 +1,36 @@
 #ifndef HTTPSCLIENT_H
 #define HTTPSCLIENT_H
+#include <stralloc.h>
 #include "config.h"
+#include "dns.h"
+#include "trace.h"
+#include "metrics.h"
+
+/* seconds, used when the [General] section does not set a timeout */
+#define DEFAULT_CONNECT_TIMEOUT 10
+#define DEFAULT_TLS_TIMEOUT 10
+#define DEFAULT_FIRST_BYTE_TIMEOUT 30
+#define DEFAULT_TOTAL_TIMEOUT 120
+
+/* options and results of fetching one calendar */
+struct fetch_context {
+    const struct general_context *general;
+    struct dns_cache *dns;
+    struct trace_context *trace;
+    struct metrics_context *metrics; // if set, every calendar is timed and recorded
+    const char *label;
+    const char *method;  // NULL: GET
+    const char *headers; // extra header lines, each ending in \r\n
+    const char *body;
+    size_t body_len;
+    unsigned long long deadline; // monotonic ms, set per fetch from total_timeout
+    unsigned long bytes;
+    unsigned long long fetch_us, parse_us; // of the last calendar, with metrics
+    const char *if_none_match; // ETag to revalidate against, a match gives status 304
+    unsigned short status; // HTTP status of the last response, 0 if there was none
+    stralloc etag; // of the last response, empty if there was none
+};
 
 void set_httpsclient_verbosity( short );
-int fetch_calendar( char *, const char *, const struct general_context *, int(*)(char *,char *) );
+int fetch_calendar( struct fetch_context *, const char *, int(*)(void *,char *), void * );
 #endif
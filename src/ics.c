@@ -9,7 +9,11 @@
 #include <str.h>
 #include <scan.h>
 #include "ics.h"
+#include "linescan.h"
+#include "hash.h"
 #include "format.h"
+#include "datetime.h"
+#include "template.h"
 
 #define V(__l,__fn) do{if(ics_verbosity>=__l){ __fn; }}while(0);
 short ics_verbosity=0;
@@ -18,71 +22,194 @@ void set_ics_verbosity( short v ) {
     ics_verbosity=v;
 }
 
-static time_t begin_year, end_year;
-unsigned char workday[366];
+static const struct formats format[] = {
+    { "text", text_header, text_timeline, text_footer, text_project, text_month },
+    { "html", html_header, html_timeline, html_footer, html_project, html_month },
+};
 
-struct calendar_context {
-    char *user;
-    char *subject;
-    time_t start;
-    //time_t pause;
-    time_t end;
-    bool dayevent;
-    bool recurring_yearly;
-    bool onsite;
-    struct calendar_context *next_entry;
-} *first_entry=NULL, *last_entry=NULL, *incubator=NULL;
+void init_ics_context( struct ics_context *ctx, struct holiday_table *holidays, char *user )
+{
+    memset(ctx, 0, sizeof(struct ics_context));
+    ctx->user = user;
+    ctx->holidays = holidays;
+    init_event_store(&ctx->store);
+    init_dedup_set(&ctx->seen);
+    init_tzone_list(&ctx->zones);
+}
+
+static void free_calentry( struct calendar_context *e )
+{
+    if (e->uid)
+        free(e->uid);
+    if (e->recur) {
+        if (e->recur->exdate)
+            free(e->recur->exdate);
+        free(e->recur);
+    }
+    free(e);
+}
 
-#define for_each_calentry(__entry) for (__entry=first_entry; (__entry); (__entry)=(__entry)->next_entry)
+void free_ics_context( struct ics_context *ctx )
+{
+    struct calendar_context *e, *next;
 
-struct glue_buffer {
-    char *str;
-    size_t alloc_len;
-} gbuf = { .str = NULL, .alloc_len=0 };
+    for (e=ctx->first_entry; e; e=next) {
+        next=e->next_entry;
+        free_calentry(e);
+    }
+    for (e=ctx->first_series; e; e=next) {
+        next=e->next_entry;
+        free_calentry(e);
+    }
+    if (ctx->incubator)
+        free_calentry(ctx->incubator);
+    if (ctx->spare)
+        free_calentry(ctx->spare);
+    stralloc_free(&ctx->subject);
+    if (ctx->gbuf.str)
+        free(ctx->gbuf.str);
+    free_event_store(&ctx->store);
+    free_dedup_set(&ctx->seen);
+    if (ctx->vtimezone)
+        tzone_abort(ctx->vtimezone);
+    free_tzone_list(&ctx->zones);
+    memset(ctx, 0, sizeof(struct ics_context));
+}
 
-struct stralloc output_line_sa;
+/*
+ * what makes two events of a user the same: UID and RECURRENCE-ID if there
+ * is a UID, else start, end and summary
+ */
+static uint64_t calentry_key( const char *subject, const struct calendar_context *e )
+{
+    unsigned long long h = hash_str("");
+    char kind = e->recur?'R':e->dayevent?'D':'T';
+
+    if ( e->user )
+        h = hash_buf(h, e->user, str_len(e->user)+1);
+    if ( e->uid ) {
+        h = hash_buf(h, "U", 1);
+        h = hash_buf(h, e->uid, str_len(e->uid)+1);
+        return hash_buf(h, (const char *)&e->recurrence_id, sizeof(e->recurrence_id));
+    }
+    h = hash_buf(h, &kind, 1);
+    h = hash_buf(h, (const char *)&e->start, sizeof(e->start));
+    h = hash_buf(h, (const char *)&e->end, sizeof(e->end));
+    return subject?hash_buf(h, subject, str_len(subject)+1):h;
+}
 
-struct formats format[] = {
-    { "text", text_header, text_timeline, text_footer },
-    { "html", html_header, html_timeline, html_footer },
-};
-struct formats current_format;
+/* 1 if ctx has taken the same event already, it is counted as a duplicate */
+static int is_duplicate( struct ics_context *ctx, const char *subject, const struct calendar_context *e )
+{
+    int ret = dedup_seen(&ctx->seen, calentry_key(subject, e));
 
-static int prepare_new_calentry(char *name)
+    if ( ret == 1 ) {
+        ctx->duplicates++;
+        V(3,carp("duplicate event dropped: ", e->uid?e->uid:subject?subject:"-"));
+    }
+    return ret;
+}
+
+/* the incubator is done with, it is kept for the next event */
+static void spare_calentry( struct ics_context *ctx )
+{
+    if ( ctx->spare )
+        free_calentry(ctx->spare);
+    ctx->spare = ctx->incubator;
+    ctx->incubator = NULL;
+}
+
+/* a plain event into ctx->summary */
+static int summarize_calentry( struct ics_context *ctx )
+{
+    struct calendar_context *e = ctx->incubator;
+    int ret;
+
+    ret = summary_add(ctx->summary, e->user, e->holidays, e->subject, calentry_subject(ctx, e),
+            e->start, e->end, e->dayevent, e->onsite);
+    spare_calentry(ctx);
+    return ret;
+}
+
+/*
+ * summary mode: 1 if the incubator is a plain event the summary does not
+ * take, else its pending SUMMARY is interned now, -1 if that fails
+ */
+static int skip_for_summary( struct ics_context *ctx )
+{
+    struct calendar_context *e = ctx->incubator;
+    const char *subject = ctx->subject.len?ctx->subject.s:NULL;
+
+    if ( !e->recur && !e->recurrence_id &&
+            !summary_takes(ctx->summary, e->holidays, subject, e->start, e->end, e->dayevent) )
+        return 1;
+    if ( subject && event_store_subject(&ctx->store, subject, &e->subject) )
+        return -1;
+    return 0;
+}
+
+static int prepare_new_calentry(struct ics_context *ctx)
 {
-    if (incubator) {
+    if (ctx->incubator) {
         carp("incubator is in use, cleaning up for new calendar entry");
-        if (incubator->subject)
-            free(incubator->subject);
-        free(incubator);
+        free_calentry(ctx->incubator);
     }
 
-    incubator = calloc( 1, sizeof(struct calendar_context) );
-    if (!incubator) {
+    if ( ctx->spare ) {
+        if ( ctx->spare->uid )
+            free(ctx->spare->uid);
+        memset(ctx->spare, 0, sizeof(struct calendar_context));
+        ctx->incubator = ctx->spare;
+        ctx->spare = NULL;
+    } else
+        ctx->incubator = calloc( 1, sizeof(struct calendar_context) );
+    if (!ctx->incubator) {
         carpsys("calloc");
         return -1;
     }
-    incubator->user = name;
-    incubator->subject = NULL;
-    incubator->start = 0;
-    //incubator->pause = 0;
-    incubator->end = 0;
-    incubator->dayevent = false;
-    incubator->recurring_yearly = false;
-    incubator->next_entry = NULL;
+    ctx->incubator->user = ctx->user;
+    ctx->incubator->holidays = ctx->holidays;
+    ctx->incubator->subject = 0;
+    ctx->incubator->start = 0;
+    //ctx->incubator->pause = 0;
+    ctx->incubator->end = 0;
+    ctx->incubator->dayevent = false;
+    ctx->incubator->recur = NULL;
+    ctx->incubator->next_entry = NULL;
+    ctx->start_utc = false;
+    ctx->start_zone = NULL;
+    ctx->subject.len = 0;
     return 0;
 }
 
-static int emerge_calentry()
+static int emerge_calentry(struct ics_context *ctx)
 {
-    struct calendar_context *e,*prev=first_entry;
+    struct calendar_context *e,*prev=ctx->first_entry;
+    struct calendar_context *incubator=ctx->incubator;
+
+    /* in the order of the data, sorted when adopted by another context */
+    if ( ctx->unsorted ) {
+        if ( ctx->last_entry )
+            ctx->last_entry->next_entry = incubator;
+        else
+            ctx->first_entry = incubator;
+        ctx->last_entry = incubator;
+        goto done;
+    }
+
+    /* series are kept aside until the report window is known */
+    if ( incubator->recur ) {
+        incubator->next_entry = ctx->first_series;
+        ctx->first_series = incubator;
+        goto done;
+    }
 
-    if (! first_entry) {
-        first_entry = incubator; last_entry = incubator;
+    if (! ctx->first_entry) {
+        ctx->first_entry = incubator; ctx->last_entry = incubator;
         goto done;
     }
 
-    for_each_calentry(e) {
+    for_each_calentry(ctx,e) {
 
         /* merge overlapping/adjacent vacation events per user */
         if ( str_equal( incubator->user, e->user ) &&
@@ -93,8 +220,7 @@ static int emerge_calentry()
                     e->end=incubator->end;
                 if ( incubator->start < e->start )
                     e->start=incubator->start;
-                free(incubator->subject);
-                free(incubator);
+                free_calentry(incubator);
                 goto done;
             }
         }
@@ -102,8 +228,8 @@ static int emerge_calentry()
         /* sort */
         if ( incubator->start <= e->start ) {
             incubator->next_entry = e;
-            if ( e == first_entry )
-                first_entry=incubator;
+            if ( e == ctx->first_entry )
+                ctx->first_entry=incubator;
             else
                 prev->next_entry=incubator;
             goto done;
@@ -113,9 +239,9 @@ static int emerge_calentry()
     }
 
     prev->next_entry = incubator;
-    last_entry = incubator;
+    ctx->last_entry = incubator;
 done:
-    incubator=NULL;
+    ctx->incubator=NULL;
     return 0;
 }
 
@@ -134,10 +260,12 @@ static struct tm get_period_boundaries(const short year, const short month, time
     if ( -1 != year )
         b.tm_year=year-1900;
     b.tm_mon=(0<month)?month-1:(!month)?0:b.tm_mon;
+    /* let mktime find out about DST at the boundary, not take the one of today */
+    b.tm_isdst=-1;
+    e=b;
     if ( begin )
         *begin=mktime(&b);
 
-    e=b;
     e.tm_mon=(0<month)?month:(!month)?12:e.tm_mon+1;
     if ( end )
         *end=mktime(&e);
@@ -145,17 +273,22 @@ static struct tm get_period_boundaries(const short year, const short month, time
     return b;
 }
 
-static unsigned short workdays_in_period( const time_t begin, const time_t end )
+/* workdays between the days of begin and end, both included */
+unsigned short workdays_in_period( const struct holiday_table *ht, const time_t begin, const time_t end )
 {
-    size_t i;
+    size_t i, last;
     unsigned short v=0;
+    uint64_t w;
     struct tm b,e;
     localtime_r(&begin,&b);
     localtime_r(&end,&e);
 
-    for ( i = b.tm_yday; i<=e.tm_yday; ++i )
-        if ( (workday[i] > 0) && (workday[i]<6) )
-            v++;
+    for ( i = b.tm_yday, last = e.tm_yday; i<=last; i = (i|63)+1 ) {
+        w = ht->workdays[i/64] >> (i%64);
+        if ( last/64 == i/64 )
+            w &= (2ULL << (last%64-i%64)) - 1;
+        v += __builtin_popcountll(w);
+    }
 
     V(3,
         buffer_puts(buffer_2,"period ");
@@ -171,45 +304,75 @@ static unsigned short workdays_in_period( const time_t begin, const time_t end )
     return v;
 }
 
-void init_holiday_list(const short year)
+/* just the month (or the year if month is 0) the report is about */
+void get_report_period( const short year, const short month, time_t *begin, time_t *end )
+{
+    get_period_boundaries(year, month, begin, end);
+}
+
+/* entries the report needs: the selected month(s), and the whole year for the vacation balance */
+void get_report_window( const struct holiday_table *ht, const short year, const short month, time_t *begin, time_t *end )
+{
+    get_period_boundaries(year, month, begin, end);
+    if ( ht->begin_year < *begin )
+        *begin = ht->begin_year;
+    if ( ht->end_year > *end )
+        *end = ht->end_year;
+}
+
+void init_holiday_list(struct holiday_table *ht, const short year)
 {
     size_t i;
     struct tm t;
     time_t e;
 
-    t = get_period_boundaries(year, 0, &begin_year, &end_year);
+    t = get_period_boundaries(year, 0, &ht->begin_year, &ht->end_year);
+    ht->first_wday = t.tm_wday;
+
+    e = ht->end_year-1;
+    localtime_r(&e, &t);
+    ht->days = t.tm_yday+1;
 
-    for (i=0; i<sizeof(workday); i++)
-        workday[i]=(i+t.tm_wday)%7;
+    memset(ht->workdays, 0, sizeof(ht->workdays));
+    for (i=0; i<ht->days; i++)
+        if ( (i+ht->first_wday)%7 > 0 && (i+ht->first_wday)%7 < 6 )
+            ht->workdays[i/64] |= 1ULL << (i%64);
+}
 
-    e = end_year-1;
-    if (localtime(&e)->tm_yday != 365)
-        workday[365] = 8;
+/* end of the occurrence of a series starting at start, keeps the day span and end time of the master */
+static time_t occurrence_end( const struct calendar_context *m, time_t start )
+{
+    const struct recurrence *r = m->recur;
+    long sday, stod, eday, etod, day, tod;
+
+    if ( m->end <= m->start )
+        return start;
+    if ( r->zone ) {
+        tzone_to_civil(r->zone, m->start, &sday, &stod);
+        tzone_to_civil(r->zone, m->end, &eday, &etod);
+        tzone_to_civil(r->zone, start, &day, &tod);
+        return tzone_from_civil(r->zone, day+(eday-sday), etod);
+    }
+    time_to_civil(m->start, r->utc, &sday, &stod);
+    time_to_civil(m->end, r->utc, &eday, &etod);
+    time_to_civil(start, r->utc, &day, &tod);
+    return civil_to_time(day+(eday-sday), etod, r->utc);
 }
 
-static int flag_holiday()
+static void flag_days( struct holiday_table *ht, const char *name, time_t start, time_t end )
 {
     struct tm b,e;
     size_t i;
 
-    if ( !incubator )
-        return -1;
-
-    if ( !incubator->dayevent ) {
-        carp("error: holiday is not a dayevent");
-        goto cleanup;
-    }
+    if ( (start >= ht->end_year) || (end < ht->begin_year) )
+        return;
 
-    if ( ! incubator->recurring_yearly &&
-            ((incubator->start >= end_year) || (incubator->end < begin_year)) )
-        goto cleanup;
-
-    localtime_r(&incubator->start, &b);
-    localtime_r(&incubator->end, &e);
+    localtime_r(&start, &b);
+    localtime_r(&end, &e);
 
     if ( b.tm_yday >= e.tm_yday && !( (e.tm_yday==0) && (b.tm_year+1==e.tm_year) ) ) {
         carp("holiday has begin after end");
-        goto cleanup;
+        return;
     }
 
     for (i=b.tm_yday; i<e.tm_yday; ++i) {
@@ -217,206 +380,794 @@ static int flag_holiday()
             buffer_puts(buffer_2,"day ");
             buffer_putulong(buffer_2,i);
             buffer_puts(buffer_2," (wday=");
-            buffer_putulong(buffer_2,workday[i]);
+            buffer_putulong(buffer_2,(i+ht->first_wday)%7);
             buffer_puts(buffer_2,") of the year marked as holiday (");
-            buffer_puts(buffer_2,incubator->subject);
+            buffer_puts(buffer_2,name);
             buffer_putsflush(buffer_2,")\n");
          );
-        workday[i]=7;
+        ht->workdays[i/64] &= ~(1ULL << (i%64));
+    }
+}
+
+static int flag_holiday(struct ics_context *ctx)
+{
+    struct calendar_context *incubator=ctx->incubator;
+    struct holiday_table *ht=ctx->holidays;
+
+    if ( !incubator )
+        return -1;
+
+    if ( !incubator->dayevent ) {
+        carp("error: holiday is not a dayevent");
+        goto cleanup;
     }
 
+    if ( incubator->recur ) {
+        struct recurrence *r = incubator->recur;
+        struct rrule_iter it;
+        time_t t;
+
+        rrule_iter_init(&it, &r->rule, incubator->start, incubator->end-incubator->start,
+                r->utc, r->zone, ht->begin_year, ht->end_year);
+        rrule_iter_exclude(&it, r->exdate, r->exdates);
+        while ( rrule_next(&it, &t) )
+            flag_days(ht, calentry_subject(ctx, incubator), t, occurrence_end(incubator, t));
+    } else
+        flag_days(ht, calentry_subject(ctx, incubator), incubator->start, incubator->end);
+
 cleanup:
-    if (incubator->subject)
-        free(incubator->subject);
-    free(incubator);
-    incubator=NULL;
+    free_calentry(incubator);
+    ctx->incubator=NULL;
     return 0;
 }
 
-static time_t str2time_t( const char *ts, const bool dayevent )
+static struct recurrence *get_recurrence( struct calendar_context *e )
 {
-    unsigned long x;
-    time_t buf;
-    struct tm t;
-    memset(&t, 0, sizeof(struct tm));
-    size_t o=0,l;
+    if ( !e->recur && !(e->recur = calloc(1, sizeof(struct recurrence))) )
+        carpsys("calloc");
+    return e->recur;
+}
 
-    // yyyymmddThhmmssZ
-    if ( str_len(ts) < (sizeof("yyyymmdd")-1) )
+static int add_exdate( struct recurrence *r, time_t t )
+{
+    time_t *x = realloc(r->exdate, (r->exdates+1)*sizeof(time_t));
+
+    if ( !x ) {
+        carpsys("realloc");
         return -1;
-    l=sizeof("yyyy")-1;
-    scan_ulongn(ts, l, &x);
-    t.tm_year=(int)(x-1900);
-    o+=l;
-    l=sizeof("mm")-1;
-    scan_ulongn(ts+o, l, &x);
-    t.tm_mon=(int)(x-1);
-    o+=l;
-    l=sizeof("dd")-1;
-    scan_ulongn(ts+o, l, &x);
-    t.tm_mday=(int)(x);
-    if ( ! dayevent && ( str_len(ts) == sizeof("yyyymmddThhmmssZ")-1 ) ) {
-        o+=l+(sizeof("T")-1);
-        l=(sizeof("hh")-1);
-        scan_ulongn(ts+o, l, &x);
-        t.tm_hour=(int)(x);
-        o+=l;
-        l=(sizeof("mm")-1);
-        scan_ulongn(ts+o, l, &x);
-        t.tm_min=(int)(x);
-        o+=l;
-        l=(sizeof("ss")-1);
-        scan_ulongn(ts+o, l, &x);
-        t.tm_sec=(int)(x);
-        buf = mktime(&t);
-        if ( ts[o+l]=='Z' ) {
-            if ( t.tm_zone )
-                buf+= t.tm_gmtoff;
-            else
-                buf+= timezone;
+    }
+    r->exdate = x;
+    r->exdate[r->exdates++] = t;
+    return 0;
+}
+
+/* the parameters of a property that matter for its date or date-time value */
+struct prop_params {
+    const char *tzid;
+    size_t tzid_len;
+    bool date; // VALUE=DATE
+};
+
+/*
+ * parameters after the name of n bytes, the value after them or NULL if
+ * there is none. Parameter values may be quoted (RFC 5545 3.2).
+ */
+static const char *parse_params( const char *line, size_t n, struct prop_params *pp )
+{
+    const char *p=line+n, *name, *v;
+    size_t l, vl;
+
+    pp->tzid = NULL;
+    pp->date = false;
+    while ( *p == ';' ) {
+        name = ++p;
+        l = str_chr(name, '=');
+        if ( !name[l] )
+            return NULL;
+        v = name+l+1;
+        if ( *v == '"' ) {
+            vl = str_chr(++v, '"');
+            p = v+vl+(v[vl]?1:0);
+        } else {
+            vl = strcspn(v, ";:");
+            p = v+vl;
         }
-        return buf;
-    } else {
-        return mktime(&t);
+        if ( l == 4 && !memcmp(name, "TZID", 4) ) {
+            pp->tzid = v;
+            pp->tzid_len = vl;
+        } else if ( l == 5 && !memcmp(name, "VALUE", 5) )
+            pp->date = (vl == 4 && !memcmp(v, "DATE", 4));
+    }
+    return (*p == ':')?p+1:NULL;
+}
+
+static const struct tzone *param_zone( struct ics_context *ctx, const struct prop_params *pp )
+{
+    return (pp->tzid && !pp->date)?tzone_find(&ctx->zones, pp->tzid, pp->tzid_len):NULL;
+}
+
+/* a date or date-time, in the zone of its TZID if it has one that is known */
+static time_t parse_dt( const struct tzone *zone, const char *v, bool dayevent, bool *utc, const struct tzone **used )
+{
+    long day, tod;
+    bool z;
+
+    if ( used )
+        *used = NULL;
+    if ( !zone || dayevent )
+        return datetime_parse(v, dayevent, utc);
+    if ( datetime_scan(v, false, &day, &tod, &z) )
+        return -1;
+    if ( utc )
+        *utc = z;
+    if ( z )
+        return civil_to_time(day, tod, true);
+    if ( used )
+        *used = zone;
+    return tzone_from_civil(zone, day, tod);
+}
+
+/* a date or date-time value that ends at a comma or the end of the line */
+static time_t parse_datetime_item( const struct tzone *zone, const char *v, size_t len )
+{
+    char ts[sizeof("yyyymmddThhmmssZ")];
+
+    if ( len >= sizeof(ts) )
+        return -1;
+    memcpy(ts, v, len);
+    ts[len] = '\0';
+    return parse_dt(zone, ts, (len == sizeof("yyyymmdd")-1), NULL, NULL);
+}
+
+static int parse_exdate( struct calendar_context *e, const char *v, const struct tzone *zone )
+{
+    struct recurrence *r;
+    size_t l;
+    time_t t;
+
+    if ( !(r=get_recurrence(e)) )
+        return -1;
+    while ( *v ) {
+        l = str_chr(v, ',');
+        if ( 0 < (t=parse_datetime_item(zone, v, l)) && add_exdate(r, t) )
+            return -1;
+        v += l + (v[l]?1:0);
+    }
+    return 0;
+}
+
+static void drop_recurrence( struct calendar_context *e )
+{
+    if ( e->recur->exdate )
+        free(e->recur->exdate);
+    free(e->recur);
+    e->recur = NULL;
+}
+
+/*
+ * Turns the series collected by the parser into plain entries, but only the
+ * occurrences that touch [begin,end). Overrides (RECURRENCE-ID) were parsed
+ * as plain entries already and replace the occurrence they were split off from,
+ * in the series of the same user: a meeting shared by two users has one UID.
+ */
+int expand_calentries( struct ics_context *ctx, time_t begin, time_t end )
+{
+    struct calendar_context *m, *o, *next, *pending=ctx->incubator;
+    struct rrule_iter it;
+    time_t t;
+
+    for_each_calentry(ctx, o) {
+        if ( !o->recurrence_id || !o->uid )
+            continue;
+        for (m=ctx->first_series; m; m=m->next_entry)
+            if ( m->uid && str_equal(m->uid, o->uid) && str_equal(m->user, o->user) &&
+                    add_exdate(m->recur, o->recurrence_id) )
+                return -1;
+    }
+
+    for (m=ctx->first_series; m; m=next) {
+        next = m->next_entry;
+        rrule_iter_init(&it, &m->recur->rule, m->start, m->end-m->start, m->recur->utc, m->recur->zone, begin, end);
+        rrule_iter_exclude(&it, m->recur->exdate, m->recur->exdates);
+        while ( rrule_next(&it, &t) ) {
+            if ( !(o = calloc(1, sizeof(struct calendar_context))) ) {
+                carpsys("calloc");
+                ctx->first_series = m;
+                ctx->incubator = pending;
+                return -1;
+            }
+            o->user = m->user;
+            o->subject = m->subject;
+            o->holidays = m->holidays;
+            o->start = t;
+            o->end = occurrence_end(m, t);
+            o->dayevent = m->dayevent;
+            o->onsite = m->onsite;
+            ctx->incubator = o;
+            emerge_calentry(ctx);
+        }
+        free_calentry(m);
     }
+    ctx->first_series = NULL;
+    ctx->incubator = pending;
+    return 0;
 }
 
-int filter_project_calentries( const char *project )
+static void filter_project_list( const struct string_table *subjects, struct calendar_context **first,
+        struct calendar_context **last, const char *project )
 {
-    struct calendar_context *e, *prev=first_entry, *next;
+    struct calendar_context *e, *prev=*first, *next;
 
-    for(e=first_entry; e;) {
+    for(e=*first; e;) {
         next=e->next_entry;
-        if ( e->dayevent || !str_start(e->subject, project) ) {
-            if ( e == first_entry )
-                first_entry=next;
+        if ( e->dayevent || !e->subject || !str_start(subjects->str[e->subject], project) ) {
+            if ( e == *first )
+                *first=next;
             else
                 prev->next_entry=next;
-            if ( e == last_entry )
-                last_entry = prev;
-            if (e->subject)
-                free(e->subject);
-            free(e);
+            if ( last && e == *last )
+                *last = prev;
+            free_calentry(e);
         } else {
             prev=e;
         }
         e=next;
     }
+}
+
+int filter_project_calentries( struct ics_context *ctx, const char *project )
+{
+    filter_project_list(&ctx->store.subjects, &ctx->first_entry, &ctx->last_entry, project);
+    filter_project_list(&ctx->store.subjects, &ctx->first_series, NULL, project);
     return 0;
 }
 
-static int parse_ics_line( char *user )
+enum ics_property {
+    PROP_OTHER=0,
+    PROP_BEGIN,
+    PROP_END,
+    PROP_SUMMARY,
+    PROP_LOCATION,
+    PROP_UID,
+    PROP_DTSTART,
+    PROP_DTEND,
+    PROP_RRULE,
+    PROP_EXDATE,
+    PROP_RECURRENCE_ID
+};
+
+#define IS_PROP(__s) ( !memcmp(line, __s, sizeof(__s)-1) )
+
+/*
+ * the property of a line by the length and bytes of its name. memcmp with
+ * a constant length is done in one or two word loads by the compiler, so
+ * each line costs about one compare instead of a str_start per property.
+ */
+static enum ics_property classify_property( const char *line, size_t namelen )
+{
+    switch (namelen) {
+        case 3:
+            if ( IS_PROP("UID") ) return PROP_UID;
+            if ( IS_PROP("END") ) return PROP_END;
+            break;
+        case 5:
+            if ( IS_PROP("BEGIN") ) return PROP_BEGIN;
+            if ( IS_PROP("DTEND") ) return PROP_DTEND;
+            if ( IS_PROP("RRULE") ) return PROP_RRULE;
+            break;
+        case 6:
+            if ( IS_PROP("EXDATE") ) return PROP_EXDATE;
+            break;
+        case 7:
+            if ( IS_PROP("SUMMARY") ) return PROP_SUMMARY;
+            if ( IS_PROP("DTSTART") ) return PROP_DTSTART;
+            break;
+        case 8:
+            if ( IS_PROP("LOCATION") ) return PROP_LOCATION;
+            break;
+        case 13:
+            if ( IS_PROP("RECURRENCE-ID") ) return PROP_RECURRENCE_ID;
+            break;
+    }
+    return PROP_OTHER;
+}
+
+static int parse_ics_line( struct ics_context *ctx )
 {
+    struct calendar_context *incubator;
+    const char *line=ctx->gbuf.str, *value;
+    size_t len=ctx->gbuf.len, n;
+    enum ics_property prop;
+    struct prop_params pp;
 
     V(4,
             buffer_puts(buffer_2, "ICS: ");
-            buffer_puts(buffer_2, gbuf.str);
+            buffer_puts(buffer_2, line);
             buffer_putsflush(buffer_2, "\n");
     );
-    if ( str_start( gbuf.str, "BEGIN:VEVENT" ) )
-        prepare_new_calentry(user);
-    if ( str_start( gbuf.str, "END:VEVENT" ) ) {
-        if ( user )
-            emerge_calentry();
-        else
-            flag_holiday();
+    if ( ctx->stop_after == ICS_STAGE_SPLIT )
+        return 0;
+    n = linescan_name(line, len);
+    if ( n == len )
+        return 0;
+    prop = classify_property(line, n);
+    /* value right after "NAME:", NULL if the property has parameters */
+    value = (line[n] == ':')?line+n+1:NULL;
+
+    /* VTIMEZONE is compiled on its own, the zone is there for the events after it */
+    if ( ctx->vtimezone ) {
+        if ( prop == PROP_END && value && str_start(value, "VTIMEZONE") ) {
+            struct tzone_builder *b = ctx->vtimezone;
+            ctx->vtimezone = NULL;
+            return tzone_end(b, &ctx->zones);
+        }
+        return tzone_line(ctx->vtimezone, line);
     }
+    if ( prop == PROP_BEGIN && value && str_start(value, "VTIMEZONE") )
+        return (ctx->vtimezone = tzone_begin())?0:-1;
+    if ( prop == PROP_BEGIN && value && str_start(value, "VEVENT") )
+        return prepare_new_calentry(ctx);
+    if ( !(incubator=ctx->incubator) )
+        return 0;
+
+    switch (prop) {
+    case PROP_END:
+        if ( !value || !str_start(value, "VEVENT") )
+            break;
+        ctx->events++;
+        if ( ctx->stop_after == ICS_STAGE_PARSE ) {
+            free_calentry(incubator);
+            ctx->incubator=NULL;
+            return 0;
+        }
+        if ( incubator->recur ) {
+            incubator->recur->utc = ctx->start_utc;
+            incubator->recur->zone = ctx->start_zone;
+            if ( incubator->recur->rule.freq == RRULE_NONE )
+                drop_recurrence(incubator);
+        }
+        if ( !ctx->user )
+            return flag_holiday(ctx);
+        if ( ctx->summary ) {
+            switch ( skip_for_summary(ctx) ) {
+            case 0:
+                break;
+            case 1:
+                spare_calentry(ctx);
+                return 0;
+            default:
+                return -1;
+            }
+        }
+        /* a re-import or the same meeting twice is stored once */
+        switch ( is_duplicate(ctx, calentry_subject(ctx, incubator), incubator) ) {
+        case 0:
+            /* series and their overrides wait for the report window */
+            if ( ctx->summary && !incubator->recur && !incubator->recurrence_id )
+                return summarize_calentry(ctx);
+            return emerge_calentry(ctx);
+        case 1:
+            free_calentry(incubator);
+            ctx->incubator=NULL;
+            return 0;
+        default:
+            return -1;
+        }
 
-    if ( str_start( gbuf.str, "SUMMARY:" ) ) {
-        if ( !(incubator->subject = calloc( str_len(gbuf.str)-(sizeof("SUMMARY:")-1)+1, sizeof(char) ))) {
-            carpsys("calloc");
+    case PROP_SUMMARY:
+        if ( !value )
+            break;
+        /* in summary mode only once the event is known to count */
+        if ( ctx->summary ) {
+            if ( !stralloc_copyb(&ctx->subject, value, str_len(value)+1) ) {
+                carpsys("stralloc_copyb");
+                return -1;
+            }
+            break;
+        }
+        if ( event_store_subject(&ctx->store, value, &incubator->subject) )
+            return -1;
+        break;
+
+    case PROP_LOCATION:
+        if ( value )
+            incubator->onsite = true;
+        break;
+
+    case PROP_UID:
+        if ( !value )
+            break;
+        if ( incubator->uid )
+            free(incubator->uid);
+        if ( !(incubator->uid = strdup(value)) ) {
+            carpsys("strdup");
             return -1;
         }
-        str_copy( incubator->subject, gbuf.str+(sizeof("SUMMARY:")-1) );
-    }
+        break;
 
-    if ( str_start( gbuf.str, "LOCATION:" ) ) {
-        incubator->onsite = true;
-    }
+    case PROP_DTSTART:
+        if ( (value=parse_params(line, n, &pp)) ) {
+            incubator->start=parse_dt( param_zone(ctx, &pp), value, pp.date, &ctx->start_utc, &ctx->start_zone );
+            if ( pp.date )
+                incubator->dayevent = true;
+        }
+        break;
 
-    if ( str_start( gbuf.str, "DTSTART:" ) ) {
-        incubator->start=str2time_t( gbuf.str+(sizeof("DTSTART:")-1), false );
-    }
-    if ( str_start( gbuf.str, "DTSTART;VALUE=DATE:" ) ) {
-        incubator->start=str2time_t( gbuf.str+(sizeof("DTSTART;VALUE=DATE:")-1), true );
-        incubator->dayevent = true;
-    }
-    if ( str_start( gbuf.str, "RRULE:FREQ=YEARLY" ) ) {
-        incubator->recurring_yearly = true;
+    case PROP_RRULE:
+        if ( value ) {
+            struct recurrence *r;
+            if ( !(r=get_recurrence(incubator)) )
+                return -1;
+            if ( rrule_parse( &r->rule, value ) ) {
+                carp("unsupported RRULE, event is counted once: ", line);
+                r->rule.freq = RRULE_NONE;
+            }
+        }
+        break;
+
+    case PROP_EXDATE:
+        if ( (value=parse_params(line, n, &pp)) && parse_exdate(incubator, value, param_zone(ctx, &pp)) )
+            return -1;
+        break;
+
+    case PROP_RECURRENCE_ID:
+        if ( (value=parse_params(line, n, &pp)) )
+            incubator->recurrence_id = parse_datetime_item(param_zone(ctx, &pp), value, str_len(value));
+        break;
+
+    case PROP_DTEND:
+        if ( (value=parse_params(line, n, &pp)) ) {
+            incubator->end=parse_dt( param_zone(ctx, &pp), value, pp.date, NULL, NULL );
+            if ( pp.date )
+                incubator->dayevent = true;
+        }
+        break;
+
+    default:
+        break;
     }
-    if ( str_start( gbuf.str, "DTEND:" ) ) {
-        incubator->end=str2time_t( gbuf.str+(sizeof("DTEND:")-1), false );
+
+    return 0;
+}
+
+/* appends len bytes of s to the glue buffer, which stays NUL terminated */
+static int glue( struct glue_buffer *gbuf, const char *s, size_t len )
+{
+    if ( gbuf->len + len + 1 > gbuf->alloc_len ) {
+        size_t n = (gbuf->len + len + 1)*2;
+        char *str = realloc( gbuf->str, n );
+        if ( !str ) {
+            carpsys("realloc");
+            return -1;
+        }
+        gbuf->str = str;
+        gbuf->alloc_len = n;
     }
-    if ( str_start( gbuf.str, "DTEND;VALUE=DATE:" ) ) {
-        incubator->end=( str2time_t( gbuf.str+(sizeof("DTEND;VALUE=DATE:")-1), true ) );
-        incubator->dayevent = true;
+    memcpy(gbuf->str + gbuf->len, s, len);
+    gbuf->len += len;
+    gbuf->str[gbuf->len] = '\0';
+    return 0;
+}
+
+/*
+ * splits the stream into content lines and unfolds them (RFC 5545 3.1): a
+ * line is only complete once the next one does not start with a space or
+ * tab, until then it waits in the glue buffer. The line ends are found by
+ * linescan_eol, which looks at 16 or 32 bytes at a time.
+ */
+static int stream2lines( struct ics_context *ctx, char *buf )
+{
+    struct glue_buffer *gbuf=&ctx->gbuf;
+    const char *p=buf, *end=buf+str_len(buf);
+    size_t eol;
+
+    if ( ctx->hash_content )
+        ctx->content_hash = hash_buf(ctx->content_hash, buf, end-buf);
+
+    while ( p < end ) {
+        if ( gbuf->complete ) {
+            gbuf->complete = false;
+            if ( *p == ' ' || *p == '\t' ) {
+                p++;
+                continue;
+            }
+            ctx->lines++;
+            if ( parse_ics_line(ctx) )
+                return -1;
+            gbuf->len = 0;
+        }
+        eol = linescan_eol(p, end-p);
+        if ( glue(gbuf, p, eol) )
+            return -1;
+        if ( p+eol == end )
+            break;
+        if ( gbuf->len && gbuf->str[gbuf->len-1] == '\r' )
+            gbuf->str[--gbuf->len] = '\0';
+        gbuf->complete = true;
+        p += eol+1;
     }
 
     return 0;
 }
 
-static int stream2lines( char *buf, char *user )
+int ics_parser( void *ctx, char *buf )
+{
+    if ( stream2lines((struct ics_context *)ctx, buf) )
+        return -1;
+    return 0;
+}
+
+/* end of the stream: the last line has no successor that could continue it */
+int ics_finish( struct ics_context *ctx )
 {
-    bool line_complete;
-    do {
-        size_t eol = str_chr(buf, '\n');
-        size_t current_len = gbuf.str?str_len(gbuf.str):0;
-        size_t required = ( current_len + eol + 1);
+    struct glue_buffer *gbuf=&ctx->gbuf;
+    int ret=0;
+
+    if ( gbuf->complete || gbuf->len ) {
+        if ( gbuf->len && gbuf->str[gbuf->len-1] == '\r' )
+            gbuf->str[--gbuf->len] = '\0';
+        ctx->lines++;
+        ret = parse_ics_line(ctx);
+    }
+    gbuf->complete = false;
+    gbuf->len = 0;
+    return ret;
+}
 
-        line_complete = (eol<str_len(buf))?true:false;
-        buf[eol] = '\0';
-        if ( eol && buf[eol-1] == '\r' ) { buf[eol-1] = '\0'; required--; }
+/*
+ * takes over the entries of an unsorted context, as if ctx had parsed their
+ * lines itself after its own. Both need the same user.
+ */
+int ics_adopt( struct ics_context *ctx, struct ics_context *from )
+{
+    struct calendar_context *e, *next, *pending=ctx->incubator;
+    int ret=0, dup=0;
+
+    for (e=from->first_entry; e; e=next) {
+        next = e->next_entry;
+        e->next_entry = NULL;
+        if ( ret || (dup = is_duplicate(ctx, calentry_subject(from, e), e)) ||
+                event_store_subject(&ctx->store, calentry_subject(from, e), &e->subject) ) {
+            free_calentry(e);
+            if ( dup != 1 )
+                ret = -1;
+            continue;
+        }
+        ctx->incubator = e;
+        emerge_calentry(ctx);
+    }
+    from->first_entry = from->last_entry = NULL;
+    /* the entries may point to the zones from found itself */
+    tzone_adopt(&ctx->zones, &from->zones);
+    ctx->incubator = pending;
+    ctx->lines += from->lines;
+    ctx->events += from->events;
+    ctx->duplicates += from->duplicates;
+    return ret;
+}
 
-        if (  required > gbuf.alloc_len ) {
-            gbuf.str = realloc( gbuf.str, required );
-            if ( ! gbuf.str )
-                return -1;
-            gbuf.alloc_len = required;
+/* stable merge sort of a list by start */
+static struct calendar_context *sort_by_start( struct calendar_context *list )
+{
+    struct calendar_context *a, *b, *slow, *fast, *head=NULL, **tail=&head;
+
+    if ( !list || !list->next_entry )
+        return list;
+    for (slow=list, fast=list->next_entry; fast && fast->next_entry; fast=fast->next_entry->next_entry)
+        slow = slow->next_entry;
+    b = slow->next_entry;
+    slow->next_entry = NULL;
+    a = sort_by_start(list);
+    b = sort_by_start(b);
+    while ( a && b ) {
+        if ( a->start <= b->start ) {
+            *tail = a;
+            a = a->next_entry;
+        } else {
+            *tail = b;
+            b = b->next_entry;
         }
-        fmt_str( gbuf.str + current_len, buf );
-        if ( required )
-            gbuf.str[required-1]='\0';
-
-        if (line_complete) {
-            parse_ics_line(user);
-            gbuf.str[0]='\0';
-            int i = 0;
-            do {
-                buf[i]=buf[i+eol+1];
-            } while (buf[i++] != '\0');
+        tail = &(*tail)->next_entry;
+    }
+    *tail = a?a:b;
+    return head;
+}
+
+/*
+ * takes over the entries of n unsorted contexts with the calendars of one
+ * user: each one is sorted, they are merged into one stream in which the
+ * overlapping and adjacent vacations are joined, and that stream is merged
+ * into the entries of ctx in one pass. Entries with the same start come in
+ * the order emerge_calentry gives them: of the later calendar first, of one
+ * calendar the later event first. An event ctx has taken before is dropped.
+ */
+int ics_merge( struct ics_context *ctx, struct ics_context *from, size_t n )
+{
+    struct calendar_context **head, *e, *next, *list, *vac=NULL, *merged=NULL, **tail=&merged, *a;
+    size_t i, k;
+    int ret=0, dup=0;
 
+    if ( !(head = calloc(n, sizeof(struct calendar_context *))) ) {
+        carpsys("calloc");
+        return -1;
+    }
+    for (i=0; i<n; ++i) {
+        ctx->duplicates += from[i].duplicates;
+        /* reversed first, so the stable sort puts the later of equal starts first */
+        for (list=NULL, e=from[i].first_entry; e; e=next) {
+            next = e->next_entry;
+            if ( ret || (dup = is_duplicate(ctx, calentry_subject(&from[i], e), e)) ||
+                    event_store_subject(&ctx->store, calentry_subject(&from[i], e), &e->subject) ) {
+                free_calentry(e);
+                /* counted for the calendar it came from, too */
+                if ( dup == 1 )
+                    from[i].duplicates++;
+                else
+                    ret = -1;
+                continue;
+            }
+            if ( e->recur ) {
+                e->next_entry = ctx->first_series;
+                ctx->first_series = e;
+            } else {
+                e->next_entry = list;
+                list = e;
+            }
         }
-    } while (line_complete);
+        head[i] = sort_by_start(list);
+        from[i].first_entry = from[i].last_entry = NULL;
+        tzone_adopt(&ctx->zones, &from[i].zones);
+        ctx->lines += from[i].lines;
+        ctx->events += from[i].events;
+    }
 
-    return 0;
+    /* n is the number of calendars of one user, a few at most */
+    for (;;) {
+        for (k=n, i=0; i<n; ++i)
+            if ( head[i] && (k == n || head[i]->start <= head[k]->start) )
+                k = i;
+        if ( k == n )
+            break;
+        e = head[k];
+        head[k] = e->next_entry;
+        if ( e->dayevent && vac && e->start <= vac->end && str_equal(e->user, vac->user) ) {
+            if ( e->end > vac->end )
+                vac->end = e->end;
+            free_calentry(e);
+            continue;
+        }
+        if ( e->dayevent )
+            vac = e;
+        *tail = e;
+        tail = &e->next_entry;
+    }
+    *tail = NULL;
+    free(head);
+
+    /* the new entries go before the ones of ctx with the same start */
+    tail = &list;
+    for (a=ctx->first_entry, e=merged; a || e; ) {
+        if ( e && (!a || e->start <= a->start) ) {
+            *tail = e;
+            e = e->next_entry;
+        } else {
+            *tail = a;
+            a = a->next_entry;
+        }
+        ctx->last_entry = *tail;
+        tail = &(*tail)->next_entry;
+    }
+    *tail = NULL;
+    ctx->first_entry = list;
+    return ret;
 }
 
-int ics_parser( char *buf, char *user )
+/* a built-in format by name, else name is the file of a template */
+int init_report_context( struct report_context *rep, const char *name, buffer *out )
 {
-    if ( stream2lines(buf, user) )
+    size_t i;
+
+    memset(rep, 0, sizeof(struct report_context));
+    rep->out = out;
+    rep->output_slices.cat = "report";
+    rep->output_slices.name = "output";
+    if ( !name ) {
+        rep->format = format[0];
+        return 0;
+    }
+    for (i=0; i<(sizeof(format)/sizeof(format[0]));i++) {
+        if (str_equal( name, format[i].name )) {
+            rep->format = format[i];
+            return 0;
+        }
+    }
+    if ( !(rep->tpl = malloc(sizeof(struct template))) ) {
+        carpsys("malloc");
         return -1;
+    }
+    if ( template_load(rep->tpl, name) ) {
+        free(rep->tpl);
+        rep->tpl = NULL;
+        carp("unknown output format: ", name);
+        return -1;
+    }
+    rep->format = (struct formats){ (char *)name, template_header, template_timeline, template_footer, template_project,
+        template_month };
     return 0;
 }
 
-struct timeslotinfo tsi;
+void free_report_context( struct report_context *rep )
+{
+    stralloc_free(&rep->output_line_sa);
+    if ( rep->tpl ) {
+        free_template(rep->tpl);
+        free(rep->tpl);
+    }
+}
+
+static void render( struct report_context *rep, void (*fn)( struct report_context * ) )
+{
+    unsigned long long t = rep->trace?trace_now():0;
+
+    fn(rep);
+    trace_slice(rep->trace, &rep->output_slices, t);
+}
+
+/*
+ * the subtotals of the months before mon (1-12) that are still to come,
+ * tsi is kept for the row that follows
+ */
+static void render_months( struct report_context *rep, short mon )
+{
+    struct month_sums *ms = rep->months;
+    struct timeslotinfo row, *tsi = &rep->tsi;
+    short k;
+
+    if ( !ms || ms->next >= mon-1 )
+        return;
+    row = *tsi;
+    for (; ms->next < mon-1 && ms->next < 12; ms->next++) {
+        tsi->mon = ms->next+1;
+        tsi->worksum_onsite_ch = ms->onsite_ch[ms->next];
+        tsi->worksum_remote_ch = ms->remote_ch[ms->next];
+        tsi->vmonth = ms->vacation[ms->next];
+        tsi->worktbd_ch = tsi->worksum_onsite_ch + tsi->worksum_remote_ch +
+            (tsi->vmonth*ms->vday_hours - ms->monthhours)*100;
+        /* what is left after this month */
+        tsi->vleft = ms->vacation_days;
+        for (k=0; k<=ms->next; ++k)
+            tsi->vleft -= ms->vacation[k];
+        render(rep, rep->format.month);
+    }
+    *tsi = row;
+}
 
-static time_t slice_timeslots( const struct calendar_context *e, const time_t begin_month, const time_t end_month )
+/* one row of the timeline, in grouped mode after the months before are done */
+static void render_row( struct report_context *rep )
 {
-    time_t start_ts=(e->start<begin_month)?begin_month:e->start,
-           end_ts=(e->end>end_month)?end_month:e->end,
+    render_months(rep, rep->tsi.mon);
+    render(rep, rep->format.timeline);
+}
+
+static time_t slice_timeslots( struct report_context *rep, const struct event_store *es, size_t i, const time_t begin_month, const time_t end_month )
+{
+    struct timeslotinfo *tsi=&rep->tsi;
+    time_t start=event_start(es, i), end=event_end(es, i),
+           start_ts=(start<begin_month)?begin_month:start,
+           end_ts=(end>end_month)?end_month:end,
            diff;
     struct tm eod, s_tm, e_tm;
 
     V(3,
         buffer_puts(buffer_2,"event start: ");
-        buffer_puts(buffer_2, ctime(&e->start));
+        buffer_puts(buffer_2, ctime(&start));
         buffer_puts(buffer_2,"event end:   ");
-        buffer_puts(buffer_2, ctime(&e->end));
+        buffer_puts(buffer_2, ctime(&end));
         buffer_flush(buffer_2);
     );
 
     diff = end_ts - start_ts;
-    if (e->dayevent)
+    if (es->flags[i] & EVENT_DAYEVENT)
         return diff;
 
     localtime_r(&start_ts, &s_tm);
@@ -427,52 +1178,73 @@ static time_t slice_timeslots( const struct calendar_context *e, const time_t be
     eod.tm_hour=0;
     eod.tm_mday+=1;
 
-    tsi.mday=s_tm.tm_mday;
-    tsi.mon=s_tm.tm_mon+1;
-    tsi.shour=s_tm.tm_hour;
-    tsi.smin=s_tm.tm_min;
+    tsi->mday=s_tm.tm_mday;
+    tsi->mon=s_tm.tm_mon+1;
+    tsi->shour=s_tm.tm_hour;
+    tsi->smin=s_tm.tm_min;
 
     if (s_tm.tm_yday < e_tm.tm_yday) {
-        tsi.ehour=24;
-        tsi.emin=0;
-        tsi.workhours_ch=( mktime(&eod) - start_ts )/(60*60/100);
-        current_format.timeline();
-        tsi.shour=0;
-        tsi.smin=0;
-        tsi.workhours_ch=(24*100);
+        tsi->ehour=24;
+        tsi->emin=0;
+        tsi->workhours_ch=( mktime(&eod) - start_ts )/(60*60/100);
+        render_row(rep);
+        tsi->shour=0;
+        tsi->smin=0;
+        tsi->workhours_ch=(24*100);
         while (e_tm.tm_yday > eod.tm_yday) {
-            tsi.mday=eod.tm_mday++;
-            tsi.mon=eod.tm_mon+1;
+            tsi->mday=eod.tm_mday++;
+            tsi->mon=eod.tm_mon+1;
             mktime(&eod);
-            current_format.timeline();
+            render_row(rep);
         }
         if (end_ts > mktime(&eod)) {
-            tsi.mday=e_tm.tm_mday;
-            tsi.mon=e_tm.tm_mon+1;
-            tsi.ehour=e_tm.tm_hour;
-            tsi.emin=e_tm.tm_min;
-            tsi.workhours_ch=( end_ts - mktime(&eod) )/(60*60/100);
-            current_format.timeline();
+            tsi->mday=e_tm.tm_mday;
+            tsi->mon=e_tm.tm_mon+1;
+            tsi->ehour=e_tm.tm_hour;
+            tsi->emin=e_tm.tm_min;
+            tsi->workhours_ch=( end_ts - mktime(&eod) )/(60*60/100);
+            render_row(rep);
         }
     } else {
-        tsi.ehour=e_tm.tm_hour;
-        tsi.emin=e_tm.tm_min;
-        tsi.workhours_ch=( end_ts - start_ts )/(60*60/100);
-        current_format.timeline();
+        tsi->ehour=e_tm.tm_hour;
+        tsi->emin=e_tm.tm_min;
+        tsi->workhours_ch=( end_ts - start_ts )/(60*60/100);
+        render_row(rep);
     }
     return diff;
 }
 
-int cal_statistics( struct config_context *cfgctx )
+/* moves the sorted entries into the columns of the store */
+static int store_calentries( struct ics_context *ctx )
+{
+    struct event_store *es = &ctx->store;
+    struct calendar_context *e, *next;
+    int ret=0;
+
+    clear_event_store(es);
+    for (e=ctx->first_entry; e; e=next) {
+        next = e->next_entry;
+        if ( !ret && event_store_add(es, e->user, e->holidays, e->subject, e->start, e->end,
+                    (e->dayevent?EVENT_DAYEVENT:0) | (e->onsite?EVENT_ONSITE:0)) )
+            ret = -1;
+        free_calentry(e);
+    }
+    ctx->first_entry = NULL;
+    ctx->last_entry = NULL;
+    return ret;
+}
+
+/* the report parameters into tsi, gives the user the report is limited to */
+static struct user_context *begin_report( struct report_context *rep, struct config_context *cfgctx,
+        const struct holiday_table *ht, time_t *begin_month, time_t *end_month )
 {
     struct user_context *user = NULL;
     struct project_context *project= NULL;
     struct program_args *pa = &(cfgctx->prog_arg);
-    struct calendar_context *e;
-    time_t begin_month, end_month;
+    struct timeslotinfo *tsi = &rep->tsi;
     struct tm t;
 
-    memset(&tsi, 0, sizeof(struct timeslotinfo));
+    memset(tsi, 0, sizeof(struct timeslotinfo));
 
     if ( pa->user ) {
         struct user_context *ucntx;
@@ -484,102 +1256,218 @@ int cal_statistics( struct config_context *cfgctx )
         }
     }
 
-    if ( pa->format ) {
-        size_t i; bool format_found=false;
-        for (i=0; i<(sizeof(format)/sizeof(format[0]));i++) {
-            if (str_equal( pa->format, format[i].name )) {
-                current_format = format[i];
-                format_found=true;
-            }
-        }
-        if (!format_found) exit(EXIT_FAILURE);
-    } else
-        current_format = format[0];
-
-    t = get_period_boundaries(pa->year, pa->month, &begin_month, &end_month);
-    tsi.mon=(pa->month)?t.tm_mon+1:1;
-    tsi.allyear=(pa->month)?false:true;
-    tsi.year=t.tm_year+1900;
+    t = get_period_boundaries(pa->year, pa->month, begin_month, end_month);
+    tsi->mon=(pa->month)?t.tm_mon+1:1;
+    tsi->allyear=(pa->month)?false:true;
+    tsi->year=t.tm_year+1900;
 
     V(4,
         buffer_puts(buffer_2,"begin of month: ");
-        buffer_puts(buffer_2, ctime(&begin_month));
+        buffer_puts(buffer_2, ctime(begin_month));
         buffer_puts(buffer_2,"end of month: ");
-        buffer_puts(buffer_2, ctime(&end_month));
+        buffer_puts(buffer_2, ctime(end_month));
         buffer_puts(buffer_2,"begin of year: ");
-        buffer_puts(buffer_2, ctime(&begin_year));
+        buffer_puts(buffer_2, ctime(&ht->begin_year));
         buffer_puts(buffer_2,"end of year: ");
-        buffer_puts(buffer_2, ctime(&end_year));
+        buffer_puts(buffer_2, ctime(&ht->end_year));
         buffer_putnlflush(buffer_2);
     );
 
     if (user) {
-        tsi.userlimit=true;
-        tsi.user = user->name;
+        tsi->userlimit=true;
+        tsi->user = user->name;
     } else
-        tsi.userlimit=false;
+        tsi->userlimit=false;
 
     if ( pa->project ) {
-        tsi.projectlimit=true;
-        tsi.project=pa->project;
+        tsi->projectlimit=true;
+        tsi->project=pa->project;
         for_each_project(cfgctx, project) {
             if ( str_equal( project->name, pa->project ) ) {
-                tsi.centihourlyrate_onsite = project->onsite;
-                tsi.centihourlyrate_remote = project->remote;
+                tsi->centihourlyrate_onsite = project->onsite;
+                tsi->centihourlyrate_remote = project->remote;
                 break;
             }
         }
     }
-    stralloc_init(&output_line_sa);
-    current_format.header();
+    return user;
+}
 
-    for (e=first_entry;e;) {
-        tsi.onsite = e->onsite;
-        tsi.user = e->user;
-        tsi.project = e->subject;
+/* a vacation day of user in work hours, from the workdays of the year */
+static unsigned short vacation_day_hours( const struct user_context *user, const struct holiday_table *ht )
+{
+    return (unsigned short) (( user->monthhours *
+                12.0 / workdays_in_period(ht, ht->begin_year, ht->end_year-1)) +.5);
+}
 
-        if ( (e->start < end_month) && (e->end > begin_month) ) {
-            time_t t = slice_timeslots(e, begin_month, end_month);
-            if ( 0>t )
-                return -1;
+/*
+ * grouped mode: the worksums and vacation days of each month of year in one
+ * pass over the events each, before the first row is out
+ */
+static void sum_months( struct month_sums *ms, const struct event_store *es, const struct holiday_table *ht,
+        short year, const struct user_context *user )
+{
+    time_t bound[13], start, end;
+    const struct holiday_table *h;
+    size_t i;
+    short m;
+
+    memset(ms, 0, sizeof(struct month_sums));
+    for (m=0; m<12; ++m)
+        get_period_boundaries(year, m+1, &bound[m], &bound[m+1]);
+    event_store_periodsums(es, bound, 12, ms->onsite_ch, ms->remote_ch);
+
+    for (i=0; i<es->len; ++i) {
+        if ( !(es->flags[i] & EVENT_DAYEVENT) )
+            continue;
+        start = event_start(es, i);
+        end = event_end(es, i);
+        h = event_holidays(es, i);
+        for (m=0; m<12; ++m)
+            if ( start < bound[m+1] && end > bound[m] )
+                ms->vacation[m] += workdays_in_period( h?h:ht, (start<bound[m])?bound[m]:start,
+                        ((end>bound[m+1])?bound[m+1]:end)-1 );
+    }
+    if ( user ) {
+        ms->monthhours = user->monthhours;
+        ms->vday_hours = vacation_day_hours(user, ht);
+        ms->vacation_days = user->vacation;
+    }
+}
 
-            if (e->dayevent)
-                tsi.vmonth += workdays_in_period(
-                            (e->start<begin_month)?begin_month:e->start,
-                            ((e->end>end_month)?end_month:e->end)-1 );
-            else {
-                if ( tsi.onsite )
-                    tsi.worksum_onsite_ch += t/(60*60/100);
-                else
-                    tsi.worksum_remote_ch += t/(60*60/100);
-            }
-        }
-        if ( (e->dayevent) && (e->start < end_year) && (e->end > begin_year) )
-            tsi.vyear += workdays_in_period(
-                            (e->start<begin_year)?begin_year:e->start,
-                            ((e->end>end_year)?end_year:e->end)-1 );
+/* the balance of the user from the sums and vacation days in tsi, then the footer */
+static void end_report( struct report_context *rep, const struct user_context *user,
+        const struct holiday_table *ht, const struct program_args *pa )
+{
+    struct timeslotinfo *tsi = &rep->tsi;
 
-        struct calendar_context *t = e->next_entry;
-        if (e->subject) free(e->subject);
-        free(e);
-        e=t;
-    }
     if ( user ) {
-        unsigned short vday_hours = (unsigned short) (( user->monthhours *
-                    12.0 / workdays_in_period(begin_year, end_year-1)) +.5);
+        unsigned short vday_hours = vacation_day_hours(user, ht);
         V(3,
             buffer_puts(buffer_2, "vacation day in work hours: ");
             buffer_putulong(buffer_2, vday_hours);
             buffer_putnlflush(buffer_2);
         );
-        tsi.worktbd_ch=(tsi.worksum_onsite_ch + tsi.worksum_remote_ch +
-                ((tsi.vmonth*vday_hours) - (user->monthhours*((pa->month)?1:12)))*100);
-        tsi.vleft=user->vacation-tsi.vyear;
+        tsi->worktbd_ch=(tsi->worksum_onsite_ch + tsi->worksum_remote_ch +
+                ((tsi->vmonth*vday_hours) - (user->monthhours*((pa->month)?1:12)))*100);
+        tsi->vleft=user->vacation-tsi->vyear;
+    }
+    render(rep, rep->format.footer);
+    trace_slices_flush(rep->trace, &rep->output_slices);
+}
+
+int cal_statistics( struct ics_context *ctx, struct report_context *rep, struct config_context *cfgctx )
+{
+    struct user_context *user;
+    struct program_args *pa = &(cfgctx->prog_arg);
+    struct holiday_table *ht = ctx->holidays;
+    struct timeslotinfo *tsi = &rep->tsi;
+    struct event_store *es = &ctx->store;
+    struct month_sums ms;
+    size_t i;
+    short m;
+    time_t begin_month, end_month, begin_window, end_window;
+
+    user = begin_report(rep, cfgctx, ht, &begin_month, &end_month);
+    get_report_window(ht, pa->year, pa->month, &begin_window, &end_window);
+    if ( expand_calentries( ctx, begin_window, end_window ) || store_calentries( ctx ) )
+        return -1;
+    if ( pa->grouped && tsi->allyear ) {
+        sum_months(&ms, es, ht, tsi->year, user);
+        rep->months = &ms;
+    }
+    render(rep, rep->format.header);
+
+    for (i=0; i<es->len; ++i) {
+        if ( event_start(es, i) >= end_month || event_end(es, i) <= begin_month )
+            continue;
+        tsi->onsite = es->flags[i] & EVENT_ONSITE;
+        tsi->user = (char *)event_user(es, i);
+        tsi->project = (char *)event_subject(es, i);
+        if ( 0>slice_timeslots(rep, es, i, begin_month, end_month) )
+            goto fail;
     }
-    current_format.footer();
 
-    stralloc_free(&output_line_sa);
-    free(gbuf.str);
+    if ( rep->months ) {
+        /* the months after the last row, the totals are the ones of the months */
+        render_months(rep, 13);
+        for (m=0; m<12; ++m) {
+            tsi->worksum_onsite_ch += ms.onsite_ch[m];
+            tsi->worksum_remote_ch += ms.remote_ch[m];
+        }
+        rep->months = NULL;
+    } else
+        event_store_worksums(es, begin_month, end_month, &tsi->worksum_onsite_ch, &tsi->worksum_remote_ch);
+
+    for (i=0; i<es->len; ++i) {
+        time_t start=event_start(es, i), end=event_end(es, i);
+        const struct holiday_table *h=event_holidays(es, i);
+
+        if ( !(es->flags[i] & EVENT_DAYEVENT) )
+            continue;
+        if ( (start < end_month) && (end > begin_month) )
+            tsi->vmonth += workdays_in_period( h?h:ht, (start<begin_month)?begin_month:start,
+                        ((end>end_month)?end_month:end)-1 );
+        if ( (start < ht->end_year) && (end > ht->begin_year) )
+            tsi->vyear += workdays_in_period( h?h:ht, (start<ht->begin_year)?ht->begin_year:start,
+                        ((end>ht->end_year)?ht->end_year:end)-1 );
+    }
+    clear_event_store(es);
+
+    end_report(rep, user, ht, pa);
+    return 0;
+fail:
+    rep->months = NULL;
+    return -1;
+}
+
+/*
+ * the report of summary mode: the plain events are in ctx->summary already,
+ * the series are expanded into it now. Instead of the timeline there is one
+ * line per subject with its sums.
+ */
+int cal_summary( struct ics_context *ctx, struct report_context *rep, struct config_context *cfgctx )
+{
+    struct user_context *user;
+    struct program_args *pa = &(cfgctx->prog_arg);
+    struct holiday_table *ht = ctx->holidays;
+    struct timeslotinfo *tsi = &rep->tsi;
+    struct summary *sum = ctx->summary;
+    struct calendar_context *e, *next;
+    time_t begin_month, end_month, begin_window, end_window;
+    size_t i;
+    int ret=0;
+
+    user = begin_report(rep, cfgctx, ht, &begin_month, &end_month);
+    get_report_window(ht, pa->year, pa->month, &begin_window, &end_window);
+    if ( expand_calentries( ctx, begin_window, end_window ) )
+        return -1;
+    for (e=ctx->first_entry; e; e=next) {
+        next = e->next_entry;
+        if ( !ret && summary_add(sum, e->user, e->holidays, e->subject, calentry_subject(ctx, e),
+                    e->start, e->end, e->dayevent, e->onsite) )
+            ret = -1;
+        free_calentry(e);
+    }
+    ctx->first_entry = ctx->last_entry = NULL;
+    if ( ret )
+        return -1;
+    render(rep, rep->format.header);
+
+    for (i=1; i<sum->subjects; ++i) {
+        if ( !sum->by_subject[i].onsite_ch && !sum->by_subject[i].remote_ch )
+            continue;
+        tsi->project = (char *)string_by_id(&ctx->store.subjects, i);
+        tsi->project_onsite_ch = sum->by_subject[i].onsite_ch;
+        tsi->project_remote_ch = sum->by_subject[i].remote_ch;
+        render(rep, rep->format.project);
+    }
+    tsi->project = pa->project;
+    tsi->worksum_onsite_ch = sum->onsite_ch;
+    tsi->worksum_remote_ch = sum->remote_ch;
+    summary_vacation(sum, &tsi->vmonth, &tsi->vyear);
+
+    end_report(rep, user, ht, pa);
     return 0;
 }
 
@@ -591,27 +1479,213 @@ int main( int argc, char *argv[] )
 #define ICSDATA "foo\r\nbar\r\n\r\nBEGIN:VEVENT\r\nDTSTART:19700101T100000Z"\
     "\r\nDTEND:19700101T123456Z\r\nSUMMARY:testevent\r\nEND:VEVENT\r\n"
 
+    struct holiday_table ht;
+    struct ics_context ctx;
     char *ics_data=calloc(str_len(ICSDATA)+1,sizeof(char));
     char *ics_user="testuser";
     memset(ics_data, 0, str_len(ICSDATA+1));
     str_copy(ics_data, ICSDATA);
-    ics_parser(ics_data, ics_user);
-    assert(str_equal(first_entry->user,"testuser"));
-    assert(str_equal(first_entry->subject,"testevent"));
-    assert(first_entry->start==(10*60*60));
-    assert(first_entry->end==((((12*60)+34)*60)+56));
+    init_ics_context(&ctx, &ht, ics_user);
+    ics_parser(&ctx, ics_data);
+    ics_finish(&ctx);
+    assert(str_equal(ctx.first_entry->user,"testuser"));
+    assert(str_equal(calentry_subject(&ctx, ctx.first_entry),"testevent"));
+    assert(ctx.first_entry->start==(10*60*60));
+    assert(ctx.first_entry->end==((((12*60)+34)*60)+56));
+    free_ics_context(&ctx);
     free(ics_data);
 
-    init_holiday_list(2020);
-    assert(workday[0] == 3);
-    assert(workday[365] == 4);
-    init_holiday_list(2021);
-    assert(workday[365] == 8);
+    /* folded lines, split across chunks in all the awkward places */
+    const char *chunks[] = { "BEGIN:VEVENT\r\nSUMMARY:long", "\r", "\n  event\r\n\tname\r\n",
+        "DTSTART:19700101T1", "00000Z\r\nDTEND:19700101T110000Z\r\nEND:VEVENT", NULL };
+    char chunk[64];
+    init_ics_context(&ctx, &ht, ics_user);
+    for (size_t i=0; chunks[i]; i++) {
+        str_copy(chunk, chunks[i]);
+        assert(0==ics_parser(&ctx, chunk));
+    }
+    assert(!ctx.first_entry);
+    assert(0==ics_finish(&ctx));
+    assert(ctx.lines==5 && ctx.events==1);
+    assert(str_equal(calentry_subject(&ctx, ctx.first_entry),"long eventname"));
+    assert(ctx.first_entry->start==10*60*60 && ctx.first_entry->end==11*60*60);
+    free_ics_context(&ctx);
+
+#define SERIESDATA "BEGIN:VEVENT\r\nUID:standup\r\nDTSTART:20230102T090000Z\r\n"\
+    "DTEND:20230102T091500Z\r\nRRULE:FREQ=WEEKLY;COUNT=10\r\nEXDATE:20230109T090000Z\r\n"\
+    "SUMMARY:standup\r\nEND:VEVENT\r\nBEGIN:VEVENT\r\nUID:standup\r\n"\
+    "RECURRENCE-ID:20230116T090000Z\r\nDTSTART:20230117T090000Z\r\n"\
+    "DTEND:20230117T091500Z\r\nSUMMARY:standup\r\nEND:VEVENT\r\n"
+    ics_data=calloc(str_len(SERIESDATA)+1,sizeof(char));
+    str_copy(ics_data, SERIESDATA);
+    init_ics_context(&ctx, &ht, ics_user);
+    ics_parser(&ctx, ics_data);
+    ics_finish(&ctx);
+    assert(ctx.first_series && ctx.first_series->recur->exdates==1);
+    assert(0==expand_calentries(&ctx, 1672531200, 1675209600));
+    assert(!ctx.first_series);
+    size_t n=0;
+    time_t starts[]={ 1672650000, 1673946000, 1674464400, 1675069200 };
+    struct calendar_context *e;
+    for_each_calentry(&ctx, e) {
+        assert(n<4 && e->start==starts[n] && e->end==starts[n]+15*60);
+        n++;
+    }
+    assert(n==4);
+    free_ics_context(&ctx);
+    free(ics_data);
+
+    /* the override of one user leaves the occurrence of the same meeting of another user alone */
+    char shared[]=SERIESDATA, master[]="BEGIN:VEVENT\r\nUID:standup\r\nDTSTART:20230102T090000Z\r\n"
+        "DTEND:20230102T091500Z\r\nRRULE:FREQ=WEEKLY;COUNT=10\r\nSUMMARY:standup\r\nEND:VEVENT\r\n";
+    size_t other=0;
+    bool moved=false;
+    init_ics_context(&ctx, &ht, ics_user);
+    assert(0==ics_parser(&ctx, shared));
+    ctx.user = "other user";
+    assert(0==ics_parser(&ctx, master) && 0==ics_finish(&ctx));
+    assert(0==expand_calentries(&ctx, 1672531200, 1675209600));
+    n=0;
+    for_each_calentry(&ctx, e) {
+        if ( str_equal(e->user, ics_user) ) {
+            n++;
+            continue;
+        }
+        other++;
+        moved |= e->start==1673859600; // 01-16, moved to the 17th by the first user only
+    }
+    assert(n==4 && other==5 && moved);
+    ctx.user = ics_user;
+    free_ics_context(&ctx);
+
+    /* TZID: a weekly series in Berlin keeps its wall clock over the change to CEST */
+#define TZDATA "BEGIN:VCALENDAR\r\nBEGIN:VTIMEZONE\r\nTZID:W. Europe Standard Time\r\n"\
+    "BEGIN:STANDARD\r\nDTSTART:16010101T030000\r\nTZOFFSETFROM:+0200\r\nTZOFFSETTO:+0100\r\n"\
+    "RRULE:FREQ=YEARLY;BYDAY=-1SU;BYMONTH=10\r\nEND:STANDARD\r\nBEGIN:DAYLIGHT\r\n"\
+    "DTSTART:16010101T020000\r\nTZOFFSETFROM:+0100\r\nTZOFFSETTO:+0200\r\n"\
+    "RRULE:FREQ=YEARLY;BYDAY=-1SU;BYMONTH=3\r\nEND:DAYLIGHT\r\nEND:VTIMEZONE\r\n"\
+    "BEGIN:VEVENT\r\nUID:jf\r\nDTSTART;TZID=\"W. Europe Standard Time\":20230320T090000\r\n"\
+    "DTEND;TZID=\"W. Europe Standard Time\":20230320T100000\r\nRRULE:FREQ=WEEKLY;COUNT=3\r\n"\
+    "EXDATE;TZID=\"W. Europe Standard Time\":20230403T090000\r\nSUMMARY:jf\r\nEND:VEVENT\r\n"\
+    "BEGIN:VEVENT\r\nDTSTART;VALUE=DATE-TIME;TZID=Unknown/Zone:20230301T090000\r\n"\
+    "DTEND;TZID=W. Europe Standard Time;VALUE=DATE-TIME:20230301T100000\r\nSUMMARY:x\r\nEND:VEVENT\r\n"\
+    "END:VCALENDAR\r\n"
+    ics_data=calloc(str_len(TZDATA)+1,sizeof(char));
+    str_copy(ics_data, TZDATA);
+    init_ics_context(&ctx, &ht, ics_user);
+    assert(0==ics_parser(&ctx, ics_data) && 0==ics_finish(&ctx));
+    assert(!ctx.vtimezone && ctx.events==2 && ctx.first_series->recur->zone);
+    assert(0==expand_calentries(&ctx, 1672531200, 1704067200));
+    /* 2023-03-01 10:00 CET, unknown zones are local time */
+    assert(ctx.first_entry->start==civil_to_time(days_from_civil(2023,3,1), 9*3600, false));
+    assert(ctx.first_entry->end==1677661200);
+    time_t tzstarts[]={ 1679299200, 1679900400 }; // 03-20 09:00 CET, 03-27 09:00 CEST
+    n=0;
+    for (e=ctx.first_entry->next_entry; e; e=e->next_entry) {
+        assert(n<2 && e->start==tzstarts[n] && e->end==tzstarts[n]+3600);
+        n++;
+    }
+    assert(n==2);
+    free_ics_context(&ctx);
+    free(ics_data);
+
+    /* two calendars of one user: vacations joined across them, later calendar first on equal starts */
+#define VEVENT(__s,__e,__sum) "BEGIN:VEVENT\r\nDTSTART" __s "\r\nDTEND" __e "\r\nSUMMARY:" __sum "\r\nEND:VEVENT\r\n"
+    struct ics_context src[2];
+    char cal_a[]=VEVENT(";VALUE=DATE:20230102",";VALUE=DATE:20230104","off")
+        VEVENT(":20230110T090000Z",":20230110T100000Z","a");
+    char cal_b[]=VEVENT(";VALUE=DATE:20230104",";VALUE=DATE:20230106","off")
+        VEVENT(":20230110T090000Z",":20230110T110000Z","b")
+        VEVENT(":20230101T090000Z",":20230101T100000Z","c");
+    char *cal_data[]={ cal_a, cal_b };
+    init_ics_context(&ctx, &ht, ics_user);
+    for (n=0; n<2; ++n) {
+        init_ics_context(&src[n], &ht, ics_user);
+        src[n].unsorted = true;
+        assert(0==ics_parser(&src[n], cal_data[n]) && 0==ics_finish(&src[n]));
+    }
+    assert(0==ics_merge(&ctx, src, 2));
+    assert(ctx.events==5 && !src[0].first_entry && !src[1].first_entry);
+    e=ctx.first_entry;
+    assert(str_equal(calentry_subject(&ctx, e), "c"));
+    e=e->next_entry;
+    assert(e->dayevent && e->start==1672617600 && e->end==1672963200);
+    e=e->next_entry;
+    assert(str_equal(calentry_subject(&ctx, e), "b") && str_equal(calentry_subject(&ctx, e->next_entry), "a"));
+    assert(ctx.last_entry==e->next_entry && !e->next_entry->next_entry);
+    for (n=0; n<2; ++n)
+        free_ics_context(&src[n]);
+    free_ics_context(&ctx);
+
+    /* duplicates: by UID and RECURRENCE-ID, without UID by start, end and summary */
+#define DUPDATA VEVENT(":20230110T090000Z",":20230110T100000Z","meeting") \
+    VEVENT(":20230110T090000Z",":20230110T100000Z","meeting") \
+    VEVENT(":20230110T090000Z",":20230110T100000Z","other") \
+    "BEGIN:VEVENT\r\nUID:u1\r\nDTSTART:20230111T090000Z\r\nDTEND:20230111T100000Z\r\nSUMMARY:a\r\nEND:VEVENT\r\n" \
+    "BEGIN:VEVENT\r\nUID:u1\r\nDTSTART:20230111T090000Z\r\nDTEND:20230111T110000Z\r\nSUMMARY:b\r\nEND:VEVENT\r\n" \
+    "BEGIN:VEVENT\r\nUID:u1\r\nRECURRENCE-ID:20230111T090000Z\r\nDTSTART:20230111T090000Z\r\n" \
+    "DTEND:20230111T100000Z\r\nEND:VEVENT\r\n"
+    char dup_a[]=DUPDATA, dup_b[]=DUPDATA;
+    init_ics_context(&ctx, &ht, ics_user);
+    assert(0==ics_parser(&ctx, dup_a) && 0==ics_finish(&ctx));
+    assert(ctx.events==6 && ctx.duplicates==2);
+    n=0;
+    for_each_calentry(&ctx, e)
+        n++;
+    assert(n==4);
+    /* the same calendar once more, as a second calendar of the user */
+    init_ics_context(&src[0], &ht, ics_user);
+    src[0].unsorted = true;
+    assert(0==ics_parser(&src[0], dup_b) && 0==ics_finish(&src[0]));
+    assert(0==ics_merge(&ctx, src, 1) && ctx.duplicates==2+2+4 && src[0].duplicates==2+4);
+    n=0;
+    for_each_calentry(&ctx, e)
+        n++;
+    assert(n==4);
+    /* another user's copy counts */
+    init_ics_context(&src[1], &ht, "other user");
+    src[1].unsorted = true;
+    assert(0==ics_parser(&src[1], dup_a) && 0==ics_finish(&src[1]));
+    assert(0==ics_merge(&ctx, &src[1], 1) && ctx.duplicates==8+2);
+    n=0;
+    for_each_calentry(&ctx, e)
+        n++;
+    assert(n==8);
+    free_ics_context(&src[0]);
+    free_ics_context(&src[1]);
+    free_ics_context(&ctx);
+
+    /* summary mode: events outside january leave neither a key nor their subject behind */
+    struct summary sum;
+    char sumdata[]=VEVENT(":20230110T090000Z",":20230110T100000Z","meeting")
+        VEVENT(":20230110T090000Z",":20230110T100000Z","meeting")
+        VEVENT(":20200110T090000Z",":20200110T100000Z","old")
+        VEVENT(":20230210T090000Z",":20230210T100000Z","later")
+        VEVENT(";VALUE=DATE:20190102",";VALUE=DATE:20190104","off 2019")
+        VEVENT(";VALUE=DATE:20230102",";VALUE=DATE:20230104","off");
+    init_holiday_list(&ht, 2023);
+    init_summary(&sum, ht.begin_year, ht.begin_year+31*SECONDS_PER_DAY, NULL);
+    init_ics_context(&ctx, &ht, ics_user);
+    ctx.summary = &sum;
+    assert(0==ics_parser(&ctx, sumdata) && 0==ics_finish(&ctx));
+    assert(ctx.events==6 && ctx.duplicates==1 && ctx.seen.len==2 && ctx.store.subjects.len==3);
+    assert(sum.remote_ch==100 && sum.users==1);
+    free_ics_context(&ctx);
+    free_summary(&sum);
+
+    init_holiday_list(&ht, 2020);
+    assert(ht.first_wday == 3);
+    assert(ht.days == 366 && (ht.workdays[365/64] >> (365%64) & 1));
+    init_holiday_list(&ht, 2021);
+    assert(ht.days == 365 && !(ht.workdays[365/64] >> (365%64) & 1));
 
     struct tm x,y={.tm_year=70, .tm_mon=0,.tm_mday=1};
     x=y; y.tm_mday=4;
-    unsigned short v = workdays_in_period( mktime(&x), mktime(&y) );
+    unsigned short v = workdays_in_period( &ht, mktime(&x), mktime(&y) );
     assert(v == 2);
+    x.tm_mday=1; x.tm_mon=1; y.tm_mday=31; y.tm_mon=11;
+    assert(workdays_in_period( &ht, mktime(&x), mktime(&y) ) == 261-21);
+    assert(workdays_in_period( &ht, ht.begin_year, ht.end_year-1 ) == 261);
 
     exit(EXIT_SUCCESS);
 }
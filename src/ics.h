@@ -1,10 +1,112 @@
 #ifndef ICS_H
 #define ICS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include "config.h"
+#include "format.h"
+#include "rrule.h"
+#include "eventstore.h"
+#include "tzone.h"
+#include "dedup.h"
+#include "summary.h"
+
+/* one bit per day of the year, set for the workdays: Monday to Friday, but no public holiday */
+#define HOLIDAY_WORDS ((366+63)/64)
+
+struct holiday_table {
+    time_t begin_year;
+    time_t end_year;
+    unsigned short days;
+    unsigned char first_wday; // of January 1st, 0: Sunday
+    uint64_t workdays[HOLIDAY_WORDS];
+};
+
+/* RRULE/EXDATE of a series master, occurrences are generated per report window */
+struct recurrence {
+    struct rrule rule;
+    bool utc;
+    const struct tzone *zone; // of DTSTART, NULL: utc or local time
+    time_t *exdate;
+    size_t exdates;
+};
+
+struct calendar_context {
+    char *user;
+    uint32_t subject; // id in the store of the ics_context
+    char *uid;
+    time_t start;
+    //time_t pause;
+    time_t end;
+    time_t recurrence_id; // 0: no override of a series occurrence
+    const struct holiday_table *holidays; // of the user's region
+    bool dayevent;
+    bool onsite;
+    struct recurrence *recur;
+    struct calendar_context *next_entry;
+};
+
+struct glue_buffer {
+    char *str;
+    size_t len;
+    size_t alloc_len;
+    bool complete;
+};
+
+/* last stage run on each line, lets the benchmark time the stages separately */
+enum ics_stage {
+    ICS_STAGE_ALL=0,
+    ICS_STAGE_SPLIT,
+    ICS_STAGE_PARSE
+};
+
+/*
+ * one parse session: all state needed to turn ICS data into calendar entries.
+ * With user==NULL the session parses a public holiday calendar and flags the
+ * days in the holiday table instead of collecting entries.
+ */
+struct ics_context {
+    char *user;
+    struct holiday_table *holidays;
+    struct calendar_context *first_entry, *last_entry, *incubator;
+    struct calendar_context *first_series;
+    struct summary *summary; // if set, plain events go into it instead of the entries
+    struct calendar_context *spare; // with summary, the entry reused for the next event
+    stralloc subject; // with summary, the SUMMARY of the incubator (with its NUL) until it is taken
+    struct event_store store; // the subjects while parsing, the entries for the statistics
+    struct dedup_set seen; // keys of the events taken so far, see calentry_key
+    bool start_utc;
+    const struct tzone *start_zone;
+    struct tzone_list zones; // of the VTIMEZONEs and the TZIDs seen so far
+    struct tzone_builder *vtimezone; // while inside one
+    struct glue_buffer gbuf;
+    enum ics_stage stop_after;
+    bool unsorted; // entries and series are only appended, see ics_adopt
+    bool hash_content;
+    unsigned long long content_hash; // of the data seen so far, if hash_content
+    unsigned long lines;
+    unsigned long events;
+    unsigned long duplicates; // events dropped because they were taken before
+};
+
+#define for_each_calentry(__ctx,__entry) for (__entry=(__ctx)->first_entry; (__entry); (__entry)=(__entry)->next_entry)
+#define calentry_subject(__ctx,__entry) string_by_id(&(__ctx)->store.subjects, (__entry)->subject)
 
 void set_ics_verbosity( short );
-void init_holiday_list( short );
-int ics_parser( char *, char * );
-int cal_statistics( struct config_context * );
-int filter_project_calentries( const char * );
+void init_holiday_list( struct holiday_table *, short );
+void init_ics_context( struct ics_context *, struct holiday_table *, char * );
+void free_ics_context( struct ics_context * );
+int init_report_context( struct report_context *, const char *, buffer * );
+void free_report_context( struct report_context * );
+int ics_parser( void *, char * );
+int ics_finish( struct ics_context * );
+int ics_adopt( struct ics_context *, struct ics_context * );
+int ics_merge( struct ics_context *, struct ics_context *, size_t );
+void get_report_period( short, short, time_t *, time_t * );
+void get_report_window( const struct holiday_table *, short, short, time_t *, time_t * );
+unsigned short workdays_in_period( const struct holiday_table *, time_t, time_t );
+int expand_calentries( struct ics_context *, time_t, time_t );
+int cal_statistics( struct ics_context *, struct report_context *, struct config_context * );
+int cal_summary( struct ics_context *, struct report_context *, struct config_context * );
+int filter_project_calentries( struct ics_context *, const char * );
 #endif
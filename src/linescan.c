@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <str.h>
+#include "linescan.h"
+
+/*
+ * finds the delimiters of ICS lines 16 (SSE2) or 32 (AVX2, if the CPU has
+ * it) bytes at a time. Other architectures and -DNOSIMD builds use the
+ * plain loop, which is also used for the tails.
+ */
+
+#if !defined(NOSIMD) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define LINESCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*find2_fn)( const char *, size_t, char, char );
+
+/* offset of the first a or b in s, len if there is none */
+static size_t find2_scalar( const char *s, size_t len, char a, char b )
+{
+    size_t i;
+
+    for (i=0; i<len; ++i)
+        if ( s[i] == a || s[i] == b )
+            break;
+    return i;
+}
+
+#ifdef LINESCAN_X86
+static size_t find2_sse2( const char *s, size_t len, char a, char b )
+{
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i;
+
+    for (i=0; i+16<=len; i+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s+i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+        if ( m )
+            return i+__builtin_ctz(m);
+    }
+    return i+find2_scalar(s+i, len-i, a, b);
+}
+
+__attribute__((target("avx2")))
+static size_t find2_avx2( const char *s, size_t len, char a, char b )
+{
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    size_t i;
+
+    for (i=0; i+32<=len; i+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s+i));
+        unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)));
+        if ( m )
+            return i+__builtin_ctz(m);
+    }
+    return i+find2_sse2(s+i, len-i, a, b);
+}
+#endif
+
+static const struct {
+    const char *name;
+    find2_fn find2;
+} impl[] = {
+#ifdef LINESCAN_X86
+    { "avx2", find2_avx2 },
+    { "sse2", find2_sse2 },
+#endif
+    { "scalar", find2_scalar },
+};
+
+static size_t selected;
+
+static int cpu_has( size_t i )
+{
+#ifdef LINESCAN_X86
+    if ( str_equal(impl[i].name, "avx2") ) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 1;
+}
+
+/* the best one the CPU has, before main() and thus before any threads */
+__attribute__((constructor))
+static void linescan_init( void )
+{
+    for (selected=0; !cpu_has(selected); ++selected)
+        ;
+}
+
+const char *linescan_impl( void )
+{
+    return impl[selected].name;
+}
+
+/* forces an implementation, -1 if it is not there or the CPU lacks it */
+int linescan_select( const char *name )
+{
+    size_t i;
+
+    for (i=0; i<sizeof(impl)/sizeof(impl[0]); ++i)
+        if ( str_equal(impl[i].name, name) && cpu_has(i) ) {
+            selected = i;
+            return 0;
+        }
+    return -1;
+}
+
+/* offset of the end of the line ('\n'), len if it is not in buf */
+size_t linescan_eol( const char *buf, size_t len )
+{
+    return impl[selected].find2(buf, len, '\n', '\n');
+}
+
+/* length of the property name, up to the first ':' or ';' */
+size_t linescan_name( const char *buf, size_t len )
+{
+    return impl[selected].find2(buf, len, ':', ';');
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stdlib.h>
+
+int main( int argc, char *argv[] )
+{
+    const char *names[] = { "avx2", "sse2", "scalar" };
+    char buf[200];
+    size_t i, n, off, len, want;
+
+    assert(0==linescan_select("scalar"));
+    assert(-1==linescan_select("mmx"));
+    assert(str_equal(linescan_impl(), "scalar"));
+    linescan_init();
+
+    srandom(42);
+    for (n=0; n<sizeof(names)/sizeof(names[0]); ++n) {
+        if ( linescan_select(names[n]) )
+            continue;
+        for (i=0; i<2000; ++i) {
+            size_t j;
+            /* mostly letters, now and then a delimiter */
+            for (j=0; j<sizeof(buf); ++j)
+                buf[j] = "ABCDEFGH:;\n\r"[random()%(random()%64?8:12)];
+            off = random()%64;
+            len = random()%(sizeof(buf)-off);
+            want = find2_scalar(buf+off, len, '\n', '\n');
+            assert(linescan_eol(buf+off, len)==want);
+            want = find2_scalar(buf+off, len, ':', ';');
+            assert(linescan_name(buf+off, len)==want);
+        }
+        assert(linescan_eol("DTSTART:20230101T000000Z\r\n", 26)==25);
+        assert(linescan_name("DTSTART;VALUE=DATE:20230101", 27)==7);
+        assert(linescan_name("no delimiter in here at all, not even after thirty-two bytes", 60)==60);
+    }
+    exit(EXIT_SUCCESS);
+}
+#endif
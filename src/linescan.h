@@ -0,0 +1,9 @@
+#ifndef LINESCAN_H
+#define LINESCAN_H
+#include <stddef.h>
+
+const char *linescan_impl( void );
+int linescan_select( const char * );
+size_t linescan_eol( const char *, size_t );
+size_t linescan_name( const char *, size_t );
+#endif
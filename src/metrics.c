@@ -0,0 +1,265 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <errmsg.h>
+#include <str.h>
+#include <fmt.h>
+#include <byte.h>
+#include "metrics.h"
+#include "atomicfile.h"
+#include "trace.h"
+
+enum metrics_field {
+    MF_FETCH,
+    MF_PARSE,
+    MF_STATUS,
+    MF_BYTES,
+    MF_LINES,
+    MF_EVENTS,
+    MF_KEPT,
+    MF_DROPPED,
+    MF_FAILED
+};
+
+/* one gauge per calendar and field, all samples of a gauge together */
+static const struct {
+    enum metrics_field field;
+    const char *name;
+    const char *help;
+} gauges[] = {
+    { MF_FETCH, "caltimist_fetch_duration_seconds", "Time to fetch and parse the calendar." },
+    { MF_PARSE, "caltimist_parse_duration_seconds", "Time spent parsing the calendar." },
+    { MF_STATUS, "caltimist_fetch_http_status", "HTTP status of the last response, 0 if there was none." },
+    { MF_BYTES, "caltimist_fetch_bytes", "Bytes received for the calendar." },
+    { MF_LINES, "caltimist_parsed_lines", "Content lines parsed." },
+    { MF_EVENTS, "caltimist_parsed_events", "Events parsed." },
+    { MF_KEPT, "caltimist_kept_events", "Events taken into the report." },
+    { MF_DROPPED, "caltimist_dropped_events", "Events dropped as duplicates, of the calendar or of one before." },
+    { MF_FAILED, "caltimist_fetch_failed", "1 if the calendar could not be fetched." }
+};
+
+int metrics_init( struct metrics_context *m )
+{
+    memset(m, 0, sizeof(struct metrics_context));
+    m->start = trace_now();
+    return 0;
+}
+
+void metrics_free( struct metrics_context *m )
+{
+    size_t i;
+
+    for (i=0; i<m->sources; ++i) {
+        free(m->source[i].user);
+        free(m->source[i].host);
+        free(m->source[i].calendar);
+    }
+    free(m->source);
+    memset(m, 0, sizeof(struct metrics_context));
+}
+
+/* host[:port] of url, "" if it has none */
+static char *url_host( const char *url )
+{
+    const char *h = url?strstr(url, "://"):NULL;
+    size_t len, at;
+    char *s;
+
+    if ( h ) {
+        h += 3;
+        len = str_chr(h, '/');
+        at = byte_rchr(h, len, '@');
+        if ( at < len ) {
+            h += at+1;
+            len -= at+1;
+        }
+    } else {
+        h = "";
+        len = 0;
+    }
+    if ( !(s = malloc(len+1)) ) {
+        carpsys("malloc");
+        return NULL;
+    }
+    memcpy(s, h, len);
+    s[len] = '\0';
+    return s;
+}
+
+/*
+ * a new calendar of user, the n-th one of the user; user NULL is the
+ * calendar of the public holidays
+ */
+struct metrics_source *metrics_add( struct metrics_context *m, const char *user, const char *url, size_t n )
+{
+    struct metrics_source *s;
+    char num[FMT_ULONG];
+
+    if ( !(s = realloc(m->source, (m->sources+1)*sizeof(struct metrics_source))) ) {
+        carpsys("realloc");
+        return NULL;
+    }
+    m->source = s;
+    s += m->sources;
+    memset(s, 0, sizeof(struct metrics_source));
+    num[fmt_ulong(num, n)] = '\0';
+    s->user = strdup(user?user:"");
+    s->calendar = strdup(user?num:METRICS_HOLIDAYS);
+    s->host = url_host(url);
+    if ( !s->user || !s->calendar || !s->host ) {
+        carpsys("strdup");
+        free(s->user);
+        free(s->calendar);
+        free(s->host);
+        return NULL;
+    }
+    m->sources++;
+    return s;
+}
+
+/* label values escape backslash, double quote and line feed */
+static int cat_label( stralloc *sa, const char *name, const char *value )
+{
+    if ( !stralloc_cats(sa, name) || !stralloc_cats(sa, "=\"") )
+        return -1;
+    for (; *value; ++value) {
+        if ( (*value == '\\' || *value == '"') && !stralloc_append(sa, "\\") )
+            return -1;
+        if ( !(*value == '\n'?stralloc_cats(sa, "\\n"):stralloc_append(sa, value)) )
+            return -1;
+    }
+    return stralloc_append(sa, "\"")?0:-1;
+}
+
+/* microseconds as seconds with six decimals */
+static int cat_seconds( stralloc *sa, unsigned long long us )
+{
+    return (stralloc_catulong0(sa, us/1000000, 0) && stralloc_append(sa, ".") &&
+            stralloc_catulong0(sa, us%1000000, 6))?0:-1;
+}
+
+static int cat_head( stralloc *sa, const char *name, const char *help )
+{
+    return (stralloc_cats(sa, "# HELP ") && stralloc_cats(sa, name) && stralloc_append(sa, " ") &&
+            stralloc_cats(sa, help) && stralloc_cats(sa, "\n# TYPE ") && stralloc_cats(sa, name) &&
+            stralloc_cats(sa, " gauge\n"))?0:-1;
+}
+
+static int cat_sample( stralloc *sa, const struct metrics_source *s, const char *name, enum metrics_field f )
+{
+    unsigned long v=0;
+
+    if ( !stralloc_cats(sa, name) || !stralloc_append(sa, "{") || cat_label(sa, "user", s->user) ||
+         !stralloc_append(sa, ",") || cat_label(sa, "host", s->host) ||
+         !stralloc_append(sa, ",") || cat_label(sa, "calendar", s->calendar) || !stralloc_cats(sa, "} ") )
+        return -1;
+    switch ( f ) {
+    case MF_FETCH: return cat_seconds(sa, s->fetch_us) || !stralloc_append(sa, "\n");
+    case MF_PARSE: return cat_seconds(sa, s->parse_us) || !stralloc_append(sa, "\n");
+    case MF_STATUS: v = s->status; break;
+    case MF_BYTES: v = s->bytes; break;
+    case MF_LINES: v = s->lines; break;
+    case MF_EVENTS: v = s->events; break;
+    case MF_KEPT: v = (s->events>s->dropped)?s->events-s->dropped:0; break;
+    case MF_DROPPED: v = s->dropped; break;
+    case MF_FAILED: v = s->failed?1:0; break;
+    }
+    return (stralloc_catulong0(sa, v, 0) && stralloc_append(sa, "\n"))?0:-1;
+}
+
+/* the calendars and the whole run in the text exposition format of Prometheus */
+int metrics_format( const struct metrics_context *m, stralloc *sa, int ok )
+{
+    struct rusage ru;
+    size_t g, i;
+
+    sa->len = 0;
+    for (g=0; g<sizeof(gauges)/sizeof(gauges[0]); ++g) {
+        if ( !m->sources )
+            break;
+        if ( cat_head(sa, gauges[g].name, gauges[g].help) )
+            goto err;
+        for (i=0; i<m->sources; ++i)
+            if ( cat_sample(sa, &m->source[i], gauges[g].name, gauges[g].field) )
+                goto err;
+    }
+    /* ru_maxrss is in kilobytes on Linux */
+    if ( getrusage(RUSAGE_SELF, &ru) )
+        ru.ru_maxrss = 0;
+    if ( cat_head(sa, "caltimist_run_duration_seconds", "Wall time of the run.") ||
+         !stralloc_cats(sa, "caltimist_run_duration_seconds ") || cat_seconds(sa, trace_now()-m->start) ||
+         !stralloc_append(sa, "\n") ||
+         cat_head(sa, "caltimist_peak_rss_bytes", "Peak resident set size of the run.") ||
+         !stralloc_cats(sa, "caltimist_peak_rss_bytes ") || !stralloc_catulong0(sa, ru.ru_maxrss*1024UL, 0) ||
+         !stralloc_append(sa, "\n") ||
+         cat_head(sa, "caltimist_run_success", "1 if the run produced its report.") ||
+         !stralloc_cats(sa, "caltimist_run_success ") || !stralloc_catulong0(sa, ok?1:0, 0) ||
+         !stralloc_append(sa, "\n") ||
+         cat_head(sa, "caltimist_last_run_timestamp_seconds", "Time the run ended.") ||
+         !stralloc_cats(sa, "caltimist_last_run_timestamp_seconds ") || !stralloc_catulong0(sa, time(NULL), 0) ||
+         !stralloc_append(sa, "\n") )
+        goto err;
+    return 0;
+err:
+    carpsys("stralloc");
+    return -1;
+}
+
+/* replaced atomically, the textfile collector never reads half a file */
+int metrics_write( const struct metrics_context *m, const char *file, int ok )
+{
+    stralloc sa;
+    int ret;
+
+    stralloc_init(&sa);
+    ret = metrics_format(m, &sa, ok) || write_file_atomic(file, sa.s, sa.len);
+    stralloc_free(&sa);
+    return ret?-1:0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+int main( int argc, char *argv[] )
+{
+    struct metrics_context m;
+    struct metrics_source *s;
+    stralloc sa;
+
+    assert(0==metrics_init(&m));
+    assert((s=metrics_add(&m, "a\"b", "https://usr:pw@cal.example:8443/path/x.ics", 1)));
+    assert(str_equal(s->host, "cal.example:8443") && str_equal(s->calendar, "1"));
+    s->fetch_us = 1500042;
+    s->events = 10;
+    s->dropped = 3;
+    s->status = 200;
+    assert((s=metrics_add(&m, NULL, "http://holidays/", 0)));
+    assert(str_equal(s->host, "holidays") && str_equal(s->calendar, METRICS_HOLIDAYS) && !*s->user);
+    s->failed = 1;
+
+    stralloc_init(&sa);
+    assert(0==metrics_format(&m, &sa, 1) && stralloc_0(&sa));
+    assert(strstr(sa.s, "# TYPE caltimist_fetch_duration_seconds gauge\n"
+                "caltimist_fetch_duration_seconds{user=\"a\\\"b\",host=\"cal.example:8443\",calendar=\"1\"} 1.500042\n"));
+    assert(strstr(sa.s, "caltimist_kept_events{user=\"a\\\"b\",host=\"cal.example:8443\",calendar=\"1\"} 7\n"));
+    assert(strstr(sa.s, "caltimist_fetch_http_status{user=\"a\\\"b\",host=\"cal.example:8443\",calendar=\"1\"} 200\n"
+                "caltimist_fetch_http_status{user=\"\",host=\"holidays\",calendar=\"public_holidays\"} 0\n"));
+    assert(strstr(sa.s, "caltimist_fetch_failed{user=\"\",host=\"holidays\",calendar=\"public_holidays\"} 1\n"));
+    assert(strstr(sa.s, "\ncaltimist_run_success 1\n"));
+    assert(!strstr(sa.s, "caltimist_peak_rss_bytes 0\n"));
+    assert(!strstr(sa.s, "pw"));
+    assert(sa.s[sa.len-2]=='\n');
+
+    stralloc_free(&sa);
+    metrics_free(&m);
+    assert(!m.sources);
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stddef.h>
+#include <stralloc.h>
+
+/* label value of the calendar of the public holidays */
+#define METRICS_HOLIDAYS "public_holidays"
+
+/* what one calendar of a run took */
+struct metrics_source {
+    char *user;     // "" for public holidays
+    char *host;     // host[:port] of the URL, without credentials
+    char *calendar; // index among the calendars of the user, or METRICS_HOLIDAYS
+    unsigned short status;
+    int failed;
+    unsigned long long fetch_us; // fetching and parsing, as they overlap
+    unsigned long long parse_us; // parsing alone
+    unsigned long bytes, lines, events, dropped;
+};
+
+/* the calendars of one run, written as node_exporter textfile at its end */
+struct metrics_context {
+    struct metrics_source *source;
+    size_t sources;
+    unsigned long long start; // trace_now() at the start of the run
+};
+
+int metrics_init( struct metrics_context * );
+void metrics_free( struct metrics_context * );
+struct metrics_source *metrics_add( struct metrics_context *, const char *, const char *, size_t );
+int metrics_format( const struct metrics_context *, stralloc *, int );
+int metrics_write( const struct metrics_context *, const char *, int );
+#endif
@@ -0,0 +1,907 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
+#include <errmsg.h>
+#include <str.h>
+#include <byte.h>
+#include "report.h"
+#include "httpsclient.h"
+#include "caldav.h"
+#include "syncstore.h"
+#include "holidays.h"
+#include "reportcache.h"
+#include "hash.h"
+#include "ics.h"
+#include "shardparse.h"
+#include "template.h"
+
+#define V(__l,__fn) do{if(report_verbosity>=__l){ __fn; }}while(0);
+short report_verbosity=0;
+
+#define CALDAV_CONTENT_TYPE "Content-Type: application/xml; charset=utf-8\r\n"
+/* sync-collection requests per run before a truncated result is given up */
+#define SYNC_MAX_ROUNDS 100
+
+void set_report_verbosity( short v ) {
+    report_verbosity=v;
+}
+
+static void trace_counters( struct trace_context *tr, const struct fetch_context *fc, const struct ics_context *ctx )
+{
+    trace_counter(tr, "bytes", fc->bytes);
+    trace_counter(tr, "lines", ctx->lines);
+    trace_counter(tr, "events", ctx->events);
+    trace_counter(tr, "duplicates", ctx->duplicates);
+}
+
+/*
+ * the n-th calendar of user (NULL: public holidays) into the metrics, if they
+ * are taken; the counters of fc and ctx have to be those of this calendar
+ */
+static void record_source( const struct fetch_context *fc, const char *user, const char *cal, size_t n,
+        int failed, const struct ics_context *ctx )
+{
+    struct metrics_source *s;
+
+    if ( !fc->metrics || !(s = metrics_add(fc->metrics, user, cal, n)) )
+        return;
+    s->failed = failed;
+    s->status = fc->status;
+    s->fetch_us = fc->fetch_us;
+    s->parse_us = fc->parse_us;
+    s->bytes = fc->bytes;
+    s->lines = ctx->lines;
+    s->events = ctx->events;
+    s->dropped = ctx->duplicates;
+}
+
+/* sends a REPORT with body to the collection cal, the answer goes through cd */
+static int caldav_report( struct fetch_context *fc, const char *cal, const char *headers, const stralloc *body, struct caldav_context *cd )
+{
+    int ret;
+
+    fc->method = "REPORT";
+    fc->headers = headers;
+    fc->body = body->s;
+    fc->body_len = body->len;
+    ret = fetch_calendar(fc, cal, caldav_parser, cd);
+    fc->method = fc->headers = fc->body = NULL;
+    fc->body_len = 0;
+    return ret;
+}
+
+/* the getetags of a collection as the validator of the report cache, empty if there were none */
+static int etags_validator( stralloc *validator, unsigned long long etags )
+{
+    validator->len = 0;
+    if ( etags && !stralloc_ready(validator, FMT_HASH) ) {
+        carpsys("stralloc_ready");
+        return -1;
+    }
+    if ( etags )
+        validator->len = fmt_hash(validator->s, etags);
+    return 0;
+}
+
+/*
+ * CalDAV calendar-query for the report window instead of the full export,
+ * the calendar-data of the multistatus response is unwrapped for ics_parser.
+ * If validator is set, it gets the getetags of the resources.
+ */
+static int fetch_caldav( struct fetch_context *fc, const char *cal, struct ics_context *ctx, time_t begin, time_t end,
+        stralloc *validator )
+{
+    struct caldav_context cd;
+    stralloc query;
+    int ret;
+
+    stralloc_init(&query);
+    if ( caldav_calendar_query(&query, begin, end, true) )
+        return -1;
+    init_caldav_context(&cd, ics_parser, ctx);
+    ret = caldav_report(fc, cal, "Depth: 1\r\n" CALDAV_CONTENT_TYPE, &query, &cd);
+    V(2,
+        buffer_puts(buffer_2, "CalDAV resources: ");
+        buffer_putulong(buffer_2, cd.resources);
+        buffer_putnlflush(buffer_2);
+    );
+    if ( !ret && validator )
+        ret = etags_validator(validator, cd.etags);
+    free_caldav_context(&cd);
+    stralloc_free(&query);
+    return ret;
+}
+
+/*
+ * RFC 6578 sync-collection against the local copy of the collection, so
+ * only what changed since the stored sync-token is transferred. Resources
+ * listed without calendar-data are fetched by a calendar-multiget. The
+ * whole copy is then parsed as if it had been downloaded. If validator is
+ * set, it gets the sync-token of the copy.
+ */
+static int fetch_caldav_sync( struct fetch_context *fc, const char *dir, const char *cal, struct ics_context *ctx,
+        stralloc *validator )
+{
+    struct sync_store st;
+    struct caldav_context cd;
+    stralloc body;
+    unsigned long long t;
+    unsigned short rounds=0;
+    bool full_sync;
+    int ret=-1;
+
+    if ( init_sync_store(&st, dir, cal) )
+        return -1;
+    stralloc_init(&body);
+    sync_load(&st);
+    full_sync = !st.token.len;
+
+    do {
+        st.truncated = false;
+        if ( !stralloc_0(&st.token) ) {
+            carpsys("stralloc_0");
+            goto cleanup;
+        }
+        st.token.len--;
+        if ( caldav_sync_collection(&body, st.token.s, true) )
+            goto cleanup;
+        init_caldav_sync_context(&cd, sync_response, &st);
+        ret = caldav_report(fc, cal, "Depth: 0\r\n" CALDAV_CONTENT_TYPE, &body, &cd);
+        if ( !ret && !stralloc_copy(&st.token, &cd.sync_token) ) {
+            carpsys("stralloc_copy");
+            ret = -1;
+        }
+        free_caldav_context(&cd);
+        /* RFC 6578 3.2: an outdated token is refused with valid-sync-token */
+        if ( ret && !full_sync && (fc->status == 403 || fc->status == 409) ) {
+            V(1,carp("sync-token refused, starting over: ", cal));
+            sync_clear(&st);
+            full_sync = true;
+            st.truncated = true;
+            ret = 0;
+            continue;
+        }
+        if ( ret )
+            goto cleanup;
+        if ( st.truncated && ++rounds == SYNC_MAX_ROUNDS ) {
+            carp("sync-collection still truncated after too many rounds: ", cal);
+            ret = -1;
+            goto cleanup;
+        }
+    } while ( st.truncated );
+
+    if ( st.missing.len ) {
+        if ( caldav_calendar_multiget(&body, st.missing.s, st.missing.len) )
+            goto cleanup;
+        st.missing.len = 0;
+        init_caldav_sync_context(&cd, sync_response, &st);
+        ret = caldav_report(fc, cal, "Depth: 1\r\n" CALDAV_CONTENT_TYPE, &body, &cd);
+        free_caldav_context(&cd);
+        if ( ret )
+            goto cleanup;
+        if ( st.missing.len ) {
+            carp("calendar-multiget without calendar-data: ", cal);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+    V(2,
+        buffer_puts(buffer_2, "sync: ");
+        buffer_putulong(buffer_2, st.updated);
+        buffer_puts(buffer_2, " updated, ");
+        buffer_putulong(buffer_2, st.removed);
+        buffer_puts(buffer_2, " removed, ");
+        buffer_putulong(buffer_2, st.resources);
+        buffer_puts(buffer_2, " resources");
+        buffer_putnlflush(buffer_2);
+    );
+    /* without the new state the next run simply syncs from the old token */
+    if ( sync_save(&st) )
+        carp("failed to save sync store: ", st.file);
+    t = fc->metrics?trace_now():0;
+    ret = sync_feed(&st, ics_parser, ctx);
+    if ( fc->metrics )
+        fc->parse_us += trace_now()-t;
+    if ( !ret && validator && !stralloc_copy(validator, &st.token) ) {
+        carpsys("stralloc_copy");
+        ret = -1;
+    }
+
+cleanup:
+    stralloc_free(&body);
+    free_sync_store(&st);
+    return ret;
+}
+
+/*
+ * makes sure the workdays of region are known: from the cache_dir or by
+ * fetching and compiling its public holiday calendar, once per run
+ */
+static int prepare_holidays( struct fetch_context *fc, struct holiday_regions *hr, struct holiday_region *r )
+{
+    struct ics_context hctx;
+    unsigned long bytes = fc->bytes;
+    unsigned long long t;
+    int ret;
+
+    if ( r->ready )
+        return 0;
+    if ( !load_holiday_region(hr, r) ) {
+        hr->cached++;
+        return 0;
+    }
+    V(1,carp("fetching public holidays: ", r->url));
+    fc->label = "public_holidays";
+    init_ics_context(&hctx, &r->table, NULL);
+    t = fc->metrics?trace_now():0;
+    fc->bytes = fc->parse_us = 0;
+    ret=fetch_calendar( fc, r->url, ics_parser, &hctx ) || ics_finish(&hctx);
+    if ( fc->metrics )
+        fc->fetch_us = trace_now()-t;
+    record_source(fc, NULL, r->url, 0, ret, &hctx);
+    fc->bytes += bytes;
+    trace_counters(fc->trace, fc, &hctx);
+    free_ics_context(&hctx);
+    if ( ret ) {
+        carp("failed to fetch public holiday calendar: ", r->url);
+        return -1;
+    }
+    r->ready = true;
+    hr->compiled++;
+    if ( save_holiday_region(hr, r) )
+        carp("failed to cache public holidays: ", r->url);
+    return 0;
+}
+
+static int collect_body( void *body, char *buf )
+{
+    if ( !stralloc_cats((stralloc *)body, buf) ) {
+        carpsys("stralloc_cats");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * a plain download with parse_threads is received in full and then parsed
+ * on that many threads, everything else is parsed while it comes in
+ */
+static int fetch_sharded( struct fetch_context *fc, const char *cal, struct ics_context *ctx, unsigned short threads )
+{
+    stralloc body;
+    unsigned long long t;
+    int ret;
+
+    stralloc_init(&body);
+    ret = fetch_calendar( fc, cal, collect_body, &body );
+    t = fc->metrics?trace_now():0;
+    if ( !ret )
+        ret = parse_ics_body( ctx, body.s, body.len, threads );
+    if ( fc->metrics )
+        fc->parse_us += trace_now()-t;
+    stralloc_free(&body);
+    return ret;
+}
+
+/* a calendar that revalidation of the report cache already received in full */
+struct pulled_source {
+    const struct user_context *u;
+    size_t cal; // index among the calendars of u
+    stralloc body;
+    stralloc etag;
+};
+
+/*
+ * one calendar of user u into ctx, the way the config says; timed with
+ * metrics. If pulled is set, the calendar was already received with it.
+ * If validator is set, it gets what tells whether the calendar changed:
+ * the ETag of a download, the getetags of a CalDAV collection or the
+ * sync-token of a synced one, empty if there is none.
+ */
+static int fetch_source( struct fetch_context *fc, const struct config_context *cfgctx, const struct user_context *u,
+        const char *cal, const struct pulled_source *pulled, stralloc *validator, struct ics_context *ctx,
+        time_t begin, time_t end )
+{
+    unsigned short threads = cfgctx->general.parse_threads;
+    unsigned long long t0 = fc->metrics?trace_now():0, t;
+    int ret;
+
+    fc->parse_us = 0;
+    if ( pulled ) {
+        ret = parse_ics_body( ctx, pulled->body.s, pulled->body.len,
+                (ctx->stop_after == ICS_STAGE_ALL && !ctx->summary)?threads:1 );
+        if ( fc->metrics )
+            fc->parse_us = trace_now()-t0;
+    } else if ( threads > 1 && !u->sync && !u->caldav && ctx->stop_after == ICS_STAGE_ALL && !ctx->summary ) {
+        ret = fetch_sharded( fc, cal, ctx, threads );
+    } else {
+        ret = u->sync?
+            fetch_caldav_sync( fc, cfgctx->general.sync_dir, cal, ctx, validator ):
+            u->caldav?
+            fetch_caldav( fc, cal, ctx, begin, end, validator ):
+            fetch_calendar( fc, cal, ics_parser, ctx );
+        t = fc->metrics?trace_now():0;
+        if ( !ret )
+            ret = ics_finish(ctx);
+        if ( fc->metrics )
+            fc->parse_us += trace_now()-t;
+    }
+    if ( fc->metrics )
+        fc->fetch_us = trace_now()-t0;
+    if ( !ret && validator && !u->sync && !u->caldav &&
+            !stralloc_copy(validator, pulled?&pulled->etag:&fc->etag) ) {
+        carpsys("stralloc_copy");
+        ret = -1;
+    }
+    return ret;
+}
+
+static unsigned long long holiday_hash( const struct holiday_table *ht )
+{
+    return hash_buf(hash_str(""), (const char *)ht->workdays, sizeof(ht->workdays));
+}
+
+/*
+ * summary mode: the calendars one after the other straight into ctx, which
+ * adds up the events as they come. The lines for the report cache are the
+ * ones fetch_user gives.
+ */
+static int fetch_summary( struct fetch_context *fc, const struct config_context *cfgctx, const struct user_context *u,
+        const struct pulled_source *pulled, stralloc *sources, struct ics_context *ctx, time_t begin, time_t end )
+{
+    unsigned long bytes=fc->bytes, lines=ctx->lines, events=ctx->events, duplicates=ctx->duplicates;
+    stralloc validator;
+    size_t i;
+    int ret=0;
+
+    stralloc_init(&validator);
+    /* counted per calendar for the metrics, the totals are restored after */
+    for_each_cal(u, i) {
+        ctx->content_hash = hash_str("");
+        fc->bytes = ctx->lines = ctx->events = ctx->duplicates = 0;
+        ret = fetch_source(fc, cfgctx, u, u->cal[i], (pulled && pulled->cal == i)?pulled:NULL,
+                sources?&validator:NULL, ctx, begin, end);
+        record_source(fc, u->name, u->cal[i], i, ret, ctx);
+        bytes += fc->bytes;
+        lines += ctx->lines;
+        events += ctx->events;
+        duplicates += ctx->duplicates;
+        if ( ret ) {
+            carp("failed to fetch calendar: ", u->cal[i]);
+            break;
+        }
+        if ( sources && (ret = report_cache_add_source(sources, holiday_hash(ctx->holidays), ctx->content_hash,
+                        &validator)) )
+            break;
+    }
+    fc->bytes = bytes;
+    ctx->lines = lines;
+    ctx->events = events;
+    ctx->duplicates = duplicates;
+    stralloc_free(&validator);
+    return ret?-1:0;
+}
+
+/* what one thread of fetch_user works on */
+struct source_job {
+    struct fetch_context fc;
+    const struct config_context *cfgctx;
+    const struct user_context *u;
+    const char *cal;
+    const struct pulled_source *pulled;
+    stralloc validator;
+    bool validate; // for the report cache
+    struct ics_context *ctx;
+    struct trace_context trace;
+    time_t begin, end;
+    int ret;
+#ifndef NOTHREADS
+    pthread_t thread;
+    bool started;
+#endif
+};
+
+static void *run_source_job( void *arg )
+{
+    struct source_job *j = arg;
+
+    j->ret = fetch_source(&j->fc, j->cfgctx, j->u, j->cal, j->pulled, j->validate?&j->validator:NULL,
+            j->ctx, j->begin, j->end);
+    return NULL;
+}
+
+/*
+ * the calendars of user u into ctx. Each one is fetched and parsed into a
+ * context of its own, the ones after the first on threads of their own, and
+ * the sorted streams are merged into ctx in one go. The DNS cache is shared,
+ * the extra threads trace on rows of their own, joined in after them.
+ * pulled, if set, is a calendar already received. With sources, each
+ * calendar adds its line for the report cache: the hashes of the holidays
+ * and of its content, and its validator.
+ */
+static int fetch_user( struct fetch_context *fc, const struct config_context *cfgctx, const struct user_context *u,
+        const struct pulled_source *pulled, stralloc *sources, struct ics_context *ctx, time_t begin, time_t end )
+{
+    struct source_job *job;
+    struct ics_context *src;
+    size_t i, n = u->cals;
+    unsigned long duplicates, bytes = fc->bytes;
+    unsigned long long t;
+    int ret=0;
+
+    if ( u->sync && !cfgctx->general.sync_dir ) {
+        carp("sync needs a sync_dir in [General], user ", u->name);
+        return -1;
+    }
+    if ( !n ) {
+        carp("no calendar for user ", u->name);
+        return -1;
+    }
+    if ( ctx->summary )
+        return fetch_summary(fc, cfgctx, u, pulled, sources, ctx, begin, end);
+    job = calloc(n, sizeof(struct source_job));
+    src = job?calloc(n, sizeof(struct ics_context)):NULL;
+    if ( !src ) {
+        carpsys("calloc");
+        free(job);
+        return -1;
+    }
+    for_each_cal(u, i) {
+        job[i].fc = *fc;
+        job[i].fc.bytes = 0;
+        if ( i ) {
+            if ( fc->trace && trace_init_thread(&job[i].trace, fc->trace, i+1) ) {
+                carp("failed to set up tracing for calendar: ", u->cal[i]);
+                trace_free(&job[i].trace);
+                job[i].fc.trace = NULL;
+            } else if ( fc->trace )
+                job[i].fc.trace = &job[i].trace;
+            job[i].fc.if_none_match = NULL;
+            stralloc_init(&job[i].fc.etag);
+        }
+        job[i].cfgctx = cfgctx;
+        job[i].u = u;
+        job[i].cal = u->cal[i];
+        job[i].pulled = (pulled && pulled->cal == i)?pulled:NULL;
+        job[i].validate = sources != NULL;
+        stralloc_init(&job[i].validator);
+        job[i].begin = begin;
+        job[i].end = end;
+        job[i].ctx = &src[i];
+        init_ics_context(&src[i], ctx->holidays, ctx->user);
+        tzone_borrow(&src[i].zones, &ctx->zones);
+        src[i].unsorted = true;
+        src[i].stop_after = ctx->stop_after;
+        src[i].hash_content = ctx->hash_content;
+        src[i].content_hash = hash_str("");
+    }
+
+#ifndef NOTHREADS
+    for (i=1; i<n; ++i)
+        job[i].started = !pthread_create(&job[i].thread, NULL, run_source_job, &job[i]);
+#endif
+    run_source_job(&job[0]);
+    for (i=1; i<n; ++i) {
+#ifndef NOTHREADS
+        if ( job[i].started ) {
+            pthread_join(job[i].thread, NULL);
+            continue;
+        }
+#endif
+        run_source_job(&job[i]);
+    }
+    /* the first one used fc itself */
+    *fc = job[0].fc;
+    fc->bytes = bytes;
+
+    for_each_cal(u, i) {
+        if ( job[i].ret ) {
+            carp("failed to fetch calendar: ", u->cal[i]);
+            ret=-1;
+        }
+        fc->bytes += job[i].fc.bytes;
+        if ( i ) {
+            if ( job[i].fc.trace && trace_adopt(fc->trace, job[i].fc.trace) )
+                ret=-1;
+            job[i].fc.trace = NULL;
+            stralloc_free(&job[i].fc.etag);
+        }
+        if ( !ret && sources && report_cache_add_source(sources, holiday_hash(ctx->holidays), src[i].content_hash,
+                    &job[i].validator) )
+            ret=-1;
+    }
+    duplicates = ctx->duplicates;
+    t = trace_now();
+    if ( !ret && ics_merge(ctx, src, n) )
+        ret=-1;
+    trace_complete(fc->trace, "report", "merge/sort", u->name, t);
+    V(1,
+        if ( ctx->duplicates > duplicates ) {
+            buffer_puts(buffer_2, "duplicate events dropped for user ");
+            buffer_puts(buffer_2, u->name);
+            buffer_puts(buffer_2, ": ");
+            buffer_putulong(buffer_2, ctx->duplicates-duplicates);
+            buffer_putnlflush(buffer_2);
+        }
+    );
+    /* after the merge, which counts the duplicates among the calendars */
+    for_each_cal(u, i) {
+        record_source(&job[i].fc, u->name, u->cal[i], i, job[i].ret, &src[i]);
+        free_ics_context(&src[i]);
+        stralloc_free(&job[i].validator);
+    }
+    free(src);
+    free(job);
+    return ret;
+}
+
+/* any response to a sync-collection from the stored token is a change */
+static int sync_changed( void *changed, const char *href, unsigned short status, const stralloc *data )
+{
+    (void)href; (void)status; (void)data;
+    *(bool *)changed = true;
+    return 0;
+}
+
+/*
+ * 0 if the synced collection cal is still at the sync-token validator:
+ * the local copy has to hold it and a sync-collection from it without
+ * calendar-data has to come back empty. The copy is only read, it moves
+ * on with the next fetch. 1 otherwise, also if it could not be told.
+ */
+static int revalidate_sync( struct fetch_context *fc, const char *dir, const char *cal, const stralloc *validator )
+{
+    struct sync_store st;
+    struct caldav_context cd;
+    stralloc body;
+    bool changed=true;
+
+    if ( !validator->len || init_sync_store(&st, dir, cal) )
+        return 1;
+    stralloc_init(&body);
+    if ( !sync_load(&st) && st.token.len == validator->len &&
+            byte_equal(st.token.s, st.token.len, validator->s) && stralloc_0(&st.token) ) {
+        st.token.len--;
+        if ( !caldav_sync_collection(&body, st.token.s, false) ) {
+            changed = false;
+            init_caldav_sync_context(&cd, sync_changed, &changed);
+            if ( caldav_report(fc, cal, "Depth: 0\r\n" CALDAV_CONTENT_TYPE, &body, &cd) )
+                changed = true;
+            free_caldav_context(&cd);
+        }
+    }
+    stralloc_free(&body);
+    free_sync_store(&st);
+    return changed?1:0;
+}
+
+/*
+ * 0 if the CalDAV collection cal still has the events of the report
+ * window it had: by the getetags of a calendar-query without
+ * calendar-data if there is a validator, else by the hash of the
+ * calendar-data, which then has to be received again. 1 otherwise.
+ */
+static int revalidate_caldav( struct fetch_context *fc, const struct user_context *u, const char *cal,
+        const stralloc *validator, unsigned long long content, time_t begin, time_t end )
+{
+    struct caldav_context cd;
+    struct ics_context hctx;
+    stralloc query, etags;
+    int ret=1;
+
+    if ( !validator->len ) {
+        init_ics_context(&hctx, NULL, u->name);
+        hctx.stop_after = ICS_STAGE_SPLIT;
+        hctx.hash_content = true;
+        hctx.content_hash = hash_str("");
+        if ( !fetch_caldav(fc, cal, &hctx, begin, end, NULL) && !ics_finish(&hctx) &&
+                hctx.content_hash == content )
+            ret = 0;
+        free_ics_context(&hctx);
+        return ret;
+    }
+    stralloc_init(&query);
+    stralloc_init(&etags);
+    if ( !caldav_calendar_query(&query, begin, end, false) ) {
+        init_caldav_context(&cd, NULL, NULL);
+        if ( !caldav_report(fc, cal, "Depth: 1\r\n" CALDAV_CONTENT_TYPE, &query, &cd) &&
+                !etags_validator(&etags, cd.etags) && etags.len == validator->len &&
+                byte_equal(etags.s, etags.len, validator->s) )
+            ret = 0;
+        free_caldav_context(&cd);
+    }
+    stralloc_free(&etags);
+    stralloc_free(&query);
+    return ret;
+}
+
+/*
+ * 0 if the cached report still holds. The period is over, so each
+ * calendar of the selected users is only asked whether it changed, by
+ * what fetching it left in its line of the cache: a sync-token, the
+ * getetags of a CalDAV collection or the ETag of a download, asked with
+ * If-None-Match. Without one, the calendar is received and compared by
+ * the hash of its content. 1 if one changed or it could not be told; if
+ * that one is a download, its body is left in p for the report.
+ */
+static int revalidate_report( struct fetch_context *fc, struct config_context *cfgctx, struct holiday_regions *hr,
+        const struct report_cache *rc, struct pulled_source *p, time_t begin, time_t end )
+{
+    struct program_args *pa = &(cfgctx->prog_arg);
+    struct user_context *u;
+    struct holiday_region *region;
+    unsigned long long holidays, content;
+    stralloc validator;
+    size_t i=0, c;
+    int ret=0;
+
+    stralloc_init(&validator);
+    for_each_user(cfgctx, u) {
+        if (pa->user && !str_equal(u->name,pa->user))
+            continue;
+        if ( !(region = get_holiday_region(hr, get_holiday_rules(cfgctx, u),
+                    get_public_holidays(cfgctx, u))) ||
+                prepare_holidays(fc, hr, region) ) {
+            ret=1;
+            break;
+        }
+        fc->label = u->name;
+        for_each_cal(u, c) {
+            if ( report_cache_source(&rc->sources, i++, &holidays, &content, &validator) ||
+                    holiday_hash(&region->table) != holidays ) {
+                ret=1;
+                break;
+            }
+            if ( u->sync ) {
+                ret = revalidate_sync(fc, cfgctx->general.sync_dir, u->cal[c], &validator);
+            } else if ( u->caldav ) {
+                ret = revalidate_caldav(fc, u, u->cal[c], &validator, content, begin, end);
+            } else {
+                fc->if_none_match = validator.len?validator.s:NULL;
+                p->body.len = 0;
+                ret = fetch_calendar(fc, u->cal[c], collect_body, &p->body)?1:0;
+                fc->if_none_match = NULL;
+                if ( ret ) {
+                    p->body.len = 0;
+                } else if ( fc->status != 304 && hash_buf(hash_str(""), p->body.s, p->body.len) != content ) {
+                    if ( !stralloc_copy(&p->etag, &fc->etag) )
+                        p->body.len = 0;
+                    else {
+                        p->u = u;
+                        p->cal = c;
+                    }
+                    ret=1;
+                }
+            }
+            if ( ret )
+                break;
+            V(2,carp(fc->status == 304?"not modified: ":"unchanged: ", u->cal[c]));
+        }
+        if ( ret )
+            break;
+    }
+    if ( !ret && !report_cache_source(&rc->sources, i, &holidays, &content, &validator) )
+        ret=1;
+    stralloc_free(&validator);
+    return ret;
+}
+
+/*
+ * fetch the public holidays and all selected user calendars and render the
+ * statistics into out. Everything lives on the stack of the caller, so any
+ * number of reports can be generated concurrently.
+ */
+int generate_report( struct config_context *cfgctx, buffer *out )
+{
+    struct program_args *pa = &(cfgctx->prog_arg);
+    const char *trace_file = pa->trace?pa->trace:cfgctx->general.trace;
+    const char *format = pa->format?pa->format:cfgctx->general.format;
+    const char *metrics_file = pa->metrics?pa->metrics:cfgctx->general.metrics;
+    struct trace_context trace, *tr=NULL;
+    struct metrics_context metrics;
+    struct dns_cache dns;
+    struct fetch_context fc;
+    struct holiday_regions regions;
+    struct holiday_region *region;
+    struct ics_context ctx;
+    struct report_context rep;
+    struct user_context *ucntx;
+    struct report_cache rcache;
+    struct summary summary;
+    struct pulled_source pulled;
+    buffer tee;
+    bool cache=false;
+    unsigned long long t_report, t;
+    time_t begin_window, end_window, begin_period, end_period;
+    int ret=0;
+
+    memset(&rcache, 0, sizeof(rcache));
+    memset(&pulled, 0, sizeof(pulled));
+    metrics_init(&metrics);
+    init_summary(&summary, 0, 0, NULL);
+    if ( init_report_context(&rep, format, out) ) {
+        if ( metrics_file )
+            metrics_write(&metrics, metrics_file, 0);
+        return -1;
+    }
+
+    if ( trace_file ) {
+        if ( trace_init(&trace) ) {
+            carp("failed to set up tracing");
+            free_report_context(&rep);
+            if ( metrics_file )
+                metrics_write(&metrics, metrics_file, 0);
+            return -1;
+        }
+        tr = &trace;
+    }
+    t_report = trace_now();
+    rep.trace = tr;
+    init_dns_cache(&dns, cfgctx->general.dns_ttl);
+    memset(&fc, 0, sizeof(struct fetch_context));
+    fc.general = &(cfgctx->general);
+    fc.dns = &dns;
+    fc.trace = tr;
+    fc.metrics = metrics_file?&metrics:NULL;
+
+    /* users without public holidays, also gives the year for the report window */
+    init_holiday_regions(&regions, pa->year, cfgctx->general.cache_dir, cfgctx->general.holiday_cache_days);
+    init_ics_context(&ctx, NULL, NULL);
+    if ( !(region = get_holiday_region(&regions, NULL, NULL)) ) {
+        ret=-1;
+        goto cleanup;
+    }
+    ctx.holidays = &region->table;
+
+    get_report_window(ctx.holidays, pa->year, pa->month, &begin_window, &end_window);
+
+    /* the output on a period that is over is kept until one of its calendars changes */
+    get_report_period(pa->year, pa->month, &begin_period, &end_period);
+    if ( pa->summary ) {
+        init_summary(&summary, begin_period, end_period, pa->project);
+        ctx.summary = &summary;
+    }
+    if ( cfgctx->general.cache_dir && end_period <= time(NULL) ) {
+        if ( init_report_cache(&rcache, cfgctx->general.cache_dir, cfgctx, rep.tpl?rep.tpl->hash:0) ) {
+            ret=-1;
+            goto cleanup;
+        }
+        if ( !report_cache_load(&rcache) &&
+                !revalidate_report(&fc, cfgctx, &regions, &rcache, &pulled, begin_window, end_window) ) {
+            V(1,carp("report from cache"));
+            if ( buffer_putsaflush(out, &rcache.output) )
+                ret=-1;
+            goto cleanup;
+        }
+        if ( buffer_tosa(&tee, &rcache.output) ) {
+            carpsys("buffer_tosa");
+            ret=-1;
+            goto cleanup;
+        }
+        rcache.sources.len = 0;
+        rcache.output.len = 0;
+        rep.out = &tee;
+        ctx.hash_content = cache = true;
+    }
+
+    for_each_user(cfgctx, ucntx) {
+        if (pa->user && !str_equal(ucntx->name,pa->user))
+            continue;
+
+        if ( !(region = get_holiday_region(&regions, get_holiday_rules(cfgctx, ucntx),
+                        get_public_holidays(cfgctx, ucntx))) ||
+                prepare_holidays(&fc, &regions, region) ) {
+            ret=-1;
+            goto cleanup;
+        }
+        /* the last one is the one of the selected user, if any */
+        ctx.holidays = &region->table;
+
+        V(1,carp("fetching calendar of user ", ucntx->name));
+        ctx.user = ucntx->name;
+        ctx.content_hash = hash_str("");
+        fc.label = ucntx->name;
+        if ( fetch_user( &fc, cfgctx, ucntx, pulled.u == ucntx?&pulled:NULL, cache?&rcache.sources:NULL,
+                    &ctx, begin_window, end_window ) ) {
+            carp("failed to fetch user calendar(s)");
+            ret=-1;
+            goto cleanup;
+        }
+        trace_counters(tr, &fc, &ctx);
+    }
+
+    t = trace_now();
+    if ( pa->project )
+        filter_project_calentries( &ctx, pa->project );
+    trace_complete(tr, "report", "filter", NULL, t);
+
+    t = trace_now();
+    if ( (pa->summary?cal_summary:cal_statistics)(&ctx, &rep, cfgctx) ) {
+        carp("issue while printing calendar statistics");
+        ret=-1;
+    }
+    trace_complete(tr, "report", "statistics", NULL, t);
+
+    if ( cache && !ret ) {
+        if ( buffer_flush(&tee) || buffer_putsaflush(out, &rcache.output) )
+            ret=-1;
+        else if ( report_cache_save(&rcache) )
+            carp("failed to save report cache: ", rcache.file);
+    }
+
+cleanup:
+    V(2,
+        buffer_puts(buffer_2, "dns cache hits: ");
+        buffer_putulong(buffer_2, dns.hits);
+        buffer_puts(buffer_2, ", lookups: ");
+        buffer_putulong(buffer_2, dns.misses);
+        buffer_puts(buffer_2, "; holiday calendars compiled: ");
+        buffer_putulong(buffer_2, regions.compiled);
+        buffer_puts(buffer_2, ", from cache: ");
+        buffer_putulong(buffer_2, regions.cached);
+        buffer_putnlflush(buffer_2);
+    );
+    if ( cache )
+        buffer_close(&tee);
+    free_report_cache(&rcache);
+    stralloc_free(&pulled.body);
+    stralloc_free(&pulled.etag);
+    free_dns_cache(&dns);
+    free_ics_context(&ctx);
+    free_summary(&summary);
+    free_holiday_regions(&regions);
+    free_report_context(&rep);
+    stralloc_free(&fc.etag);
+    if ( tr ) {
+        trace_complete(tr, "report", "report", pa->user, t_report);
+        if ( trace_write(tr, trace_file) )
+            ret=-1;
+        trace_free(tr);
+    }
+    /* last, so the wall time and the peak RSS cover the whole run */
+    if ( metrics_file && metrics_write(&metrics, metrics_file, !ret) )
+        ret=-1;
+    metrics_free(&metrics);
+    return ret;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stralloc.h>
+
+char *PROGNAME;
+
+int main( int argc, char *argv[] )
+{
+    struct config_context cfgctx;
+    stralloc sa;
+    buffer b;
+
+    memset(&cfgctx, 0, sizeof(struct config_context));
+    stralloc_init(&sa);
+    assert(0==buffer_tosa(&b, &sa));
+
+    cfgctx.prog_arg.year=2020;
+    cfgctx.prog_arg.month=2;
+    cfgctx.prog_arg.format="nonexisting";
+    assert(-1==generate_report(&cfgctx, &b));
+
+    cfgctx.prog_arg.format="text";
+    assert(0==generate_report(&cfgctx, &b));
+    buffer_flush(&b);
+    assert(sa.len > 7);
+    assert(!memcmp(sa.s, "2/2020\n", 7));
+
+    buffer_close(&b);
+    stralloc_free(&sa);
+    exit(EXIT_SUCCESS);
+}
+#endif
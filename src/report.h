@@ -0,0 +1,8 @@
+#ifndef REPORT_H
+#define REPORT_H
+#include <buffer.h>
+#include "config.h"
+
+void set_report_verbosity( short );
+int generate_report( struct config_context *, buffer * );
+#endif
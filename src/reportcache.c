@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <buffer.h>
+#include <errmsg.h>
+#include <byte.h>
+#include <fmt.h>
+#include <str.h>
+#include <scan.h>
+#include <mmap.h>
+#include "atomicfile.h"
+#include "hash.h"
+#include "reportcache.h"
+
+#define V(__l,__fn) do{if(reportcache_verbosity>=__l){ __fn; }}while(0);
+short reportcache_verbosity=0;
+
+#define REPORTCACHE_MAGIC "caltimist-report 1\n"
+/* two hashes, blanks and the newline around the ETag */
+#define SOURCE_MIN (2*FMT_HASH+3)
+
+void set_reportcache_verbosity( short v ) {
+    reportcache_verbosity=v;
+}
+
+static int cat_line( stralloc *sa, const char *name, const char *value )
+{
+    return stralloc_cats(sa, name) && stralloc_cats(sa, "=") &&
+        stralloc_cats(sa, value?value:"") && stralloc_cats(sa, "\n");
+}
+
+/*
+ * the key are the report parameters, the fingerprint of the rc file and the
+ * hash of the template the output is rendered with (0 for a built-in
+ * format), the entry is <dir>/report-<hash of the key>
+ */
+int init_report_cache( struct report_cache *rc, const char *dir, const struct config_context *cfgctx,
+        unsigned long long layout )
+{
+    const struct program_args *pa = &cfgctx->prog_arg;
+    char n[FMT_HASH];
+    size_t i;
+
+    memset(rc, 0, sizeof(struct report_cache));
+    if ( !cat_line(&rc->key, "user", pa->user) ||
+            !stralloc_cats(&rc->key, "year=") || !stralloc_catulong0(&rc->key, pa->year, 0) ||
+            !stralloc_cats(&rc->key, "\nmonth=") || !stralloc_catulong0(&rc->key, pa->month, 0) ||
+            !stralloc_cats(&rc->key, "\n") || !cat_line(&rc->key, "project", pa->project) ||
+            !cat_line(&rc->key, "format", pa->format) ||
+            (pa->summary && !stralloc_cats(&rc->key, "summary=1\n")) ||
+            (pa->grouped && !stralloc_cats(&rc->key, "grouped=1\n")) ||
+            !stralloc_cats(&rc->key, "config=") || !stralloc_catb(&rc->key, n, fmt_hash(n, cfgctx->fingerprint)) ||
+            !stralloc_cats(&rc->key, "\n") ||
+            (layout && (!stralloc_cats(&rc->key, "template=") ||
+                        !stralloc_catb(&rc->key, n, fmt_hash(n, layout)) || !stralloc_cats(&rc->key, "\n"))) ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    if ( !(rc->file = malloc(str_len(dir)+sizeof("/report-")+FMT_HASH)) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    i = fmt_str(rc->file, dir);
+    i += fmt_str(rc->file+i, "/report-");
+    i += fmt_hash(rc->file+i, hash_buf(hash_str(""), rc->key.s, rc->key.len));
+    rc->file[i] = '\0';
+    return 0;
+}
+
+void free_report_cache( struct report_cache *rc )
+{
+    free(rc->file);
+    stralloc_free(&rc->key);
+    stralloc_free(&rc->sources);
+    stralloc_free(&rc->output);
+}
+
+/* the sources line with the hash of the holiday table and the content of a calendar and its validator */
+int report_cache_add_source( stralloc *sources, unsigned long long holidays, unsigned long long content, const stralloc *validator )
+{
+    char n[FMT_HASH];
+
+    if ( !stralloc_catb(sources, n, fmt_hash(n, holidays)) || !stralloc_cats(sources, " ") ||
+            !stralloc_catb(sources, n, fmt_hash(n, content)) || !stralloc_cats(sources, " ") ||
+            (validator && !stralloc_catb(sources, validator->s, byte_chr(validator->s, validator->len, '\n'))) ||
+            !stralloc_cats(sources, "\n") ) {
+        carpsys("stralloc");
+        return -1;
+    }
+    return 0;
+}
+
+/* the values of line i of sources, -1 if there are fewer lines */
+int report_cache_source( const stralloc *sources, size_t i, unsigned long long *holidays,
+        unsigned long long *content, stralloc *validator )
+{
+    const char *p=sources->s, *end=sources->s+sources->len;
+    size_t n;
+
+    for (; p < end; p += n+1) {
+        n = byte_chr(p, end-p, '\n');
+        if ( i-- )
+            continue;
+        if ( n < SOURCE_MIN-1 || FMT_HASH != scan_xlonglong(p, holidays) || p[FMT_HASH] != ' ' ||
+                FMT_HASH != scan_xlonglong(p+FMT_HASH+1, content) || p[2*FMT_HASH+1] != ' ' )
+            return -1;
+        if ( !stralloc_copyb(validator, p+SOURCE_MIN-1, n-(SOURCE_MIN-1)) || !stralloc_0(validator) ) {
+            carpsys("stralloc");
+            return -1;
+        }
+        validator->len--;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * the entry for the key: magic, the key, the sources, an empty line and the
+ * output. 0 if it was there, 1 if not.
+ */
+int report_cache_load( struct report_cache *rc )
+{
+    const char *map, *p, *end;
+    size_t size=0, n;
+    int ret=1;
+
+    if ( !(map = mmap_read(rc->file, &size)) ) {
+        if ( errno != ENOENT )
+            carpsys(rc->file);
+        return 1;
+    }
+    p = map;
+    end = map+size;
+    n = str_len(REPORTCACHE_MAGIC);
+    if ( size < n+rc->key.len || memcmp(p, REPORTCACHE_MAGIC, n) || memcmp(p+n, rc->key.s, rc->key.len) ) {
+        carp("ignoring damaged report cache: ", rc->file);
+        goto out;
+    }
+    p += n+rc->key.len;
+    rc->sources.len = 0;
+    while ( p < end && *p != '\n' ) {
+        n = byte_chr(p, end-p, '\n');
+        if ( p+n == end || n < SOURCE_MIN-1 ) {
+            carp("ignoring damaged report cache: ", rc->file);
+            goto out;
+        }
+        if ( !stralloc_catb(&rc->sources, p, n+1) ) {
+            carpsys("stralloc");
+            goto out;
+        }
+        p += n+1;
+    }
+    if ( p == end ) {
+        carp("ignoring damaged report cache: ", rc->file);
+        goto out;
+    }
+    p++;
+    if ( !stralloc_copyb(&rc->output, p, end-p) ) {
+        carpsys("stralloc");
+        goto out;
+    }
+    V(2,carp("cached report: ", rc->file));
+    ret = 0;
+out:
+    mmap_unmap(map, size);
+    return ret;
+}
+
+int report_cache_save( const struct report_cache *rc )
+{
+    stralloc sa;
+    int ret=-1;
+
+    stralloc_init(&sa);
+    if ( !stralloc_copys(&sa, REPORTCACHE_MAGIC) || !stralloc_cat(&sa, &rc->key) ||
+            !stralloc_cat(&sa, &rc->sources) || !stralloc_cats(&sa, "\n") || !stralloc_cat(&sa, &rc->output) )
+        carpsys("stralloc");
+    else
+        ret = write_file_atomic(rc->file, sa.s, sa.len);
+    stralloc_free(&sa);
+    return ret;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <unistd.h>
+
+int main( int argc, char *argv[] )
+{
+    char dir[] = "/tmp/reportcache-XXXXXX";
+    struct config_context cfg;
+    struct report_cache rc, other;
+    stralloc etag;
+    unsigned long long h, c;
+
+    assert(mkdtemp(dir));
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.prog_arg.user = "foo";
+    cfg.prog_arg.year = 2023;
+    cfg.prog_arg.month = 1;
+    cfg.fingerprint = 42;
+    assert(0==init_report_cache(&rc, dir, &cfg, 0));
+    assert(1==report_cache_load(&rc));
+
+    /* one line per calendar, the ETag is optional */
+    stralloc_init(&etag);
+    assert(stralloc_copys(&etag, "\"v1\""));
+    assert(0==report_cache_add_source(&rc.sources, 1, 2, &etag));
+    assert(0==report_cache_add_source(&rc.sources, 3, 4, NULL));
+    assert(0==report_cache_source(&rc.sources, 0, &h, &c, &etag) && h==1 && c==2 && str_equal(etag.s, "\"v1\""));
+    assert(0==report_cache_source(&rc.sources, 1, &h, &c, &etag) && h==3 && c==4 && !etag.len);
+    assert(-1==report_cache_source(&rc.sources, 2, &h, &c, &etag));
+
+    /* round trip */
+    assert(stralloc_copys(&rc.output, "report\nfor january\n"));
+    assert(0==report_cache_save(&rc));
+    assert(0==init_report_cache(&other, dir, &cfg, 0));
+    assert(0==report_cache_load(&other));
+    assert(other.sources.len==rc.sources.len && !memcmp(other.sources.s, rc.sources.s, rc.sources.len));
+    assert(other.output.len==rc.output.len && !memcmp(other.output.s, rc.output.s, rc.output.len));
+    free_report_cache(&other);
+
+    /* other parameters or another config, another entry */
+    cfg.prog_arg.format = "html";
+    assert(0==init_report_cache(&other, dir, &cfg, 0));
+    assert(!str_equal(other.file, rc.file) && 1==report_cache_load(&other));
+    free_report_cache(&other);
+    cfg.prog_arg.format = NULL;
+    cfg.prog_arg.summary = true;
+    assert(0==init_report_cache(&other, dir, &cfg, 0));
+    assert(!str_equal(other.file, rc.file) && 1==report_cache_load(&other));
+    free_report_cache(&other);
+    cfg.prog_arg.summary = false;
+    cfg.prog_arg.grouped = true;
+    assert(0==init_report_cache(&other, dir, &cfg, 0));
+    assert(!str_equal(other.file, rc.file) && 1==report_cache_load(&other));
+    free_report_cache(&other);
+    cfg.prog_arg.grouped = false;
+    assert(0==init_report_cache(&other, dir, &cfg, 1));
+    assert(!str_equal(other.file, rc.file) && 1==report_cache_load(&other));
+    free_report_cache(&other);
+    cfg.fingerprint = 43;
+    assert(0==init_report_cache(&other, dir, &cfg, 0));
+    assert(1==report_cache_load(&other));
+    free_report_cache(&other);
+
+    /* a cut off entry is not used */
+    assert(0==truncate(rc.file, 60));
+    assert(1==report_cache_load(&rc));
+
+    unlink(rc.file);
+    rmdir(dir);
+    free_report_cache(&rc);
+    stralloc_free(&etag);
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,26 @@
+#ifndef REPORTCACHE_H
+#define REPORTCACHE_H
+#include <stralloc.h>
+#include "config.h"
+
+/*
+ * finished output of a report on a closed period, for the parameters in key
+ * and valid as long as the calendars in sources (one line per calendar:
+ * hash of the holiday table, hash of the content and the validator, i.e.
+ * the ETag, the hash of the getetags or the sync-token) stay the same
+ */
+struct report_cache {
+    char *file;
+    stralloc key;
+    stralloc sources;
+    stralloc output;
+};
+
+void set_reportcache_verbosity( short );
+int init_report_cache( struct report_cache *, const char *, const struct config_context *, unsigned long long );
+void free_report_cache( struct report_cache * );
+int report_cache_load( struct report_cache * );
+int report_cache_save( const struct report_cache * );
+int report_cache_add_source( stralloc *, unsigned long long, unsigned long long, const stralloc * );
+int report_cache_source( const stralloc *, size_t, unsigned long long *, unsigned long long *, stralloc * );
+#endif
@@ -0,0 +1,505 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <str.h>
+#include <scan.h>
+#include "rrule.h"
+#include "datetime.h"
+
+/*
+ * RRULE (RFC 5545 3.3.10) for FREQ DAILY/WEEKLY/MONTHLY/YEARLY with
+ * INTERVAL, COUNT, UNTIL, BYDAY, BYMONTHDAY, BYMONTH and WKST.
+ * Occurrences are generated period by period and only inside the window
+ * given to the iterator, so no series is ever materialised. Open ended
+ * rules start right at the window instead of at DTSTART.
+ */
+
+static const char *weekdays[]={ "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+
+static int scan_weekday( const char *s )
+{
+    int i;
+    for (i=0; i<7; ++i)
+        if ( s[0] == weekdays[i][0] && s[1] == weekdays[i][1] )
+            return i;
+    return -1;
+}
+
+static size_t scan_signed( const char *s, long *v )
+{
+    unsigned long u;
+    size_t l, o=0;
+    bool neg=false;
+
+    if ( *s == '+' || *s == '-' ) {
+        neg = (*s == '-');
+        o++;
+    }
+    if ( !(l=scan_ulong(s+o, &u)) )
+        return 0;
+    *v = neg?-(long)u:(long)u;
+    return o+l;
+}
+
+static int parse_byday( struct rrule *r, const char *v, size_t len )
+{
+    size_t i=0, l;
+    long ord;
+    int wd;
+
+    while ( i < len ) {
+        ord = 0;
+        l = scan_signed(v+i, &ord);
+        i += l;
+        if ( i+2 > len || 0 > (wd=scan_weekday(v+i)) || r->nbyday >= RRULE_MAX_BYDAY || ord < -53 || ord > 53 )
+            return -1;
+        r->byday[r->nbyday].ord = (signed char)ord;
+        r->byday[r->nbyday].wday = (unsigned char)wd;
+        r->nbyday++;
+        i += 2;
+        if ( i < len && v[i] != ',' )
+            return -1;
+        i++;
+    }
+    return 0;
+}
+
+static int parse_numlist( const char *v, size_t len, long min, long max, uint32_t *pos, uint32_t *neg )
+{
+    size_t i=0, l;
+    long n;
+
+    while ( i < len ) {
+        if ( !(l=scan_signed(v+i, &n)) || n < min || n > max || n == 0 )
+            return -1;
+        if ( n > 0 )
+            *pos |= (uint32_t)1 << n;
+        else if ( neg )
+            *neg |= (uint32_t)1 << -n;
+        else
+            return -1;
+        i += l;
+        if ( i < len && v[i] != ',' )
+            return -1;
+        i++;
+    }
+    return 0;
+}
+
+int rrule_parse( struct rrule *r, const char *s )
+{
+    size_t i=0, k, v, e;
+    unsigned long ul;
+
+    memset(r, 0, sizeof(struct rrule));
+    r->interval = 1;
+    r->wkst = 1;
+
+    while ( s[i] ) {
+        k = i;
+        v = k + str_chr(s+k, '=');
+        e = k + str_chr(s+k, ';');
+        if ( v >= e )
+            return -1;
+        v++;
+#define part(__n) ( (v-k-1 == sizeof(__n)-1) && !memcmp(s+k, __n, sizeof(__n)-1) )
+        if ( part("FREQ") ) {
+            if ( !memcmp(s+v, "DAILY", 5) ) r->freq = RRULE_DAILY;
+            else if ( !memcmp(s+v, "WEEKLY", 6) ) r->freq = RRULE_WEEKLY;
+            else if ( !memcmp(s+v, "MONTHLY", 7) ) r->freq = RRULE_MONTHLY;
+            else if ( !memcmp(s+v, "YEARLY", 6) ) r->freq = RRULE_YEARLY;
+            else
+                return -1;
+        } else if ( part("INTERVAL") ) {
+            if ( !scan_ulong(s+v, &ul) || !ul || ul > USHRT_MAX )
+                return -1;
+            r->interval = (unsigned short)ul;
+        } else if ( part("COUNT") ) {
+            if ( !scan_ulong(s+v, &r->count) || !r->count )
+                return -1;
+        } else if ( part("UNTIL") ) {
+            char until[sizeof("yyyymmddThhmmssZ")];
+            if ( e-v >= sizeof(until) )
+                return -1;
+            memcpy(until, s+v, e-v);
+            until[e-v] = '\0';
+            if ( 0 >= (r->until=datetime_parse(until, (e-v == sizeof("yyyymmdd")-1), NULL)) )
+                return -1;
+        } else if ( part("BYDAY") ) {
+            if ( parse_byday(r, s+v, e-v) )
+                return -1;
+        } else if ( part("BYMONTHDAY") ) {
+            if ( parse_numlist(s+v, e-v, -31, 31, &r->bymonthday, &r->bymonthday_neg) )
+                return -1;
+        } else if ( part("BYMONTH") ) {
+            uint32_t m=0;
+            if ( parse_numlist(s+v, e-v, 1, 12, &m, NULL) )
+                return -1;
+            r->bymonth = (uint16_t)m;
+        } else if ( part("WKST") ) {
+            int wd = scan_weekday(s+v);
+            if ( wd < 0 )
+                return -1;
+            r->wkst = (unsigned char)wd;
+        } else if ( !(s[k] == 'X' && s[k+1] == '-') ) {
+            /* BYSETPOS, BYWEEKNO, BYYEARDAY, BYHOUR... would change the set */
+            return -1;
+        }
+#undef part
+        i = s[e]?e+1:e;
+    }
+
+    return r->freq?0:-1;
+}
+
+static bool byday_matches( const struct rrule *r, int wd, long nth, long nth_last )
+{
+    size_t i;
+    for (i=0; i<r->nbyday; ++i)
+        if ( r->byday[i].wday == wd && ( !r->byday[i].ord ||
+                    r->byday[i].ord == nth || r->byday[i].ord == -nth_last ) )
+            return true;
+    return false;
+}
+
+static bool monthday_matches( const struct rrule *r, unsigned md, unsigned ndays )
+{
+    return ( r->bymonthday & ((uint32_t)1 << md) ) ||
+        ( r->bymonthday_neg & ((uint32_t)1 << (ndays-md+1)) );
+}
+
+/* BYxxx parts limiting a DAILY or WEEKLY rule */
+static bool day_passes( const struct rrule *r, long day )
+{
+    long y;
+    unsigned m, d;
+
+    if ( !r->bymonth && !r->bymonthday && !r->bymonthday_neg )
+        return true;
+    civil_from_days(day, &y, &m, &d);
+    if ( r->bymonth && !(r->bymonth & (1 << m)) )
+        return false;
+    if ( (r->bymonthday || r->bymonthday_neg) && !monthday_matches(r, d, days_in_month(y, m)) )
+        return false;
+    return true;
+}
+
+static void expand_month( struct rrule_iter *it, long y, unsigned m, unsigned start_mday )
+{
+    const struct rrule *r = it->rule;
+    unsigned md, ndays = days_in_month(y, m);
+    long first = days_from_civil(y, m, 1);
+    bool bymd = (r->bymonthday || r->bymonthday_neg);
+
+    for (md=1; md<=ndays; ++md) {
+        bool ok;
+        if ( !bymd && !r->nbyday )
+            ok = (md == start_mday);
+        else {
+            ok = !bymd || monthday_matches(r, md, ndays);
+            if ( ok && r->nbyday )
+                ok = byday_matches(r, weekday_from_days(first+md-1), (md-1)/7+1, (ndays-md)/7+1);
+        }
+        if ( ok )
+            it->cand[it->ncand++] = first+md-1;
+    }
+}
+
+/* fills the candidate days of the current period, returns its first day */
+static long expand_period( struct rrule_iter *it )
+{
+    const struct rrule *r = it->rule;
+    long sy, y, first, base, i;
+    unsigned sm, sd, m;
+
+    it->ncand = 0;
+    it->pos = 0;
+    civil_from_days(it->start_day, &sy, &sm, &sd);
+
+    switch ( r->freq ) {
+    case RRULE_DAILY:
+        first = it->start_day + it->period*r->interval;
+        if ( (!r->nbyday || byday_matches(r, weekday_from_days(first), 0, 0)) && day_passes(r, first) )
+            it->cand[it->ncand++] = first;
+        return first;
+    case RRULE_WEEKLY:
+        base = it->start_day - (weekday_from_days(it->start_day) - r->wkst + 7) % 7;
+        first = base + it->period*r->interval*7;
+        for (i=0; i<7; ++i) {
+            int wd = weekday_from_days(first+i);
+            if ( (r->nbyday?byday_matches(r, wd, 0, 0):(wd == weekday_from_days(it->start_day))) &&
+                    day_passes(r, first+i) )
+                it->cand[it->ncand++] = first+i;
+        }
+        return first;
+    case RRULE_MONTHLY:
+        base = sy*12 + (sm-1) + it->period*r->interval;
+        y = base/12;
+        m = base%12 + 1;
+        if ( !r->bymonth || (r->bymonth & (1 << m)) )
+            expand_month(it, y, m, sd);
+        return days_from_civil(y, m, 1);
+    case RRULE_YEARLY:
+        y = sy + it->period*r->interval;
+        first = days_from_civil(y, 1, 1);
+        if ( r->nbyday && !r->bymonth && !r->bymonthday && !r->bymonthday_neg ) {
+            /* ordinals count within the year */
+            long ndays = days_from_civil(y+1, 1, 1) - first;
+            for (i=0; i<ndays; ++i)
+                if ( byday_matches(r, weekday_from_days(first+i), i/7+1, (ndays-1-i)/7+1) )
+                    it->cand[it->ncand++] = first+i;
+        } else if ( !r->nbyday && !r->bymonth && !r->bymonthday && !r->bymonthday_neg ) {
+            if ( sd <= days_in_month(y, sm) )
+                it->cand[it->ncand++] = days_from_civil(y, sm, sd);
+        } else {
+            for (m=1; m<=12; ++m)
+                if ( !r->bymonth || (r->bymonth & (1 << m)) )
+                    expand_month(it, y, m, sd);
+        }
+        return first;
+    default:
+        it->done = true;
+        return 0;
+    }
+}
+
+/* periods to skip so that the first one expanded is just before the window */
+static long periods_before( const struct rrule_iter *it, long day )
+{
+    const struct rrule *r = it->rule;
+    long sy, y, base;
+    unsigned sm, sd, m, d;
+
+    if ( day <= it->start_day )
+        return 0;
+    civil_from_days(it->start_day, &sy, &sm, &sd);
+    civil_from_days(day, &y, &m, &d);
+
+    switch ( r->freq ) {
+    case RRULE_DAILY:
+        return (day - it->start_day) / r->interval;
+    case RRULE_WEEKLY:
+        base = it->start_day - (weekday_from_days(it->start_day) - r->wkst + 7) % 7;
+        return (day - base) / (7L*r->interval);
+    case RRULE_MONTHLY:
+        return ((y*12+m) - (sy*12+sm)) / r->interval;
+    case RRULE_YEARLY:
+        return (y - sy) / r->interval;
+    default:
+        return 0;
+    }
+}
+
+/* with COUNT, periods can only be skipped if every period yields exactly one occurrence */
+static bool one_per_period( const struct rrule_iter *it )
+{
+    const struct rrule *r = it->rule;
+    long y;
+    unsigned m, d;
+
+    if ( r->nbyday || r->bymonth || r->bymonthday || r->bymonthday_neg )
+        return false;
+    civil_from_days(it->start_day, &y, &m, &d);
+    switch ( r->freq ) {
+    case RRULE_DAILY:
+    case RRULE_WEEKLY:
+        return true;
+    case RRULE_MONTHLY:
+        return d <= 28;
+    case RRULE_YEARLY:
+        return !(m == 2 && d == 29);
+    default:
+        return false;
+    }
+}
+
+static void to_civil( const struct rrule_iter *it, time_t t, long *day, long *tod )
+{
+    if ( it->zone )
+        tzone_to_civil(it->zone, t, day, tod);
+    else
+        time_to_civil(t, it->utc, day, tod);
+}
+
+static time_t from_civil( const struct rrule_iter *it, long day, long tod )
+{
+    if ( it->zone )
+        return tzone_from_civil(it->zone, day, tod);
+    return civil_to_time(day, tod, it->utc);
+}
+
+void rrule_iter_init( struct rrule_iter *it, const struct rrule *r, time_t dtstart, time_t duration,
+        bool utc, const struct tzone *zone, time_t window_begin, time_t window_end )
+{
+    long day, tod, skip;
+
+    it->rule = r;
+    it->exdate = NULL;
+    it->exdates = 0;
+    it->dtstart = dtstart;
+    it->duration = (duration>0)?duration:0;
+    it->window_begin = window_begin;
+    it->window_end = window_end;
+    it->utc = utc;
+    it->zone = zone;
+    it->remaining = r->count?r->count:ULONG_MAX;
+    it->done = (r->freq == RRULE_NONE) || (dtstart >= window_end) ||
+        (r->until && r->until < window_begin-it->duration);
+    it->ncand = it->pos = 0;
+    to_civil(it, dtstart, &it->start_day, &it->tod);
+
+    to_civil(it, window_begin-it->duration, &day, &tod);
+    skip = periods_before(it, day-1);
+    if ( skip > 0 && r->count ) {
+        if ( !one_per_period(it) )
+            skip = 0;
+        else if ( (unsigned long)skip >= it->remaining )
+            it->done = true;
+        else
+            it->remaining -= skip;
+    }
+    it->period = skip-1;
+}
+
+void rrule_iter_exclude( struct rrule_iter *it, const time_t *exdate, size_t exdates )
+{
+    it->exdate = exdate;
+    it->exdates = exdates;
+}
+
+static bool excluded( const struct rrule_iter *it, time_t t )
+{
+    size_t i;
+    for (i=0; i<it->exdates; ++i)
+        if ( it->exdate[i] == t )
+            return true;
+    return false;
+}
+
+/* 1 and the start of the next occurrence inside the window, 0 when the series is done */
+int rrule_next( struct rrule_iter *it, time_t *start )
+{
+    long end_day, tod;
+    time_t t;
+
+    to_civil(it, it->window_end, &end_day, &tod);
+    while ( !it->done ) {
+        if ( it->pos >= it->ncand ) {
+            it->period++;
+            if ( expand_period(it) > end_day+1 )
+                it->done = true;
+            continue;
+        }
+        t = from_civil(it, it->cand[it->pos++], it->tod);
+        if ( t < it->dtstart )
+            continue;
+        if ( (it->rule->until && t > it->rule->until) || !it->remaining ) {
+            it->done = true;
+            break;
+        }
+        it->remaining--;
+        if ( t >= it->window_end ) {
+            it->done = true;
+            break;
+        }
+        if ( excluded(it, t) || t+it->duration <= it->window_begin )
+            continue;
+        *start = t;
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+#define DAY(__y,__m,__d) ((time_t)days_from_civil(__y,__m,__d)*SECONDS_PER_DAY)
+
+static size_t expand( const char *rule, time_t dtstart, time_t wb, time_t we, time_t *out, size_t max )
+{
+    struct rrule r;
+    struct rrule_iter it;
+    size_t n=0;
+    time_t t;
+
+    assert(0==rrule_parse(&r, rule));
+    rrule_iter_init(&it, &r, dtstart, 3600, true, NULL, wb, we);
+    while ( rrule_next(&it, &t) ) {
+        if ( n < max ) out[n] = t;
+        n++;
+    }
+    return n;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct rrule r;
+    struct rrule_iter it;
+    time_t o[64], t, ex;
+    size_t n;
+
+    assert(0==rrule_parse(&r, "FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,-1FR;COUNT=10;WKST=SU"));
+    assert(r.freq==RRULE_WEEKLY && r.interval==2 && r.count==10 && r.wkst==0);
+    assert(r.nbyday==2 && r.byday[1].ord==-1 && r.byday[1].wday==5);
+    assert(0==rrule_parse(&r, "FREQ=MONTHLY;BYMONTHDAY=1,-1;BYMONTH=2,12"));
+    assert(r.bymonthday==2 && r.bymonthday_neg==2 && r.bymonth==((1<<2)|(1<<12)));
+    assert(-1==rrule_parse(&r, "FREQ=HOURLY"));
+    assert(-1==rrule_parse(&r, "FREQ=MONTHLY;BYSETPOS=-1;BYDAY=MO"));
+
+    /* daily standup 2023-01-02 09:00Z, window january */
+    n = expand("FREQ=DAILY;BYDAY=MO,TU,WE,TH,FR", DAY(2023,1,2)+9*3600, DAY(2023,1,1), DAY(2023,2,1), o, 64);
+    assert(n==22);
+    assert(o[0]==DAY(2023,1,2)+9*3600 && o[4]==DAY(2023,1,6)+9*3600 && o[5]==DAY(2023,1,9)+9*3600);
+
+    /* weekly with COUNT and a window in the middle of the series */
+    n = expand("FREQ=WEEKLY;COUNT=10", DAY(2023,1,2)+9*3600, DAY(2023,2,1), DAY(2023,3,1), o, 64);
+    assert(n==4 && o[0]==DAY(2023,2,6)+9*3600 && o[3]==DAY(2023,2,27)+9*3600);
+    n = expand("FREQ=WEEKLY;COUNT=10", DAY(2023,1,2)+9*3600, DAY(2023,3,1), DAY(2023,4,1), o, 64);
+    assert(n==1 && o[0]==DAY(2023,3,6)+9*3600);
+
+    /* UNTIL is inclusive */
+    n = expand("FREQ=DAILY;UNTIL=20230105T090000Z", DAY(2023,1,2)+9*3600, DAY(2023,1,1), DAY(2024,1,1), o, 64);
+    assert(n==4);
+
+    /* second tuesday and last friday of the month */
+    n = expand("FREQ=MONTHLY;BYDAY=2TU,-1FR", DAY(2023,1,1)+9*3600, DAY(2023,3,1), DAY(2023,5,1), o, 64);
+    assert(n==4 && o[0]==DAY(2023,3,14)+9*3600 && o[1]==DAY(2023,3,31)+9*3600 && o[2]==DAY(2023,4,11)+9*3600);
+
+    /* the 31st only exists in some months */
+    n = expand("FREQ=MONTHLY", DAY(2023,1,31), DAY(2023,1,1), DAY(2024,1,1), o, 64);
+    assert(n==7);
+    n = expand("FREQ=MONTHLY;BYMONTHDAY=-1", DAY(2023,1,31), DAY(2024,2,1), DAY(2024,3,1), o, 64);
+    assert(n==1 && o[0]==DAY(2024,2,29));
+
+    /* yearly: fixed date, nth weekday of a month, whole year BYDAY */
+    n = expand("FREQ=YEARLY", DAY(1990,12,25), DAY(2023,1,1), DAY(2024,1,1), o, 64);
+    assert(n==1 && o[0]==DAY(2023,12,25));
+    n = expand("FREQ=YEARLY;BYMONTH=11;BYDAY=4TH", DAY(2000,11,23), DAY(2023,1,1), DAY(2024,1,1), o, 64);
+    assert(n==1 && o[0]==DAY(2023,11,23));
+    n = expand("FREQ=YEARLY;BYDAY=1MO", DAY(2000,1,3), DAY(2023,1,1), DAY(2024,1,1), o, 64);
+    assert(n==1 && o[0]==DAY(2023,1,2));
+    n = expand("FREQ=YEARLY;INTERVAL=4", DAY(2000,2,29), DAY(2023,1,1), DAY(2030,1,1), o, 64);
+    assert(n==2 && o[0]==DAY(2024,2,29) && o[1]==DAY(2028,2,29));
+
+    /* open ended series far in the past only costs the periods inside the window */
+    assert(0==rrule_parse(&r, "FREQ=DAILY"));
+    rrule_iter_init(&it, &r, DAY(1971,1,1), 3600, true, NULL, DAY(2023,1,1), DAY(2023,1,3));
+    assert(it.period > 18900);
+    ex = DAY(2023,1,1);
+    rrule_iter_exclude(&it, &ex, 1);
+    assert(1==rrule_next(&it, &t) && t==DAY(2023,1,2));
+    assert(0==rrule_next(&it, &t));
+
+    /* an occurrence starting before the window but ending inside is still reported */
+    n = expand("FREQ=DAILY", DAY(2023,1,1)-1800, DAY(2023,1,1), DAY(2023,1,2), o, 64);
+    assert(n==2 && o[0]==DAY(2023,1,1)-1800);
+
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,62 @@
+#ifndef RRULE_H
+#define RRULE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "tzone.h"
+
+#define RRULE_MAX_BYDAY 16
+/* a YEARLY rule with BYDAY and no BYMONTH can hit every day of a year */
+#define RRULE_MAX_CANDIDATES 366
+
+enum rrule_freq {
+    RRULE_NONE=0,
+    RRULE_DAILY,
+    RRULE_WEEKLY,
+    RRULE_MONTHLY,
+    RRULE_YEARLY
+};
+
+struct rrule_byday {
+    signed char ord;    // 0: every, n: n-th, -n: n-th last
+    unsigned char wday; // 0 = sunday
+};
+
+struct rrule {
+    enum rrule_freq freq;
+    unsigned short interval;
+    unsigned long count;        // 0: unlimited
+    time_t until;               // 0: open ended
+    unsigned char wkst;
+    unsigned char nbyday;
+    struct rrule_byday byday[RRULE_MAX_BYDAY];
+    uint32_t bymonthday;        // bit n: day n of the month
+    uint32_t bymonthday_neg;    // bit n: n-th last day of the month
+    uint16_t bymonth;           // bit n: month n
+};
+
+/* generates the occurrences of one series inside a window, one at a time */
+struct rrule_iter {
+    const struct rrule *rule;
+    const time_t *exdate;
+    size_t exdates;
+    time_t dtstart;
+    time_t duration;
+    time_t window_begin;
+    time_t window_end;
+    bool utc;
+    const struct tzone *zone; // wall clock of the zone instead of utc/local
+    long start_day;
+    long tod;
+    long period;
+    unsigned long remaining;
+    bool done;
+    size_t ncand, pos;
+    long cand[RRULE_MAX_CANDIDATES];
+};
+
+int rrule_parse( struct rrule *, const char * );
+void rrule_iter_init( struct rrule_iter *, const struct rrule *, time_t, time_t, bool, const struct tzone *, time_t, time_t );
+void rrule_iter_exclude( struct rrule_iter *, const time_t *, size_t );
+int rrule_next( struct rrule_iter *, time_t * );
+#endif
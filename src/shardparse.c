@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
+#include <buffer.h>
+#include <errmsg.h>
+#include "hash.h"
+#include "shardparse.h"
+
+/*
+ * parses a complete ICS body on several threads: it is cut into shards at
+ * lines starting with BEGIN:VEVENT, every shard is parsed into a context of
+ * its own and the entries are adopted by the caller's context shard by
+ * shard, so the result is the same as from parsing the body in one go.
+ */
+
+#define V(__l,__fn) do{if(shardparse_verbosity>=__l){ __fn; }}while(0);
+short shardparse_verbosity=0;
+
+#define SHARD_CHUNK 65536
+
+struct shard {
+    struct ics_context ctx;
+    const char *data;
+    size_t len;
+    int ret;
+#ifndef NOTHREADS
+    pthread_t thread;
+    bool started;
+#endif
+};
+
+void set_shardparse_verbosity( short v ) {
+    shardparse_verbosity=v;
+}
+
+/* the parser wants NUL terminated chunks and the body may be read only */
+static int feed( struct ics_context *ctx, const char *data, size_t len )
+{
+    char chunk[SHARD_CHUNK+1];
+    size_t o, n;
+
+    for (o=0; o<len; o+=n) {
+        n = (len-o > SHARD_CHUNK)?SHARD_CHUNK:len-o;
+        memcpy(chunk, data+o, n);
+        chunk[n] = '\0';
+        if ( ics_parser(ctx, chunk) )
+            return -1;
+    }
+    return ics_finish(ctx);
+}
+
+#ifndef NOTHREADS
+static void *parse_shard( void *arg )
+{
+    struct shard *s = arg;
+
+    s->ret = feed(&s->ctx, s->data, s->len);
+    return NULL;
+}
+#endif
+
+/*
+ * the VTIMEZONEs of the whole body into ctx before the shards start, so
+ * every shard knows the zones wherever in the body they are defined
+ */
+static int prepare_zones( struct ics_context *ctx, const char *data, size_t len )
+{
+    struct ics_context tz;
+    const char *p=data, *end=data+len, *e;
+    int ret=0;
+
+    init_ics_context(&tz, ctx->holidays, ctx->user);
+    tzone_borrow(&tz.zones, &ctx->zones);
+    while ( !ret && (p = memmem(p, end-p, "BEGIN:VTIMEZONE", 15)) ) {
+        if ( !(e = memmem(p, end-p, "END:VTIMEZONE", 13)) )
+            break;
+        e += 13;
+        ret = feed(&tz, p, e-p);
+        p = e;
+    }
+    tzone_adopt(&ctx->zones, &tz.zones);
+    free_ics_context(&tz);
+    return ret;
+}
+
+/* start of the first line at or after from that begins an event, len if none */
+static size_t next_shard( const char *data, size_t len, size_t from )
+{
+    const char *p;
+
+    if ( !from )
+        return 0;
+    if ( from >= len || !(p = memmem(data+from-1, len-from+1, "\nBEGIN:VEVENT", 13)) )
+        return len;
+    return p-data+1;
+}
+
+/*
+ * data into ctx, which has no line pending, on up to threads threads. The
+ * public holidays (ctx without user) share the table and are parsed in one
+ * piece, as are bodies smaller than SHARD_MIN per thread.
+ */
+int parse_ics_body( struct ics_context *ctx, const char *data, size_t len, unsigned short threads )
+{
+    struct shard *shard;
+    size_t n, i, b;
+    int ret=0;
+
+    n = len/SHARD_MIN;
+    if ( n > threads )
+        n = threads;
+    if ( n > SHARD_MAX )
+        n = SHARD_MAX;
+#ifdef NOTHREADS
+    n = 1;
+#endif
+    /* the parser's debug output is not meant for several threads */
+    if ( n < 2 || !ctx->user || shardparse_verbosity >= 4 )
+        return feed(ctx, data, len);
+
+    if ( prepare_zones(ctx, data, len) )
+        return -1;
+    if ( !(shard = calloc(n, sizeof(struct shard))) ) {
+        carpsys("calloc");
+        return -1;
+    }
+    for (i=0, b=0; i<n && b<len; ++i) {
+        init_ics_context(&shard[i].ctx, ctx->holidays, ctx->user);
+        tzone_borrow(&shard[i].ctx.zones, &ctx->zones);
+        shard[i].ctx.unsorted = true;
+        shard[i].ctx.stop_after = ctx->stop_after;
+        shard[i].data = data+b;
+        b = (i+1 == n)?len:next_shard(data, len, ((i+1)*len)/n);
+        shard[i].len = (data+b)-shard[i].data;
+    }
+    n = i;
+    V(2,
+        buffer_puts(buffer_2, "parsing ");
+        buffer_putulong(buffer_2, len);
+        buffer_puts(buffer_2, " bytes in ");
+        buffer_putulong(buffer_2, n);
+        buffer_puts(buffer_2, " shards");
+        buffer_putnlflush(buffer_2);
+    );
+
+#ifndef NOTHREADS
+    /* the first shard is parsed by the calling thread, the others in parallel */
+    for (i=1; i<n; ++i)
+        shard[i].started = !pthread_create(&shard[i].thread, NULL, parse_shard, &shard[i]);
+    parse_shard(&shard[0]);
+    for (i=1; i<n; ++i)
+        if ( shard[i].started )
+            pthread_join(shard[i].thread, NULL);
+        else
+            parse_shard(&shard[i]);
+#endif
+
+    for (i=0; i<n; ++i) {
+        if ( shard[i].ret || ics_adopt(ctx, &shard[i].ctx) )
+            ret = -1;
+        free_ics_context(&shard[i].ctx);
+    }
+    free(shard);
+    if ( ctx->hash_content )
+        ctx->content_hash = hash_buf(ctx->content_hash, data, len);
+    return ret;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include <stralloc.h>
+#include <str.h>
+#include "datetime.h"
+
+#define EVENT(__day,__summary) "BEGIN:VEVENT\r\nDTSTART:202301" __day "T090000Z\r\n"\
+    "DTEND:202301" __day "T100000Z\r\nSUMMARY:" __summary "\r\n  folded\r\nDESCRIPTION:" DESC "\r\nEND:VEVENT\r\n"
+/* the zone is defined once at the start, the shards after the first need it as well */
+#define TZEVENT(__day,__summary) "BEGIN:VEVENT\r\nDTSTART;TZID=Plus One:202301" __day "T100000\r\n"\
+    "DTEND;TZID=Plus One:202301" __day "T110000\r\nSUMMARY:" __summary "\r\n  folded\r\nDESCRIPTION:" DESC "\r\nEND:VEVENT\r\n"
+#define VTIMEZONE "BEGIN:VTIMEZONE\r\nTZID:Plus One\r\nBEGIN:STANDARD\r\nDTSTART:19700101T000000\r\n"\
+    "TZOFFSETFROM:+0100\r\nTZOFFSETTO:+0100\r\nEND:STANDARD\r\nEND:VTIMEZONE\r\n"
+#define DESC "0123456789012345678901234567890123456789012345678901234567890123456789"\
+    "0123456789012345678901234567890123456789012345678901234567890123456789"
+
+static void check_same( struct ics_context *a, struct ics_context *b )
+{
+    struct calendar_context *x, *y;
+
+    assert(a->lines==b->lines && a->events==b->events);
+    for (x=a->first_entry, y=b->first_entry; x && y; x=x->next_entry, y=y->next_entry)
+        assert(x->start==y->start && x->end==y->end &&
+                str_equal(calentry_subject(a, x), calentry_subject(b, y)));
+    assert(!x && !y);
+}
+
+int main( int argc, char *argv[] )
+{
+    struct holiday_table ht;
+    struct ics_context one, many;
+    stralloc body;
+    size_t i;
+
+    /* enough events for a few shards, with equal start times to keep in order */
+    stralloc_init(&body);
+    assert(stralloc_copys(&body, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\n" VTIMEZONE));
+    for (i=0; body.len < 4*SHARD_MIN; ++i)
+        assert(stralloc_cats(&body, (i%3)?TZEVENT("05","later"):(i%2)?EVENT("02","b"):EVENT("02","a")));
+    assert(stralloc_cats(&body, "END:VCALENDAR"));
+
+    init_holiday_list(&ht, 2023);
+    init_ics_context(&one, &ht, "u");
+    init_ics_context(&many, &ht, "u");
+    one.hash_content = many.hash_content = true;
+    one.content_hash = many.content_hash = hash_str("");
+    assert(0==parse_ics_body(&one, body.s, body.len, 1));
+    assert(0==parse_ics_body(&many, body.s, body.len, 4));
+    /* the last of the events on the 2nd comes first */
+    assert(one.events==i && str_equal(calentry_subject(&one, one.first_entry), ((i-1)/3*3)%2?"b folded":"a folded"));
+    assert(one.content_hash==many.content_hash);
+    assert(one.last_entry->start==days_from_civil(2023,1,5)*SECONDS_PER_DAY+9*3600);
+    check_same(&one, &many);
+    free_ics_context(&one);
+    free_ics_context(&many);
+
+    /* cut right before an event */
+    assert(next_shard(body.s, body.len, 1) == str_len("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n" VTIMEZONE));
+    assert(next_shard(body.s, body.len, body.len-5) == body.len);
+
+    stralloc_free(&body);
+    exit(EXIT_SUCCESS);
+}
+#endif
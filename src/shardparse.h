@@ -0,0 +1,12 @@
+#ifndef SHARDPARSE_H
+#define SHARDPARSE_H
+#include <stddef.h>
+#include "ics.h"
+
+/* below this many bytes per thread a body is parsed in one piece */
+#define SHARD_MIN (256*1024)
+#define SHARD_MAX 64
+
+void set_shardparse_verbosity( short );
+int parse_ics_body( struct ics_context *, const char *, size_t, unsigned short );
+#endif
@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errmsg.h>
+#include <str.h>
+#include "ics.h"
+#include "summary.h"
+
+void init_summary( struct summary *s, time_t begin, time_t end, const char *project )
+{
+    memset(s, 0, sizeof(struct summary));
+    s->begin = begin;
+    s->end = end;
+    s->project = project;
+}
+
+void free_summary( struct summary *s )
+{
+    size_t i;
+
+    for (i=0; i<s->users; ++i)
+        free(s->user[i].vacation);
+    free(s->user);
+    free(s->by_subject);
+    memset(s, 0, sizeof(struct summary));
+}
+
+/* the users come one after the other, so the last one is looked at first */
+static struct summary_user *get_user( struct summary *s, const char *name, const struct holiday_table *holidays )
+{
+    struct summary_user *u;
+    size_t i;
+
+    for (i=s->users; i--; )
+        if ( s->user[i].name == name || str_equal(s->user[i].name, name) )
+            return &s->user[i];
+    if ( !(u = realloc(s->user, (s->users+1)*sizeof(struct summary_user))) ) {
+        carpsys("realloc");
+        return NULL;
+    }
+    s->user = u;
+    u += s->users;
+    if ( !(u->vacation = calloc(HOLIDAY_WORDS, sizeof(uint64_t))) ) {
+        carpsys("calloc");
+        return NULL;
+    }
+    u->name = name;
+    u->holidays = holidays;
+    s->users++;
+    return u;
+}
+
+/* sets the days of [start,end) in the year of the user's holiday table */
+static void mark_days( struct summary_user *u, time_t start, time_t end )
+{
+    const struct holiday_table *h = u->holidays;
+    struct tm b, e;
+    time_t last;
+    int i;
+
+    if ( start < h->begin_year )
+        start = h->begin_year;
+    if ( end > h->end_year )
+        end = h->end_year;
+    if ( start >= end )
+        return;
+    last = end-1;
+    localtime_r(&start, &b);
+    localtime_r(&last, &e);
+    for (i=b.tm_yday; i<=e.tm_yday; ++i)
+        u->vacation[i/64] |= 1ULL << (i%64);
+}
+
+/* centihours of [start,end) in the report period */
+static uint32_t period_ch( const struct summary *s, time_t start, time_t end )
+{
+    uint32_t b=event_minutes(s->begin), n=event_minutes(s->end), from, to;
+
+    from = event_minutes(start);
+    to = event_minutes(end);
+    from = (from>b)?from:b;
+    to = (to<n)?to:n;
+    return ((to>from)?to-from:0)*5/3;
+}
+
+/*
+ * if summary_add would take the event at all: a timed one in the report
+ * period (and of the project, if one is set), a day event in the year of
+ * its holiday table. The others need neither a duplicate key nor their
+ * subject kept, so memory follows the period and not the size of the export.
+ */
+bool summary_takes( const struct summary *s, const struct holiday_table *holidays, const char *subject,
+        time_t start, time_t end, bool dayevent )
+{
+    if ( dayevent )
+        return !s->project && holidays && start < holidays->end_year && end > holidays->begin_year;
+    if ( s->project && (!subject || !str_start(subject, s->project)) )
+        return false;
+    return period_ch(s, start, end) > 0;
+}
+
+/*
+ * one event into the totals, clipped to the report period the same way
+ * as by event_store_worksums; with a project set only its timed events
+ */
+int summary_add( struct summary *s, const char *user, const struct holiday_table *holidays, uint32_t subject_id,
+        const char *subject, time_t start, time_t end, bool dayevent, bool onsite )
+{
+    struct summary_user *u;
+    struct summary_project *p;
+    uint32_t ch;
+
+    s->events++;
+    if ( dayevent ) {
+        if ( s->project || !holidays )
+            return 0;
+        if ( !(u = get_user(s, user, holidays)) )
+            return -1;
+        mark_days(u, start, end);
+        return 0;
+    }
+    if ( s->project && (!subject || !str_start(subject, s->project)) )
+        return 0;
+
+    if ( !(ch = period_ch(s, start, end)) )
+        return 0;
+    if ( subject_id >= s->subjects ) {
+        size_t len = (subject_id+1 > s->subjects*2)?subject_id+1:s->subjects*2;
+        if ( !(p = realloc(s->by_subject, len*sizeof(struct summary_project))) ) {
+            carpsys("realloc");
+            return -1;
+        }
+        memset(p+s->subjects, 0, (len-s->subjects)*sizeof(struct summary_project));
+        s->by_subject = p;
+        s->subjects = len;
+    }
+    if ( onsite ) {
+        s->onsite_ch += ch;
+        s->by_subject[subject_id].onsite_ch += ch;
+    } else {
+        s->remote_ch += ch;
+        s->by_subject[subject_id].remote_ch += ch;
+    }
+    return 0;
+}
+
+static short count_days( const uint64_t *days, const uint64_t *workdays, size_t first, size_t last )
+{
+    short v=0;
+    size_t i;
+
+    for (i=first; i<=last; ++i)
+        v += (days[i/64] & workdays[i/64]) >> (i%64) & 1;
+    return v;
+}
+
+/* workdays of vacation in the report period and in its year, of all users */
+void summary_vacation( const struct summary *s, short *vmonth, short *vyear )
+{
+    const struct summary_user *u;
+    const struct holiday_table *h;
+    time_t b, e;
+    struct tm bt, et;
+    size_t i;
+
+    *vmonth = *vyear = 0;
+    for (i=0; i<s->users; ++i) {
+        u = &s->user[i];
+        h = u->holidays;
+        *vyear += count_days(u->vacation, h->workdays, 0, h->days-1);
+        b = (s->begin<h->begin_year)?h->begin_year:s->begin;
+        e = ((s->end>h->end_year)?h->end_year:s->end)-1;
+        if ( b > e )
+            continue;
+        localtime_r(&b, &bt);
+        localtime_r(&e, &et);
+        *vmonth += count_days(u->vacation, h->workdays, bt.tm_yday, et.tm_yday);
+    }
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+#include "datetime.h"
+
+int main( int argc, char *argv[] )
+{
+    struct holiday_table ht;
+    struct summary s;
+    time_t jan, feb, mar;
+    short vm, vy;
+
+    init_holiday_list(&ht, 2023);
+    jan = ht.begin_year;
+    feb = jan+31*SECONDS_PER_DAY;
+    mar = feb+28*SECONDS_PER_DAY;
+    init_summary(&s, feb, mar, NULL);
+
+    /* clipped to february, by subject */
+    assert(0==summary_add(&s, "u", &ht, 1, "a", feb-3600, feb+3600, false, true));
+    assert(0==summary_add(&s, "u", &ht, 3, "b", feb+7200, feb+9000, false, false));
+    assert(0==summary_add(&s, "u", &ht, 1, "a", jan, jan+3600, false, false));
+    assert(s.onsite_ch==100 && s.remote_ch==50 && s.subjects>=4);
+    assert(s.by_subject[1].onsite_ch==100 && s.by_subject[3].remote_ch==50 && !s.by_subject[2].onsite_ch);
+
+    /* overlapping vacations count once: Mon 30.1. to Fri 3.2. and Wed 1.2. to Tue 7.2. */
+    assert(0==summary_add(&s, "u", &ht, 0, NULL, jan+29*SECONDS_PER_DAY, jan+34*SECONDS_PER_DAY, true, false));
+    assert(0==summary_add(&s, "u", &ht, 0, NULL, jan+31*SECONDS_PER_DAY, jan+38*SECONDS_PER_DAY, true, false));
+    assert(0==summary_add(&s, "v", &ht, 0, NULL, feb, feb+SECONDS_PER_DAY, true, false));
+    summary_vacation(&s, &vm, &vy);
+    assert(s.users==2 && vy==2+5+1 && vm==5+1);
+    assert(s.events==6);
+    free_summary(&s);
+
+    /* only the timed events of the project */
+    init_summary(&s, jan, mar, "a");
+    assert(0==summary_add(&s, "u", &ht, 1, "ab", feb, feb+3600, false, true));
+    assert(0==summary_add(&s, "u", &ht, 2, "b", feb, feb+3600, false, true));
+    assert(0==summary_add(&s, "u", &ht, 0, NULL, feb, feb+SECONDS_PER_DAY, true, false));
+    assert(s.onsite_ch==100 && !s.users);
+    assert(summary_takes(&s, &ht, "ab", feb, feb+3600, false) && !summary_takes(&s, &ht, "b", feb, feb+3600, false));
+    assert(!summary_takes(&s, &ht, NULL, feb, feb+SECONDS_PER_DAY, true));
+    free_summary(&s);
+
+    /* what is out of the period (or, for vacation, the year) is not taken */
+    init_summary(&s, feb, mar, NULL);
+    assert(summary_takes(&s, &ht, NULL, feb-60, feb+60, false) && !summary_takes(&s, &ht, NULL, jan, feb, false));
+    assert(summary_takes(&s, &ht, NULL, jan, jan+SECONDS_PER_DAY, true));
+    assert(!summary_takes(&s, &ht, NULL, jan-SECONDS_PER_DAY, jan, true) && !summary_takes(&s, NULL, NULL, jan, feb, true));
+    free_summary(&s);
+    exit(EXIT_SUCCESS);
+}
+#endif
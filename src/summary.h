@@ -0,0 +1,44 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+struct holiday_table;
+
+/* the vacation days of one user in the year of the holiday table, one bit per day */
+struct summary_user {
+    const char *name;
+    const struct holiday_table *holidays;
+    uint64_t *vacation;
+};
+
+struct summary_project {
+    long onsite_ch;
+    long remote_ch;
+};
+
+/*
+ * the totals of a report, added up event by event as they are parsed: the
+ * memory depends on the number of users and subjects, not on the events
+ */
+struct summary {
+    time_t begin, end; // of the report period
+    const char *project; // prefix the timed events have to match, NULL: all
+    long onsite_ch;
+    long remote_ch;
+    struct summary_user *user;
+    size_t users;
+    struct summary_project *by_subject; // by subject id of the event store
+    size_t subjects;
+    unsigned long events;
+};
+
+void init_summary( struct summary *, time_t, time_t, const char * );
+void free_summary( struct summary * );
+int summary_add( struct summary *, const char *, const struct holiday_table *, uint32_t, const char *,
+        time_t, time_t, bool, bool );
+bool summary_takes( const struct summary *, const struct holiday_table *, const char *, time_t, time_t, bool );
+void summary_vacation( const struct summary *, short *, short * );
+#endif
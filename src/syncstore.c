@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <buffer.h>
+#include <byte.h>
+#include <errmsg.h>
+#include <fmt.h>
+#include <str.h>
+#include <scan.h>
+#include <open.h>
+#include <mmap.h>
+#include "atomicfile.h"
+#include "hash.h"
+#include "syncstore.h"
+
+#define V(__l,__fn) do{if(syncstore_verbosity>=__l){ __fn; }}while(0);
+short syncstore_verbosity=0;
+
+#define SYNC_MAGIC "caltimist-sync 1\n"
+
+void set_syncstore_verbosity( short v ) {
+    syncstore_verbosity=v;
+}
+
+/* the store of collection url is <dir>/<hash of url>.sync */
+int init_sync_store( struct sync_store *st, const char *dir, const char *url )
+{
+    size_t i;
+
+    memset(st, 0, sizeof(struct sync_store));
+    stralloc_init(&st->token);
+    stralloc_init(&st->missing);
+    if ( !(st->file = malloc(str_len(dir)+1+FMT_HASH+sizeof(".sync"))) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    i = fmt_str(st->file, dir);
+    st->file[i++] = '/';
+    i += fmt_hash(st->file+i, hash_str(url));
+    i += fmt_str(st->file+i, ".sync");
+    st->file[i] = '\0';
+    return 0;
+}
+
+static void free_resource( struct sync_resource *r )
+{
+    free(r->href);
+    free(r->data);
+    free(r);
+}
+
+void sync_clear( struct sync_store *st )
+{
+    struct sync_resource *r, *next;
+    size_t i;
+
+    for (i=0; i<SYNC_BUCKETS; ++i) {
+        for (r=st->bucket[i]; r; r=next) {
+            next = r->next_resource;
+            free_resource(r);
+        }
+        st->bucket[i] = NULL;
+    }
+    st->resources = 0;
+    st->token.len = 0;
+    st->missing.len = 0;
+    st->dirty = true;
+}
+
+void free_sync_store( struct sync_store *st )
+{
+    sync_clear(st);
+    stralloc_free(&st->token);
+    stralloc_free(&st->missing);
+    free(st->file);
+}
+
+static struct sync_resource **lookup( struct sync_store *st, const char *href )
+{
+    struct sync_resource **r = &st->bucket[hash_str(href) & (SYNC_BUCKETS-1)];
+
+    while ( *r && !str_equal((*r)->href, href) )
+        r = &(*r)->next_resource;
+    return r;
+}
+
+/* adds or replaces the calendar-data of href */
+int sync_update( struct sync_store *st, const char *href, const char *data, size_t len )
+{
+    struct sync_resource **r = lookup(st, href);
+    char *copy;
+
+    if ( !(copy = malloc(len+1)) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    if ( !*r ) {
+        if ( !(*r = calloc(1, sizeof(struct sync_resource))) || !((*r)->href = strdup(href)) ) {
+            carpsys("malloc");
+            free(*r);
+            *r = NULL;
+            free(copy);
+            return -1;
+        }
+        st->resources++;
+    }
+    free((*r)->data);
+    (*r)->data = copy;
+    (*r)->len = len;
+    st->updated++;
+    st->dirty = true;
+    return 0;
+}
+
+void sync_remove( struct sync_store *st, const char *href )
+{
+    struct sync_resource **r = lookup(st, href), *gone;
+
+    if ( !*r )
+        return;
+    gone = *r;
+    *r = gone->next_resource;
+    free_resource(gone);
+    st->resources--;
+    st->removed++;
+    st->dirty = true;
+}
+
+/*
+ * caldav_context callback for sync-collection and calendar-multiget
+ * responses. Resources reported without calendar-data are noted in
+ * missing, to be fetched by a calendar-multiget afterwards.
+ */
+int sync_response( void *ctx, const char *href, unsigned short status, const stralloc *data )
+{
+    struct sync_store *st = (struct sync_store *)ctx;
+
+    V(3,carp("sync: ", href));
+    switch ( status ) {
+    case 0:
+    case 200:
+        if ( data )
+            return sync_update(st, href, data->s, data->len);
+        if ( !stralloc_catb(&st->missing, href, str_len(href)+1) ) {
+            carpsys("stralloc_catb");
+            return -1;
+        }
+        return 0;
+    case 404:
+        sync_remove(st, href);
+        return 0;
+    case 507:
+        /* RFC 6578 3.6: more changes are waiting for the next request */
+        st->truncated = true;
+        return 0;
+    default:
+        V(1,carp("sync: ignoring resource with unexpected status: ", href));
+        return 0;
+    }
+}
+
+static const char *line( const char **p, const char *end )
+{
+    const char *l = *p;
+    size_t n = end-l, eol;
+
+    eol = byte_chr(l, n, '\n');
+    if ( eol == n )
+        return NULL;
+    *p = l+eol+1;
+    return l;
+}
+
+/*
+ * reads the store file, a missing one is an empty store:
+ *   caltimist-sync 1\n <token>\n  and per resource  <href>\n <len>\n <data>\n
+ */
+int sync_load( struct sync_store *st )
+{
+    const char *map, *p, *end, *l, *href;
+    char *h=NULL;
+    size_t size;
+    unsigned long len;
+    int ret=-1;
+
+    sync_clear(st);
+    st->dirty = false;
+    if ( !(map = mmap_read(st->file, &size)) ) {
+        if ( errno == ENOENT )
+            return 0;
+        carpsys(st->file);
+        return -1;
+    }
+    p = map;
+    end = map+size;
+    if ( size < str_len(SYNC_MAGIC) || memcmp(p, SYNC_MAGIC, str_len(SYNC_MAGIC)) )
+        goto corrupt;
+    p += str_len(SYNC_MAGIC);
+    if ( !(l = line(&p, end)) )
+        goto corrupt;
+    if ( !stralloc_copyb(&st->token, l, p-l-1) ) {
+        carpsys("stralloc_copyb");
+        goto out;
+    }
+    while ( p < end ) {
+        if ( !(href = line(&p, end)) || !(l = line(&p, end)) )
+            goto corrupt;
+        if ( scan_ulong(l, &len) != (size_t)(p-l-1) || len+1 > (size_t)(end-p) || p[len] != '\n' )
+            goto corrupt;
+        if ( !(h = malloc(l-href)) ) {
+            carpsys("malloc");
+            goto out;
+        }
+        memcpy(h, href, l-href-1);
+        h[l-href-1] = '\0';
+        if ( sync_update(st, h, p, len) )
+            goto out;
+        free(h);
+        h = NULL;
+        p += len+1;
+    }
+    st->updated = 0;
+    st->dirty = false;
+    ret = 0;
+    V(2,
+        buffer_puts(buffer_2, "sync: loaded ");
+        buffer_putulong(buffer_2, st->resources);
+        buffer_puts(buffer_2, " resources from ");
+        buffer_puts(buffer_2, st->file);
+        buffer_putnlflush(buffer_2);
+    );
+    goto out;
+corrupt:
+    carp("corrupt sync store: ", st->file);
+out:
+    free(h);
+    mmap_unmap(map, size);
+    if ( ret )
+        sync_clear(st);
+    return ret;
+}
+
+static int cat_resource( stralloc *sa, const struct sync_resource *r )
+{
+    return stralloc_cats(sa, r->href) && stralloc_append(sa, "\n") &&
+        stralloc_catulong0(sa, r->len, 0) && stralloc_append(sa, "\n") &&
+        stralloc_catb(sa, r->data, r->len) && stralloc_append(sa, "\n");
+}
+
+/* replaces the store file atomically, so a crashed run keeps the old state */
+int sync_save( struct sync_store *st )
+{
+    const struct sync_resource *r;
+    stralloc sa;
+    size_t i;
+    int ret=-1;
+
+    if ( !st->dirty )
+        return 0;
+    stralloc_init(&sa);
+    if ( !stralloc_copys(&sa, SYNC_MAGIC) || !stralloc_cat(&sa, &st->token) || !stralloc_append(&sa, "\n") )
+        goto nomem;
+    for (i=0; i<SYNC_BUCKETS; ++i)
+        for (r=st->bucket[i]; r; r=r->next_resource)
+            if ( !cat_resource(&sa, r) )
+                goto nomem;
+    if ( !(ret = write_file_atomic(st->file, sa.s, sa.len)) )
+        st->dirty = false;
+    goto out;
+nomem:
+    carpsys("stralloc");
+out:
+    stralloc_free(&sa);
+    return ret;
+}
+
+/* streams the calendar-data of all resources into parser (usually ics_parser) */
+int sync_feed( struct sync_store *st, int(*parser)(void *,char *), void *parser_ctx )
+{
+    const struct sync_resource *r;
+    char chunk[SYNC_CHUNK+1];
+    size_t i, o, n;
+
+    for (i=0; i<SYNC_BUCKETS; ++i)
+        for (r=st->bucket[i]; r; r=r->next_resource)
+            for (o=0; o<r->len; o+=n) {
+                n = (r->len-o > SYNC_CHUNK)?SYNC_CHUNK:r->len-o;
+                memcpy(chunk, r->data+o, n);
+                chunk[n] = '\0';
+                if ( parser(parser_ctx, chunk) ) {
+                    carp("parser failed on ", r->href);
+                    return -1;
+                }
+            }
+    return 0;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+static int collect( void *ctx, char *buf )
+{
+    return stralloc_cats((stralloc *)ctx, buf)?0:-1;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct sync_store st;
+    stralloc sa, data;
+    char dir[] = "/tmp/syncstore-XXXXXX";
+    char big[3*SYNC_CHUNK];
+    int fd;
+
+    assert(mkdtemp(dir));
+    stralloc_init(&sa);
+    stralloc_init(&data);
+
+    /* a missing file is an empty store */
+    assert(0==init_sync_store(&st, dir, "https://u:p@example.com/dav/cal/"));
+    assert(str_len(st.file)==str_len(dir)+1+FMT_HASH+5);
+    assert(0==sync_load(&st));
+    assert(st.resources==0 && st.token.len==0);
+
+    /* changes, a deletion and a 507 as seen by the caldav parser */
+    assert(stralloc_copys(&data, "BEGIN:VEVENT\r\nEND:VEVENT\r\n"));
+    assert(0==sync_response(&st, "/cal/a.ics", 0, &data));
+    assert(0==sync_response(&st, "/cal/b.ics", 200, &data));
+    assert(stralloc_copys(&data, "BEGIN:VEVENT\r\nSUMMARY:new\r\nEND:VEVENT\r\n"));
+    assert(0==sync_response(&st, "/cal/a.ics", 0, &data));
+    assert(0==sync_response(&st, "/cal/b.ics", 404, NULL));
+    assert(0==sync_response(&st, "/cal/gone.ics", 404, NULL));
+    assert(0==sync_response(&st, "/cal/c.ics", 0, NULL));
+    assert(0==sync_response(&st, "/cal/d.ics", 0, NULL));
+    assert(0==sync_response(&st, "/cal/", 507, NULL));
+    assert(st.resources==1 && st.removed==1 && st.truncated);
+    assert(st.missing.len==22 && !memcmp(st.missing.s, "/cal/c.ics\0/cal/d.ics\0", 22));
+
+    /* large resources are fed in pieces */
+    memset(big, 'x', sizeof(big));
+    memcpy(big+sizeof(big)-2, "\r\n", 2);
+    assert(0==sync_update(&st, "/cal/big.ics", big, sizeof(big)));
+    assert(st.resources==2);
+    assert(0==sync_feed(&st, collect, &sa));
+    assert(sa.len==sizeof(big)+data.len);
+
+    /* survives a round trip through the file */
+    assert(stralloc_copys(&st.token, "http://example.com/sync/7"));
+    assert(0==sync_save(&st));
+    free_sync_store(&st);
+    assert(0==init_sync_store(&st, dir, "https://u:p@example.com/dav/cal/"));
+    assert(0==sync_load(&st));
+    assert(st.resources==2 && !st.dirty);
+    assert(st.token.len==25 && !memcmp(st.token.s, "http://example.com/sync/7", 25));
+    sa.len=0;
+    assert(0==sync_feed(&st, collect, &sa));
+    assert(sa.len==sizeof(big)+data.len);
+    assert(memmem(sa.s, sa.len, data.s, data.len));
+
+    /* a damaged file is reported and leaves an empty store */
+    assert(-1!=(fd=open_append(st.file)));
+    assert(5==write(fd, "junk\n", 5));
+    close(fd);
+    assert(-1==sync_load(&st));
+    assert(st.resources==0 && st.token.len==0);
+
+    unlink(st.file);
+    rmdir(dir);
+    free_sync_store(&st);
+    stralloc_free(&sa);
+    stralloc_free(&data);
+    exit(EXIT_SUCCESS);
+}
+#endif
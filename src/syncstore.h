@@ -0,0 +1,42 @@
+#ifndef SYNCSTORE_H
+#define SYNCSTORE_H
+#include <stddef.h>
+#include <stdbool.h>
+#include <stralloc.h>
+
+#define SYNC_BUCKETS 1024
+#define SYNC_CHUNK 4096
+
+struct sync_resource {
+    char *href;
+    char *data;
+    size_t len;
+    struct sync_resource *next_resource;
+};
+
+/*
+ * local copy of a CalDAV collection (RFC 6578): the resources by href and
+ * the sync-token they correspond to, kept in one file per collection
+ */
+struct sync_store {
+    char *file;
+    stralloc token;
+    struct sync_resource *bucket[SYNC_BUCKETS];
+    unsigned long resources;
+    unsigned long updated, removed;
+    stralloc missing;
+    bool truncated;
+    bool dirty;
+};
+
+void set_syncstore_verbosity( short );
+int init_sync_store( struct sync_store *, const char *, const char * );
+void free_sync_store( struct sync_store * );
+void sync_clear( struct sync_store * );
+int sync_load( struct sync_store * );
+int sync_save( struct sync_store * );
+int sync_update( struct sync_store *, const char *, const char *, size_t );
+void sync_remove( struct sync_store *, const char * );
+int sync_response( void *, const char *, unsigned short, const stralloc * );
+int sync_feed( struct sync_store *, int(*)(void *,char *), void * );
+#endif
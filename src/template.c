@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errmsg.h>
+#include <mmap.h>
+#include <byte.h>
+#include <str.h>
+#include "hash.h"
+#include "template.h"
+
+/*
+ * output formats from a file instead of C: the text of each section is cut
+ * into literal spans and {placeholders} once at startup, a row is then
+ * only the spans copied and the values formatted in between. {{ is a
+ * literal {, an unknown placeholder fails the load.
+ */
+
+#define V(__l,__fn) do{if(template_verbosity>=__l){ __fn; }}while(0);
+short template_verbosity=0;
+
+static const char *part_name[TEMPLATE_PARTS] = { "[header]", "[row]", "[footer]", "[project]", "[month]" };
+
+static const struct {
+    const char *name;
+    enum template_field field;
+} field_name[] = {
+    { "period", TF_PERIOD },
+    { "year", TF_YEAR },
+    { "month", TF_MONTH },
+    { "user", TF_USER },
+    { "project", TF_PROJECT },
+    { "date", TF_DATE },
+    { "start", TF_START },
+    { "end", TF_END },
+    { "hours", TF_HOURS },
+    { "location", TF_LOCATION },
+    { "onsite", TF_ONSITE },
+    { "remote", TF_REMOTE },
+    { "balance", TF_BALANCE },
+    { "vacation", TF_VACATION },
+    { "vacation_left", TF_VACATION_LEFT },
+    { "amount_onsite", TF_AMOUNT_ONSITE },
+    { "amount_remote", TF_AMOUNT_REMOTE },
+    { "amount", TF_AMOUNT },
+};
+
+void set_template_verbosity( short v ) {
+    template_verbosity=v;
+}
+
+static int add_op( struct template *t, enum template_part part, enum template_field field, const char *lit, size_t len )
+{
+    struct template_op *op;
+    size_t n = t->ops[part];
+
+    /* literal spans next to each other are one copy */
+    if ( field == TF_LITERAL ) {
+        if ( !len )
+            return 0;
+        if ( n && t->op[part][n-1].field == TF_LITERAL && t->op[part][n-1].lit+t->op[part][n-1].len == lit ) {
+            t->op[part][n-1].len += len;
+            return 0;
+        }
+    }
+    if ( !(op = realloc(t->op[part], (n+1)*sizeof(struct template_op))) ) {
+        carpsys("realloc");
+        return -1;
+    }
+    op[n].field = field;
+    op[n].lit = lit;
+    op[n].len = len;
+    t->op[part] = op;
+    t->ops[part]++;
+    return 0;
+}
+
+static int compile_line( struct template *t, enum template_part part, const char *p, size_t len )
+{
+    const char *end=p+len;
+    size_t n, i;
+
+    while ( p < end ) {
+        n = byte_chr(p, end-p, '{');
+        if ( add_op(t, part, TF_LITERAL, p, n) )
+            return -1;
+        p += n;
+        if ( p == end )
+            break;
+        if ( p+1 < end && p[1] == '{' ) {
+            if ( add_op(t, part, TF_LITERAL, p+1, 1) )
+                return -1;
+            p += 2;
+            continue;
+        }
+        n = byte_chr(p, end-p, '}');
+        for (i=0; i<sizeof(field_name)/sizeof(field_name[0]); ++i)
+            if ( n-1 == str_len(field_name[i].name) && !memcmp(p+1, field_name[i].name, n-1) )
+                break;
+        if ( p+n == end || i == sizeof(field_name)/sizeof(field_name[0]) ) {
+            carp("unknown placeholder in template: ", part_name[part]);
+            return -1;
+        }
+        if ( add_op(t, part, field_name[i].field, NULL, 0) )
+            return -1;
+        p += n+1;
+    }
+    return 0;
+}
+
+/* the sections of len bytes of text, which is copied */
+int template_compile( struct template *t, const char *text, size_t len )
+{
+    const char *p, *end;
+    size_t n, i;
+    int part=-1;
+
+    memset(t, 0, sizeof(struct template));
+    if ( !(t->text = malloc(len+1)) ) {
+        carpsys("malloc");
+        return -1;
+    }
+    memcpy(t->text, text, len);
+    t->text[len] = '\0';
+    t->hash = hash_buf(hash_str(""), text, len);
+
+    for (p=t->text, end=p+len; p<end; p+=n) {
+        n = byte_chr(p, end-p, '\n');
+        n += (p+n < end);
+        for (i=0; i<TEMPLATE_PARTS; ++i)
+            if ( str_start(p, part_name[i]) && (p+str_len(part_name[i]) == end ||
+                        p[str_len(part_name[i])] == '\n' || p[str_len(part_name[i])] == '\r') )
+                break;
+        if ( i < TEMPLATE_PARTS ) {
+            part = i;
+            continue;
+        }
+        if ( part < 0 ) {
+            /* comments and blank lines before the first section */
+            if ( *p == '#' || *p == '\n' || *p == '\r' )
+                continue;
+            carp("template text before its first section");
+            goto fail;
+        }
+        if ( compile_line(t, part, p, n) )
+            goto fail;
+    }
+    V(2,
+        buffer_puts(buffer_2, "template ops: ");
+        for (i=0; i<TEMPLATE_PARTS; ++i) {
+            buffer_puts(buffer_2, part_name[i]);
+            buffer_putulong(buffer_2, t->ops[i]);
+            buffer_puts(buffer_2, " ");
+        }
+        buffer_putnlflush(buffer_2);
+    );
+    return 0;
+fail:
+    free_template(t);
+    return -1;
+}
+
+int template_load( struct template *t, const char *file )
+{
+    const char *map;
+    size_t size;
+    int ret;
+
+    if ( !(map = mmap_read(file, &size)) ) {
+        carpsys(file);
+        return -1;
+    }
+    ret = template_compile(t, map, size);
+    mmap_unmap(map, size);
+    if ( ret )
+        carp("failed to load template: ", file);
+    return ret;
+}
+
+void free_template( struct template *t )
+{
+    size_t i;
+
+    for (i=0; i<TEMPLATE_PARTS; ++i)
+        free(t->op[i]);
+    free(t->text);
+    memset(t, 0, sizeof(struct template));
+}
+
+static void put_amount( stralloc *sa, long ch, short centihourlyrate )
+{
+    long p=(ch*centihourlyrate)/100;
+    FMT_PRICE((*sa), p);
+}
+
+/*
+ * user and project are the ones of the row, in header and footer they are
+ * only set if the report is limited to one. In a project line onsite and
+ * remote are the sums of that project, in a month section the sums are the
+ * ones of that month and the period is the month.
+ */
+static void render_part( struct report_context *rep, enum template_part part )
+{
+    const struct timeslotinfo *tsi=&rep->tsi;
+    const struct template_op *op=rep->tpl->op[part], *end=op+rep->tpl->ops[part];
+    stralloc *sa=&rep->output_line_sa;
+    bool row = (part == TEMPLATE_ROW), project = (part == TEMPLATE_PROJECT), month = (part == TEMPLATE_MONTH);
+    long o, r;
+
+    stralloc_zero(sa);
+    for (; op<end; ++op) {
+        switch (op->field) {
+        case TF_LITERAL:
+            stralloc_catb(sa, op->lit, op->len);
+            break;
+        case TF_PERIOD:
+            if ( tsi->allyear && !month )
+                stralloc_cats(sa, "1-12");
+            else
+                stralloc_catlong(sa, tsi->mon);
+            stralloc_append(sa, "/");
+            stralloc_catlong(sa, tsi->year);
+            break;
+        case TF_YEAR:
+            stralloc_catlong(sa, tsi->year);
+            break;
+        case TF_MONTH:
+            stralloc_catulong0(sa, tsi->mon, 2);
+            break;
+        case TF_USER:
+            if ( (row || tsi->userlimit) && tsi->user )
+                stralloc_cats(sa, tsi->user);
+            break;
+        case TF_PROJECT:
+            if ( (row || project || tsi->projectlimit) && tsi->project )
+                stralloc_cats(sa, tsi->project);
+            break;
+        case TF_DATE:
+            FMT_DATE((*sa), tsi->mday, tsi->mon);
+            break;
+        case TF_START:
+            FMT_TIME((*sa), tsi->shour, tsi->smin);
+            break;
+        case TF_END:
+            FMT_TIME((*sa), tsi->ehour, tsi->emin);
+            break;
+        case TF_HOURS:
+            FMT_IND_HOURS((*sa), tsi->workhours_ch);
+            break;
+        case TF_LOCATION:
+            stralloc_cats(sa, tsi->onsite?"onsite":"remote");
+            break;
+        case TF_ONSITE:
+            o = project?tsi->project_onsite_ch:tsi->worksum_onsite_ch;
+            FMT_IND_HOURS((*sa), o);
+            break;
+        case TF_REMOTE:
+            r = project?tsi->project_remote_ch:tsi->worksum_remote_ch;
+            FMT_IND_HOURS((*sa), r);
+            break;
+        case TF_BALANCE:
+            FMT_IND_HOURS((*sa), tsi->worktbd_ch);
+            break;
+        case TF_VACATION:
+            stralloc_catlong(sa, tsi->vmonth);
+            break;
+        case TF_VACATION_LEFT:
+            stralloc_catlong(sa, tsi->vleft);
+            break;
+        case TF_AMOUNT_ONSITE:
+            put_amount(sa, tsi->worksum_onsite_ch, tsi->centihourlyrate_onsite);
+            break;
+        case TF_AMOUNT_REMOTE:
+            put_amount(sa, tsi->worksum_remote_ch, tsi->centihourlyrate_remote);
+            break;
+        case TF_AMOUNT:
+            o=(tsi->worksum_onsite_ch * tsi->centihourlyrate_onsite)/100;
+            r=(tsi->worksum_remote_ch * tsi->centihourlyrate_remote)/100;
+            o+=r;
+            FMT_PRICE((*sa), o);
+            break;
+        }
+    }
+    buffer_putsa(rep->out, sa);
+}
+
+void template_header( struct report_context *rep )
+{
+    render_part(rep, TEMPLATE_HEADER);
+}
+
+/* rows are only flushed with the footer, not one by one */
+void template_timeline( struct report_context *rep )
+{
+    render_part(rep, TEMPLATE_ROW);
+}
+
+void template_project( struct report_context *rep )
+{
+    render_part(rep, TEMPLATE_PROJECT);
+}
+
+void template_month( struct report_context *rep )
+{
+    render_part(rep, TEMPLATE_MONTH);
+}
+
+void template_footer( struct report_context *rep )
+{
+    render_part(rep, TEMPLATE_FOOTER);
+    buffer_flush(rep->out);
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+#define TPL "# invoice layout\n\n[header]\nreport {period} {user}\n[row]\n{date};{start};{end};{hours};{location};{user};{project};{{x}\n"\
+    "[footer]\nsum {onsite}/{remote} = {amount} ({amount_onsite}+{amount_remote})\nvacation {vacation}, left {vacation_left}"
+
+int main( int argc, char *argv[] )
+{
+    struct template t;
+    struct report_context rep;
+    stralloc out;
+    buffer b;
+
+    assert(0==template_compile(&t, TPL, str_len(TPL)));
+    /* the literal { is merged into the span after it */
+    assert(t.ops[TEMPLATE_HEADER]==5 && t.op[TEMPLATE_HEADER][0].len==7 && t.op[TEMPLATE_HEADER][4].len==1);
+    assert(t.ops[TEMPLATE_ROW]==15 && t.op[TEMPLATE_ROW][14].len==4 && !memcmp(t.op[TEMPLATE_ROW][14].lit, "{x}\n", 4));
+    assert(t.op[TEMPLATE_FOOTER][1].field==TF_ONSITE && t.op[TEMPLATE_FOOTER][5].field==TF_AMOUNT);
+    assert(t.hash==hash_str(TPL));
+
+    stralloc_init(&out);
+    buffer_tosa(&b, &out);
+    memset(&rep, 0, sizeof(rep));
+    rep.out = &b;
+    rep.tpl = &t;
+    rep.tsi = (struct timeslotinfo){ .user="foo", .project="p1", .mday=3, .mon=5, .year=2023,
+        .shour=9, .smin=5, .ehour=10, .emin=35, .onsite=true, .workhours_ch=150,
+        .worksum_onsite_ch=1000, .worksum_remote_ch=250, .centihourlyrate_onsite=5000,
+        .centihourlyrate_remote=4000, .vmonth=2, .vleft=20 };
+    template_header(&rep);
+    template_timeline(&rep);
+    template_footer(&rep);
+    /* the prices end in the first byte of CURSYM, as with the built-in formats */
+    assert(!memcmp(out.s, "report 5/2023 \n03.05.;09:05;10:35;01,50h;onsite;foo;p1;{x}\n"
+                "sum 10,00h/02,50h = 600,00\xe2 (500,00\xe2+100,00\xe2)\nvacation 2, left 20", out.len));
+    buffer_close(&b);
+    free_template(&t);
+
+    /* the sums of one project in summary mode */
+    assert(0==template_compile(&t, "[project]\n{project}: {onsite}/{remote}\n", 39));
+    stralloc_zero(&out);
+    buffer_tosa(&b, &out);
+    rep.tpl = &t;
+    rep.tsi.project_onsite_ch = 25;
+    rep.tsi.project_remote_ch = 0;
+    template_project(&rep);
+    buffer_flush(&b);
+    assert(out.len==18 && !memcmp(out.s, "p1: 00,25h/00,00h\n", 18));
+    buffer_close(&b);
+    free_template(&t);
+
+    /* the subtotals of a month of a year report */
+    assert(0==template_compile(&t, "[month]\n{period}: {onsite} {balance}\n", 37));
+    stralloc_zero(&out);
+    buffer_tosa(&b, &out);
+    rep.tpl = &t;
+    rep.tsi.allyear = true;
+    rep.tsi.worktbd_ch = -800;
+    template_month(&rep);
+    buffer_flush(&b);
+    assert(out.len==23 && !memcmp(out.s, "5/2023: 10,00h -08,00h\n", 23));
+    buffer_close(&b);
+    stralloc_free(&out);
+    free_template(&t);
+
+    assert(-1==template_compile(&t, "[row]\n{date} {nope}\n", 19) && !t.text);
+    assert(-1==template_compile(&t, "[row]\n{date\n", 12));
+    assert(-1==template_compile(&t, "text\n[row]\n", 11));
+    exit(EXIT_SUCCESS);
+}
+#endif
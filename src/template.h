@@ -0,0 +1,65 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+#include <stddef.h>
+#include "format.h"
+
+enum template_part {
+    TEMPLATE_HEADER=0,
+    TEMPLATE_ROW,
+    TEMPLATE_FOOTER,
+    TEMPLATE_PROJECT,
+    TEMPLATE_MONTH,
+    TEMPLATE_PARTS
+};
+
+/* what an op writes: a literal span of the template or one value of the report */
+enum template_field {
+    TF_LITERAL=0,
+    TF_PERIOD,
+    TF_YEAR,
+    TF_MONTH,
+    TF_USER,
+    TF_PROJECT,
+    TF_DATE,
+    TF_START,
+    TF_END,
+    TF_HOURS,
+    TF_LOCATION,
+    TF_ONSITE,
+    TF_REMOTE,
+    TF_BALANCE,
+    TF_VACATION,
+    TF_VACATION_LEFT,
+    TF_AMOUNT_ONSITE,
+    TF_AMOUNT_REMOTE,
+    TF_AMOUNT
+};
+
+struct template_op {
+    enum template_field field;
+    const char *lit; // into template.text, for TF_LITERAL
+    size_t len;
+};
+
+/*
+ * an output format from a file with the sections [header], [row], [footer],
+ * [project] (summary mode) and [month] (grouped mode), each compiled once
+ * into the ops that render it
+ */
+struct template {
+    char *text;
+    struct template_op *op[TEMPLATE_PARTS];
+    size_t ops[TEMPLATE_PARTS];
+    unsigned long long hash; // of the file, part of the report cache key
+};
+
+void set_template_verbosity( short );
+int template_compile( struct template *, const char *, size_t );
+int template_load( struct template *, const char * );
+void free_template( struct template * );
+void template_header( struct report_context * );
+void template_timeline( struct report_context * );
+void template_footer( struct report_context * );
+void template_project( struct report_context * );
+void template_month( struct report_context * );
+#endif
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <errmsg.h>
+#include <fmt.h>
+#include <str.h>
+#include <open.h>
+#include "atomicfile.h"
+#include "trace.h"
+
+/*
+ * collects spans and counters in the trace event format understood by
+ * chrome://tracing and Perfetto. All functions accept tr==NULL, so callers
+ * don't have to care whether tracing is enabled.
+ */
+
+unsigned long long trace_now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+int trace_init( struct trace_context *tr )
+{
+    memset(tr, 0, sizeof(struct trace_context));
+    stralloc_init(&tr->sa);
+    tr->origin = trace_now();
+    tr->pid = getpid();
+    tr->tid = 1;
+    return stralloc_copys(&tr->sa, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[")?0:-1;
+}
+
+/*
+ * tr collects the events of a thread other than the one recording into of,
+ * on row tid of the same timeline; they go into of with trace_adopt once
+ * the thread is done
+ */
+int trace_init_thread( struct trace_context *tr, const struct trace_context *of, unsigned long tid )
+{
+    memset(tr, 0, sizeof(struct trace_context));
+    stralloc_init(&tr->sa);
+    tr->origin = of->origin;
+    tr->pid = of->pid;
+    tr->tid = tid;
+    return stralloc_copys(&tr->sa, "[")?0:-1;
+}
+
+/* the events of other appended to tr, other is freed */
+int trace_adopt( struct trace_context *tr, struct trace_context *other )
+{
+    int ret=0;
+
+    if ( other->sa.len > 1 && ((tr->sa.s[tr->sa.len-1] != '[' && !stralloc_append(&tr->sa, ",")) ||
+                !stralloc_catb(&tr->sa, other->sa.s+1, other->sa.len-1)) ) {
+        carpsys("stralloc_catb");
+        ret=-1;
+    }
+    trace_free(other);
+    return ret;
+}
+
+void trace_free( struct trace_context *tr )
+{
+    if (tr)
+        stralloc_free(&tr->sa);
+}
+
+static void cat_escaped( stralloc *sa, const char *s )
+{
+    for (; *s; ++s) {
+        if ( *s == '"' || *s == '\\' ) {
+            stralloc_append(sa, "\\");
+            stralloc_append(sa, s);
+        } else if ( (unsigned char)*s < 0x20 )
+            stralloc_append(sa, " ");
+        else
+            stralloc_append(sa, s);
+    }
+}
+
+static void event_head( struct trace_context *tr, const char *cat, const char *name, const char *ph, unsigned long long ts )
+{
+    if ( tr->sa.s[tr->sa.len-1] != '[' )
+        stralloc_append(&tr->sa, ",");
+    stralloc_cats(&tr->sa, "\n{\"cat\":\"");
+    cat_escaped(&tr->sa, cat);
+    stralloc_cats(&tr->sa, "\",\"name\":\"");
+    cat_escaped(&tr->sa, name);
+    stralloc_catm(&tr->sa, "\",\"ph\":\"", ph, "\",\"pid\":");
+    stralloc_catulong0(&tr->sa, tr->pid, 0);
+    stralloc_cats(&tr->sa, ",\"tid\":");
+    stralloc_catulong0(&tr->sa, tr->tid, 0);
+    stralloc_cats(&tr->sa, ",\"ts\":");
+    stralloc_catulong0(&tr->sa, (ts>tr->origin)?ts-tr->origin:0, 0);
+}
+
+void trace_span( struct trace_context *tr, const char *cat, const char *name, const char *label,
+        unsigned long long start, unsigned long long end )
+{
+    if (!tr)
+        return;
+
+    event_head(tr, cat, name, "X", start);
+    stralloc_cats(&tr->sa, ",\"dur\":");
+    stralloc_catulong0(&tr->sa, (end>start)?end-start:0, 0);
+    if ( label ) {
+        stralloc_cats(&tr->sa, ",\"args\":{\"label\":\"");
+        cat_escaped(&tr->sa, label);
+        stralloc_cats(&tr->sa, "\"}");
+    }
+    stralloc_append(&tr->sa, "}");
+}
+
+void trace_complete( struct trace_context *tr, const char *cat, const char *name, const char *label, unsigned long long start )
+{
+    if (tr)
+        trace_span(tr, cat, name, label, start, trace_now());
+}
+
+void trace_counter( struct trace_context *tr, const char *name, unsigned long value )
+{
+    if (!tr)
+        return;
+
+    event_head(tr, "counter", name, "C", trace_now());
+    stralloc_cats(&tr->sa, ",\"args\":{\"");
+    cat_escaped(&tr->sa, name);
+    stralloc_cats(&tr->sa, "\":");
+    stralloc_catulong0(&tr->sa, value, 0);
+    stralloc_cats(&tr->sa, "}}");
+}
+
+void trace_slice( struct trace_context *tr, struct trace_slices *sl, unsigned long long start )
+{
+    unsigned long long now;
+
+    if (!tr)
+        return;
+
+    now=trace_now();
+    if ( sl->end && start < sl->end+TRACE_COALESCE_US ) {
+        sl->end=now;
+        return;
+    }
+    trace_slices_flush(tr, sl);
+    sl->start=start;
+    sl->end=now;
+}
+
+void trace_slices_flush( struct trace_context *tr, struct trace_slices *sl )
+{
+    if ( !tr || !sl->end )
+        return;
+    trace_span(tr, sl->cat, sl->name, sl->label, sl->start, sl->end);
+    sl->end=0;
+}
+
+/* write to a temporary file first, so readers never see a half written trace */
+int trace_write( struct trace_context *tr, const char *file )
+{
+    if ( !stralloc_cats(&tr->sa, "\n]}\n") ) {
+        carpsys("stralloc_cats");
+        return -1;
+    }
+    return write_file_atomic(file, tr->sa.s, tr->sa.len);
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+static size_t occurrences( const stralloc *sa, const char *needle )
+{
+    size_t n=0, l=str_len(needle);
+    const char *p=sa->s, *e=sa->s+sa->len;
+
+    while ( (p=memmem(p, e-p, needle, l)) ) {
+        n++;
+        p+=l;
+    }
+    return n;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct trace_context tr;
+    struct trace_slices sl = { "fetch", "parse", "us\"er", 0, 0 };
+    unsigned long long t;
+
+    assert(0==trace_init(&tr));
+    t=trace_now();
+    trace_complete(&tr, "fetch", "dns", "jack", t);
+    assert(1==occurrences(&tr.sa, "\"name\":\"dns\",\"ph\":\"X\""));
+    assert(1==occurrences(&tr.sa, "\"args\":{\"label\":\"jack\"}"));
+
+    /* two adjacent slices end up in one span, a distant one gets its own */
+    trace_slice(&tr, &sl, t);
+    trace_slice(&tr, &sl, t+1);
+    trace_slice(&tr, &sl, trace_now()+10*TRACE_COALESCE_US);
+    trace_slices_flush(&tr, &sl);
+    assert(2==occurrences(&tr.sa, "\"name\":\"parse\""));
+    assert(2==occurrences(&tr.sa, "us\\\"er"));
+
+    trace_counter(&tr, "bytes", 4711);
+    assert(1==occurrences(&tr.sa, "\"args\":{\"bytes\":4711}"));
+
+    /* the spans of another thread join on a row of their own */
+    struct trace_context th;
+    assert(0==trace_init_thread(&th, &tr, 2) && 0==trace_adopt(&tr, &th));
+    assert(tr.sa.s[tr.sa.len-1]=='}');
+    assert(0==trace_init_thread(&th, &tr, 2));
+    trace_complete(&th, "fetch", "connect", "jill", t);
+    assert(0==trace_adopt(&tr, &th));
+    assert(1==occurrences(&tr.sa, "\"name\":\"connect\"") && 1==occurrences(&tr.sa, "\"tid\":2,"));
+    assert(1==occurrences(&tr.sa, "},\n{\"cat\":\"fetch\",\"name\":\"connect\""));
+
+    trace_slices_flush(NULL, &sl);
+    trace_complete(NULL, "fetch", "dns", NULL, t);
+    trace_free(&tr);
+    exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stralloc.h>
+
+/* slices of one phase closer together than this are merged into one span */
+#define TRACE_COALESCE_US 1000
+
+struct trace_context {
+    stralloc sa;
+    unsigned long long origin;
+    unsigned long pid;
+    unsigned long tid; // row in the viewer, one per thread that records
+};
+
+/* a phase that runs in many short pieces, e.g. parsing each received chunk */
+struct trace_slices {
+    const char *cat;
+    const char *name;
+    const char *label;
+    unsigned long long start;
+    unsigned long long end;
+};
+
+unsigned long long trace_now( void );
+int trace_init( struct trace_context * );
+int trace_init_thread( struct trace_context *, const struct trace_context *, unsigned long );
+int trace_adopt( struct trace_context *, struct trace_context * );
+void trace_free( struct trace_context * );
+void trace_span( struct trace_context *, const char *, const char *, const char *, unsigned long long, unsigned long long );
+void trace_complete( struct trace_context *, const char *, const char *, const char *, unsigned long long );
+void trace_counter( struct trace_context *, const char *, unsigned long );
+void trace_slice( struct trace_context *, struct trace_slices *, unsigned long long );
+void trace_slices_flush( struct trace_context *, struct trace_slices * );
+int trace_write( struct trace_context *, const char * );
+#endif
@@ -0,0 +1,743 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * part of caltimist - calculates project-/worktime and vacation using iCalendar data
+ * Copyright (C) 2023 Thomas Pöhnitzsch <thpo+caltimist@dotrc.de>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errmsg.h>
+#include <str.h>
+#include <scan.h>
+#include <mmap.h>
+#include <byte.h>
+#include <buffer.h>
+#include "tzone.h"
+#include "rrule.h"
+#include "datetime.h"
+
+/*
+ * time zones for TZID parameters (RFC 5545 3.2.19), from the VTIMEZONE
+ * components of the calendar or else from the zoneinfo files of the
+ * system (RFC 8536). Either way a zone is compiled once into its list of
+ * transitions up to TZONE_LAST_YEAR and never goes through the TZ
+ * environment and mktime.
+ */
+
+#define V(__l,__fn) do{if(tzone_verbosity>=__l){ __fn; }}while(0);
+short tzone_verbosity=0;
+
+struct tzone_observance {
+    long day, tod;   // DTSTART, wall clock before the change
+    long from, to;   // TZOFFSETFROM, TZOFFSETTO
+    bool has_from, has_to;
+    bool has_rule;
+    struct rrule rule;
+    long *rdate;     // wall clock, seconds since the epoch
+    size_t rdates;
+};
+
+struct tzone_builder {
+    char *tzid;
+    struct tzone_observance *obs;
+    size_t nobs;
+    bool in_obs;
+};
+
+void set_tzone_verbosity( short v ) {
+    tzone_verbosity=v;
+}
+
+void init_tzone_list( struct tzone_list *l )
+{
+    memset(l, 0, sizeof(struct tzone_list));
+}
+
+static void free_tzone( struct tzone *z )
+{
+    free(z->tzid);
+    free(z->trans);
+    free(z);
+}
+
+void free_tzone_list( struct tzone_list *l )
+{
+    struct tzone *z, *next;
+
+    for (z=l->first; z && z != l->borrowed; z=next) {
+        next = z->next;
+        free_tzone(z);
+    }
+    init_tzone_list(l);
+}
+
+/* l (empty) sees the zones of from, which has to outlive it */
+void tzone_borrow( struct tzone_list *l, const struct tzone_list *from )
+{
+    l->first = (struct tzone *)from->first;
+    l->borrowed = from->first;
+    l->last = NULL;
+}
+
+/* the zones from found on its own go to l, so pointers to them stay valid */
+void tzone_adopt( struct tzone_list *l, struct tzone_list *from )
+{
+    struct tzone *z;
+
+    if ( from->first == from->borrowed )
+        return;
+    for (z=from->first; z->next != from->borrowed; z=z->next);
+    z->next = l->first;
+    l->first = from->first;
+    from->first = (struct tzone *)from->borrowed;
+    from->last = NULL;
+}
+
+static struct tzone *lookup( const struct tzone_list *l, const char *name, size_t len )
+{
+    struct tzone *z;
+
+    for (z=l->first; z; z=z->next)
+        if ( !strncmp(z->tzid, name, len) && !z->tzid[len] )
+            return z;
+    return NULL;
+}
+
+static struct tzone *new_tzone( const char *name, size_t len )
+{
+    struct tzone *z = calloc(1, sizeof(struct tzone));
+
+    if ( !z || !(z->tzid = strndup(name, len)) ) {
+        carpsys("calloc");
+        free(z);
+        return NULL;
+    }
+    return z;
+}
+
+static int add_transition( struct tzone *z, size_t *alloc, time_t at, long offset )
+{
+    if ( z->len >= TZONE_MAX_TRANSITIONS )
+        return 0;
+    if ( z->len == *alloc ) {
+        size_t n = *alloc?*alloc*2:64;
+        struct tzone_transition *t = realloc(z->trans, n*sizeof(struct tzone_transition));
+        if ( !t ) {
+            carpsys("realloc");
+            return -1;
+        }
+        z->trans = t;
+        *alloc = n;
+    }
+    z->trans[z->len].at = at;
+    z->trans[z->len].offset = offset;
+    z->len++;
+    return 0;
+}
+
+static int cmp_transition( const void *a, const void *b )
+{
+    const struct tzone_transition *x = a, *y = b;
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+/* sorted, of two changes at the same time the first one is kept */
+static void finish_tzone( struct tzone *z )
+{
+    size_t i, n;
+
+    qsort(z->trans, z->len, sizeof(struct tzone_transition), cmp_transition);
+    for (i=n=0; i<z->len; ++i)
+        if ( !n || z->trans[i].at != z->trans[n-1].at )
+            z->trans[n++] = z->trans[i];
+    z->len = n;
+    z->valid = true;
+}
+
+long tzone_offset( const struct tzone *z, time_t t )
+{
+    size_t lo=0, hi=z->len, mid;
+
+    while ( lo < hi ) {
+        mid = lo + (hi-lo)/2;
+        if ( z->trans[mid].at <= t )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo?z->trans[lo-1].offset:z->initial;
+}
+
+/*
+ * wall clock in z to UTC. A time skipped by a change is moved on by the
+ * change, of a time that is there twice the first one is taken.
+ */
+time_t tzone_from_civil( const struct tzone *z, long day, long tod )
+{
+    time_t wall = (time_t)day*SECONDS_PER_DAY + tod;
+    long before = tzone_offset(z, wall-SECONDS_PER_DAY), after = tzone_offset(z, wall+SECONDS_PER_DAY);
+
+    if ( tzone_offset(z, wall-before) == before || tzone_offset(z, wall-after) != after )
+        return wall-before;
+    return wall-after;
+}
+
+void tzone_to_civil( const struct tzone *z, time_t t, long *day, long *tod )
+{
+    time_to_civil(t + tzone_offset(z, t), true, day, tod);
+}
+
+/*
+ * VTIMEZONE, line by line between BEGIN:VTIMEZONE and END:VTIMEZONE
+ */
+
+struct tzone_builder *tzone_begin( void )
+{
+    struct tzone_builder *b = calloc(1, sizeof(struct tzone_builder));
+
+    if ( !b )
+        carpsys("calloc");
+    return b;
+}
+
+void tzone_abort( struct tzone_builder *b )
+{
+    size_t i;
+
+    for (i=0; i<b->nobs; ++i)
+        free(b->obs[i].rdate);
+    free(b->obs);
+    free(b->tzid);
+    free(b);
+}
+
+static const char *value_of( const char *line, const char *name )
+{
+    size_t l = str_len(name);
+
+    if ( !str_start(line, name) || (line[l] != ':' && line[l] != ';') )
+        return NULL;
+    l += str_chr(line+l, ':');
+    return line[l]?line+l+1:NULL;
+}
+
+/* +hhmm[ss] or -hhmm[ss] */
+static int scan_utc_offset( const char *v, long *offset )
+{
+    unsigned long hh, mm, ss=0;
+    size_t len = str_len(v);
+
+    if ( (len != 5 && len != 7) || (*v != '+' && *v != '-') ||
+            2 != scan_ulongn(v+1, 2, &hh) || 2 != scan_ulongn(v+3, 2, &mm) ||
+            (len == 7 && 2 != scan_ulongn(v+5, 2, &ss)) )
+        return -1;
+    *offset = hh*3600 + mm*60 + ss;
+    if ( *v == '-' )
+        *offset = -*offset;
+    return 0;
+}
+
+static int add_rdates( struct tzone_observance *o, const char *v )
+{
+    char ts[sizeof("yyyymmddThhmmss")];
+    long day, tod, *r;
+    size_t l;
+
+    while ( *v ) {
+        l = str_chr(v, ',');
+        if ( l < sizeof(ts) ) {
+            memcpy(ts, v, l);
+            ts[l] = '\0';
+            if ( !datetime_scan(ts, false, &day, &tod, NULL) ) {
+                if ( !(r = realloc(o->rdate, (o->rdates+1)*sizeof(long))) ) {
+                    carpsys("realloc");
+                    return -1;
+                }
+                o->rdate = r;
+                o->rdate[o->rdates++] = day*SECONDS_PER_DAY + tod;
+            }
+        }
+        v += l + (v[l]?1:0);
+    }
+    return 0;
+}
+
+int tzone_line( struct tzone_builder *b, const char *line )
+{
+    struct tzone_observance *o;
+    const char *v;
+
+    if ( str_start(line, "BEGIN:STANDARD") || str_start(line, "BEGIN:DAYLIGHT") ) {
+        if ( !(o = realloc(b->obs, (b->nobs+1)*sizeof(struct tzone_observance))) ) {
+            carpsys("realloc");
+            return -1;
+        }
+        b->obs = o;
+        memset(&b->obs[b->nobs++], 0, sizeof(struct tzone_observance));
+        b->in_obs = true;
+        return 0;
+    }
+    if ( str_start(line, "END:STANDARD") || str_start(line, "END:DAYLIGHT") ) {
+        b->in_obs = false;
+        return 0;
+    }
+    if ( !b->in_obs ) {
+        if ( (v=value_of(line, "TZID")) && !b->tzid && !(b->tzid = strdup(v)) ) {
+            carpsys("strdup");
+            return -1;
+        }
+        return 0;
+    }
+
+    o = &b->obs[b->nobs-1];
+    if ( (v=value_of(line, "DTSTART")) )
+        datetime_scan(v, false, &o->day, &o->tod, NULL);
+    else if ( (v=value_of(line, "TZOFFSETFROM")) )
+        o->has_from = !scan_utc_offset(v, &o->from);
+    else if ( (v=value_of(line, "TZOFFSETTO")) )
+        o->has_to = !scan_utc_offset(v, &o->to);
+    else if ( (v=value_of(line, "RRULE")) ) {
+        if ( !(o->has_rule = !rrule_parse(&o->rule, v)) )
+            carp("unsupported RRULE in VTIMEZONE, ignored: ", line);
+    } else if ( (v=value_of(line, "RDATE")) )
+        return add_rdates(o, v);
+    return 0;
+}
+
+static int compile_observance( struct tzone *z, size_t *alloc, struct tzone_observance *o,
+        time_t *earliest, time_t until )
+{
+    time_t wall = (time_t)o->day*SECONDS_PER_DAY + o->tod, t;
+    struct rrule_iter it;
+    size_t i;
+
+    if ( !o->has_to )
+        return 0;
+    if ( !o->has_from )
+        o->from = o->to;
+    if ( !z->len || wall-o->from < *earliest ) {
+        *earliest = wall-o->from;
+        z->initial = o->from;
+    }
+    if ( add_transition(z, alloc, wall-o->from, o->to) )
+        return -1;
+    for (i=0; i<o->rdates; ++i)
+        if ( add_transition(z, alloc, o->rdate[i]-o->from, o->to) )
+            return -1;
+    if ( !o->has_rule )
+        return 0;
+    /* in wall clock, which is plain arithmetic like UTC */
+    rrule_iter_init(&it, &o->rule, wall, 0, true, NULL, wall, until);
+    while ( rrule_next(&it, &t) && z->len < TZONE_MAX_TRANSITIONS )
+        if ( add_transition(z, alloc, t-o->from, o->to) )
+            return -1;
+    return 0;
+}
+
+/* compiles the zone into l unless l has one of that name already, frees b */
+int tzone_end( struct tzone_builder *b, struct tzone_list *l )
+{
+    time_t until = (time_t)days_from_civil(TZONE_LAST_YEAR+1, 1, 1)*SECONDS_PER_DAY, earliest=0;
+    struct tzone *z=NULL;
+    size_t i, alloc=0;
+    int ret=0;
+
+    if ( !b->tzid ) {
+        carp("VTIMEZONE without TZID, ignored");
+        goto out;
+    }
+    if ( lookup(l, b->tzid, str_len(b->tzid)) ) {
+        V(2,carp("VTIMEZONE defined before, ignored: ", b->tzid));
+        goto out;
+    }
+    if ( !(z = new_tzone(b->tzid, str_len(b->tzid))) ) {
+        ret = -1;
+        goto out;
+    }
+    for (i=0; i<b->nobs; ++i)
+        if ( compile_observance(z, &alloc, &b->obs[i], &earliest, until) ) {
+            free_tzone(z);
+            ret = -1;
+            goto out;
+        }
+    if ( !z->len ) {
+        carp("VTIMEZONE without offsets, ignored: ", b->tzid);
+        free_tzone(z);
+        goto out;
+    }
+    finish_tzone(z);
+    z->next = l->first;
+    l->first = z;
+    V(2,
+        buffer_puts(buffer_2, "VTIMEZONE ");
+        buffer_puts(buffer_2, z->tzid);
+        buffer_puts(buffer_2, ": ");
+        buffer_putulong(buffer_2, z->len);
+        buffer_putsflush(buffer_2, " transitions\n");
+    );
+out:
+    tzone_abort(b);
+    return ret;
+}
+
+/*
+ * zoneinfo files (TZif), version 1 with 32 bit times or version 2 and up
+ * with 64 bit times and a POSIX TZ string for the time after the table
+ */
+
+struct posix_rule {
+    unsigned long m, w, d; // Mm.w.d: day d (0: sunday) of week w (5: last) in month m
+    long time;             // local time of the change, default 02:00
+};
+
+static uint32_t be32( const unsigned char *p )
+{
+    return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+}
+
+static int64_t be64( const unsigned char *p )
+{
+    return (int64_t)((uint64_t)be32(p)<<32 | be32(p+4));
+}
+
+static const char *posix_name( const char *s )
+{
+    const char *p=s;
+
+    if ( *p == '<' ) {
+        p += str_chr(p, '>');
+        return *p?p+1:NULL;
+    }
+    while ( (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') )
+        p++;
+    return (p-s >= 3)?p:NULL;
+}
+
+/* [+-]hh[:mm[:ss]], as written: POSIX counts west of UTC positive */
+static const char *posix_time( const char *s, long *secs )
+{
+    unsigned long v;
+    size_t l, i;
+    bool neg = (*s == '-');
+
+    if ( *s == '+' || *s == '-' )
+        s++;
+    if ( !(l = scan_ulong(s, &v)) )
+        return NULL;
+    *secs = v*3600;
+    s += l;
+    for (i=0; i<2 && *s == ':'; ++i) {
+        if ( !(l = scan_ulong(s+1, &v)) )
+            return NULL;
+        *secs += (i?v:v*60);
+        s += l+1;
+    }
+    if ( neg )
+        *secs = -*secs;
+    return s;
+}
+
+static const char *posix_rule( const char *s, struct posix_rule *r )
+{
+    size_t l;
+
+    if ( *s++ != ',' || *s++ != 'M' )
+        return NULL;
+    if ( !(l = scan_ulong(s, &r->m)) || s[l] != '.' )
+        return NULL;
+    s += l+1;
+    if ( !(l = scan_ulong(s, &r->w)) || s[l] != '.' )
+        return NULL;
+    s += l+1;
+    if ( !(l = scan_ulong(s, &r->d)) )
+        return NULL;
+    s += l;
+    if ( r->m < 1 || r->m > 12 || r->w < 1 || r->w > 5 || r->d > 6 )
+        return NULL;
+    r->time = 7200;
+    if ( *s == '/' )
+        s = posix_time(s+1, &r->time);
+    return s;
+}
+
+static long posix_day( long y, const struct posix_rule *r )
+{
+    long first = days_from_civil(y, r->m, 1);
+    long day = first + (long)((r->d + 7 - weekday_from_days(first)) % 7) + 7*(long)(r->w-1);
+
+    while ( day >= first + (long)days_in_month(y, r->m) )
+        day -= 7;
+    return day;
+}
+
+/* the changes of the TZ string after the last one of the table */
+static int posix_extend( struct tzone *z, size_t *alloc, const char *tz )
+{
+    struct posix_rule start, end;
+    const char *s;
+    long std, dst, y;
+    unsigned m, d;
+    bool table = (z->len > 0);
+    time_t last = table?z->trans[z->len-1].at:0, t;
+
+    if ( !(s = posix_name(tz)) || !(s = posix_time(s, &std)) )
+        return 0;
+    std = -std;
+    if ( !table )
+        z->initial = std;
+    if ( !*s )
+        return 0;
+    if ( !(s = posix_name(s)) )
+        return 0;
+    dst = std+3600;
+    if ( *s != ',' ) {
+        if ( !(s = posix_time(s, &dst)) )
+            return 0;
+        dst = -dst;
+    }
+    if ( !(s = posix_rule(s, &start)) || !(s = posix_rule(s, &end)) ) {
+        V(1,carp("unsupported TZ rule, the offsets end with the table: ", tz));
+        return 0;
+    }
+    civil_from_days(last/SECONDS_PER_DAY, &y, &m, &d);
+    for (; y<=TZONE_LAST_YEAR; ++y) {
+        t = (time_t)posix_day(y, &start)*SECONDS_PER_DAY + start.time - std;
+        if ( (!table || t > last) && add_transition(z, alloc, t, dst) )
+            return -1;
+        t = (time_t)posix_day(y, &end)*SECONDS_PER_DAY + end.time - dst;
+        if ( (!table || t > last) && add_transition(z, alloc, t, std) )
+            return -1;
+    }
+    return 0;
+}
+
+/* z from a TZif file, left invalid if the file is not one */
+static int parse_tzif( struct tzone *z, const unsigned char *p, size_t size )
+{
+    const unsigned char *end = p+size, *times, *idx, *types;
+    uint32_t timecnt, typecnt, charcnt, leapcnt, isstdcnt, isutcnt, i;
+    size_t tsize=4, alloc=0, n;
+    bool v2;
+    char footer[128];
+
+    for (;;) {
+        if ( end-p < 44 || memcmp(p, "TZif", 4) )
+            return 0;
+        v2 = (p[4] >= '2');
+        isutcnt = be32(p+20);
+        isstdcnt = be32(p+24);
+        leapcnt = be32(p+28);
+        timecnt = be32(p+32);
+        typecnt = be32(p+36);
+        charcnt = be32(p+40);
+        p += 44;
+        n = (size_t)timecnt*(tsize+1) + (size_t)typecnt*6 + charcnt +
+            (size_t)leapcnt*(tsize+4) + isstdcnt + isutcnt;
+        if ( !typecnt || (size_t)(end-p) < n )
+            return 0;
+        /* the 32 bit data of a version 2 file is only there for old readers */
+        if ( tsize == 4 && v2 ) {
+            p += n;
+            tsize = 8;
+            continue;
+        }
+        break;
+    }
+    times = p;
+    idx = times + (size_t)timecnt*tsize;
+    types = idx + timecnt;
+    z->initial = (int32_t)be32(types);
+    for (i=0; i<timecnt; ++i) {
+        if ( idx[i] >= typecnt )
+            return 0;
+        if ( add_transition(z, &alloc, (tsize == 8)?be64(times+i*8):(int32_t)be32(times+i*4),
+                    (int32_t)be32(types+idx[i]*6)) )
+            return -1;
+    }
+    p += n;
+    if ( tsize == 8 && p < end && *p == '\n' ) {
+        n = byte_chr(p+1, end-p-1, '\n');
+        if ( p+1+n < end && n < sizeof(footer) ) {
+            memcpy(footer, p+1, n);
+            footer[n] = '\0';
+            if ( posix_extend(z, &alloc, footer) )
+                return -1;
+        }
+    }
+    finish_tzone(z);
+    return 0;
+}
+
+/* the zone of the system, not found is a zone too */
+static struct tzone *load_tzif( const char *name, size_t len )
+{
+    const char *dir = getenv("TZDIR"), *map;
+    struct tzone *z;
+    char *file;
+    size_t size=0;
+    int ret=0;
+
+    if ( !(z = new_tzone(name, len)) )
+        return NULL;
+    if ( !dir || !*dir )
+        dir = TZONE_DIR;
+    /* the name comes from the calendar, it must not leave the directory */
+    if ( !len || *z->tzid == '/' || strstr(z->tzid, "..") )
+        goto unknown;
+    if ( !(file = malloc(str_len(dir)+len+2)) ) {
+        carpsys("malloc");
+        free_tzone(z);
+        return NULL;
+    }
+    str_copy(file, dir);
+    str_copy(file+str_len(dir), "/");
+    str_copy(file+str_len(dir)+1, z->tzid);
+    if ( (map = mmap_read(file, &size)) ) {
+        ret = parse_tzif(z, (const unsigned char *)map, size);
+        mmap_unmap(map, size);
+    }
+    free(file);
+    if ( ret ) {
+        free_tzone(z);
+        return NULL;
+    }
+    if ( z->valid ) {
+        V(2,carp("time zone from ", dir, ": ", z->tzid));
+        return z;
+    }
+unknown:
+    carp("unknown time zone, times are taken as local time: ", z->tzid);
+    z->len = 0;
+    return z;
+}
+
+/* the zone of a TZID parameter value, NULL if it is unknown */
+const struct tzone *tzone_find( struct tzone_list *l, const char *name, size_t len )
+{
+    struct tzone *z;
+
+    if ( l->last && !strncmp(l->last->tzid, name, len) && !l->last->tzid[len] )
+        return l->last->valid?l->last:NULL;
+    if ( !(z = lookup(l, name, len)) ) {
+        if ( !(z = load_tzif(name, len)) )
+            return NULL;
+        z->next = l->first;
+        l->first = z;
+    }
+    l->last = z;
+    return z->valid?z:NULL;
+}
+
+#ifdef UNITTEST
+#include <assert.h>
+
+#define BERLIN "TZID:Europe/Berlin\r\nBEGIN:DAYLIGHT\r\nTZOFFSETFROM:+0100\r\nTZOFFSETTO:+0200\r\n"\
+    "DTSTART:19810329T020000\r\nRRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU\r\nEND:DAYLIGHT\r\n"\
+    "BEGIN:STANDARD\r\nTZOFFSETFROM:+0200\r\nTZOFFSETTO:+0100\r\nDTSTART:19961027T030000\r\n"\
+    "RRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU\r\nEND:STANDARD\r\n"
+
+#define DAY(__y,__m,__d) days_from_civil(__y,__m,__d)
+#define UTC(__y,__m,__d,__h,__min) ((time_t)DAY(__y,__m,__d)*SECONDS_PER_DAY+(__h)*3600+(__min)*60)
+
+static void feed_lines( struct tzone_builder *b, char *s )
+{
+    char *eol;
+
+    for (; *s; s=eol+2) {
+        eol = strstr(s, "\r\n");
+        *eol = '\0';
+        assert(0==tzone_line(b, s));
+    }
+}
+
+/* the same checks for Europe/Berlin from any source */
+static void check_berlin( const struct tzone *z )
+{
+    long day, tod;
+
+    assert(z && z->valid);
+    assert(tzone_offset(z, UTC(2023,1,15,12,0)) == 3600);
+    assert(tzone_offset(z, UTC(2023,7,15,12,0)) == 7200);
+    /* 2023-03-26 02:00 CET is 01:00 UTC, 2023-10-29 03:00 CEST is 01:00 UTC */
+    assert(tzone_offset(z, UTC(2023,3,26,0,59)) == 3600 && tzone_offset(z, UTC(2023,3,26,1,0)) == 7200);
+    assert(tzone_offset(z, UTC(2023,10,29,0,59)) == 7200 && tzone_offset(z, UTC(2023,10,29,1,0)) == 3600);
+    assert(tzone_from_civil(z, DAY(2023,3,1), 9*3600) == UTC(2023,3,1,8,0));
+    assert(tzone_from_civil(z, DAY(2023,6,1), 9*3600) == UTC(2023,6,1,7,0));
+    /* skipped by the change: 02:30 is 03:30 CEST; twice: the first 02:30 is CEST */
+    assert(tzone_from_civil(z, DAY(2023,3,26), 2*3600+1800) == UTC(2023,3,26,1,30));
+    assert(tzone_from_civil(z, DAY(2023,10,29), 2*3600+1800) == UTC(2023,10,29,0,30));
+    tzone_to_civil(z, UTC(2023,6,30,22,30), &day, &tod);
+    assert(day == DAY(2023,7,1) && tod == 30*60);
+    /* beyond the year 2037 of the old 32 bit tables */
+    assert(tzone_offset(z, UTC(2090,7,1,0,0)) == 7200 && tzone_offset(z, UTC(2090,12,1,0,0)) == 3600);
+}
+
+int main( int argc, char *argv[] )
+{
+    struct tzone_list l, shard;
+    struct tzone_builder *b;
+    struct tzone z;
+    const struct tzone *berlin, *ny;
+    char lines[]=BERLIN;
+    size_t alloc=0;
+
+    init_tzone_list(&l);
+    assert((b = tzone_begin()));
+    feed_lines(b, lines);
+    assert(0==tzone_end(b, &l));
+    assert(l.first && str_equal(l.first->tzid, "Europe/Berlin"));
+    check_berlin(berlin=tzone_find(&l, "Europe/Berlin;foo", 13));
+    assert(berlin == l.first);
+
+    /* the first definition stays */
+    assert((b = tzone_begin()) && 0==tzone_line(b, "TZID:Europe/Berlin") && 0==tzone_line(b, "BEGIN:STANDARD") &&
+            0==tzone_line(b, "TZOFFSETTO:+0000") && 0==tzone_line(b, "END:STANDARD"));
+    assert(0==tzone_end(b, &l) && l.first == berlin && !berlin->next);
+
+    /* a fixed offset */
+    assert((b = tzone_begin()) && 0==tzone_line(b, "TZID:Fixed") && 0==tzone_line(b, "BEGIN:STANDARD") &&
+            0==tzone_line(b, "DTSTART:16010101T000000") && 0==tzone_line(b, "TZOFFSETFROM:-0330") &&
+            0==tzone_line(b, "TZOFFSETTO:-0330") && 0==tzone_line(b, "END:STANDARD"));
+    assert(0==tzone_end(b, &l));
+    assert(tzone_from_civil(tzone_find(&l, "Fixed", 5), DAY(2023,1,1), 0) == UTC(2023,1,1,3,30));
+
+    /* the TZ string of a TZif footer */
+    memset(&z, 0, sizeof(z));
+    assert(0==posix_extend(&z, &alloc, "CET-1CEST,M3.5.0,M10.5.0/3"));
+    finish_tzone(&z);
+    check_berlin(&z);
+    free(z.trans);
+    memset(&z, 0, sizeof(z));
+    alloc = 0;
+    assert(0==posix_extend(&z, &alloc, "<-03>3"));
+    assert(!z.len && z.initial == -3*3600);
+    /* southern hemisphere, the changes of a year in the other order */
+    assert(0==posix_extend(&z, &alloc, "AEST-10AEDT,M10.1.0,M4.1.0/3"));
+    finish_tzone(&z);
+    assert(tzone_offset(&z, UTC(2023,1,1,0,0)) == 11*3600 && tzone_offset(&z, UTC(2023,7,1,0,0)) == 10*3600);
+    free(z.trans);
+
+    /* the names of the calendar do not get out of the zoneinfo directory */
+    assert(!tzone_find(&l, "../../etc/passwd", 16) && !tzone_find(&l, "/etc/passwd", 11));
+    assert(!tzone_find(&l, "No/Such_Zone", 12));
+
+    /* a shard sees the zones of the main list and keeps its own apart */
+    init_tzone_list(&shard);
+    tzone_borrow(&shard, &l);
+    assert(tzone_find(&shard, "Europe/Berlin", 13) == berlin);
+    /* the zoneinfo of the system, if it has one */
+    if ( (ny = tzone_find(&shard, "America/New_York", 16)) ) {
+        assert(tzone_from_civil(ny, DAY(2023,7,4), 12*3600) == UTC(2023,7,4,16,0));
+        assert(tzone_from_civil(ny, DAY(2023,12,4), 12*3600) == UTC(2023,12,4,17,0));
+        check_berlin(tzone_find(&shard, "Europe/Paris", 12));
+    }
+    tzone_adopt(&l, &shard);
+    assert(shard.first == (struct tzone *)shard.borrowed);
+    free_tzone_list(&shard);
+    assert(tzone_find(&l, "No/Such_Zone", 12) == NULL && lookup(&l, "No/Such_Zone", 12));
+    free_tzone_list(&l);
+
+    exit(EXIT_SUCCESS);
+}
+#endif
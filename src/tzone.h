@@ -0,0 +1,56 @@
+#ifndef TZONE_H
+#define TZONE_H
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* transitions are compiled up to this year, the TZif footer and RRULEs are open ended */
+#define TZONE_LAST_YEAR 2100
+#define TZONE_MAX_TRANSITIONS 4096
+#define TZONE_DIR "/usr/share/zoneinfo"
+
+struct tzone_transition {
+    time_t at;   // UTC
+    long offset; // seconds east of UTC from at on
+};
+
+/*
+ * one TZID compiled into the sorted list of its offset changes, so a
+ * conversion is a binary search. A zone that could not be found is kept
+ * with valid unset, so it is looked for only once.
+ */
+struct tzone {
+    char *tzid;
+    bool valid;
+    long initial; // offset before the first transition
+    struct tzone_transition *trans;
+    size_t len;
+    struct tzone *next;
+};
+
+/*
+ * the zones known to one parse session, newest first. The zones from
+ * borrowed on belong to another list and are only looked at.
+ */
+struct tzone_list {
+    struct tzone *first;
+    const struct tzone *borrowed;
+    const struct tzone *last; // of the last lookup
+};
+
+struct tzone_builder;
+
+void set_tzone_verbosity( short );
+void init_tzone_list( struct tzone_list * );
+void free_tzone_list( struct tzone_list * );
+void tzone_borrow( struct tzone_list *, const struct tzone_list * );
+void tzone_adopt( struct tzone_list *, struct tzone_list * );
+const struct tzone *tzone_find( struct tzone_list *, const char *, size_t );
+long tzone_offset( const struct tzone *, time_t );
+time_t tzone_from_civil( const struct tzone *, long, long );
+void tzone_to_civil( const struct tzone *, time_t, long *, long * );
+struct tzone_builder *tzone_begin( void );
+int tzone_line( struct tzone_builder *, const char * );
+int tzone_end( struct tzone_builder *, struct tzone_list * );
+void tzone_abort( struct tzone_builder * );
+#endif